@@ -0,0 +1,103 @@
+/*
+ * SPDX-FileCopyrightText: 2020 Piotr Rak <piotr.rak@gamil.com>
+ * SPDX-License-Identifier: MIT
+ */
+#pragma once
+
+#include <bhd/context.hh>
+#include <bhd/display_cache.hh>
+
+#include "minigl.hh"
+
+#include <chrono>
+#include <cstdio>
+
+namespace behead_egl::bench {
+
+using clock = std::chrono::steady_clock;
+
+inline double ms_since(clock::time_point start)
+{
+   return std::chrono::duration<double, std::milli>(clock::now() - start).count();
+}
+
+// Exit status meson treats as skipped, ie. no EGL device to run on
+constexpr int SKIP = 77;
+
+// Entry points benchmarks need beyond internal::GlProcs
+struct BenchGl
+{
+   PFNGLCLEARCOLORPROC glClearColor = nullptr;
+   PFNGLCLEARPROC glClear = nullptr;
+
+   bool ok = false;
+};
+
+inline const BenchGl &bench_gl()
+{
+   static const BenchGl gl = [] {
+      BenchGl r;
+
+      r.glClearColor = reinterpret_cast<PFNGLCLEARCOLORPROC>(eglGetProcAddress("glClearColor"));
+      r.glClear = reinterpret_cast<PFNGLCLEARPROC>(eglGetProcAddress("glClear"));
+      r.ok = r.glClearColor != nullptr && r.glClear != nullptr;
+
+      return r;
+   }();
+
+   return gl;
+}
+
+// Display and context current on calling thread, for benchmarks driving GL themselves
+struct CurrentContext
+{
+   EGLDisplay dpy = EGL_NO_DISPLAY;
+   EGLContext ctx = EGL_NO_CONTEXT;
+
+   CurrentContext()
+   {
+      // Software device (llvmpipe) only if there is no drm one, like RenderScheduler
+      for (bool software : { false, true })
+      {
+         enumerate_display_devices([&] (const DeviceEXT_Info &info) {
+            bool usable = software ? info.has_MESA_device_software : info.has_EXT_device_drm;
+
+            if (dpy == EGL_NO_DISPLAY && usable)
+               dpy = create_headless_display(info);
+         });
+      }
+
+      if (dpy == EGL_NO_DISPLAY || !eglInitialize(dpy, nullptr, nullptr))
+         return;
+
+      ctx = create_headless_context(dpy);
+
+      if (ctx != EGL_NO_CONTEXT && !eglMakeCurrent(dpy, EGL_NO_SURFACE, EGL_NO_SURFACE, ctx))
+      {
+         eglDestroyContext(dpy, ctx);
+         ctx = EGL_NO_CONTEXT;
+      }
+   }
+
+   ~CurrentContext()
+   {
+      if (ctx != EGL_NO_CONTEXT)
+      {
+         eglMakeCurrent(dpy, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+         eglDestroyContext(dpy, ctx);
+      }
+
+      if (dpy != EGL_NO_DISPLAY)
+         terminate_display(dpy);
+   }
+
+   CurrentContext(const CurrentContext &) = delete;
+   CurrentContext &operator=(const CurrentContext &) = delete;
+
+   bool ok() const
+   {
+      return ctx != EGL_NO_CONTEXT && internal::gl_procs().ok && bench_gl().ok;
+   }
+};
+
+} // namespace behead_egl::bench
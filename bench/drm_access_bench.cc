@@ -0,0 +1,258 @@
+/*
+ * SPDX-FileCopyrightText: 2020 Piotr Rak <piotr.rak@gamil.com>
+ * SPDX-License-Identifier: MIT
+ */
+#include "bench.hh"
+
+#include "minidrm.hh"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <grp.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace bhd = behead_egl;
+namespace bhdi = behead_egl::internal;
+
+namespace {
+
+using bhd::bench::clock;
+using bhdi::DrmNodeFlag;
+
+constexpr unsigned DEVICES = 64;
+constexpr unsigned PASSES = 1000;
+
+// nobody, as on most distributions
+constexpr uid_t UNPRIVILEGED_UID = 65534;
+constexpr gid_t UNPRIVILEGED_GID = 65534;
+
+// Numbers of real drm device with render node, so open_drm_nodes() finds its sysfs entry
+bool find_render_device(dev_t &card, dev_t &render)
+{
+   DIR *d = ::opendir(bhdi::DRM_DIR);
+
+   if (d == nullptr)
+      return false;
+
+   bool found = false;
+
+   while (dirent *e = ::readdir(d))
+   {
+      if (std::strncmp(e->d_name, "renderD", 7) != 0)
+         continue;
+
+      struct stat st;
+
+      if (::fstatat(::dirfd(d), e->d_name, &st, 0) != 0 || !S_ISCHR(st.st_mode) || minor(st.st_rdev) < 128)
+         continue;
+
+      render = st.st_rdev;
+      card = makedev(major(st.st_rdev), minor(st.st_rdev) - 128);
+      found = true;
+      break;
+   }
+
+   ::closedir(d);
+
+   return found;
+}
+
+// Fake /dev/dri: card nodes of DEVICES devices all standing for one real device,
+// and its render node, root owned with mode 0600. Once we drop to unprivileged
+// uid, render node is denied to us, like devices of host are to container
+// that sees them.
+struct FakeTree
+{
+   std::string dir;
+   std::vector<std::string> paths;
+   std::vector<std::string> cards;
+
+   bool ok = false;
+
+   FakeTree(dev_t card, dev_t render)
+   {
+      char tmp[] = "/tmp/bhd-dri-XXXXXX";
+
+      if (::mkdtemp(tmp) == nullptr)
+         return;
+
+      dir = std::string(tmp) + "/";
+
+      // Nodes are looked up by unprivileged uid
+      if (::chmod(tmp, 0755) != 0)
+         return;
+
+      std::string render_path = dir + "renderD" + std::to_string(minor(render));
+
+      if (::mknod(render_path.c_str(), S_IFCHR | 0600, render) != 0)
+         return;
+
+      paths.push_back(render_path);
+
+      for (unsigned i = 0; i < DEVICES; ++i)
+      {
+         std::string card_path = dir + "card-fake" + std::to_string(i);
+
+         if (::mknod(card_path.c_str(), S_IFCHR | 0600, card) != 0)
+            return;
+
+         paths.push_back(card_path);
+         cards.push_back(card_path);
+      }
+
+      ok = true;
+   }
+
+   ~FakeTree()
+   {
+      for (const auto &p : paths)
+         ::unlink(p.c_str());
+
+      if (!dir.empty())
+         ::rmdir(dir.c_str());
+   }
+};
+
+bool drop_privileges()
+{
+   return ::setgroups(0, nullptr) == 0 &&
+          ::setresgid(UNPRIVILEGED_GID, UNPRIVILEGED_GID, UNPRIVILEGED_GID) == 0 &&
+          ::setresuid(UNPRIVILEGED_UID, UNPRIVILEGED_UID, UNPRIVILEGED_UID) == 0;
+}
+
+// What picking inaccessible device costs without filtering: open_drm_nodes()
+// failing with permission denied, reported by exception.
+unsigned open_all(const FakeTree &tree)
+{
+   unsigned opened = 0;
+
+   for (const auto &card : tree.cards)
+   {
+      try
+      {
+         auto nodes = bhdi::open_drm_nodes(card.c_str(), DrmNodeFlag::Render, tree.dir.c_str());
+         ++opened;
+      }
+      catch (const std::runtime_error &)
+      {
+      }
+   }
+
+   return opened;
+}
+
+unsigned filter_all(int drm_dir_fd, const FakeTree &tree)
+{
+   unsigned accessible = 0;
+
+   for (const auto &card : tree.cards)
+      accessible += bhdi::drm_nodes_accessible(drm_dir_fd, card.c_str(), DrmNodeFlag::Render);
+
+   return accessible;
+}
+
+template <typename Fn_>
+void report(const char *name, Fn_ &&pass)
+{
+   unsigned found = 0;
+
+   auto start = clock::now();
+
+   for (unsigned i = 0; i < PASSES; ++i)
+      found = pass();
+
+   double ms = bhd::bench::ms_since(start);
+
+   std::printf("%-14s devices=%u usable=%u %9.1f ms %9.1f ns/device\n",
+               name, DEVICES, found, ms, ms * 1e6 / (double(PASSES) * DEVICES));
+}
+
+// Runs in forked child, it can't regain privileges to clean up
+int run_unprivileged(const FakeTree &tree, dev_t render)
+{
+   if (!drop_privileges())
+   {
+      std::fprintf(stderr, "Couldn't drop privileges\n");
+      return bhd::bench::SKIP;
+   }
+
+   bhdi::unique_fd drm_dir = bhdi::open_drm_dir(tree.dir.c_str());
+
+   if (!drm_dir.ok())
+      return EXIT_FAILURE;
+
+   std::string render_name = "renderD" + std::to_string(minor(render));
+
+   // Both paths have to see the same denial
+   bhdi::unique_fd probe{::openat(drm_dir.get(), render_name.c_str(), O_RDWR | O_CLOEXEC)};
+
+   if (probe.ok() || errno != EACCES)
+   {
+      std::fprintf(stderr, "Render node isn't denied to unprivileged uid\n");
+      return bhd::bench::SKIP;
+   }
+
+   report("failed open", [&] { return open_all(tree); });
+   report("accessible", [&] { return filter_all(drm_dir.get(), tree); });
+
+   return EXIT_SUCCESS;
+}
+
+} // namespace anonymous
+
+// Pre-flight accessibility check of EnumerateOpt::Accessible against
+// open_drm_nodes() failing with permission denied, on fake drm tree.
+//
+// Needs drm device with render node, and root to create nodes and drop privileges.
+int main()
+{
+   dev_t card = 0;
+   dev_t render = 0;
+
+   if (!find_render_device(card, render))
+   {
+      std::fprintf(stderr, "No drm device with render node\n");
+      return bhd::bench::SKIP;
+   }
+
+   FakeTree tree(card, render);
+
+   if (!tree.ok)
+   {
+      // Creating device nodes needs CAP_MKNOD
+      std::fprintf(stderr, "Couldn't create fake drm tree\n");
+      return bhd::bench::SKIP;
+   }
+
+   std::fflush(stdout);
+
+   pid_t pid = ::fork();
+
+   if (pid < 0)
+      return EXIT_FAILURE;
+
+   if (pid == 0)
+   {
+      int status = run_unprivileged(tree, render);
+
+      std::fflush(stdout);
+      ::_exit(status);
+   }
+
+   int status = 0;
+
+   if (::waitpid(pid, &status, 0) != pid || !WIFEXITED(status))
+      return EXIT_FAILURE;
+
+   return WEXITSTATUS(status);
+}
@@ -0,0 +1,158 @@
+/*
+ * SPDX-FileCopyrightText: 2020 Piotr Rak <piotr.rak@gamil.com>
+ * SPDX-License-Identifier: MIT
+ */
+#include "bench.hh"
+
+#include <bhd/readback.hh>
+
+#include <cstdlib>
+#include <vector>
+
+namespace bhd = behead_egl;
+namespace bhdi = behead_egl::internal;
+
+namespace {
+
+using bhd::bench::clock;
+
+constexpr unsigned FRAMES = 200;
+
+struct Size
+{
+   unsigned width;
+   unsigned height;
+};
+
+constexpr Size SIZES[] = { { 256, 256 }, { 1280, 720 }, { 1920, 1080 } };
+
+// Color attachment of size bound as read and draw framebuffer
+struct Target
+{
+   GLuint fbo = 0;
+   GLuint rb = 0;
+
+   explicit Target(Size size)
+   {
+      const auto &gl = bhdi::gl_procs();
+
+      gl.glGenRenderbuffers(1, &rb);
+      gl.glBindRenderbuffer(GL_RENDERBUFFER, rb);
+      gl.glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, GLsizei(size.width), GLsizei(size.height));
+
+      gl.glGenFramebuffers(1, &fbo);
+      gl.glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+      gl.glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, rb);
+   }
+
+   ~Target()
+   {
+      const auto &gl = bhdi::gl_procs();
+
+      gl.glBindFramebuffer(GL_FRAMEBUFFER, 0);
+      gl.glDeleteFramebuffers(1, &fbo);
+      gl.glDeleteRenderbuffers(1, &rb);
+   }
+};
+
+// Frame differs from previous, so nothing can be skipped
+void draw(unsigned i)
+{
+   const auto &bgl = bhd::bench::bench_gl();
+
+   bgl.glClearColor(float(i % 256) / 255.0f, 0.0f, 0.0f, 1.0f);
+   bgl.glClear(GL_COLOR_BUFFER_BIT);
+}
+
+double run_sync(Size size)
+{
+   const auto &gl = bhdi::gl_procs();
+
+   std::vector<unsigned char> pixels(std::size_t(size.width) * size.height * 4);
+
+   auto start = clock::now();
+
+   for (unsigned i = 0; i < FRAMES; ++i)
+   {
+      draw(i);
+      gl.glReadPixels(0, 0, GLsizei(size.width), GLsizei(size.height), GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+   }
+
+   return bhd::bench::ms_since(start);
+}
+
+double run_pipeline(Size size, unsigned depth)
+{
+   unsigned long checksum = 0;
+
+   bhd::ReadbackOpts opts;
+   opts.depth = depth;
+
+   bhd::ReadbackPipeline pipeline(size.width, size.height, [&] (const bhd::ReadbackFrame &f) {
+      // Touch frame like consumer would
+      checksum += static_cast<const unsigned char *>(f.data)[0];
+   }, opts);
+
+   if (!pipeline.ok())
+      return -1.0;
+
+   auto start = clock::now();
+
+   for (unsigned i = 0; i < FRAMES; ++i)
+   {
+      draw(i);
+      pipeline.capture();
+   }
+
+   pipeline.flush();
+
+   return bhd::bench::ms_since(start);
+}
+
+void report(const char *name, Size size, double ms)
+{
+   double mb = double(size.width) * size.height * 4 * FRAMES / 1e6;
+
+   std::printf("%-12s %4ux%-4u %9.1f ms %8.1f frames/s %9.1f MB/s\n",
+               name, size.width, size.height, ms, FRAMES * 1000.0 / ms, mb * 1000.0 / ms);
+}
+
+} // namespace anonymous
+
+// Frame readback through ReadbackPipeline against synchronous glReadPixels()
+// into client memory, rendering between readbacks.
+int main()
+{
+   bhd::bench::CurrentContext context;
+
+   if (!context.ok())
+   {
+      std::fprintf(stderr, "No context to run on\n");
+      return bhd::bench::SKIP;
+   }
+
+   for (Size size : SIZES)
+   {
+      Target target(size);
+
+      report("sync", size, run_sync(size));
+
+      for (unsigned depth : { 2u, 3u, 4u })
+      {
+         double ms = run_pipeline(size, depth);
+
+         if (ms < 0)
+         {
+            std::fprintf(stderr, "ReadbackPipeline failed to set up\n");
+            return EXIT_FAILURE;
+         }
+
+         char name[16];
+         std::snprintf(name, sizeof(name), "pbo depth=%u", depth);
+
+         report(name, size, ms);
+      }
+   }
+
+   return EXIT_SUCCESS;
+}
@@ -0,0 +1,115 @@
+/*
+ * SPDX-FileCopyrightText: 2020 Piotr Rak <piotr.rak@gamil.com>
+ * SPDX-License-Identifier: MIT
+ */
+#include "bench.hh"
+
+#include <bhd/scheduler.hh>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <thread>
+
+namespace bhd = behead_egl;
+namespace bhdi = behead_egl::internal;
+
+namespace {
+
+using bhd::bench::clock;
+
+constexpr int TARGET_SIZE = 256;
+constexpr unsigned JOBS = 2000;
+
+// Clears target of worker and reads one pixel back, so job waits for GPU
+void render_job(std::atomic<unsigned> &done)
+{
+   const auto &gl = bhdi::gl_procs();
+   const auto &bgl = bhd::bench::bench_gl();
+
+   // Contexts stay current on their worker threads for whole scheduler lifetime,
+   // target goes away with context.
+   thread_local GLuint fbo = [&] {
+      GLuint fb = 0;
+      GLuint rb = 0;
+
+      gl.glGenRenderbuffers(1, &rb);
+      gl.glBindRenderbuffer(GL_RENDERBUFFER, rb);
+      gl.glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, TARGET_SIZE, TARGET_SIZE);
+
+      gl.glGenFramebuffers(1, &fb);
+      gl.glBindFramebuffer(GL_FRAMEBUFFER, fb);
+      gl.glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, rb);
+
+      return fb;
+   }();
+
+   gl.glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+
+   bgl.glClearColor(1.0f, 0.0f, 0.0f, 1.0f);
+   bgl.glClear(GL_COLOR_BUFFER_BIT);
+
+   GLubyte px[4];
+   gl.glReadPixels(0, 0, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE, px);
+
+   done.fetch_add(1, std::memory_order_relaxed);
+}
+
+// Returns jobs per second, negative if scheduler couldn't start
+double run(unsigned workers)
+{
+   bhd::SchedulerOpts opts;
+   opts.workers_per_device = workers;
+   opts.max_devices = 1;
+
+   bhd::RenderScheduler scheduler(opts);
+
+   if (!scheduler.ok())
+      return -1.0;
+
+   std::atomic<unsigned> done{0};
+
+   // Every worker sets its target up before timing starts
+   for (std::size_t w = 0; w < scheduler.worker_count(); ++w)
+      scheduler.submit_to(w, [&] (const bhd::RenderWorker &) { render_job(done); });
+
+   scheduler.wait_idle();
+   done = 0;
+
+   auto start = clock::now();
+
+   for (unsigned i = 0; i < JOBS; ++i)
+   {
+      while (!scheduler.submit([&] (const bhd::RenderWorker &) { render_job(done); }))
+         std::this_thread::yield();
+   }
+
+   scheduler.wait_idle();
+
+   double ms = bhd::bench::ms_since(start);
+
+   std::printf("workers=%-3zu jobs=%u %9.1f ms %10.1f jobs/s\n",
+               scheduler.worker_count(), done.load(), ms, done.load() * 1000.0 / ms);
+
+   return done.load() * 1000.0 / ms;
+}
+
+} // namespace anonymous
+
+// Throughput of RenderScheduler on single device as workers are added,
+// with software device (llvmpipe) it shows how well workers share CPU.
+int main()
+{
+   unsigned max_workers = std::max(4u, std::thread::hardware_concurrency());
+
+   for (unsigned workers = 1; workers <= max_workers; workers *= 2)
+   {
+      if (run(workers) < 0)
+      {
+         std::fprintf(stderr, "No device to schedule on\n");
+         return bhd::bench::SKIP;
+      }
+   }
+
+   return EXIT_SUCCESS;
+}
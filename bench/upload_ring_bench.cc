@@ -0,0 +1,129 @@
+/*
+ * SPDX-FileCopyrightText: 2020 Piotr Rak <piotr.rak@gamil.com>
+ * SPDX-License-Identifier: MIT
+ */
+#include "bench.hh"
+
+#include <bhd/upload_ring.hh>
+
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+namespace bhd = behead_egl;
+namespace bhdi = behead_egl::internal;
+
+namespace {
+
+using bhd::bench::clock;
+
+constexpr GLsizei TEX_SIZE = 512;
+constexpr std::size_t BLOCK = std::size_t(TEX_SIZE) * TEX_SIZE * 4;
+
+// Per run, split between producers
+constexpr unsigned BLOCKS = 480;
+
+// Producers fill slices, render thread uploads each into texture.
+// Returns MB/s, negative if ring couldn't be set up.
+double run(std::size_t capacity, unsigned producers)
+{
+   const auto &gl = bhdi::gl_procs();
+
+   bhd::UploadRing ring(bhd::UploadRingOpts{ capacity });
+
+   if (!ring.ok())
+      return -1.0;
+
+   GLuint tex = 0;
+   gl.glGenTextures(1, &tex);
+   gl.glBindTexture(GL_TEXTURE_2D, tex);
+
+   std::atomic<unsigned> finished{0};
+   std::vector<std::thread> threads;
+
+   auto start = clock::now();
+
+   for (unsigned p = 0; p < producers; ++p)
+   {
+      threads.emplace_back([&, p] {
+         for (unsigned i = p; i < BLOCKS; i += producers)
+         {
+            auto slice = ring.reserve(BLOCK);
+
+            if (!slice)
+               break;
+
+            std::memset(slice.data, int(i), slice.size);
+            ring.submit(slice, i);
+         }
+
+         finished.fetch_add(1, std::memory_order_release);
+      });
+   }
+
+   unsigned consumed = 0;
+
+   auto upload = [&] (const bhd::UploadBlock &block) {
+      gl.glBindBuffer(GL_PIXEL_UNPACK_BUFFER, block.buffer);
+      gl.glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, TEX_SIZE, TEX_SIZE, 0, GL_RGBA, GL_UNSIGNED_BYTE,
+                      reinterpret_cast<const void *>(block.offset));
+      gl.glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+      ++consumed;
+   };
+
+   for (;;)
+   {
+      // NB: Read before consuming, so blocks submitted last aren't missed
+      bool done = finished.load(std::memory_order_acquire) == producers;
+
+      if (ring.consume(upload) == 0 && done)
+         break;
+   }
+
+   gl.glFinish();
+
+   double ms = bhd::bench::ms_since(start);
+
+   for (auto &t : threads)
+      t.join();
+
+   gl.glDeleteTextures(1, &tex);
+
+   double mb = double(consumed) * BLOCK / 1e6;
+
+   std::printf("capacity=%4zu MiB producers=%u blocks=%u %9.1f ms %9.1f MB/s\n",
+               capacity >> 20, producers, consumed, ms, mb * 1000.0 / ms);
+
+   return mb * 1000.0 / ms;
+}
+
+} // namespace anonymous
+
+// Streaming texture upload bandwidth of UploadRing, as ring size and
+// number of producer threads change.
+int main()
+{
+   bhd::bench::CurrentContext context;
+
+   if (!context.ok())
+   {
+      std::fprintf(stderr, "No context to run on\n");
+      return bhd::bench::SKIP;
+   }
+
+   for (std::size_t capacity : { std::size_t(4) << 20, std::size_t(16) << 20, std::size_t(64) << 20 })
+   {
+      for (unsigned producers : { 1u, 2u, 4u })
+      {
+         if (run(capacity, producers) < 0)
+         {
+            std::fprintf(stderr, "Context lacks buffer storage support\n");
+            return bhd::bench::SKIP;
+         }
+      }
+   }
+
+   return EXIT_SUCCESS;
+}
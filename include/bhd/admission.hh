@@ -0,0 +1,127 @@
+/*
+ * SPDX-FileCopyrightText: 2020 Piotr Rak <piotr.rak@gamil.com>
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef BEHEAD_EGL_include_bhd_admission_hh_included_
+#define BEHEAD_EGL_include_bhd_admission_hh_included_ 1
+
+#include "bhd/behead_egl.hh"
+
+#include <chrono>
+#include <memory>
+
+namespace behead_egl
+{
+
+namespace internal { struct DeviceLimiterImpl; }
+
+// Upper bound of DeviceLimiter max_per_device
+constexpr unsigned MaxAdmissionsPerDevice = 64;
+
+struct AdmissionOpts
+{
+   // Concurrent tickets per device, processes sharing shm_name should agree on it.
+   unsigned max_per_device = 4;
+
+   // How long acquire() queues for free slot, negative waits forever.
+   std::chrono::milliseconds max_wait = std::chrono::milliseconds(-1);
+
+   // Try other devices, before queueing on one with fewest waiters.
+   bool redirect = true;
+
+   // Name of shared memory object, every process using it shares limits.
+   const char *shm_name = "/behead-egl-admission";
+
+   // Permissions shm_name is created with; default shares limits only among
+   // processes of same user. Existing object keeps its permissions.
+   unsigned shm_mode = 0600;
+};
+
+class DeviceLimiter;
+
+// Holds one slot of device, returns it on destruction.
+// Keep it for lifetime of display or context it was acquired for.
+class BHD_EXPORT AdmissionTicket final
+{
+public:
+   AdmissionTicket() noexcept;
+   ~AdmissionTicket();
+
+   AdmissionTicket(AdmissionTicket &&other) noexcept;
+   AdmissionTicket &operator=(AdmissionTicket &&other) noexcept;
+
+   AdmissionTicket(const AdmissionTicket &) = delete;
+   AdmissionTicket &operator=(const AdmissionTicket &) = delete;
+
+   bool ok() const noexcept { return _owner != nullptr; }
+
+   // DRM minor of primary node of device
+   unsigned drm_minor() const noexcept { return _minor; }
+
+   // Time spent queued before it was granted
+   std::chrono::nanoseconds wait_time() const noexcept { return _wait; }
+
+   void release() noexcept;
+
+private:
+   friend class DeviceLimiter;
+
+   std::shared_ptr<internal::DeviceLimiterImpl> _owner;
+
+   unsigned _minor = 0;
+   unsigned _slot = 0;
+
+   std::chrono::nanoseconds _wait = std::chrono::nanoseconds(0);
+};
+
+// Host-wide (cross-process) limit of concurrent users of each device,
+// keyed by DRM minor of device's primary node.
+//
+// Slots of crashed processes are reclaimed by waiters (by pid, see shm liveness note).
+// Wait times are reported through foreach_stat() as "admission.wait",
+// along with "admission.redirect", "admission.timeout" and "admission.reclaim".
+class BHD_EXPORT DeviceLimiter final
+{
+public:
+   explicit DeviceLimiter(const AdmissionOpts &opts = AdmissionOpts{});
+   ~DeviceLimiter();
+
+   DeviceLimiter(DeviceLimiter &&) noexcept;
+   DeviceLimiter &operator=(DeviceLimiter &&) noexcept;
+
+   DeviceLimiter(const DeviceLimiter &) = delete;
+   DeviceLimiter &operator=(const DeviceLimiter &) = delete;
+
+   // False if shared memory couldn't be set up.
+   bool ok() const noexcept;
+
+   const AdmissionOpts &opts() const noexcept;
+
+   // Returns ticket if device has free slot, invalid ticket otherwise.
+   AdmissionTicket try_acquire(unsigned drm_minor);
+
+   // Queues for free slot of device at most opts().max_wait.
+   AdmissionTicket acquire(unsigned drm_minor);
+
+   // Number of tickets currently held for device, host-wide.
+   unsigned in_use(unsigned drm_minor) const;
+
+   // Number of threads queued in acquire() for device, host-wide.
+   unsigned waiting(unsigned drm_minor) const;
+
+private:
+   std::shared_ptr<internal::DeviceLimiterImpl> _impl;
+};
+
+// Same as create_headless_display(), but display is created only on device
+// limiter admits; ticket receives the slot. When every candidate device is busy,
+// it queues for one with fewest waiters, skipping devices that failed to open.
+//
+// If limiter is not ok(), it behaves as create_headless_display() and ticket is left invalid.
+BHD_EXPORT EGLDisplay create_headless_display(DeviceLimiter &limiter, AdmissionTicket &ticket,
+                                              DrmNodeUsage = DefaultDrmNodeUsage);
+
+}
+
+#endif // !defined(BEHEAD_EGL_include_bhd_admission_hh_included_)
@@ -0,0 +1,101 @@
+/*
+ * SPDX-FileCopyrightText: 2020 Piotr Rak <piotr.rak@gamil.com>
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef BEHEAD_EGL_include_bhd_assignment_hh_included_
+#define BEHEAD_EGL_include_bhd_assignment_hh_included_ 1
+
+#include "bhd/behead_egl.hh"
+
+#include <memory>
+
+namespace behead_egl
+{
+
+namespace internal { struct DeviceAssignmentTableImpl; }
+
+constexpr const char *DefaultAssignmentShmName = "/behead-egl-assignment";
+
+// Maximum number of displays recorded host-wide
+constexpr unsigned MaxAssignments = 1024;
+
+// Record of single display in DeviceAssignmentTable, removed on destruction.
+// Keep it until display is terminated.
+class BHD_EXPORT DeviceAssignment final
+{
+public:
+   DeviceAssignment() noexcept;
+   ~DeviceAssignment();
+
+   DeviceAssignment(DeviceAssignment &&other) noexcept;
+   DeviceAssignment &operator=(DeviceAssignment &&other) noexcept;
+
+   DeviceAssignment(const DeviceAssignment &) = delete;
+   DeviceAssignment &operator=(const DeviceAssignment &) = delete;
+
+   bool ok() const noexcept { return _owner != nullptr; }
+
+   // DRM minor of primary node of device
+   unsigned drm_minor() const noexcept { return _minor; }
+
+   void release() noexcept;
+
+private:
+   friend class DeviceAssignmentTable;
+
+   std::shared_ptr<internal::DeviceAssignmentTableImpl> _owner;
+
+   unsigned _minor = 0;
+   unsigned _entry = 0;
+};
+
+// Host-wide table of active displays per device in /dev/shm,
+// lets independent processes spread their displays evenly across devices.
+//
+// Table is lock-free; entries of dead processes are reclaimed by whoever scans it
+// (by pid, see shm liveness note).
+//
+// Table is created with permissions shm_mode, default shares it only among
+// processes of same user. Existing table keeps its permissions.
+class BHD_EXPORT DeviceAssignmentTable final
+{
+public:
+   explicit DeviceAssignmentTable(const char *shm_name = DefaultAssignmentShmName,
+                                  unsigned shm_mode = 0600);
+   ~DeviceAssignmentTable();
+
+   DeviceAssignmentTable(DeviceAssignmentTable &&) noexcept;
+   DeviceAssignmentTable &operator=(DeviceAssignmentTable &&) noexcept;
+
+   DeviceAssignmentTable(const DeviceAssignmentTable &) = delete;
+   DeviceAssignmentTable &operator=(const DeviceAssignmentTable &) = delete;
+
+   // False if shared memory couldn't be set up.
+   bool ok() const noexcept;
+
+   // Records display on device, invalid result if table is full.
+   DeviceAssignment assign(unsigned drm_minor);
+
+   // Number of displays recorded for device, host-wide.
+   unsigned active_displays(unsigned drm_minor) const;
+
+   // Removes entries of processes that are gone, returns their count.
+   unsigned reclaim_dead() const;
+
+private:
+   std::shared_ptr<internal::DeviceAssignmentTableImpl> _impl;
+};
+
+// Same as create_headless_display(), but picks usable device with least
+// displays recorded in table (ties go to device create_headless_display() prefers)
+// and records the display in assignment.
+//
+// If table is not ok(), it behaves as create_headless_display() and assignment is left invalid.
+BHD_EXPORT EGLDisplay create_headless_display(DeviceAssignmentTable &table,
+                                              DeviceAssignment &assignment,
+                                              DrmNodeUsage = DefaultDrmNodeUsage);
+
+}
+
+#endif // !defined(BEHEAD_EGL_include_bhd_assignment_hh_included_)
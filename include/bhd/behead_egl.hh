@@ -7,8 +7,10 @@
 #define BEHEAD_EGL_include_bhd_behead_egl_hh_included_ 1
 
 #include <memory>
+#include <memory_resource>
 #include <functional>
 #include <optional>
+#include <string_view>
 
 #define EGL_NO_X11
 #define MESA_EGL_NO_X11_HEADERS
@@ -37,6 +39,11 @@ enum class EnumerateOpt
 {
    All,
    Usable,
+
+   // Usable ones whose nodes create_headless_display() opens with DefaultDrmNodeUsage
+   // exist in /dev/dri and are accessible to this process. Checked without opening
+   // them, so devices in containers we may not open are skipped cheaply.
+   Accessible,
 };
 
 const EnumerateOpt DefaultEnumerateOpt = EnumerateOpt::All;
@@ -57,6 +64,9 @@ public:
 
    const char  *drm_path                  = nullptr;
    opt_int      cuda_dev_id               = std::nullopt;
+
+   // See mark_device_unhealthy()
+   bool         marked_unhealthy          = false;
 };
 
 
@@ -67,8 +77,57 @@ BHD_EXPORT bool check_headless_display_support();
 
 BHD_EXPORT EGLDisplay create_headless_display(DrmNodeUsage = DefaultDrmNodeUsage);
 
+// Creates display for device whose primary or render node drm_fd refers to,
+// ie. one received from DrmFdBroker (see bhd/fd_broker.hh).
+//
+// Always takes ownership of drm_fd, even on failure.
+BHD_EXPORT EGLDisplay create_headless_display(int drm_fd);
+
+// Creates display on given device, as reported by enumerate_display_devices().
+// Unlike other variants it accepts also software devices (EGL_MESA_device_software).
+BHD_EXPORT EGLDisplay create_headless_display(const DeviceEXT_Info &device,
+                                              DrmNodeUsage = DefaultDrmNodeUsage);
+
+// Creates display on device with given query_device_persistent_id(), ie. one worker
+// used before restart, whose caches are warm. Fails if there is no such device.
+BHD_EXPORT EGLDisplay create_headless_display(std::string_view persistent_id,
+                                              DrmNodeUsage = DefaultDrmNodeUsage);
+
 BHD_EXPORT bool enumerate_display_devices(const device_enumeration_cb_t &cb, EnumerateOpt = DefaultEnumerateOpt);
 
+// Id of device that survives reboots and driver reloads, unlike enumeration order and drm minor:
+// "uuid:<hex>" from EGL_EXT_device_persistent_id, otherwise "<bus>:<address>" of drm device
+// (ie. "pci:0000:01:00.0"). nullptr if neither is available.
+//
+// Returned string lives as long as process. It isn't part of DeviceEXT_Info,
+// since resolving it reads sysfs; query it only for devices you record.
+BHD_EXPORT const char *query_device_persistent_id(const DeviceEXT_Info &device);
+
+// Excludes device from devices create_headless_display() picks from, ie. after GPU reset.
+// It's still enumerated, with DeviceEXT_Info::marked_unhealthy set, and can be used
+// explicitly. Passing false makes it eligible again.
+BHD_EXPORT void mark_device_unhealthy(EGLDeviceEXT dev, bool unhealthy = true);
+
+// Variants taking memory_resource do every allocation they need on success from mr,
+// ie. caller's per-request monotonic arena; nullptr means default resource.
+// Only failures still reach global heap (exceptions and messages reporting them).
+//
+// NB: create_headless_display(const DeviceEXT_Info &) and get_initialized_display_device_info()
+// don't allocate on success, so they come without one.
+BHD_EXPORT EGLDisplay create_headless_display(DrmNodeUsage, std::pmr::memory_resource *mr);
+
+BHD_EXPORT EGLDisplay create_headless_display(int drm_fd, std::pmr::memory_resource *mr);
+
+// Picks only among devices enumerate_display_devices() reports with candidates.
+// EnumerateOpt::Accessible skips devices whose nodes for DrmNodeUsage can't be
+// opened before picking, instead of picking one just to fail opening it;
+// others behave as create_headless_display(DrmNodeUsage).
+BHD_EXPORT EGLDisplay create_headless_display(DrmNodeUsage, EnumerateOpt candidates,
+                                              std::pmr::memory_resource *mr = nullptr);
+
+BHD_EXPORT bool enumerate_display_devices(const device_enumeration_cb_t &cb, EnumerateOpt,
+                                          std::pmr::memory_resource *mr);
+
 // BEWARE: This function has very long name for a reason!
 // It may ever work for EGLDisplay initialized by eglInitialize() and before eglTerminate().
 // See EGL_EXT_device_query specification eglQueryDisplayAttribEXT for more details.
@@ -0,0 +1,60 @@
+/*
+ * SPDX-FileCopyrightText: 2020 Piotr Rak <piotr.rak@gamil.com>
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef BEHEAD_EGL_include_bhd_bringup_hh_included_
+#define BEHEAD_EGL_include_bhd_bringup_hh_included_ 1
+
+#include "bhd/behead_egl.hh"
+
+#include <chrono>
+#include <vector>
+
+namespace behead_egl
+{
+
+struct BringupOpts
+{
+   DrmNodeUsage usage = DefaultDrmNodeUsage;
+
+   // eglInitialize() each display created
+   bool initialize = true;
+
+   // Software devices are brought up only when asked for, or there is no drm device
+   bool include_software = false;
+};
+
+struct DisplayBringup
+{
+   DeviceEXT_Info device;
+
+   // EGL_NO_DISPLAY if creation failed, still set if only initialization failed
+   EGLDisplay dpy         = EGL_NO_DISPLAY;
+
+   bool       initialized = false;
+   EGLint     major       = 0;
+   EGLint     minor       = 0;
+
+   // eglGetError() of failed initialization
+   EGLint     egl_error   = EGL_SUCCESS;
+
+   // Opening nodes and creating display, then eglInitialize()
+   std::chrono::nanoseconds create_time{0};
+   std::chrono::nanoseconds initialize_time{0};
+};
+
+// Creates (and optionally initializes) display on every usable device at once.
+//
+// Devices are enumerated once, then each is brought up on its own thread, so it
+// takes about as long as the slowest device rather than all of them together.
+// Devices are ordered as create_headless_display() prefers them, unhealthy ones
+// are skipped. Parked displays (see bhd/prewarm.hh) are handed out as usual.
+//
+// Returns one result per device tried, empty if there is none or enumeration failed.
+// Time spent per device is reported through foreach_stat() as "bringup.device".
+BHD_EXPORT std::vector<DisplayBringup> create_headless_displays_all(const BringupOpts &opts = BringupOpts{});
+
+}
+
+#endif // !defined(BEHEAD_EGL_include_bhd_bringup_hh_included_)
@@ -0,0 +1,67 @@
+/*
+ * SPDX-FileCopyrightText: 2020 Piotr Rak <piotr.rak@gamil.com>
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef BEHEAD_EGL_include_bhd_context_hh_included_
+#define BEHEAD_EGL_include_bhd_context_hh_included_ 1
+
+#include "bhd/behead_egl.hh"
+
+namespace behead_egl
+{
+
+enum class ContextApi
+{
+   OpenGLES,
+   OpenGL,
+};
+
+// EGL_IMG_context_priority levels, in ascending order
+enum class ContextPriority
+{
+   // Nothing requested, driver decides
+   Default,
+   Low,
+   Medium,
+   High,
+};
+
+struct ContextOpts
+{
+   ContextApi api = ContextApi::OpenGLES;
+
+   EGLint major_version = 3;
+   EGLint minor_version = 0;
+
+   // Request robust buffer access and reset notification (lose context on reset)
+   // through EGL_EXT_create_context_robustness; ignored if display lacks it.
+   bool robust = false;
+
+   // Requested through EGL_IMG_context_priority.
+   // Drivers may grant lower priority than requested (ie. High needs privileges),
+   // displays lacking the extension grant Default. Either is warned about and
+   // counted in foreach_stat() as "context.priority_downgrade".
+   ContextPriority priority = ContextPriority::Default;
+};
+
+// Picks config usable for pbuffer surfaces and contexts of opts.api.
+// Display must be initialized by eglInitialize().
+//
+// Result is cached per display, see bhd/display_cache.hh.
+//
+// Returns nullptr on failure.
+BHD_EXPORT EGLConfig choose_headless_config(EGLDisplay dpy, const ContextOpts &opts = ContextOpts{});
+
+// Creates context on display initialized by eglInitialize(); it can be made current
+// without any surface (EGL_KHR_surfaceless_context) or with pbuffer.
+//
+// NB: Binds opts.api as current rendering API of calling thread (see eglBindAPI).
+BHD_EXPORT EGLContext create_headless_context(EGLDisplay dpy, const ContextOpts &opts = ContextOpts{});
+
+// Priority driver actually granted to ctx, Default if display lacks EGL_IMG_context_priority.
+BHD_EXPORT ContextPriority query_context_priority(EGLDisplay dpy, EGLContext ctx);
+
+}
+
+#endif // !defined(BEHEAD_EGL_include_bhd_context_hh_included_)
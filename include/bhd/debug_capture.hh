@@ -0,0 +1,89 @@
+/*
+ * SPDX-FileCopyrightText: 2020 Piotr Rak <piotr.rak@gamil.com>
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef BEHEAD_EGL_include_bhd_debug_capture_hh_included_
+#define BEHEAD_EGL_include_bhd_debug_capture_hh_included_ 1
+
+#include "bhd/behead_egl.hh"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+namespace behead_egl
+{
+
+enum class DebugSource
+{
+   EGL,
+   GL,
+};
+
+struct DebugMessage
+{
+   DebugSource   source    = DebugSource::GL;
+
+   // EGL: messageType (EGL_DEBUG_MSG_*_KHR) and error, type is 0.
+   // GL: GL_DEBUG_SEVERITY_*, GL_DEBUG_TYPE_* and message id.
+   std::uint32_t severity  = 0;
+   std::uint32_t type      = 0;
+   std::uint32_t id        = 0;
+
+   // Truncated to DebugMessageMaxLength, valid only during sink call
+   const char   *text      = nullptr;
+
+   // EGL command that failed, empty for GL
+   const char   *command   = nullptr;
+
+   // Kernel thread id message was reported on
+   std::int32_t  thread_id = 0;
+
+   std::chrono::steady_clock::time_point timestamp;
+};
+
+constexpr std::size_t DebugMessageMaxLength = 255;
+
+using debug_sink_t = std::function<void (const DebugMessage &)>;
+
+struct DebugCaptureOpts
+{
+   // Per-thread ring capacity, rounded up to power of 2
+   unsigned ring_size = 256;
+
+   // Per-thread rate limit, excess messages are counted and dropped
+   unsigned max_per_second = 100;
+
+   // Where drain_debug_messages() delivers, std::cerr if not set
+   debug_sink_t sink;
+};
+
+// Captures EGL_KHR_debug messages (when client extension is advertised) and
+// GL debug output of contexts made by create_headless_context() afterwards.
+//
+// Callbacks record messages into lock-free per-thread rings, they are delivered
+// to sink only by drain_debug_messages(). While disabled no callback is installed,
+// contexts are created without debug flag, so it costs nothing.
+//
+// Messages are reported through foreach_stat() as "debug.message",
+// messages dropped by rate limit as "debug.suppressed", ring overflows as "debug.dropped".
+//
+// Returns true if EGL debug callback got installed; GL debug output is captured
+// regardless, where contexts support GL_KHR_debug.
+BHD_EXPORT bool enable_debug_capture(const DebugCaptureOpts &opts = DebugCaptureOpts{});
+
+// Uninstalls EGL callback; GL callbacks of existing contexts stay, but record nothing.
+BHD_EXPORT void disable_debug_capture();
+
+// Installs GL debug callback on context current on calling thread,
+// for contexts created other way than by create_headless_context().
+BHD_EXPORT bool capture_context_debug_output();
+
+// Delivers recorded messages of all threads to sink, returns their count.
+BHD_EXPORT std::size_t drain_debug_messages();
+
+}
+
+#endif // !defined(BEHEAD_EGL_include_bhd_debug_capture_hh_included_)
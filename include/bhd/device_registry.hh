@@ -0,0 +1,74 @@
+/*
+ * SPDX-FileCopyrightText: 2020 Piotr Rak <piotr.rak@gamil.com>
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef BEHEAD_EGL_include_bhd_device_registry_hh_included_
+#define BEHEAD_EGL_include_bhd_device_registry_hh_included_ 1
+
+#include "bhd/behead_egl.hh"
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace behead_egl
+{
+
+namespace internal { struct DeviceRegistryImpl; }
+
+// Called on watcher thread after registry changed
+using registry_cb_t = std::function<void (std::uint64_t epoch)>;
+
+struct DeviceRegistryOpts
+{
+   // Directory with drm nodes; any other directory may stand in for it (ie. in tests),
+   // devices are matched to nodes by file name.
+   std::string drm_dir = "/dev/dri";
+
+   registry_cb_t on_change;
+};
+
+// Device list kept up to date with drm nodes appearing and disappearing (hotplug,
+// driver reload) by inotify watcher on drm directory.
+//
+// NB: devtmpfs creates and removes nodes for each drm uevent, so watching directory
+// sees same events as uevent monitor, without netlink socket permissions.
+//
+// Drm devices are listed while their primary node exists, software devices always.
+// Every change bumps epoch, so readers can cheaply check whether their copy is current.
+//
+// Updates are reported through foreach_stat() as "registry.update".
+class BHD_EXPORT DeviceRegistry final
+{
+public:
+   explicit DeviceRegistry(const DeviceRegistryOpts &opts = DeviceRegistryOpts{});
+   ~DeviceRegistry();
+
+   DeviceRegistry(const DeviceRegistry &) = delete;
+   DeviceRegistry &operator=(const DeviceRegistry &) = delete;
+
+   // False if directory couldn't be watched; registry still holds initial snapshot then.
+   bool ok() const noexcept;
+
+   // Lock-free, bumped after each change is applied
+   std::uint64_t epoch() const noexcept;
+
+   // Copies current device list, returns epoch it corresponds to.
+   std::uint64_t devices(std::vector<DeviceEXT_Info> &out) const;
+
+   // Copies names of drm nodes (card*, renderD*) present, returns epoch.
+   std::uint64_t nodes(std::vector<std::string> &out) const;
+
+   // Rescans directory and devices from scratch
+   void refresh();
+
+private:
+   std::unique_ptr<internal::DeviceRegistryImpl> _impl;
+};
+
+}
+
+#endif // !defined(BEHEAD_EGL_include_bhd_device_registry_hh_included_)
@@ -0,0 +1,104 @@
+/*
+ * SPDX-FileCopyrightText: 2020 Piotr Rak <piotr.rak@gamil.com>
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef BEHEAD_EGL_include_bhd_device_table_hh_included_
+#define BEHEAD_EGL_include_bhd_device_table_hh_included_ 1
+
+#include "bhd/behead_egl.hh"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace behead_egl
+{
+
+namespace internal { struct DeviceTableImpl; }
+
+// Bits of DeviceTable::caps() column
+enum DeviceCap : std::uint32_t
+{
+   DeviceCapNvCuda         = 1u << 0, // EGL_NV_device_cuda
+   DeviceCapDrm            = 1u << 1, // EGL_EXT_device_drm
+   DeviceCapMesaSoftware   = 1u << 2, // EGL_MESA_device_software
+   DeviceCapUnhealthy      = 1u << 3, // see mark_device_unhealthy()
+   DeviceCapPci            = 1u << 4, // pci_ids() entry is valid
+};
+
+struct DeviceFilter
+{
+   // DeviceCap bits device must have all of, and none of
+   std::uint32_t require   = 0;
+   std::uint32_t exclude   = DeviceCapUnhealthy;
+
+   // Any when negative
+   std::int32_t  numa_node = -1;
+
+   // Any when 0
+   std::uint16_t pci_vendor = 0;
+};
+
+// Snapshot of devices in structure-of-arrays layout, for hosts with many of them
+// (ie. SR-IOV virtual functions): each property is column indexed by device,
+// so scans touch only columns they need.
+//
+// Snapshot is taken on construction and by refresh(), columns stay valid until next one.
+class BHD_EXPORT DeviceTable final
+{
+public:
+   static constexpr std::size_t npos = std::size_t(-1);
+
+   DeviceTable();
+   ~DeviceTable();
+
+   DeviceTable(const DeviceTable &) = delete;
+   DeviceTable &operator=(const DeviceTable &) = delete;
+
+   // False if devices couldn't be enumerated, table is empty then.
+   bool ok() const noexcept;
+
+   bool refresh();
+
+   std::size_t size() const noexcept;
+
+   // {{{ Columns, size() entries each
+
+   const EGLDeviceEXT  *devices() const noexcept;
+
+   // DeviceCap bits
+   const std::uint32_t *caps() const noexcept;
+
+   // -1 for devices without drm node
+   const std::int32_t  *drm_minors() const noexcept;
+
+   // -1 for non CUDA devices
+   const std::int32_t  *cuda_ids() const noexcept;
+
+   // -1 when unknown
+   const std::int32_t  *numa_nodes() const noexcept;
+
+   // PCI vendor id in high, device id in low 16 bits; see DeviceCapPci
+   const std::uint32_t *pci_ids() const noexcept;
+
+   // }}}
+
+   // Appends indices of devices matching filter to out, in table order.
+   // Returns number appended.
+   std::size_t filter(const DeviceFilter &f, std::vector<std::uint32_t> &out) const;
+
+   // Index of device create_headless_display() would pick, npos if none
+   std::size_t pick() const noexcept;
+
+   // Full record of device at index, ie. to create display on it
+   DeviceEXT_Info info(std::size_t index) const;
+
+private:
+   std::unique_ptr<internal::DeviceTableImpl> _impl;
+};
+
+}
+
+#endif // !defined(BEHEAD_EGL_include_bhd_device_table_hh_included_)
@@ -0,0 +1,38 @@
+/*
+ * SPDX-FileCopyrightText: 2020 Piotr Rak <piotr.rak@gamil.com>
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef BEHEAD_EGL_include_bhd_display_cache_hh_included_
+#define BEHEAD_EGL_include_bhd_display_cache_hh_included_ 1
+
+#include "bhd/behead_egl.hh"
+
+namespace behead_egl
+{
+
+// Library keeps per-display cache of configs picked by choose_headless_config()
+// (keyed by attribute list) and of parsed display extensions, so creating
+// contexts, fences and the like on display doesn't call eglChooseConfig() and
+// eglQueryString() again.
+//
+// Both become stale once display is terminated; terminate it with
+// terminate_display(), or call forget_display() if it's done elsewhere.
+// Cached config is checked with eglGetConfigAttrib() before it is returned,
+// so display terminated by plain eglTerminate() and initialized again
+// doesn't get configs from before.
+//
+// Display usage sampling (see bhd/drm_telemetry.hh) stops too.
+//
+// Lookups are reported through foreach_stat() as "display_cache.hit"
+// and "display_cache.miss".
+
+// Calls eglTerminate(), then drops cached state of dpy
+BHD_EXPORT EGLBoolean terminate_display(EGLDisplay dpy);
+
+// Drops cached state of dpy, ie. after eglTerminate() was called on it
+BHD_EXPORT void forget_display(EGLDisplay dpy);
+
+}
+
+#endif // !defined(BEHEAD_EGL_include_bhd_display_cache_hh_included_)
@@ -0,0 +1,150 @@
+/*
+ * SPDX-FileCopyrightText: 2020 Piotr Rak <piotr.rak@gamil.com>
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef BEHEAD_EGL_include_bhd_drm_telemetry_hh_included_
+#define BEHEAD_EGL_include_bhd_drm_telemetry_hh_included_ 1
+
+#include "bhd/behead_egl.hh"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+
+namespace behead_egl
+{
+
+namespace internal { struct FdinfoReaderImpl; }
+namespace internal { struct DrmClientSnapshotImpl; }
+
+struct DrmEngineUsage
+{
+   // <keystr> of drm-engine-<keystr>, ie. "gfx", "render", "compute"
+   char          name[24] = {};
+
+   // Time engine spent busy with client's work since it opened node
+   std::uint64_t busy_ns  = 0;
+
+   // drm-engine-capacity-<keystr>, engines of that class busy at once at most
+   std::uint32_t capacity = 1;
+};
+
+struct DrmRegionUsage
+{
+   // <region> of drm-total-<region>, ie. "vram", "gtt", "system"
+   char          name[24] = {};
+
+   // Bytes of buffers client allocated in region, and part of it resident there.
+   // Kernels reporting only drm-memory-<region> fill just resident.
+   std::uint64_t total    = 0;
+   std::uint64_t resident = 0;
+};
+
+// DRM client usage stats (see kernel drm-usage-stats), as in fdinfo of drm node fd
+struct DrmUsageSample
+{
+   constexpr static std::size_t MAX_ENGINES = 16;
+   constexpr static std::size_t MAX_REGIONS = 8;
+
+   char          driver[24] = {};
+   std::uint64_t client_id  = 0;
+
+   // Further engines and regions are dropped
+   DrmEngineUsage engines[MAX_ENGINES];
+   std::size_t    engine_count = 0;
+
+   DrmRegionUsage regions[MAX_REGIONS];
+   std::size_t    region_count = 0;
+
+   std::chrono::steady_clock::time_point taken;
+};
+
+// Busy fraction of engine name between two samples of the same client,
+// scaled by its capacity; negative if either lacks it.
+BHD_EXPORT double engine_utilization(const DrmUsageSample &prev, const DrmUsageSample &cur,
+                                     const char *name) noexcept;
+
+// Reads DrmUsageSample from fdinfo file; it is opened once and reread with pread(),
+// sampling doesn't allocate.
+//
+// Any file of that format works, ie. fake one in place of /proc/self/fdinfo/<fd>.
+class BHD_EXPORT FdinfoReader final
+{
+public:
+   explicit FdinfoReader(const char *path);
+   ~FdinfoReader();
+
+   FdinfoReader(const FdinfoReader &) = delete;
+   FdinfoReader &operator=(const FdinfoReader &) = delete;
+
+   // False when file couldn't be opened
+   bool ok() const noexcept;
+
+   // Returns false if file can't be read or has no drm-driver key (not drm fd).
+   bool sample(DrmUsageSample &out) noexcept;
+
+private:
+   std::unique_ptr<internal::FdinfoReaderImpl> _impl;
+};
+
+// Usage is sampled only for displays passed to track_display_usage().
+//
+// Drivers open nodes of device themselves (ie. Mesa opens render node even when
+// given fd), so tracking looks for drm clients (open drm files, told apart by
+// drm-client-id) of process that appeared on display's device since snapshot
+// taken before display was created, and samples their fdinfo. Nothing is kept
+// open besides fdinfo files.
+//
+//    DrmClientSnapshot before;
+//    EGLDisplay dpy = create_headless_display();
+//    eglInitialize(dpy, nullptr, nullptr);
+//    track_display_usage(dpy, before);
+//
+// NB: Clients opened meanwhile by other threads are counted in as well. Usage of
+// several clients is summed, client_id is 0 then. Clients driver opens later
+// aren't picked up.
+
+// Drm clients of process at the time it was taken
+class BHD_EXPORT DrmClientSnapshot final
+{
+public:
+   DrmClientSnapshot();
+   ~DrmClientSnapshot();
+
+   DrmClientSnapshot(const DrmClientSnapshot &) = delete;
+   DrmClientSnapshot &operator=(const DrmClientSnapshot &) = delete;
+
+   // False when it couldn't be taken
+   bool ok() const noexcept;
+
+private:
+   friend bool track_display_usage(EGLDisplay dpy, const DrmClientSnapshot &before);
+
+   std::unique_ptr<internal::DrmClientSnapshotImpl> _impl;
+};
+
+// Starts sampling display initialized by eglInitialize(), drivers open nodes there;
+// before is snapshot taken prior to creating it.
+// Returns false if display isn't on drm device, or no new client on its device
+// reports usage stats (kernel or driver without drm-usage-stats).
+BHD_EXPORT bool track_display_usage(EGLDisplay dpy, const DrmClientSnapshot &before);
+
+// Stops sampling dpy; forget_display() and terminate_display()
+// (see bhd/display_cache.hh) do it as well.
+BHD_EXPORT void untrack_display_usage(EGLDisplay dpy);
+
+// Returns false if dpy isn't tracked, or sampling failed
+BHD_EXPORT bool sample_display_usage(EGLDisplay dpy, DrmUsageSample &out);
+
+using display_usage_cb_t = std::function<void (EGLDisplay, const DrmUsageSample &)>;
+
+// Samples every tracked display, returns number passed to cb.
+// NB: cb must not track or untrack displays, it runs under lock.
+BHD_EXPORT std::size_t foreach_display_usage(const display_usage_cb_t &cb);
+
+}
+
+#endif // !defined(BEHEAD_EGL_include_bhd_drm_telemetry_hh_included_)
@@ -0,0 +1,62 @@
+/*
+ * SPDX-FileCopyrightText: 2020 Piotr Rak <piotr.rak@gamil.com>
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef BEHEAD_EGL_include_bhd_egl_trace_hh_included_
+#define BEHEAD_EGL_include_bhd_egl_trace_hh_included_ 1
+
+#include "bhd/behead_egl.hh"
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+
+namespace behead_egl
+{
+
+// Records EGL calls library makes to enumerate, query devices and create displays
+// (eglQueryString on EGL_NO_DISPLAY, eglQueryDevicesEXT, eglQueryDeviceStringEXT,
+// eglQueryDeviceAttribEXT, eglQueryDisplayAttribEXT, eglGetPlatformDisplayEXT)
+// with arguments, results and duration into binary log at path.
+//
+// Has to be called before first call into library that talks to EGL, procedures
+// are looked up once. The same is done when BEHEAD_EGL_TRACE=<path> is set.
+//
+// Returns false if it is too late, or log can't be created.
+// Recorded calls are reported through foreach_stat() as "egl_trace.call".
+BHD_EXPORT bool record_egl_calls(const char *path);
+
+struct ReplayedCall
+{
+   // EGL procedure name
+   const char   *name  = nullptr;
+
+   // Position in log
+   std::uint32_t index = 0;
+
+   std::chrono::nanoseconds recorded{0};
+   std::chrono::nanoseconds replayed{0};
+
+   // Call referenced handle that couldn't be mapped to live one, it wasn't made
+   bool skipped = false;
+
+   // Same result as recorded, handles compared after mapping
+   bool matched = false;
+};
+
+using replay_cb_t = std::function<void (const ReplayedCall &)>;
+
+// Re-executes calls recorded by record_egl_calls() against EGL implementation
+// loaded in this process (ie. other driver, or stub with LD_PRELOAD), reporting
+// each through cb.
+//
+// Devices and displays are mapped to live ones in order they were returned.
+// DRM fds passed to eglGetPlatformDisplayEXT are reopened by node path.
+//
+// Returns false when log can't be read or is truncated, calls up to damage are reported.
+BHD_EXPORT bool replay_egl_calls(const char *path, const replay_cb_t &cb);
+
+}
+
+#endif // !defined(BEHEAD_EGL_include_bhd_egl_trace_hh_included_)
@@ -0,0 +1,109 @@
+/*
+ * SPDX-FileCopyrightText: 2020 Piotr Rak <piotr.rak@gamil.com>
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef BEHEAD_EGL_include_bhd_failover_hh_included_
+#define BEHEAD_EGL_include_bhd_failover_hh_included_ 1
+
+#include "bhd/behead_egl.hh"
+#include "bhd/context.hh"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+
+namespace behead_egl
+{
+
+namespace internal { struct DisplayFailoverImpl; }
+
+struct FailoverEvent
+{
+   EGLDisplay    lost_display       = EGL_NO_DISPLAY;
+   EGLDeviceEXT  lost_device        = nullptr;
+
+   // Initialized and watched already; EGL_NO_DISPLAY if no healthy device is left.
+   EGLDisplay    replacement        = EGL_NO_DISPLAY;
+   EGLDeviceEXT  replacement_device = nullptr;
+
+   // glGetGraphicsResetStatus() seen by watcher,
+   // 0 if display became unusable or loss was reported by client.
+   std::uint32_t reset_status       = 0;
+
+   // From detection to replacement being ready
+   std::chrono::nanoseconds recovery_time{0};
+};
+
+using failover_cb_t = std::function<void (const FailoverEvent &)>;
+
+struct FailoverOpts
+{
+   // Usage of replacement displays
+   DrmNodeUsage usage = DefaultDrmNodeUsage;
+
+   std::chrono::milliseconds poll_interval{50};
+
+   // Guard contexts watcher creates on each display, robust is always requested
+   ContextOpts context;
+
+   // Fall back to software devices once no drm device is healthy
+   bool allow_software = true;
+};
+
+// Watches displays for GPU resets and fails them over to next best device.
+//
+// Watcher thread keeps small robust guard context (EGL_EXT_create_context_robustness)
+// on each watched display and polls its reset status; device reset is reported to all
+// contexts on it. Without robustness support only displays that became unusable
+// (eglMakeCurrent() failing with EGL_CONTEXT_LOST) are detected. Clients may report
+// loss they observed themselves with report_lost().
+//
+// On loss the device is marked unhealthy (see mark_device_unhealthy()), replacement
+// display is created on next best healthy device, initialized, watched, and callback
+// is called on watcher thread. Lost display stays owned by client, it should
+// release it with terminate_display() (see bhd/display_cache.hh) once its contexts
+// are gone; plain eglTerminate() leaves cached state of display behind.
+//
+// NB: All EGL and GL calls go through libEGL and eglGetProcAddress(), so resets
+// can be injected with stub EGL library (LD_PRELOAD).
+//
+// Resets are reported through foreach_stat() as "failover.reset",
+// time to replacement as "failover.recovery".
+class BHD_EXPORT DisplayFailover final
+{
+public:
+   explicit DisplayFailover(failover_cb_t cb, const FailoverOpts &opts = FailoverOpts{});
+
+   // Stops watching, destroys guard contexts
+   ~DisplayFailover();
+
+   DisplayFailover(const DisplayFailover &) = delete;
+   DisplayFailover &operator=(const DisplayFailover &) = delete;
+
+   bool ok() const noexcept;
+
+   // Creates and initializes display on best healthy device, then watches it.
+   EGLDisplay create_display();
+
+   // Watches display initialized by eglInitialize().
+   bool watch(EGLDisplay dpy);
+
+   // Stops watching display, ie. before client terminates it.
+   void unwatch(EGLDisplay dpy);
+
+   // Fails display over as if reset was detected, ie. when client's own robust
+   // context reported GL_*_CONTEXT_RESET.
+   void report_lost(EGLDisplay dpy);
+
+   std::size_t watched() const;
+
+private:
+   std::unique_ptr<internal::DisplayFailoverImpl> _impl;
+};
+
+}
+
+#endif // !defined(BEHEAD_EGL_include_bhd_failover_hh_included_)
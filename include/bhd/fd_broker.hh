@@ -0,0 +1,80 @@
+/*
+ * SPDX-FileCopyrightText: 2020 Piotr Rak <piotr.rak@gamil.com>
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef BEHEAD_EGL_include_bhd_fd_broker_hh_included_
+#define BEHEAD_EGL_include_bhd_fd_broker_hh_included_ 1
+
+#include "bhd/behead_egl.hh"
+
+#include <cstddef>
+#include <memory>
+
+namespace behead_egl
+{
+
+namespace internal { struct DrmFdBrokerImpl; }
+
+// Owns drm node file descriptors and hands out their copies to clients
+// connected over unix domain socket (SCM_RIGHTS).
+//
+// Meant for sandboxed workers that can't open /dev/dri themselves,
+// and for fork-per-job setups, where nodes are opened only once by the broker.
+// Client side is request_brokered_drm_fd() + create_headless_display(int).
+//
+// NB: Copies share open file description with broker, including DRM master
+// status of primary node.
+class BHD_EXPORT DrmFdBroker final
+{
+public:
+   DrmFdBroker();
+   ~DrmFdBroker();
+
+   DrmFdBroker(DrmFdBroker &&) noexcept;
+   DrmFdBroker &operator=(DrmFdBroker &&) noexcept;
+
+   DrmFdBroker(const DrmFdBroker &) = delete;
+   DrmFdBroker &operator=(const DrmFdBroker &) = delete;
+
+   // Opens nodes (see open_drm_nodes) of every device with EGL_EXT_device_drm.
+   // Device create_headless_display() would pick becomes device 0.
+   //
+   // Returns number of devices opened.
+   std::size_t open_devices(DrmNodeUsage = DefaultDrmNodeUsage);
+
+   // Adds device with already opened node fds, any of them may be -1.
+   // Broker takes ownership of both.
+   //
+   // Returns index of added device.
+   std::size_t add_device(int primary_fd, int render_fd);
+
+   std::size_t device_count() const noexcept;
+
+   // Serves requests on connected socket conn_fd until peer closes connection.
+   //
+   // Returns false on I/O or protocol error.
+   bool serve_connection(int conn_fd) const;
+
+   // Accepts connections on listening socket listen_fd and serves all of them
+   // at once from calling thread, so long lived clients don't hold others back.
+   // Clients that misbehave or don't read their replies are dropped.
+   //
+   // Returns once accept() fails, ie. when listen_fd was shut down.
+   bool serve(int listen_fd) const;
+
+private:
+   std::unique_ptr<internal::DrmFdBrokerImpl> _impl;
+};
+
+// Requests node fd of device device_index from broker connected on sock_fd.
+// Node is picked with usage same way create_headless_display() does.
+//
+// Returns fd owned by caller or -1 on failure.
+BHD_EXPORT int request_brokered_drm_fd(int sock_fd,
+                                       DrmNodeUsage = DefaultDrmNodeUsage,
+                                       unsigned device_index = 0);
+
+}
+
+#endif // !defined(BEHEAD_EGL_include_bhd_fd_broker_hh_included_)
@@ -0,0 +1,76 @@
+/*
+ * SPDX-FileCopyrightText: 2020 Piotr Rak <piotr.rak@gamil.com>
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef BEHEAD_EGL_include_bhd_fence_await_hh_included_
+#define BEHEAD_EGL_include_bhd_fence_await_hh_included_ 1
+
+// C++20 coroutine front-end for FenceReactor.
+//
+// Library itself is C++17, so this is header only and available
+// only to consumers compiled with coroutine support.
+
+#include "bhd/fence_reactor.hh"
+
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+
+#include <coroutine>
+
+namespace behead_egl
+{
+
+// co_await yields true once fence signaled, false on failure.
+//
+// NB: Coroutine is resumed on reactor thread, hop to your own executor
+// if it should continue elsewhere.
+class FenceAwaiter
+{
+public:
+   FenceAwaiter(FenceReactor &reactor, EGLDisplay dpy, EGLSyncKHR sync = EGL_NO_SYNC_KHR) noexcept:
+      _reactor(reactor), _dpy(dpy), _sync(sync) {}
+
+   bool await_ready() const noexcept { return false; }
+
+   bool await_suspend(std::coroutine_handle<> h)
+   {
+      auto cb = [this, h] (bool signaled) {
+         _signaled = signaled;
+         h.resume();
+      };
+
+      bool watched = _sync == EGL_NO_SYNC_KHR ? _reactor.watch_fence(_dpy, cb)
+                                              : _reactor.watch_sync(_dpy, _sync, cb);
+
+      // NB: Once watched, callback may have already resumed us and *this may be gone.
+      // Otherwise don't suspend at all and resume with false.
+      return watched;
+   }
+
+   bool await_resume() const noexcept { return _signaled; }
+
+private:
+   FenceReactor &_reactor;
+   EGLDisplay _dpy;
+   EGLSyncKHR _sync;
+
+   bool _signaled = false;
+};
+
+// Inserts fence into current context's command stream and awaits it
+inline FenceAwaiter async_fence(FenceReactor &reactor, EGLDisplay dpy) noexcept
+{
+   return FenceAwaiter(reactor, dpy);
+}
+
+// Awaits existing fence, reactor takes ownership of sync
+inline FenceAwaiter async_sync(FenceReactor &reactor, EGLDisplay dpy, EGLSyncKHR sync) noexcept
+{
+   return FenceAwaiter(reactor, dpy, sync);
+}
+
+}
+
+#endif // defined(__cpp_impl_coroutine)
+
+#endif // !defined(BEHEAD_EGL_include_bhd_fence_await_hh_included_)
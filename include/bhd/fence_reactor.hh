@@ -0,0 +1,70 @@
+/*
+ * SPDX-FileCopyrightText: 2020 Piotr Rak <piotr.rak@gamil.com>
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef BEHEAD_EGL_include_bhd_fence_reactor_hh_included_
+#define BEHEAD_EGL_include_bhd_fence_reactor_hh_included_ 1
+
+#include "bhd/behead_egl.hh"
+
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <memory>
+
+namespace behead_egl
+{
+
+namespace internal { struct FenceReactorImpl; }
+
+// Called once on reactor thread; signaled is false if fence failed
+// or reactor was destroyed before it signaled.
+using fence_cb_t = std::function<void (bool signaled)>;
+
+struct FenceReactorOpts
+{
+   // How often fences without native fd are polled
+   std::chrono::microseconds poll_interval = std::chrono::microseconds(500);
+};
+
+// Waits for EGL_KHR_fence_sync fences of any number of displays on single thread.
+//
+// Where display has EGL_ANDROID_native_fence_sync, fence is exported as native
+// fence fd and completed from epoll; other fences are polled by same thread.
+//
+// Fence latencies are reported through foreach_stat() as "fence.wait",
+// along with "fence.native" and "fence.polled" counts.
+class BHD_EXPORT FenceReactor final
+{
+public:
+   explicit FenceReactor(const FenceReactorOpts &opts = FenceReactorOpts{});
+
+   // Completes pending fences with signaled == false
+   ~FenceReactor();
+
+   FenceReactor(const FenceReactor &) = delete;
+   FenceReactor &operator=(const FenceReactor &) = delete;
+
+   bool ok() const noexcept;
+
+   // Inserts fence into command stream of context current on calling thread
+   // (and bound to dpy), flushes it and calls cb once it signals.
+   //
+   // Returns false if fence couldn't be created, cb is not called then.
+   bool watch_fence(EGLDisplay dpy, fence_cb_t cb);
+
+   // Same as above for existing fence sync object, reactor takes its ownership
+   // (even on failure). Commands preceding it must have been already flushed.
+   bool watch_sync(EGLDisplay dpy, EGLSyncKHR sync, fence_cb_t cb);
+
+   // Fences not yet completed
+   std::size_t pending() const noexcept;
+
+private:
+   std::unique_ptr<internal::FenceReactorImpl> _impl;
+};
+
+}
+
+#endif // !defined(BEHEAD_EGL_include_bhd_fence_reactor_hh_included_)
@@ -0,0 +1,125 @@
+/*
+ * SPDX-FileCopyrightText: 2020 Piotr Rak <piotr.rak@gamil.com>
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef BEHEAD_EGL_include_bhd_frame_ring_hh_included_
+#define BEHEAD_EGL_include_bhd_frame_ring_hh_included_ 1
+
+#include "bhd/behead_egl.hh"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace behead_egl
+{
+
+namespace internal { struct FrameRingImpl; }
+
+// Upper bound of FrameRingOpts::slots
+constexpr unsigned MaxFrameRingSlots = 64;
+
+struct FrameRingOpts
+{
+   unsigned slots = 4;
+
+   // glReadPixels() format and type, see ReadbackOpts
+   std::uint32_t format = 0x1908; // GL_RGBA
+   std::uint32_t type   = 0x1401; // GL_UNSIGNED_BYTE
+};
+
+// Frame as seen by consumer, it points straight into shared memory.
+struct RingFrame
+{
+   const void   *data     = nullptr;
+   std::size_t   size     = 0;
+   std::size_t   stride   = 0;
+
+   unsigned      width    = 0;
+   unsigned      height   = 0;
+
+   std::uint64_t frame_id = 0;
+};
+
+// Producer side of frame ring living in sealed memfd, shared with consumer
+// processes. Frames are read back straight into ring slots, consumers map
+// the same memory, so frames aren't copied between processes at all.
+//
+// Each slot carries sequence number, so consumer can tell slot was overwritten
+// while it was reading it; publication is signaled with futex in shared memory.
+class BHD_EXPORT FrameRingWriter final
+{
+public:
+   FrameRingWriter(unsigned width, unsigned height, const FrameRingOpts &opts = FrameRingOpts{});
+   ~FrameRingWriter();
+
+   FrameRingWriter(FrameRingWriter &&) noexcept;
+   FrameRingWriter &operator=(FrameRingWriter &&) noexcept;
+
+   FrameRingWriter(const FrameRingWriter &) = delete;
+   FrameRingWriter &operator=(const FrameRingWriter &) = delete;
+
+   bool ok() const noexcept;
+
+   // Sealed memfd of the ring, still owned by writer.
+   int fd() const noexcept;
+
+   // Passes ring fd to consumer over unix domain socket (SCM_RIGHTS)
+   bool send_fd(int sock) const;
+
+   // Reads currently bound read framebuffer of context current on calling thread
+   // into next slot and publishes it. Pixel pack buffer binding is reset to 0.
+   //
+   // Returns frame id, 0 on failure.
+   std::uint64_t capture();
+
+   // Generic producer interface: write at most slot_size() bytes of frame
+   // into memory returned by begin_frame(), then publish it with end_frame().
+   void *begin_frame();
+   std::uint64_t end_frame();
+
+   std::size_t slot_size() const noexcept;
+   std::size_t stride() const noexcept;
+
+private:
+   std::unique_ptr<internal::FrameRingImpl> _impl;
+};
+
+// Consumer side of frame ring.
+class BHD_EXPORT FrameRingReader final
+{
+public:
+   // Maps ring from fd received from FrameRingWriter, takes ownership of fd.
+   explicit FrameRingReader(int fd);
+   ~FrameRingReader();
+
+   FrameRingReader(FrameRingReader &&) noexcept;
+   FrameRingReader &operator=(FrameRingReader &&) noexcept;
+
+   FrameRingReader(const FrameRingReader &) = delete;
+   FrameRingReader &operator=(const FrameRingReader &) = delete;
+
+   bool ok() const noexcept;
+
+   // Waits for frame newer than last one returned, at most timeout
+   // (negative waits forever). If consumer fell behind, it skips to newest one.
+   bool wait_frame(RingFrame &out, std::chrono::milliseconds timeout);
+
+   // Checks frame wasn't overwritten by producer, call it once done with frame data.
+   bool still_valid(const RingFrame &frame) const noexcept;
+
+   // Frames producer overwrote before we got to them
+   std::uint64_t dropped() const noexcept;
+
+private:
+   std::unique_ptr<internal::FrameRingImpl> _impl;
+};
+
+// Receives ring fd sent by FrameRingWriter::send_fd(), -1 on failure.
+BHD_EXPORT int receive_frame_ring_fd(int sock);
+
+}
+
+#endif // !defined(BEHEAD_EGL_include_bhd_frame_ring_hh_included_)
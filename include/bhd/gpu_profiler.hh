@@ -0,0 +1,90 @@
+/*
+ * SPDX-FileCopyrightText: 2020 Piotr Rak <piotr.rak@gamil.com>
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef BEHEAD_EGL_include_bhd_gpu_profiler_hh_included_
+#define BEHEAD_EGL_include_bhd_gpu_profiler_hh_included_ 1
+
+#include "bhd/behead_egl.hh"
+
+#include <memory>
+#include <string>
+#include <string_view>
+
+namespace behead_egl
+{
+
+namespace internal { struct GpuProfilerImpl; }
+
+struct GpuProfilerOpts
+{
+   // Frames queries stay in flight before they are resolved, blocking if needed
+   unsigned latency = 3;
+
+   // Scope name prefix in foreach_stat() reports
+   std::string prefix = "gpu.";
+};
+
+// GPU time of named scopes, measured with timestamp queries (GL_EXT_disjoint_timer_query,
+// GL_ARB_timer_query) kept in ring of frames and resolved few frames later,
+// so pipeline isn't stalled.
+//
+// Durations are reported through foreach_stat() as "<prefix><scope name>", the same way
+// as library's CPU-side counters. Scopes can nest. Results of frames during which
+// GPU timer became disjoint (GL_GPU_DISJOINT_EXT) are dropped.
+//
+// Must be created, used and destroyed with the same context current.
+class BHD_EXPORT GpuProfiler final
+{
+public:
+   explicit GpuProfiler(const GpuProfilerOpts &opts = GpuProfilerOpts{});
+
+   // Resolves frames in flight
+   ~GpuProfiler();
+
+   GpuProfiler(const GpuProfiler &) = delete;
+   GpuProfiler &operator=(const GpuProfiler &) = delete;
+
+   // False if context lacks timestamp queries
+   bool ok() const noexcept;
+
+   void begin(std::string_view name);
+   void end();
+
+   // Closes current frame and resolves older ones whose results are available.
+   // Scopes still open are carried to next frame.
+   void end_frame();
+
+   // Waits for and resolves all frames in flight
+   void flush();
+
+private:
+   std::unique_ptr<internal::GpuProfilerImpl> _impl;
+};
+
+// Times scope of enclosing block
+class GpuScope final
+{
+public:
+   GpuScope(GpuProfiler &profiler, std::string_view name):
+      _profiler(profiler)
+   {
+      _profiler.begin(name);
+   }
+
+   ~GpuScope()
+   {
+      _profiler.end();
+   }
+
+   GpuScope(const GpuScope &) = delete;
+   GpuScope &operator=(const GpuScope &) = delete;
+
+private:
+   GpuProfiler &_profiler;
+};
+
+}
+
+#endif // !defined(BEHEAD_EGL_include_bhd_gpu_profiler_hh_included_)
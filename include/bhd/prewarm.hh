@@ -0,0 +1,52 @@
+/*
+ * SPDX-FileCopyrightText: 2020 Piotr Rak <piotr.rak@gamil.com>
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef BEHEAD_EGL_include_bhd_prewarm_hh_included_
+#define BEHEAD_EGL_include_bhd_prewarm_hh_included_ 1
+
+#include "bhd/behead_egl.hh"
+#include "bhd/context.hh"
+
+#include <chrono>
+
+namespace behead_egl
+{
+
+struct PrewarmOpts
+{
+   // Usage of displays created; they are handed out only to requests of the same usage
+   DrmNodeUsage usage = DefaultDrmNodeUsage;
+
+   // Warm every drm device up, otherwise only the one create_headless_display() picks.
+   bool all_devices = false;
+
+   // Context used to compile trivial program, so shader compiler gets loaded too
+   ContextOpts context;
+};
+
+// Starts background thread that creates display on selected devices, initializes it,
+// compiles trivial program on it and parks it.
+//
+// Subsequent create_headless_display() for parked device and usage hands parked
+// display out, already initialized (eglInitialize() on it is no-op); if warm-up
+// of that device is still in progress it waits for it instead of racing it.
+// Each parked display is handed out once.
+//
+// Warm-up also starts from check_headless_display_support() when BEHEAD_EGL_PREWARM
+// is set in environment ("all" selects all devices).
+//
+// Returns false if warm-up was already started or displays aren't supported.
+//
+// Time spent per device is reported through foreach_stat() as "prewarm.device",
+// displays handed out as "prewarm.hit".
+BHD_EXPORT bool prewarm(const PrewarmOpts &opts = PrewarmOpts{});
+
+// Waits at most timeout for warm-up to finish, negative waits forever.
+// Returns true if it finished (or never started).
+BHD_EXPORT bool wait_prewarm(std::chrono::milliseconds timeout = std::chrono::milliseconds(-1));
+
+}
+
+#endif // !defined(BEHEAD_EGL_include_bhd_prewarm_hh_included_)
@@ -0,0 +1,76 @@
+/*
+ * SPDX-FileCopyrightText: 2020 Piotr Rak <piotr.rak@gamil.com>
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef BEHEAD_EGL_include_bhd_program_cache_hh_included_
+#define BEHEAD_EGL_include_bhd_program_cache_hh_included_ 1
+
+#include "bhd/behead_egl.hh"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+
+namespace behead_egl
+{
+
+namespace internal { struct ProgramBinaryCacheImpl; }
+
+// On-disk cache of linked program binaries (OpenGL ES 3.0 or GL_ARB_get_program_binary).
+//
+// File is bound to driver (GL vendor, renderer and version strings) and device
+// (drm path, CUDA device id) it was created for; file written for anything else
+// is ignored and replaced on first store().
+//
+// Binaries are appended to file, each record carries checksum. On open file is
+// mapped and scanned; if complete record turns out damaged, valid records are
+// rewritten to new file that atomically replaces it. Record cut short at the end
+// is left alone, other process may be appending it.
+//
+// Several processes may share one file, they coordinate with flock(). Binaries
+// stored by others are picked up once cache is opened again.
+//
+// Must be created with context current on device given. Programs loaded and
+// stored must belong to context current on calling thread, sharing the same driver.
+//
+// Lookups are reported through foreach_stat() as "program_cache.hit" and
+// "program_cache.miss", stores as "program_cache.store".
+class BHD_EXPORT ProgramBinaryCache final
+{
+public:
+   ProgramBinaryCache(std::string path, const DeviceEXT_Info &device);
+   ~ProgramBinaryCache();
+
+   ProgramBinaryCache(const ProgramBinaryCache &) = delete;
+   ProgramBinaryCache &operator=(const ProgramBinaryCache &) = delete;
+
+   // False when driver doesn't support any program binary format
+   bool ok() const noexcept;
+
+   // Loads binary stored under key (ie. hash of shader sources) into program.
+   // Returns true if program got linked from it. On false program has to be
+   // compiled and linked as usual, then passed to store().
+   //
+   // NB: Binary of different driver build is rejected by GL, not an error.
+   bool load(std::uint32_t program, std::string_view key);
+
+   // Stores binary of linked program under key.
+   //
+   // NB: For some drivers GL_PROGRAM_BINARY_RETRIEVABLE_HINT has to be set before linking.
+   bool store(std::uint32_t program, std::string_view key);
+
+   // Number of binaries available
+   std::size_t size() const noexcept;
+
+   const std::string &path() const noexcept;
+
+private:
+   std::unique_ptr<internal::ProgramBinaryCacheImpl> _impl;
+};
+
+}
+
+#endif // !defined(BEHEAD_EGL_include_bhd_program_cache_hh_included_)
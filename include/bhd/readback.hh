@@ -0,0 +1,92 @@
+/*
+ * SPDX-FileCopyrightText: 2020 Piotr Rak <piotr.rak@gamil.com>
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef BEHEAD_EGL_include_bhd_readback_hh_included_
+#define BEHEAD_EGL_include_bhd_readback_hh_included_ 1
+
+#include "bhd/behead_egl.hh"
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+
+namespace behead_egl
+{
+
+namespace internal { struct ReadbackPipelineImpl; }
+
+struct ReadbackFrame
+{
+   // Valid only during callback
+   const void   *data     = nullptr;
+   std::size_t   size     = 0;
+   std::size_t   stride   = 0;
+
+   unsigned      width    = 0;
+   unsigned      height   = 0;
+
+   // As returned by ReadbackPipeline::capture()
+   std::uint64_t frame_id = 0;
+};
+
+using readback_cb_t = std::function<void (const ReadbackFrame &)>;
+
+struct ReadbackOpts
+{
+   // Number of pixel buffers in flight
+   unsigned depth = 3;
+
+   // glReadPixels() format and type; only 8 bit per channel
+   // GL_RGBA, GL_RGBA_INTEGER, GL_RED, GL_RG are supported.
+   std::uint32_t format = 0x1908; // GL_RGBA
+   std::uint32_t type   = 0x1401; // GL_UNSIGNED_BYTE
+};
+
+// Asynchronous readback of rendered frames through ring of pixel buffer
+// objects, each guarded by fence.
+//
+// Must be created, used and destroyed with the same context current,
+// callback runs on that thread too (from capture(), poll() or flush()).
+// Pack alignment (GL_PACK_ALIGNMENT) is expected to stay as it was at construction.
+//
+// Frames are reported through foreach_stat() as "readback.frame",
+// ring stalls (all buffers were in flight) as "readback.stall".
+class BHD_EXPORT ReadbackPipeline final
+{
+public:
+   ReadbackPipeline(unsigned width, unsigned height, readback_cb_t cb,
+                    const ReadbackOpts &opts = ReadbackOpts{});
+
+   // Delivers frames in flight, then releases buffers
+   ~ReadbackPipeline();
+
+   ReadbackPipeline(const ReadbackPipeline &) = delete;
+   ReadbackPipeline &operator=(const ReadbackPipeline &) = delete;
+
+   bool ok() const noexcept;
+
+   // Starts readback of currently bound read framebuffer.
+   // If whole ring is in flight, waits for oldest frame and delivers it first.
+   //
+   // Returns frame id, 0 on failure.
+   std::uint64_t capture();
+
+   // Delivers frames that are ready, never blocks. Returns their count.
+   std::size_t poll();
+
+   // Waits for and delivers all frames in flight.
+   void flush();
+
+   unsigned depth() const noexcept;
+   unsigned in_flight() const noexcept;
+
+private:
+   std::unique_ptr<internal::ReadbackPipelineImpl> _impl;
+};
+
+}
+
+#endif // !defined(BEHEAD_EGL_include_bhd_readback_hh_included_)
@@ -0,0 +1,128 @@
+/*
+ * SPDX-FileCopyrightText: 2020 Piotr Rak <piotr.rak@gamil.com>
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef BEHEAD_EGL_include_bhd_scheduler_hh_included_
+#define BEHEAD_EGL_include_bhd_scheduler_hh_included_ 1
+
+#include "bhd/behead_egl.hh"
+#include "bhd/context.hh"
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+
+namespace behead_egl
+{
+
+namespace internal { struct RenderSchedulerImpl; }
+
+// Jobs of each class run only on workers of that class
+enum class JobClass
+{
+   // Bulk work, on workers with SchedulerOpts::context priority
+   Batch,
+   // Latency sensitive (ie. previews), on workers with SchedulerOpts::interactive_priority
+   Interactive,
+};
+
+// What render job gets to run on; its context is current on calling thread.
+struct RenderWorker
+{
+   unsigned index         = 0;
+   unsigned device_index  = 0;
+
+   EGLDisplay display     = EGL_NO_DISPLAY;
+   EGLContext context     = EGL_NO_CONTEXT;
+
+   const DeviceEXT_Info *device = nullptr;
+
+   JobClass job_class     = JobClass::Batch;
+
+   // Granted to context, may be lower than requested
+   ContextPriority priority = ContextPriority::Default;
+};
+
+using render_job_t = std::function<void (const RenderWorker &)>;
+
+struct SchedulerOpts
+{
+   // Worker threads (each with own context) per device
+   unsigned workers_per_device = 1;
+
+   // Limit number of devices used, 0 uses all
+   unsigned max_devices = 0;
+
+   // Per worker, rounded up to power of two
+   std::size_t queue_capacity = 1024;
+
+   // Idle workers take jobs queued for workers on equivalent devices,
+   // ie. those with same set of device extensions.
+   bool work_stealing = true;
+
+   DrmNodeUsage node_usage = DefaultDrmNodeUsage;
+
+   // Batch workers use context.priority
+   ContextOpts context;
+
+   // Additional workers per device running JobClass::Interactive jobs,
+   // their contexts are created with interactive_priority.
+   unsigned interactive_workers_per_device = 0;
+
+   ContextPriority interactive_priority = ContextPriority::High;
+};
+
+// Runs render jobs on worker threads; each owns context permanently current
+// on display of its device.
+//
+// Uses devices with EGL_EXT_device_drm; if there are none it falls back to
+// software devices (EGL_MESA_device_software).
+//
+// Jobs are stolen only between workers of the same JobClass, so batch jobs never
+// occupy interactive workers.
+//
+// Job timings are reported through foreach_stat() as "scheduler.job", along with
+// "scheduler.steal" and "scheduler.job_failed" (job has thrown).
+class BHD_EXPORT RenderScheduler final
+{
+public:
+   explicit RenderScheduler(const SchedulerOpts &opts = SchedulerOpts{});
+
+   // Finishes queued jobs, then tears down workers, their contexts and displays
+   ~RenderScheduler();
+
+   RenderScheduler(const RenderScheduler &) = delete;
+   RenderScheduler &operator=(const RenderScheduler &) = delete;
+
+   // False if no worker could be started
+   bool ok() const noexcept;
+
+   std::size_t worker_count() const noexcept;
+   std::size_t device_count() const noexcept;
+
+   // Queues job on next worker in round-robin order that has room.
+   // Returns false if all queues are full.
+   bool submit(render_job_t job);
+
+   // Same for workers of given class. JobClass::Interactive jobs no interactive
+   // worker accepts (none running, queues full or there are none) go to batch ones.
+   bool submit(render_job_t job, JobClass job_class);
+
+   // Queues job on given worker, false if its queue is full or worker is not running.
+   bool submit_to(std::size_t worker, render_job_t job);
+
+   // Number of workers, whose context got lower priority than requested;
+   // including displays without EGL_IMG_context_priority.
+   std::size_t downgraded_workers() const noexcept;
+
+   // Blocks until all submitted jobs are finished
+   void wait_idle();
+
+private:
+   std::unique_ptr<internal::RenderSchedulerImpl> _impl;
+};
+
+}
+
+#endif // !defined(BEHEAD_EGL_include_bhd_scheduler_hh_included_)
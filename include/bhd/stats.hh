@@ -0,0 +1,39 @@
+/*
+ * SPDX-FileCopyrightText: 2020 Piotr Rak <piotr.rak@gamil.com>
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef BEHEAD_EGL_include_bhd_stats_hh_included_
+#define BEHEAD_EGL_include_bhd_stats_hh_included_ 1
+
+#include "bhd/behead_egl.hh"
+
+#include <cstdint>
+#include <functional>
+
+namespace behead_egl
+{
+
+// Snapshot of single library counter.
+//
+// Pure event counters report only count; timings report
+// count of samples, their sum and maximum in nanoseconds.
+struct StatSample
+{
+   const char    *name     = nullptr;
+   std::uint64_t  count    = 0;
+   std::uint64_t  total_ns = 0;
+   std::uint64_t  max_ns   = 0;
+};
+
+using stats_cb_t = std::function<void (const StatSample &)>;
+
+// Calls cb for every counter registered so far, in registration order.
+BHD_EXPORT void foreach_stat(const stats_cb_t &cb);
+
+// Zeroes all counters, registrations are kept.
+BHD_EXPORT void reset_stats();
+
+}
+
+#endif // !defined(BEHEAD_EGL_include_bhd_stats_hh_included_)
@@ -0,0 +1,124 @@
+/*
+ * SPDX-FileCopyrightText: 2020 Piotr Rak <piotr.rak@gamil.com>
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef BEHEAD_EGL_include_bhd_target_pool_hh_included_
+#define BEHEAD_EGL_include_bhd_target_pool_hh_included_ 1
+
+#include "bhd/behead_egl.hh"
+#include "bhd/context.hh"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace behead_egl
+{
+
+namespace internal { struct TargetPoolImpl; }
+
+enum class ColorFormat
+{
+   RGBA8,
+   RGBA16F,
+   R8,
+};
+
+enum class DepthFormat
+{
+   None,
+   Depth24Stencil8,
+   Depth32F,
+};
+
+struct RenderTargetDesc
+{
+   std::uint32_t width  = 0;
+   std::uint32_t height = 0;
+
+   ColorFormat color = ColorFormat::RGBA8;
+   DepthFormat depth = DepthFormat::None;
+
+   // Also hand out pbuffer surface of the same size class
+   bool pbuffer = false;
+};
+
+// Render target handed out by RenderTargetPool, GL objects are owned by pool.
+struct RenderTarget
+{
+   // Complete framebuffer with color_texture attached to GL_COLOR_ATTACHMENT0 and
+   // depth_renderbuffer (if asked for) to GL_DEPTH_ATTACHMENT or GL_DEPTH_STENCIL_ATTACHMENT
+   std::uint32_t framebuffer        = 0;
+   std::uint32_t color_texture      = 0;
+   std::uint32_t depth_renderbuffer = 0;
+
+   EGLSurface    pbuffer            = EGL_NO_SURFACE;
+
+   // Size class, at least as large as requested; set viewport to requested size
+   std::uint32_t width  = 0;
+   std::uint32_t height = 0;
+
+   std::uint64_t id     = 0;
+
+   explicit operator bool() const noexcept { return framebuffer != 0; }
+};
+
+struct RenderTargetPoolOpts
+{
+   // Bytes held by pool, both idle and handed out targets; idle ones are
+   // evicted least recently released first to make room
+   std::size_t memory_cap = std::size_t(256) << 20;
+
+   // Config for pbuffer surfaces, see choose_headless_config()
+   ContextOpts context;
+};
+
+// Recycles render targets of size classes, so steady state jobs of similar sizes
+// don't allocate any GPU memory.
+//
+// Sizes are rounded up to classes at most 25% larger in each dimension.
+// Released targets are fenced and handed out again only after commands issued
+// so far signal, so other contexts sharing objects can still read them.
+//
+// Must be created, used and destroyed with the same context current (on dpy).
+//
+// Reuses are reported through foreach_stat() as "target_pool.hit", allocations
+// as "target_pool.miss", targets freed to stay under cap as "target_pool.evict".
+class BHD_EXPORT RenderTargetPool final
+{
+public:
+   explicit RenderTargetPool(EGLDisplay dpy, const RenderTargetPoolOpts &opts = RenderTargetPoolOpts{});
+   ~RenderTargetPool();
+
+   RenderTargetPool(const RenderTargetPool &) = delete;
+   RenderTargetPool &operator=(const RenderTargetPool &) = delete;
+
+   // False when GL entry points are missing
+   bool ok() const noexcept;
+
+   // Returns idle target of desc size class, allocates one on miss.
+   // Leaves framebuffer, texture and renderbuffer bindings unchanged.
+   //
+   // Returns empty target if allocation failed or would exceed memory cap.
+   RenderTarget acquire(const RenderTargetDesc &desc);
+
+   // Fences target and returns it to pool, target is reset.
+   void release(RenderTarget &target);
+
+   // Frees all idle targets
+   void trim();
+
+   // Bytes held, estimated from formats
+   std::size_t memory() const noexcept;
+
+   // Targets held, idle and handed out
+   std::size_t size() const noexcept;
+
+private:
+   std::unique_ptr<internal::TargetPoolImpl> _impl;
+};
+
+}
+
+#endif // !defined(BEHEAD_EGL_include_bhd_target_pool_hh_included_)
@@ -0,0 +1,123 @@
+/*
+ * SPDX-FileCopyrightText: 2020 Piotr Rak <piotr.rak@gamil.com>
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef BEHEAD_EGL_include_bhd_upload_ring_hh_included_
+#define BEHEAD_EGL_include_bhd_upload_ring_hh_included_ 1
+
+#include "bhd/behead_egl.hh"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+
+namespace behead_egl
+{
+
+namespace internal { struct UploadRingImpl; }
+
+// Part of ring reserved by producer, it is written through data.
+struct UploadSlice
+{
+   void         *data   = nullptr;
+   std::size_t   size   = 0;
+
+   // Offset within UploadRing::buffer()
+   std::size_t   offset = 0;
+
+   std::uint64_t id     = 0;
+
+   explicit operator bool() const noexcept { return data != nullptr; }
+};
+
+// Submitted slice as seen by render thread
+struct UploadBlock
+{
+   // GL buffer name and range, bind it as GL_PIXEL_UNPACK_BUFFER for glTex(Sub)Image*()
+   // or GL_ARRAY_BUFFER for vertex data, then source it from offset.
+   std::uint32_t buffer = 0;
+   std::size_t   offset = 0;
+   std::size_t   size   = 0;
+
+   std::uint64_t id     = 0;
+
+   // As passed to UploadRing::submit()
+   std::uint64_t tag    = 0;
+};
+
+using upload_cb_t = std::function<void (const UploadBlock &)>;
+
+struct UploadRingOpts
+{
+   // Size of mapped buffer
+   std::size_t capacity = 64 << 20;
+};
+
+// Streaming upload through single persistently and coherently mapped buffer
+// (GL_EXT_buffer_storage or GL_ARB_buffer_storage) used as ring.
+//
+// Producers reserve slices from any thread and write straight into mapped
+// memory, render thread sources GL commands from the buffer and fences them;
+// space is reused once those fences signal. No staging copies are made
+// on our side.
+//
+// Must be created, consumed and destroyed with the same context current.
+// Producers must be done with the ring before it is destroyed.
+//
+// Submitted bytes are reported through foreach_stat() as "upload.bytes",
+// consumed blocks as "upload.block", producers waiting for space as "upload.stall".
+class BHD_EXPORT UploadRing final
+{
+public:
+   explicit UploadRing(const UploadRingOpts &opts = UploadRingOpts{});
+   ~UploadRing();
+
+   UploadRing(const UploadRing &) = delete;
+   UploadRing &operator=(const UploadRing &) = delete;
+
+   // False when context lacks buffer storage support or allocation failed
+   bool ok() const noexcept;
+
+   // {{{ Any thread
+
+   // Reserves size bytes aligned to alignment (power of 2).
+   // Waits at most timeout for render thread to free space, negative waits forever.
+   //
+   // Slices are consumed in reservation order, each has to be submitted or canceled,
+   // otherwise it holds back ones reserved after it.
+   //
+   // Returns empty slice on failure or timeout.
+   UploadSlice reserve(std::size_t size, std::size_t alignment = 256,
+                       std::chrono::milliseconds timeout = std::chrono::milliseconds(-1));
+
+   // Hands written slice to render thread
+   bool submit(const UploadSlice &slice, std::uint64_t tag = 0);
+
+   // Returns slice unused
+   bool cancel(const UploadSlice &slice);
+
+   // }}}
+
+   // {{{ Render thread
+
+   // Calls cb for each submitted block in reservation order and fences
+   // commands issued by it. Also releases space of blocks whose fences signaled.
+   //
+   // Never blocks on GPU. Returns number of blocks passed to cb.
+   std::size_t consume(const upload_cb_t &cb);
+
+   // }}}
+
+   std::uint32_t buffer() const noexcept;
+   std::size_t capacity() const noexcept;
+
+private:
+   std::unique_ptr<internal::UploadRingImpl> _impl;
+};
+
+}
+
+#endif // !defined(BEHEAD_EGL_include_bhd_upload_ring_hh_included_)
@@ -0,0 +1,582 @@
+/*
+ * SPDX-FileCopyrightText: 2020 Piotr Rak <piotr.rak@gamil.com>
+ * SPDX-License-Identifier: MIT
+ */
+#include "bhd/admission.hh"
+
+#include "behead_egl_impl.hh"
+#include "display_strategy.hh"
+#include "minidrm.hh"
+#include "shm_region.hh"
+#include "stats.hh"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <iostream>
+
+namespace bhdi = behead_egl::internal;
+namespace bhd = behead_egl;
+
+namespace {
+
+using std::chrono::steady_clock;
+using std::chrono::nanoseconds;
+
+// Primary nodes use minors 0-63, but don't be stingy.
+constexpr unsigned MAX_DRM_MINORS = 256;
+
+// NB: Bumped on layout change, 'bhaa' lacked waiters
+constexpr std::uint32_t ADMISSION_MAGIC = 0x62686162; // 'bhab'
+
+// Waiters counted per device, further ones still wait
+constexpr unsigned MAX_COUNTED_WAITERS = 32;
+
+// How often waiters look for slots held by dead processes
+constexpr nanoseconds RECLAIM_PERIOD = std::chrono::milliseconds(100);
+
+// {{{ Shared memory layout, all-zero is valid initial state.
+
+struct DeviceSlots
+{
+   // Bumped on each release, waiters futex_wait() on it
+   std::atomic<std::uint32_t> release_seq;
+
+   // Pid of holder or 0
+   std::atomic<std::int32_t> holders[bhd::MaxAdmissionsPerDevice];
+
+   // Pid of process queued in acquire() or 0, one per waiting thread
+   std::atomic<std::int32_t> waiters[MAX_COUNTED_WAITERS];
+};
+
+struct AdmissionTable
+{
+   std::atomic<std::uint32_t> magic;
+
+   DeviceSlots devices[MAX_DRM_MINORS];
+};
+
+// }}}
+
+struct Counters
+{
+   bhdi::StatCounter &wait      = bhdi::stat_counter("admission.wait");
+   bhdi::StatCounter &redirect  = bhdi::stat_counter("admission.redirect");
+   bhdi::StatCounter &timeout   = bhdi::stat_counter("admission.timeout");
+   bhdi::StatCounter &reclaim   = bhdi::stat_counter("admission.reclaim");
+};
+
+Counters &counters()
+{
+   static Counters c;
+   return c;
+}
+
+} // namespace anonymous
+
+namespace behead_egl::internal {
+
+struct DeviceLimiterImpl
+{
+   AdmissionOpts opts;
+
+   SharedRegion region;
+
+   const std::int32_t pid = std::int32_t(::getpid());
+
+   AdmissionTable &table() const
+   {
+      return *static_cast<AdmissionTable *>(region.data());
+   }
+
+   DeviceSlots *slots(unsigned drm_minor) const
+   {
+      if (!region.ok() || drm_minor >= MAX_DRM_MINORS)
+         return nullptr;
+
+      return &table().devices[drm_minor];
+   }
+
+   // Returns claimed slot index or -1
+   int try_claim(DeviceSlots &dev) const noexcept;
+
+   // Frees slots of dead holders, returns true if any was freed
+   bool reclaim_dead(DeviceSlots &dev) const noexcept;
+
+   // Returns waiter slot index or -1 if all are taken
+   int enqueue(DeviceSlots &dev) const noexcept;
+   void dequeue(DeviceSlots &dev, int slot) const noexcept;
+
+   // Live waiters, slots of dead ones are freed
+   unsigned waiting(DeviceSlots &dev) const noexcept;
+
+   void release(unsigned drm_minor, unsigned slot) const noexcept;
+};
+
+int DeviceLimiterImpl::try_claim(DeviceSlots &dev) const noexcept
+{
+   for (unsigned i = 0; i < opts.max_per_device; ++i)
+   {
+      std::int32_t expected = 0;
+
+      if (dev.holders[i].compare_exchange_strong(expected, pid, std::memory_order_acq_rel))
+         return int(i);
+   }
+
+   return -1;
+}
+
+bool DeviceLimiterImpl::reclaim_dead(DeviceSlots &dev) const noexcept
+{
+   bool reclaimed = false;
+
+   // NB: Other processes may use higher limit, look at all of slots.
+   for (auto &h : dev.holders)
+   {
+      std::int32_t holder = h.load(std::memory_order_relaxed);
+
+      if (holder == 0 || holder == pid || is_pid_alive(holder))
+         continue;
+
+      if (h.compare_exchange_strong(holder, 0, std::memory_order_acq_rel))
+      {
+         counters().reclaim.add();
+         reclaimed = true;
+      }
+   }
+
+   if (reclaimed)
+   {
+      dev.release_seq.fetch_add(1, std::memory_order_release);
+      futex_wake_all(dev.release_seq);
+   }
+
+   return reclaimed;
+}
+
+int DeviceLimiterImpl::enqueue(DeviceSlots &dev) const noexcept
+{
+   for (unsigned i = 0; i < MAX_COUNTED_WAITERS; ++i)
+   {
+      std::int32_t expected = 0;
+
+      if (dev.waiters[i].compare_exchange_strong(expected, pid, std::memory_order_acq_rel))
+         return int(i);
+   }
+
+   return -1;
+}
+
+void DeviceLimiterImpl::dequeue(DeviceSlots &dev, int slot) const noexcept
+{
+   if (slot < 0)
+      return;
+
+   std::int32_t expected = pid;
+
+   // NB: Same as release(), could be only reclaimed if pid got reused
+   dev.waiters[slot].compare_exchange_strong(expected, 0, std::memory_order_acq_rel);
+}
+
+unsigned DeviceLimiterImpl::waiting(DeviceSlots &dev) const noexcept
+{
+   unsigned count = 0;
+
+   for (auto &w : dev.waiters)
+   {
+      std::int32_t waiter = w.load(std::memory_order_relaxed);
+
+      if (waiter == 0)
+         continue;
+
+      if (waiter == pid || is_pid_alive(waiter))
+      {
+         ++count;
+         continue;
+      }
+
+      if (w.compare_exchange_strong(waiter, 0, std::memory_order_acq_rel))
+         counters().reclaim.add();
+   }
+
+   return count;
+}
+
+void DeviceLimiterImpl::release(unsigned drm_minor, unsigned slot) const noexcept
+{
+   DeviceSlots *dev = slots(drm_minor);
+
+   assert(dev != nullptr);
+   assert(slot < MaxAdmissionsPerDevice);
+
+   std::int32_t expected = pid;
+
+   // NB: It could be only reclaimed by someone else, if pid got reused. Nothing to do then.
+   dev->holders[slot].compare_exchange_strong(expected, 0, std::memory_order_acq_rel);
+
+   dev->release_seq.fetch_add(1, std::memory_order_release);
+   futex_wake_all(dev->release_seq);
+}
+
+} // namespace behead_egl::internal
+
+namespace behead_egl
+{
+
+using bhdi::BeheadEGL;
+using bhdi::runtime_egl_error;
+using std::runtime_error;
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// AdmissionTicket implementation
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+AdmissionTicket::AdmissionTicket() noexcept = default;
+
+AdmissionTicket::~AdmissionTicket()
+{
+   release();
+}
+
+AdmissionTicket::AdmissionTicket(AdmissionTicket &&other) noexcept:
+   _owner(std::move(other._owner)),
+   _minor(other._minor),
+   _slot(other._slot),
+   _wait(other._wait)
+{}
+
+AdmissionTicket &AdmissionTicket::operator=(AdmissionTicket &&other) noexcept
+{
+   if (this != &other)
+   {
+      release();
+
+      _owner = std::move(other._owner);
+      _minor = other._minor;
+      _slot = other._slot;
+      _wait = other._wait;
+   }
+
+   return *this;
+}
+
+void AdmissionTicket::release() noexcept
+{
+   if (_owner == nullptr)
+      return;
+
+   _owner->release(_minor, _slot);
+   _owner.reset();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// DeviceLimiter implementation
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+DeviceLimiter::DeviceLimiter(const AdmissionOpts &opts):
+   _impl(std::make_shared<internal::DeviceLimiterImpl>())
+{
+   _impl->opts = opts;
+   _impl->opts.max_per_device = std::clamp(opts.max_per_device, 1u, MaxAdmissionsPerDevice);
+
+   try
+   {
+      auto region = internal::SharedRegion::open(opts.shm_name, sizeof(AdmissionTable), opts.shm_mode);
+
+      auto *table = static_cast<AdmissionTable *>(region.data());
+
+      if (!internal::claim_region_magic(table->magic, ADMISSION_MAGIC))
+         throw std::runtime_error("Shared memory is used by something else");
+
+      _impl->region = std::move(region);
+   }
+   catch (const std::runtime_error &e)
+   {
+      // WARNING
+      std::cerr << "Failed to set up device admission control" << std::endl;
+      std::cerr << e.what() << std::endl;
+   }
+}
+
+DeviceLimiter::~DeviceLimiter() = default;
+
+DeviceLimiter::DeviceLimiter(DeviceLimiter &&) noexcept = default;
+DeviceLimiter &DeviceLimiter::operator=(DeviceLimiter &&) noexcept = default;
+
+bool DeviceLimiter::ok() const noexcept
+{
+   return _impl != nullptr && _impl->region.ok();
+}
+
+const AdmissionOpts &DeviceLimiter::opts() const noexcept
+{
+   // Moved-from limiter reports defaults
+   static const AdmissionOpts defaults;
+
+   return _impl != nullptr ? _impl->opts : defaults;
+}
+
+AdmissionTicket DeviceLimiter::try_acquire(unsigned drm_minor)
+{
+   AdmissionTicket ticket;
+
+   if (_impl == nullptr)
+      return ticket;
+
+   DeviceSlots *dev = _impl->slots(drm_minor);
+
+   if (dev == nullptr)
+      return ticket;
+
+   int slot = _impl->try_claim(*dev);
+
+   // Someone might have crashed holding it
+   if (slot < 0 && _impl->reclaim_dead(*dev))
+      slot = _impl->try_claim(*dev);
+
+   if (slot < 0)
+      return ticket;
+
+   ticket._owner = _impl;
+   ticket._minor = drm_minor;
+   ticket._slot = unsigned(slot);
+
+   return ticket;
+}
+
+AdmissionTicket DeviceLimiter::acquire(unsigned drm_minor)
+{
+   if (_impl == nullptr)
+      return AdmissionTicket{};
+
+   DeviceSlots *dev = _impl->slots(drm_minor);
+
+   if (dev == nullptr)
+      return AdmissionTicket{};
+
+   const auto start = steady_clock::now();
+   const bool forever = _impl->opts.max_wait.count() < 0;
+   const auto deadline = start + _impl->opts.max_wait;
+
+   // Counted while queued, create_headless_display() picks shortest queue
+   struct Queued
+   {
+      const internal::DeviceLimiterImpl &impl;
+      DeviceSlots &dev;
+      int slot;
+
+      ~Queued() { impl.dequeue(dev, slot); }
+   } queued{ *_impl, *dev, _impl->enqueue(*dev) };
+
+   for (;;)
+   {
+      // Read sequence before trying, so we don't miss release in between
+      std::uint32_t seq = dev->release_seq.load(std::memory_order_acquire);
+
+      AdmissionTicket ticket = try_acquire(drm_minor);
+
+      if (ticket.ok())
+      {
+         ticket._wait = steady_clock::now() - start;
+         counters().wait.record(ticket._wait);
+         return ticket;
+      }
+
+      nanoseconds timeout = RECLAIM_PERIOD;
+
+      if (!forever)
+      {
+         auto left = deadline - steady_clock::now();
+
+         if (left <= nanoseconds(0))
+         {
+            counters().timeout.add();
+            return AdmissionTicket{};
+         }
+
+         timeout = std::min<nanoseconds>(timeout, left);
+      }
+
+      internal::futex_wait(dev->release_seq, seq, timeout.count());
+   }
+}
+
+unsigned DeviceLimiter::waiting(unsigned drm_minor) const
+{
+   if (_impl == nullptr)
+      return 0;
+
+   DeviceSlots *dev = _impl->slots(drm_minor);
+
+   return dev != nullptr ? _impl->waiting(*dev) : 0;
+}
+
+unsigned DeviceLimiter::in_use(unsigned drm_minor) const
+{
+   if (_impl == nullptr)
+      return 0;
+
+   DeviceSlots *dev = _impl->slots(drm_minor);
+
+   if (dev == nullptr)
+      return 0;
+
+   unsigned count = 0;
+
+   for (const auto &h : dev->holders)
+      count += h.load(std::memory_order_relaxed) != 0;
+
+   return count;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Display creation with admission
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+EGLDisplay create_headless_display(DeviceLimiter &limiter, AdmissionTicket &ticket,
+                                   DrmNodeUsage node_usage)
+{
+   ticket.release();
+
+   if (!limiter.ok())
+      return create_headless_display(node_usage);
+
+   if (!BeheadEGL::ensure_client_extensions())
+      return EGL_NO_DISPLAY;
+
+   try
+   {
+      const auto infos = BeheadEGL::query_device_infos();
+      const auto ranked = BeheadEGL::rank_display_devices(infos);
+
+      if (ranked.empty())
+      {
+         // ERROR
+         std::cerr << "Couldn't find suitable EGLDeviceEXT" << std::endl;
+         return EGL_NO_DISPLAY;
+      }
+
+      internal::DisplayCreationStrategy strategy(node_usage);
+
+      // Minor of each ranked device, or -1 once it failed to stat or open
+      std::vector<int> minors(ranked.size(), -1);
+
+      for (std::size_t i = 0; i < ranked.size(); ++i)
+      {
+         unsigned drm_minor = 0;
+
+         if (internal::query_drm_minor(ranked[i]->drm_path, drm_minor))
+            minors[i] = int(drm_minor);
+      }
+
+      auto try_device = [&] (std::size_t i, bool queue) {
+         const DeviceEXT_Info &info = *ranked[i];
+
+         if (minors[i] < 0)
+            throw runtime_error(std::string("Can't stat ") + info.drm_path);
+
+         const unsigned drm_minor = unsigned(minors[i]);
+
+         AdmissionTicket t = queue ? limiter.acquire(drm_minor)
+                                   : limiter.try_acquire(drm_minor);
+         if (!t.ok())
+            return EGL_NO_DISPLAY;
+
+         // From now on failure is device's, don't queue for it
+         minors[i] = -1;
+
+         // NB: Nodes are opened only once admitted, waiting doesn't hold fds
+         auto nodes = internal::open_drm_nodes(info.drm_path, strategy.get_open_flag());
+
+         EGLDisplay dpy = BeheadEGL::create_display_on_nodes(nodes, node_usage,
+                                                             info.egl_device_ext);
+
+         if (dpy != EGL_NO_DISPLAY)
+         {
+            minors[i] = int(drm_minor);
+            ticket = std::move(t);
+         }
+
+         return dpy;
+      };
+
+      // Take any free device, in order of preference
+      std::size_t candidates = limiter.opts().redirect ? ranked.size() : 1;
+
+      for (std::size_t i = 0; i < candidates; ++i)
+      {
+         try
+         {
+            EGLDisplay dpy = try_device(i, false);
+
+            if (dpy != EGL_NO_DISPLAY)
+            {
+               if (i > 0)
+                  counters().redirect.add();
+
+               return dpy;
+            }
+         }
+         catch (const runtime_error &e)
+         {
+            // WARNING
+            std::cerr << "Failed to create EGLDisplay" << std::endl;
+            std::cerr << e.what() << std::endl;
+         }
+      }
+
+      // All busy, queue for one with fewest waiters; ties go to preferred one
+      std::size_t shortest = candidates;
+      unsigned fewest = 0;
+
+      for (std::size_t i = 0; i < candidates; ++i)
+      {
+         if (minors[i] < 0)
+            continue;
+
+         unsigned waiting = limiter.waiting(unsigned(minors[i]));
+
+         if (shortest == candidates || waiting < fewest)
+         {
+            shortest = i;
+            fewest = waiting;
+         }
+      }
+
+      if (shortest == candidates)
+      {
+         // ERROR
+         std::cerr << "Couldn't create EGLDisplay on any device" << std::endl;
+         return EGL_NO_DISPLAY;
+      }
+
+      return try_device(shortest, true);
+   }
+   catch (const runtime_egl_error &e)
+   {
+      // WARNING
+      std::cerr << "Couldn't query any device capabilities" << std::endl;
+      std::cerr << e.what() << " (EGLError: " << e.egl_error << ")" << std::endl;
+   }
+   catch (const runtime_error &e)
+   {
+      std::cerr << "Failed to create EGLDisplay" << std::endl;
+      std::cerr << e.what() << std::endl;
+   }
+   catch (...)
+   {
+      assert(false && "Leaked exception");
+   }
+
+   return EGL_NO_DISPLAY;
+}
+
+} // namespace behead_egl
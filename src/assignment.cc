@@ -0,0 +1,363 @@
+/*
+ * SPDX-FileCopyrightText: 2020 Piotr Rak <piotr.rak@gamil.com>
+ * SPDX-License-Identifier: MIT
+ */
+#include "bhd/assignment.hh"
+
+#include "behead_egl_impl.hh"
+#include "display_strategy.hh"
+#include "minidrm.hh"
+#include "shm_region.hh"
+#include "stats.hh"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include <iostream>
+
+namespace bhdi = behead_egl::internal;
+namespace bhd = behead_egl;
+
+namespace {
+
+constexpr std::uint32_t ASSIGNMENT_MAGIC = 0x62686174; // 'bhat'
+
+// {{{ Shared memory layout, all-zero is valid initial state.
+//
+// Each entry packs holder pid and drm minor + 1, so it is claimed
+// and released with single CAS; 0 is free entry.
+
+struct AssignmentTable
+{
+   std::atomic<std::uint32_t> magic;
+
+   std::atomic<std::uint64_t> entries[bhd::MaxAssignments];
+};
+
+static_assert(std::atomic<std::uint64_t>::is_always_lock_free);
+
+constexpr std::uint64_t pack_entry(std::int32_t pid, unsigned drm_minor) noexcept
+{
+   return (std::uint64_t(std::uint32_t(pid)) << 32) | std::uint64_t(drm_minor + 1);
+}
+
+constexpr std::int32_t entry_pid(std::uint64_t e) noexcept
+{
+   return std::int32_t(e >> 32);
+}
+
+constexpr unsigned entry_minor(std::uint64_t e) noexcept
+{
+   return unsigned(e & 0xffffffffu) - 1;
+}
+
+// }}}
+
+struct Counters
+{
+   bhdi::StatCounter &reclaim  = bhdi::stat_counter("assignment.reclaim");
+   bhdi::StatCounter &full     = bhdi::stat_counter("assignment.full");
+};
+
+Counters &counters()
+{
+   static Counters c;
+   return c;
+}
+
+} // namespace anonymous
+
+namespace behead_egl::internal {
+
+struct DeviceAssignmentTableImpl
+{
+   SharedRegion region;
+
+   const std::int32_t pid = std::int32_t(::getpid());
+
+   AssignmentTable &table() const
+   {
+      return *static_cast<AssignmentTable *>(region.data());
+   }
+
+   // Frees entry if its holder is dead, returns true if it did.
+   bool reclaim_if_dead(std::atomic<std::uint64_t> &entry, std::uint64_t e) const noexcept
+   {
+      if (e == 0 || entry_pid(e) == pid || is_pid_alive(entry_pid(e)))
+         return false;
+
+      if (!entry.compare_exchange_strong(e, 0, std::memory_order_acq_rel))
+         return false;
+
+      counters().reclaim.add();
+      return true;
+   }
+
+   void release(unsigned entry, unsigned drm_minor) const noexcept
+   {
+      assert(entry < MaxAssignments);
+
+      std::uint64_t expected = pack_entry(pid, drm_minor);
+
+      // NB: Fails only if pid got reused and someone reclaimed it; nothing to do then.
+      table().entries[entry].compare_exchange_strong(expected, 0, std::memory_order_acq_rel);
+   }
+};
+
+} // namespace behead_egl::internal
+
+namespace behead_egl
+{
+
+using bhdi::BeheadEGL;
+using bhdi::runtime_egl_error;
+using std::runtime_error;
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// DeviceAssignment implementation
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+DeviceAssignment::DeviceAssignment() noexcept = default;
+
+DeviceAssignment::~DeviceAssignment()
+{
+   release();
+}
+
+DeviceAssignment::DeviceAssignment(DeviceAssignment &&other) noexcept:
+   _owner(std::move(other._owner)),
+   _minor(other._minor),
+   _entry(other._entry)
+{}
+
+DeviceAssignment &DeviceAssignment::operator=(DeviceAssignment &&other) noexcept
+{
+   if (this != &other)
+   {
+      release();
+
+      _owner = std::move(other._owner);
+      _minor = other._minor;
+      _entry = other._entry;
+   }
+
+   return *this;
+}
+
+void DeviceAssignment::release() noexcept
+{
+   if (_owner == nullptr)
+      return;
+
+   _owner->release(_entry, _minor);
+   _owner.reset();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// DeviceAssignmentTable implementation
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+DeviceAssignmentTable::DeviceAssignmentTable(const char *shm_name, unsigned shm_mode):
+   _impl(std::make_shared<internal::DeviceAssignmentTableImpl>())
+{
+   try
+   {
+      auto region = internal::SharedRegion::open(shm_name, sizeof(AssignmentTable), shm_mode);
+
+      auto *table = static_cast<AssignmentTable *>(region.data());
+
+      if (!internal::claim_region_magic(table->magic, ASSIGNMENT_MAGIC))
+         throw std::runtime_error("Shared memory is used by something else");
+
+      _impl->region = std::move(region);
+   }
+   catch (const std::runtime_error &e)
+   {
+      // WARNING
+      std::cerr << "Failed to set up device assignment table" << std::endl;
+      std::cerr << e.what() << std::endl;
+   }
+}
+
+DeviceAssignmentTable::~DeviceAssignmentTable() = default;
+
+DeviceAssignmentTable::DeviceAssignmentTable(DeviceAssignmentTable &&) noexcept = default;
+DeviceAssignmentTable &DeviceAssignmentTable::operator=(DeviceAssignmentTable &&) noexcept = default;
+
+bool DeviceAssignmentTable::ok() const noexcept
+{
+   return _impl != nullptr && _impl->region.ok();
+}
+
+DeviceAssignment DeviceAssignmentTable::assign(unsigned drm_minor)
+{
+   DeviceAssignment assignment;
+
+   if (!ok())
+      return assignment;
+
+   auto &entries = _impl->table().entries;
+
+   const std::uint64_t mine = pack_entry(_impl->pid, drm_minor);
+
+   // Start at pid dependent position, so processes don't fight over first entries
+   const unsigned start = unsigned(_impl->pid) % MaxAssignments;
+
+   for (unsigned n = 0; n < MaxAssignments; ++n)
+   {
+      unsigned i = (start + n) % MaxAssignments;
+
+      std::uint64_t e = entries[i].load(std::memory_order_relaxed);
+
+      if (e != 0 && !_impl->reclaim_if_dead(entries[i], e))
+         continue;
+
+      e = 0;
+
+      if (entries[i].compare_exchange_strong(e, mine, std::memory_order_acq_rel))
+      {
+         assignment._owner = _impl;
+         assignment._minor = drm_minor;
+         assignment._entry = i;
+
+         return assignment;
+      }
+   }
+
+   counters().full.add();
+
+   return assignment;
+}
+
+unsigned DeviceAssignmentTable::active_displays(unsigned drm_minor) const
+{
+   if (!ok())
+      return 0;
+
+   unsigned count = 0;
+
+   for (const auto &entry : _impl->table().entries)
+   {
+      std::uint64_t e = entry.load(std::memory_order_relaxed);
+
+      count += e != 0 && entry_minor(e) == drm_minor;
+   }
+
+   return count;
+}
+
+unsigned DeviceAssignmentTable::reclaim_dead() const
+{
+   if (!ok())
+      return 0;
+
+   unsigned count = 0;
+
+   for (auto &entry : _impl->table().entries)
+      count += _impl->reclaim_if_dead(entry, entry.load(std::memory_order_relaxed));
+
+   return count;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Balanced display creation
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+EGLDisplay create_headless_display(DeviceAssignmentTable &table, DeviceAssignment &assignment,
+                                   DrmNodeUsage node_usage)
+{
+   assignment.release();
+
+   if (!table.ok())
+      return create_headless_display(node_usage);
+
+   if (!BeheadEGL::ensure_client_extensions())
+      return EGL_NO_DISPLAY;
+
+   try
+   {
+      const auto infos = BeheadEGL::query_device_infos();
+      const auto ranked = BeheadEGL::rank_display_devices(infos);
+
+      struct Candidate
+      {
+         const DeviceEXT_Info *info;
+         unsigned drm_minor;
+         unsigned load;
+      };
+
+      std::vector<Candidate> candidates;
+
+      table.reclaim_dead();
+
+      for (const auto *info : ranked)
+      {
+         unsigned drm_minor = 0;
+
+         if (!internal::query_drm_minor(info->drm_path, drm_minor))
+            continue;
+
+         candidates.push_back({ info, drm_minor, table.active_displays(drm_minor) });
+      }
+
+      if (candidates.empty())
+      {
+         // ERROR
+         std::cerr << "Couldn't find suitable EGLDeviceEXT" << std::endl;
+         return EGL_NO_DISPLAY;
+      }
+
+      // Least loaded first, stable keeps preference order on ties
+      std::stable_sort(candidates.begin(), candidates.end(),
+                       [] (const Candidate &a, const Candidate &b) { return a.load < b.load; });
+
+      internal::DisplayCreationStrategy strategy(node_usage);
+
+      for (const auto &c : candidates)
+      {
+         try
+         {
+            // NB: Record first, so concurrent pickers see it as soon as possible
+            DeviceAssignment a = table.assign(c.drm_minor);
+
+            auto nodes = internal::open_drm_nodes(c.info->drm_path, strategy.get_open_flag());
+
+            EGLDisplay dpy = BeheadEGL::create_display_on_nodes(nodes, node_usage,
+                                                                c.info->egl_device_ext);
+
+            if (dpy != EGL_NO_DISPLAY)
+            {
+               assignment = std::move(a);
+               return dpy;
+            }
+         }
+         catch (const runtime_error &e)
+         {
+            // WARNING
+            std::cerr << "Failed to create EGLDisplay" << std::endl;
+            std::cerr << e.what() << std::endl;
+         }
+      }
+   }
+   catch (const runtime_egl_error &e)
+   {
+      // WARNING
+      std::cerr << "Couldn't query any device capabilities" << std::endl;
+      std::cerr << e.what() << " (EGLError: " << e.egl_error << ")" << std::endl;
+   }
+   catch (...)
+   {
+      assert(false && "Leaked exception");
+   }
+
+   return EGL_NO_DISPLAY;
+}
+
+} // namespace behead_egl
@@ -4,14 +4,20 @@
  */
 #include "bhd/behead_egl.hh"
 
+#include "behead_egl_impl.hh"
+#include "display_strategy.hh"
+#include "egl_trace.hh"
 #include "minidrm.hh"
-#include "tokenize_sv.hh"
+#include "parked_displays.hh"
 
+#include <algorithm>
 #include <atomic>
 #include <cassert>
+#include <cstdio>
 #include <mutex>
 #include <optional>
 #include <stdexcept>
+#include <utility>
 #include <vector>
 
 #include <iostream>
@@ -28,41 +34,13 @@
 namespace bhdi = behead_egl::internal;
 namespace bhd = behead_egl;
 
-namespace {
-
-bool has_extension(std::string_view extensions, std::string_view ext) noexcept
-{
-   using bhdi::foreach_token_sv;
-
-   bool ext_found = false;
-
-   // XXX: strstr() + strlen() + check for ' ' or '\0' at after token
-   // reads memory once, this does it twice.
-   // Ie. oldschool C approach is better slightly beterr, but i don't care.
-   foreach_token_sv(extensions, ' ', [=, &ext_found] (auto checked) mutable {
-       ext_found = (ext == checked);
-       return ext_found;
-   });
-
-   return ext_found;
-}
-
-using list_sv = std::initializer_list<std::string_view>;
-
-bool has_all_extensions(std::string_view ext_str, list_sv extensions) noexcept
-{
-   bool all_ext = true;
+using bhdi::has_extension;
+using bhdi::has_all_extensions;
+using bhdi::set_egl_proc;
+using bhdi::all;
+using bhdi::list_sv;
 
-   // NB: brute-force O(n*m)
-   for (auto e : extensions)
-   {
-      all_ext = all_ext && has_extension(ext_str, e);
-
-      if (!all_ext) break;
-   }
-
-   return all_ext;
-}
+namespace {
 
 void debug_report_first_missing(std::string_view ext_str, list_sv ext_list)
 {
@@ -78,35 +56,14 @@ void debug_report_first_missing(std::string_view ext_str, list_sv ext_list)
 #endif
 }
 
-struct runtime_egl_error : public std::runtime_error
-{
-   template <typename... ArgsTy_>
-   runtime_egl_error(ArgsTy_... args):
-      std::runtime_error(args...), egl_error(eglGetError()) {}
-
-   EGLint egl_error;
-};
-
 using std::runtime_error;
 
-template <typename FnTy_>
-bool set_egl_proc(FnTy_ &fn, const char *proc_name)
-{
-   fn = reinterpret_cast<FnTy_>((void*)eglGetProcAddress(proc_name));
-   return fn != nullptr;
-}
-
-template <typename...Args>
-inline bool all(Args... args)
-{
-   return (... && args);
-}
-
 } // namespace anonymous
 
 using bhd::DeviceEXT_Info;
-using VecDevEXT = std::vector<EGLDeviceEXT>;
-using VecDevInfos = std::vector<DeviceEXT_Info>;
+using bhdi::runtime_egl_error;
+using bhdi::VecDevEXT;
+using bhdi::VecDevInfos;
 
 // This selects the first found CUDA device that supports EGL_EXT_device_drm
 // If not found first non-CUDA device with EGL_EXT_device_drm
@@ -123,6 +80,10 @@ pick_display_device_ext(const VecDevInfos &device_infos)
 
    for (const auto &cap : device_infos)
    {
+      // Devices that were reset aren't picked anymore
+      if (cap.marked_unhealthy)
+         continue;
+
       // Count as CUDA device
       if (cap.has_NV_device_cuda && cap.has_EXT_device_drm)
       {
@@ -159,113 +120,16 @@ pick_display_device_ext(const VecDevInfos &device_infos)
 
 namespace behead_egl::internal {
 
-struct DisplayCreationStrategy
-{
-   explicit DisplayCreationStrategy(DrmNodeUsage usage) noexcept:
-     _node_usage(usage) {}
-
-   DrmNodeFlag get_open_flag() const;
-
-   bool has_fallback() const;
-
-   DrmNodeFlag node_flag() const;
-   DrmNodeFlag fallback_node_flag() const;
-
-   unique_fd take_node_fd(DrmNodeFds& fds) const;
-   unique_fd take_fallback_node_fd(DrmNodeFds& fds) const;
-
-private:
-   const DrmNodeUsage _node_usage;
-};
-
-struct BeheadEGL final
-{
-   // Public API
-   static bool check_support();
-
-   static EGLDisplay create_headless_display(DrmNodeUsage node_usage);
-
-   static bool enumerate_display_devices(const device_enumeration_cb_t &cb, EnumerateOpt opt);
-
-   static DeviceEXT_Info get_display_device_info(EGLDisplay dpy);
-
-public:
-   // NB: This is not class, it is a module.
-   // It's declared as class for convinience of providing scope for EGL extension
-   // functions.
-
-   BeheadEGL() = delete;
-   ~BeheadEGL() = delete;
-
-   BeheadEGL(const BeheadEGL &) = delete;
-   BeheadEGL(BeheadEGL &&) = delete;
-
-   BeheadEGL operator=(const BeheadEGL &) = delete;
-   BeheadEGL operator=(BeheadEGL &&) = delete;
-private:
-   // {{{ EGL extension functions setup
-
-   // NB: Called only with _do_init_egl_client_procs once_flag
-   static void _do_init_egl_client_procs(bool (*_assert_caller)());
-
-   static bool _ensure_client_extensions();
-
-   // }}}
-
-   /// {{{ EGLDeviceEXT enumeration and extensions query
-
-   static VecDevEXT _enumerate_devices_ext();
-
-   static DeviceEXT_Info _query_device_info(EGLDeviceEXT dev_ext);
-
-   static VecDevInfos _collect_device_ext_infos(const VecDevEXT &devices);
-
-   /// }}}
-
-   // Creates platform_device EGLDisplay using file descriptor for device dev
-   //
-   // may throw runtime_egl_error
-   static EGLDisplay _create_platform_device_display_fd(const unique_fd &fd, EGLDeviceEXT dev);
-
-   static EGLDisplay _create_display_fd(const unique_fd &fd, DrmNodeFlag node, EGLDeviceEXT dev);
-
-private:
-   // Protects EGL extension function pointers
-   static inline std::once_flag _client_egl_procs_flag;
-
-   // Since we also assert on this variable in debug mode, some of our static functions
-   // wouldn't be thread-safe.
-   static inline std::atomic_bool _client_procs_ok = false;
-
-   // EXT_device_enumeration
-   static inline PFNEGLQUERYDEVICESEXTPROC _eglQueryDevicesEXT = nullptr;
-
-   // EXT_device_query
-   static inline PFNEGLQUERYDEVICEATTRIBEXTPROC _eglQueryDeviceAttribEXT = nullptr;
-   static inline PFNEGLQUERYDEVICESTRINGEXTPROC _eglQueryDeviceStringEXT = nullptr;
-   static inline PFNEGLQUERYDISPLAYATTRIBEXTPROC _eglQueryDisplayAttribEXT = nullptr;
-
-   // EGL_EXT_platform_base
-   static inline PFNEGLGETPLATFORMDISPLAYEXTPROC _eglGetPlatformDisplayEXT = nullptr;
-
-   // EGL client extensions that are mandatory for us.
-   inline static const list_sv EXT_CLIENT_REQUIRED = {
-      "EGL_EXT_platform_base",
-      "EGL_EXT_device_base",
-      "EGL_EXT_device_query",
-      "EGL_EXT_device_enumeration",
-      "EGL_EXT_platform_device",
-   };
-};
-
 void BeheadEGL::_do_init_egl_client_procs(bool (*_assert_caller)())
 {
    assert(_assert_caller == &_ensure_client_extensions);
    (void) _assert_caller;
 
+   bool tracing = egl_trace_start();
+
    // Check if world is happy place and we talk to EGL 1.5 or better
    // and we can query client extensions.
-   const char *client_extensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+   const char *client_extensions = traced_query_string(EGL_NO_DISPLAY, EGL_EXTENSIONS);
 
    // We can't obtain extensions EGL client extension
    if (client_extensions == nullptr)
@@ -295,6 +159,19 @@ void BeheadEGL::_do_init_egl_client_procs(bool (*_assert_caller)())
 #undef _egl_proc
    );
 
+   if (ok && tracing)
+   {
+      egl_trace_hook(_eglQueryDevicesEXT, _eglQueryDeviceAttribEXT, _eglQueryDeviceStringEXT,
+                     _eglQueryDisplayAttribEXT, _eglGetPlatformDisplayEXT);
+   }
+
+   // Optional ones
+   if (has_extension(client_extensions, "EGL_KHR_debug"))
+      set_egl_proc(_eglDebugMessageControlKHR, "eglDebugMessageControlKHR");
+
+   // NB: Device extension, checked per device
+   set_egl_proc(_eglQueryDeviceBinaryEXT, "eglQueryDeviceBinaryEXT");
+
    // we carry dependency one _set_egl_proc stores
    _client_procs_ok.store(ok, std::memory_order_release);
 }
@@ -314,7 +191,7 @@ bool BeheadEGL::_ensure_client_extensions()
    return _client_procs_ok.load(std::memory_order_acquire);
 }
 
-VecDevEXT BeheadEGL::_enumerate_devices_ext()
+VecDevEXT BeheadEGL::_enumerate_devices_ext(std::pmr::memory_resource *mr)
 {
    assert(_client_procs_ok); // NB: mo:acquire would suffice
 
@@ -331,7 +208,7 @@ VecDevEXT BeheadEGL::_enumerate_devices_ext()
       throw std::runtime_error("No available EGLDeviceEXT's ");
 
    // Allocate space for devices
-   VecDevEXT devices_ext{std::size_t(num_devices), nullptr};
+   VecDevEXT devices_ext(std::size_t(num_devices), nullptr, mr);
 
    if (_eglQueryDevicesEXT(devices_ext.size(), devices_ext.data(), &num_devices) != EGL_TRUE)
        throw runtime_egl_error("Failed to enumerate available EGLDeviceEXT.");
@@ -373,6 +250,8 @@ DeviceEXT_Info BeheadEGL::_query_device_info(EGLDeviceEXT dev_ext)
       info.drm_path = drm_path;
    }
 
+   info.marked_unhealthy = _is_device_unhealthy(dev_ext);
+
    if (info.has_NV_device_cuda)
    {
       int cuda_id = -1;
@@ -388,9 +267,68 @@ DeviceEXT_Info BeheadEGL::_query_device_info(EGLDeviceEXT dev_ext)
    return info;
 }
 
-VecDevInfos BeheadEGL::_collect_device_ext_infos(const VecDevEXT &devices)
+bool BeheadEGL::_format_persistent_id(const DeviceEXT_Info &info, char (&id)[128]) noexcept
 {
-   VecDevInfos device_infos;
+   // NB: id is large enough for "uuid:" and 16 bytes in hex, or sysfs bus id
+   bool found = false;
+
+   if (_eglQueryDeviceBinaryEXT != nullptr
+       && has_extension(info.device_extensions, "EGL_EXT_device_persistent_id"))
+   {
+      unsigned char uuid[16];
+      EGLint size = 0;
+
+      if (_eglQueryDeviceBinaryEXT(info.egl_device_ext, EGL_DEVICE_UUID_EXT,
+                                   sizeof(uuid), uuid, &size) == EGL_TRUE
+          && size == sizeof(uuid))
+      {
+         char *p = id + std::snprintf(id, sizeof(id), "uuid:");
+
+         for (unsigned char byte : uuid)
+            p += std::snprintf(p, 3, "%02x", byte);
+
+         found = true;
+      }
+   }
+
+   if (!found && info.has_EXT_device_drm)
+      found = query_drm_bus_id(info.drm_path, id, sizeof(id));
+
+   return found;
+}
+
+const char *BeheadEGL::_query_persistent_id(const DeviceEXT_Info &info)
+{
+   char id[128];
+
+   if (!_format_persistent_id(info, id))
+      return nullptr;
+
+   std::lock_guard guard{_persistent_ids_lock};
+
+   // NB: Lookup first, known ids don't allocate
+   auto it = _persistent_ids.find(std::string_view(id));
+
+   if (it == _persistent_ids.end())
+      it = _persistent_ids.emplace(id).first;
+
+   return it->c_str();
+}
+
+const char *BeheadEGL::query_persistent_id(const DeviceEXT_Info &info)
+{
+   if (!_ensure_client_extensions())
+      return nullptr;
+
+   return _query_persistent_id(info);
+}
+
+VecDevInfos BeheadEGL::_collect_device_ext_infos(const VecDevEXT &devices,
+                                                 std::pmr::memory_resource *mr)
+{
+   VecDevInfos device_infos(mr);
+
+   device_infos.reserve(devices.size());
 
    unsigned count = 0;
 
@@ -441,11 +379,29 @@ BeheadEGL::_create_platform_device_display_fd(const unique_fd& fd, EGLDeviceEXT
    return dpy;
 }
 
+EGLDisplay BeheadEGL::_create_platform_device_display(EGLDeviceEXT dev)
+{
+   assert(_client_procs_ok);
+   assert(dev != nullptr);
+
+   EGLDisplay dpy = _eglGetPlatformDisplayEXT(EGL_PLATFORM_DEVICE_EXT, dev, nullptr);
+
+   if (dpy == EGL_NO_DISPLAY)
+      throw runtime_egl_error("Failed to create platform display.");
+
+   return dpy;
+}
+
 bool BeheadEGL::check_support()
 {
    try
    {
-      return _ensure_client_extensions();
+      if (!_ensure_client_extensions())
+         return false;
+
+      prewarm_from_env();
+
+      return true;
    }
    catch (...)
    {
@@ -456,22 +412,23 @@ bool BeheadEGL::check_support()
    return false;
 }
 
-EGLDisplay BeheadEGL::create_headless_display(DrmNodeUsage node_usage)
+EGLDisplay BeheadEGL::create_headless_display(DrmNodeUsage node_usage, EnumerateOpt candidates,
+                                              std::pmr::memory_resource *mr)
 {
    if (!_ensure_client_extensions())
        return EGL_NO_DISPLAY;
 
-   VecDevEXT devices;
-   VecDevInfos device_infos;
+   VecDevEXT devices(mr);
+   VecDevInfos device_infos(mr);
 
    try
    {
       // Enumerate all EGLDeviceEXT
       // see EXT_device_enumeration
-      devices = _enumerate_devices_ext();
+      devices = _enumerate_devices_ext(mr);
 
       // Collect capabilites of those devices
-      device_infos = _collect_device_ext_infos(devices);
+      device_infos = _collect_device_ext_infos(devices, mr);
    }
    catch (const runtime_egl_error &e)
    {
@@ -487,6 +444,18 @@ EGLDisplay BeheadEGL::create_headless_display(DrmNodeUsage node_usage)
       return EGL_NO_DISPLAY;
    }
 
+   // Skip devices whose nodes we aren't permitted to open, before picking,
+   // so we don't pick one just to fail opening it
+   if (candidates == EnumerateOpt::Accessible)
+   {
+      const DrmNodeFlag nodes = DisplayCreationStrategy(node_usage).get_open_flag();
+      const unique_fd drm_dir = open_drm_dir();
+
+      device_infos.erase(std::remove_if(device_infos.begin(), device_infos.end(), [&] (const DeviceEXT_Info &info) {
+         return info.has_EXT_device_drm && !drm_nodes_accessible(drm_dir.get(), info.drm_path, nodes);
+      }), device_infos.end());
+   }
+
    const DeviceEXT_Info *picked = pick_display_device_ext(device_infos);
 
    if (picked == nullptr)
@@ -496,44 +465,206 @@ EGLDisplay BeheadEGL::create_headless_display(DrmNodeUsage node_usage)
       return EGL_NO_DISPLAY;
    }
 
-   EGLDisplay dpy = EGL_NO_DISPLAY;
-
    EGLDeviceEXT device = picked->egl_device_ext;
 
    assert(device);
 
+   if (EGLDisplay dpy = take_parked_display(device, node_usage); dpy != EGL_NO_DISPLAY)
+      return dpy;
+
    try
    {
       DisplayCreationStrategy strategy(node_usage);
 
       auto nodes = open_drm_nodes(picked->drm_path, strategy.get_open_flag());
 
-      // Take primary or render node fd, depending on strategy
-      auto node_fd = strategy.take_node_fd(nodes);
+      return create_display_on_nodes(nodes, node_usage, device);
+   }
+   catch (const runtime_error &e)
+   {
+      std::cerr << "Failed to create EGLDisplay" << std::endl;
+      std::cerr << e.what() << std::endl;
+   }
+
+   return EGL_NO_DISPLAY;
+}
+
+EGLDisplay BeheadEGL::create_device_display(const DeviceEXT_Info &info, DrmNodeUsage node_usage)
+{
+   if (!_ensure_client_extensions())
+       return EGL_NO_DISPLAY;
 
-      // Try create display for node
-      dpy = _create_display_fd(node_fd, strategy.node_flag(), device);
+   if (info.egl_device_ext == nullptr)
+      return EGL_NO_DISPLAY;
 
-      if (dpy != EGL_NO_DISPLAY)
-         return dpy;
+   if (EGLDisplay dpy = take_parked_display(info.egl_device_ext, node_usage); dpy != EGL_NO_DISPLAY)
+      return dpy;
 
-      // Try fallback node if strategy requires it
-      if (strategy.has_fallback())
+   try
+   {
+      if (info.has_EXT_device_drm)
       {
-         auto fallback_node_fd = strategy.take_node_fd(nodes);
+         DisplayCreationStrategy strategy(node_usage);
 
-         dpy = _create_display_fd(fallback_node_fd, strategy.fallback_node_flag(), device);
+         auto nodes = open_drm_nodes(info.drm_path, strategy.get_open_flag());
 
-         if (dpy != EGL_NO_DISPLAY)
-            return dpy;
+         return create_display_on_nodes(nodes, node_usage, info.egl_device_ext);
       }
+
+      // Software rasterizer, there are no nodes to open
+      if (info.has_MESA_device_software)
+         return _create_platform_device_display(info.egl_device_ext);
+   }
+   catch (const runtime_egl_error &e)
+   {
+      // WARNING
+      std::cerr << "Failed to create EGLDisplay" << std::endl;
+      std::cerr << e.what() << " (EGLError: " << e.egl_error << ")" << std::endl;
+      return EGL_NO_DISPLAY;
    }
    catch (const runtime_error &e)
    {
       std::cerr << "Failed to create EGLDisplay" << std::endl;
       std::cerr << e.what() << std::endl;
+      return EGL_NO_DISPLAY;
+   }
+
+   // ERROR
+   std::cerr << "EGLDeviceEXT is neither drm nor software device" << std::endl;
+
+   return EGL_NO_DISPLAY;
+}
+
+EGLDisplay BeheadEGL::create_persistent_id_display(std::string_view persistent_id,
+                                                   DrmNodeUsage node_usage)
+{
+   if (!_ensure_client_extensions())
+       return EGL_NO_DISPLAY;
+
+   VecDevInfos device_infos;
+
+   try
+   {
+      device_infos = query_device_infos();
+   }
+   catch (const runtime_egl_error &e)
+   {
+      // WARNING
+      std::cerr << "Couldn't query any device capabilities" << std::endl;
+      std::cerr << e.what() << " (EGLError: " << e.egl_error << ")" << std::endl;
+      return EGL_NO_DISPLAY;
+   }
+
+   char id[128];
+
+   // NB: Ids are resolved only here, enumeration doesn't pay for them
+   for (const auto &info : device_infos)
+   {
+      if (_format_persistent_id(info, id) && id == persistent_id)
+         return create_device_display(info, node_usage);
    }
 
+   // ERROR
+   std::cerr << "Couldn't find EGLDeviceEXT with id " << persistent_id << std::endl;
+
+   return EGL_NO_DISPLAY;
+}
+
+EGLDisplay BeheadEGL::create_display_on_nodes(DrmNodeFds &nodes, DrmNodeUsage node_usage,
+                                              EGLDeviceEXT device)
+{
+   DisplayCreationStrategy strategy(node_usage);
+
+   // Take primary or render node fd, depending on strategy
+   auto node_fd = strategy.take_node_fd(nodes);
+
+   // Try create display for node
+   EGLDisplay dpy = _create_display_fd(node_fd, strategy.node_flag(), device);
+
+   if (dpy != EGL_NO_DISPLAY)
+      return dpy;
+
+   // Try fallback node if strategy requires it
+   if (strategy.has_fallback())
+   {
+      auto fallback_node_fd = strategy.take_fallback_node_fd(nodes);
+
+      dpy = _create_display_fd(fallback_node_fd, strategy.fallback_node_flag(), device);
+   }
+
+   return dpy;
+}
+
+VecDevInfos BeheadEGL::query_device_infos(std::pmr::memory_resource *mr)
+{
+   assert(_client_procs_ok);
+
+   return _collect_device_ext_infos(_enumerate_devices_ext(mr), mr);
+}
+
+VecDevInfoPtrs BeheadEGL::rank_display_devices(const VecDevInfos &infos)
+{
+   VecDevInfoPtrs ranked(infos.get_allocator());
+
+   ranked.reserve(infos.size());
+
+   // NB: Keep in sync with pick_display_device_ext()
+   for (const auto &info : infos)
+   {
+      if (info.has_NV_device_cuda && info.has_EXT_device_drm && !info.marked_unhealthy)
+         ranked.push_back(&info);
+   }
+
+   for (const auto &info : infos)
+   {
+      if (!info.has_NV_device_cuda && info.has_EXT_device_drm && !info.marked_unhealthy)
+         ranked.push_back(&info);
+   }
+
+   assert(ranked.empty() || ranked.front() == pick_display_device_ext(infos));
+
+   return ranked;
+}
+
+EGLDisplay BeheadEGL::create_headless_display_fd(unique_fd drm_fd, std::pmr::memory_resource *mr)
+{
+   if (!drm_fd.ok())
+      return EGL_NO_DISPLAY;
+
+   if (!_ensure_client_extensions())
+       return EGL_NO_DISPLAY;
+
+   VecDevInfos device_infos(mr);
+
+   try
+   {
+      device_infos = _collect_device_ext_infos(_enumerate_devices_ext(mr), mr);
+   }
+   catch (const runtime_egl_error &e)
+   {
+      // WARNING
+      std::cerr << "Couldn't query any device capabilities" << std::endl;
+      std::cerr << e.what() << " (EGLError: " << e.egl_error << ")" << std::endl;
+      return EGL_NO_DISPLAY;
+   }
+
+   // Find EGLDeviceEXT that owns node drm_fd refers to
+   for (const auto &info : device_infos)
+   {
+      if (!info.has_EXT_device_drm)
+         continue;
+
+      DrmNodeFlag node = match_drm_node(drm_fd.get(), info.drm_path);
+
+      if (node == DrmNodeFlag::None)
+         continue;
+
+      return _create_display_fd(drm_fd, node, info.egl_device_ext);
+   }
+
+   // ERROR
+   std::cerr << "Couldn't find EGLDeviceEXT for drm file descriptor" << std::endl;
+
    return EGL_NO_DISPLAY;
 }
 
@@ -565,7 +696,8 @@ EGLDisplay BeheadEGL::_create_display_fd(const unique_fd &fd, DrmNodeFlag node,
    return dpy;
 }
 
-bool BeheadEGL::enumerate_display_devices(const device_enumeration_cb_t &cb, EnumerateOpt opt)
+bool BeheadEGL::enumerate_display_devices(const device_enumeration_cb_t &cb, EnumerateOpt opt,
+                                          std::pmr::memory_resource *mr)
 {
    assert(!!cb);
 
@@ -574,13 +706,23 @@ bool BeheadEGL::enumerate_display_devices(const device_enumeration_cb_t &cb, Enu
 
    try
    {
-       const auto devices = _enumerate_devices_ext();
-       const auto infos = _collect_device_ext_infos(devices);
+       const auto devices = _enumerate_devices_ext(mr);
+       const auto infos = _collect_device_ext_infos(devices, mr);
+
+       const DrmNodeFlag nodes = DisplayCreationStrategy(DefaultDrmNodeUsage).get_open_flag();
+
+       // NB: Opened only when asked, other modes don't touch drm directory
+       const unique_fd drm_dir = opt == EnumerateOpt::Accessible ? open_drm_dir() : unique_fd{};
 
        for (const auto &nfo : infos)
        {
-          if (opt == EnumerateOpt::All || nfo.has_EXT_device_drm)
-             cb(nfo);
+          if (opt != EnumerateOpt::All && !nfo.has_EXT_device_drm)
+             continue;
+
+          if (opt == EnumerateOpt::Accessible && !drm_nodes_accessible(drm_dir.get(), nfo.drm_path, nodes))
+             continue;
+
+          cb(nfo);
        }
 
        return true;
@@ -625,6 +767,25 @@ DeviceEXT_Info BeheadEGL::get_display_device_info(EGLDisplay dpy)
    return ret;
 }
 
+void BeheadEGL::mark_device_unhealthy(EGLDeviceEXT dev, bool unhealthy)
+{
+   std::lock_guard guard{_unhealthy_lock};
+
+   auto it = std::find(_unhealthy_devices.begin(), _unhealthy_devices.end(), dev);
+
+   if (unhealthy && it == _unhealthy_devices.end())
+      _unhealthy_devices.push_back(dev);
+   else if (!unhealthy && it != _unhealthy_devices.end())
+      _unhealthy_devices.erase(it);
+}
+
+bool BeheadEGL::_is_device_unhealthy(EGLDeviceEXT dev)
+{
+   std::lock_guard guard{_unhealthy_lock};
+
+   return std::find(_unhealthy_devices.begin(), _unhealthy_devices.end(), dev) != _unhealthy_devices.end();
+}
+
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 // DisplayCreationStrategy implementation
@@ -785,9 +946,23 @@ bool check_headless_display_support()
 
 EGLDisplay create_headless_display(DrmNodeUsage node_usage)
 {
+   return create_headless_display(node_usage, std::pmr::get_default_resource());
+}
+
+EGLDisplay create_headless_display(DrmNodeUsage node_usage, std::pmr::memory_resource *mr)
+{
+   return create_headless_display(node_usage, EnumerateOpt::Usable, mr);
+}
+
+EGLDisplay create_headless_display(DrmNodeUsage node_usage, EnumerateOpt candidates,
+                                   std::pmr::memory_resource *mr)
+{
+   if (mr == nullptr)
+      mr = std::pmr::get_default_resource();
+
    try
    {
-      return BeheadEGL::create_headless_display(node_usage);
+      return BeheadEGL::create_headless_display(node_usage, candidates, mr);
    }
    catch (const runtime_egl_error &e)
    {
@@ -801,14 +976,95 @@ EGLDisplay create_headless_display(DrmNodeUsage node_usage)
    return EGL_NO_DISPLAY;
 }
 
+EGLDisplay create_headless_display(int drm_fd)
+{
+   return create_headless_display(drm_fd, std::pmr::get_default_resource());
+}
+
+EGLDisplay create_headless_display(int drm_fd, std::pmr::memory_resource *mr)
+{
+   // NB: Take ownership first, so it is closed on every path
+   bhdi::unique_fd fd{drm_fd};
+
+   if (mr == nullptr)
+      mr = std::pmr::get_default_resource();
+
+   try
+   {
+      return BeheadEGL::create_headless_display_fd(std::move(fd), mr);
+   }
+   catch (...)
+   {
+      assert(false && "Leaked exception");
+   }
+
+   return EGL_NO_DISPLAY;
+}
+
+EGLDisplay create_headless_display(const DeviceEXT_Info &device, DrmNodeUsage node_usage)
+{
+   try
+   {
+      return BeheadEGL::create_device_display(device, node_usage);
+   }
+   catch (...)
+   {
+      assert(false && "Leaked exception");
+   }
+
+   return EGL_NO_DISPLAY;
+}
+
+EGLDisplay create_headless_display(std::string_view persistent_id, DrmNodeUsage node_usage)
+{
+   try
+   {
+      return BeheadEGL::create_persistent_id_display(persistent_id, node_usage);
+   }
+   catch (...)
+   {
+      assert(false && "Leaked exception");
+   }
+
+   return EGL_NO_DISPLAY;
+}
+
+const char *query_device_persistent_id(const DeviceEXT_Info &device)
+{
+   try
+   {
+      return BeheadEGL::query_persistent_id(device);
+   }
+   catch (const std::bad_alloc &)
+   {
+      // ERROR
+      std::cerr << "Out of memory interning device id" << std::endl;
+   }
+   catch (...)
+   {
+      assert(false && "Leaked exception");
+   }
+
+   return nullptr;
+}
+
 bool enumerate_display_devices(const device_enumeration_cb_t &cb, EnumerateOpt opt)
+{
+   return enumerate_display_devices(cb, opt, std::pmr::get_default_resource());
+}
+
+bool enumerate_display_devices(const device_enumeration_cb_t &cb, EnumerateOpt opt,
+                               std::pmr::memory_resource *mr)
 {
    if (!cb)
       return false;
 
+   if (mr == nullptr)
+      mr = std::pmr::get_default_resource();
+
    try
    {
-      return BeheadEGL::enumerate_display_devices(cb, opt);
+      return BeheadEGL::enumerate_display_devices(cb, opt, mr);
    }
    catch (...)
    {
@@ -818,6 +1074,21 @@ bool enumerate_display_devices(const device_enumeration_cb_t &cb, EnumerateOpt o
    return false;
 }
 
+void mark_device_unhealthy(EGLDeviceEXT dev, bool unhealthy)
+{
+   if (dev == nullptr)
+      return;
+
+   try
+   {
+      BeheadEGL::mark_device_unhealthy(dev, unhealthy);
+   }
+   catch (...)
+   {
+      assert(false && "Leaked exception");
+   }
+}
+
 DeviceEXT_Info get_initialized_display_device_info(EGLDisplay dpy)
 {
    try
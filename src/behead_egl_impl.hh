@@ -0,0 +1,232 @@
+/*
+ * SPDX-FileCopyrightText: 2020 Piotr Rak <piotr.rak@gamil.com>
+ * SPDX-License-Identifier: MIT
+ */
+#pragma once
+
+#include "bhd/behead_egl.hh"
+
+#include "minidrm.hh"
+#include "tokenize_sv.hh"
+
+#include <atomic>
+#include <initializer_list>
+#include <memory_resource>
+#include <mutex>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace behead_egl::internal {
+
+inline bool has_extension(std::string_view extensions, std::string_view ext) noexcept
+{
+   bool ext_found = false;
+
+   // XXX: strstr() + strlen() + check for ' ' or '\0' at after token
+   // reads memory once, this does it twice.
+   // Ie. oldschool C approach is better slightly beterr, but i don't care.
+   foreach_token_sv(extensions, ' ', [=, &ext_found] (auto checked) mutable {
+       ext_found = (ext == checked);
+       return ext_found;
+   });
+
+   return ext_found;
+}
+
+using list_sv = std::initializer_list<std::string_view>;
+
+inline bool has_all_extensions(std::string_view ext_str, list_sv extensions) noexcept
+{
+   bool all_ext = true;
+
+   // NB: brute-force O(n*m)
+   for (auto e : extensions)
+   {
+      all_ext = all_ext && has_extension(ext_str, e);
+
+      if (!all_ext) break;
+   }
+
+   return all_ext;
+}
+
+template <typename FnTy_>
+bool set_egl_proc(FnTy_ &fn, const char *proc_name)
+{
+   fn = reinterpret_cast<FnTy_>((void*)eglGetProcAddress(proc_name));
+   return fn != nullptr;
+}
+
+template <typename...Args>
+inline bool all(Args... args)
+{
+   return (... && args);
+}
+
+struct runtime_egl_error : public std::runtime_error
+{
+   template <typename... ArgsTy_>
+   runtime_egl_error(ArgsTy_... args):
+      std::runtime_error(args...), egl_error(eglGetError()) {}
+
+   EGLint egl_error;
+};
+
+// NB: pmr, so callers can keep enumeration in their arena
+using VecDevEXT = std::pmr::vector<EGLDeviceEXT>;
+using VecDevInfos = std::pmr::vector<DeviceEXT_Info>;
+using VecDevInfoPtrs = std::pmr::vector<const DeviceEXT_Info *>;
+
+struct BeheadEGL final
+{
+   // Public API
+   static bool check_support();
+
+   static EGLDisplay create_headless_display(DrmNodeUsage node_usage, EnumerateOpt candidates,
+                                             std::pmr::memory_resource *mr);
+
+   static EGLDisplay create_headless_display_fd(unique_fd drm_fd, std::pmr::memory_resource *mr);
+
+   static EGLDisplay create_device_display(const DeviceEXT_Info &info, DrmNodeUsage node_usage);
+
+   static EGLDisplay create_persistent_id_display(std::string_view persistent_id,
+                                                  DrmNodeUsage node_usage);
+
+   static bool enumerate_display_devices(const device_enumeration_cb_t &cb, EnumerateOpt opt,
+                                         std::pmr::memory_resource *mr);
+
+   static DeviceEXT_Info get_display_device_info(EGLDisplay dpy);
+
+   static void mark_device_unhealthy(EGLDeviceEXT dev, bool unhealthy);
+
+   static const char *query_persistent_id(const DeviceEXT_Info &info);
+
+   // {{{ Library internal API, for other modules
+
+   static bool ensure_client_extensions() { return _ensure_client_extensions(); }
+
+   // EGL_KHR_debug entry point, nullptr if client extension isn't advertised
+   static PFNEGLDEBUGMESSAGECONTROLKHRPROC debug_message_control()
+   {
+      return _ensure_client_extensions() ? _eglDebugMessageControlKHR : nullptr;
+   }
+
+   // Enumerates and queries all EGLDeviceEXT
+   //
+   // may throw runtime_egl_error
+   static VecDevInfos query_device_infos(std::pmr::memory_resource *mr = std::pmr::get_default_resource());
+
+   // Devices usable for display creation, most preferred first; unhealthy ones are skipped.
+   // First one is the device create_headless_display() picks.
+   //
+   // NB: Allocated from the same resource as infos
+   static VecDevInfoPtrs rank_display_devices(const VecDevInfos &infos);
+
+   // Creates display on device nodes opened for node_usage,
+   // takes node fds it used from nodes.
+   static EGLDisplay create_display_on_nodes(DrmNodeFds &nodes, DrmNodeUsage node_usage,
+                                             EGLDeviceEXT device);
+
+   // }}}
+
+public:
+   // NB: This is not class, it is a module.
+   // It's declared as class for convinience of providing scope for EGL extension
+   // functions.
+
+   BeheadEGL() = delete;
+   ~BeheadEGL() = delete;
+
+   BeheadEGL(const BeheadEGL &) = delete;
+   BeheadEGL(BeheadEGL &&) = delete;
+
+   BeheadEGL operator=(const BeheadEGL &) = delete;
+   BeheadEGL operator=(BeheadEGL &&) = delete;
+private:
+   // {{{ EGL extension functions setup
+
+   // NB: Called only with _do_init_egl_client_procs once_flag
+   static void _do_init_egl_client_procs(bool (*_assert_caller)());
+
+   static bool _ensure_client_extensions();
+
+   // }}}
+
+   /// {{{ EGLDeviceEXT enumeration and extensions query
+
+   static VecDevEXT _enumerate_devices_ext(std::pmr::memory_resource *mr);
+
+   static DeviceEXT_Info _query_device_info(EGLDeviceEXT dev_ext);
+
+   static VecDevInfos _collect_device_ext_infos(const VecDevEXT &devices, std::pmr::memory_resource *mr);
+
+   static bool _is_device_unhealthy(EGLDeviceEXT dev);
+
+   // Formats id of info into id, false if device has none.
+   // See query_device_persistent_id()
+   static bool _format_persistent_id(const DeviceEXT_Info &info, char (&id)[128]) noexcept;
+
+   // Returns interned id, nullptr if device has none
+   static const char *_query_persistent_id(const DeviceEXT_Info &info);
+
+   /// }}}
+
+   // Creates platform_device EGLDisplay using file descriptor for device dev
+   //
+   // may throw runtime_egl_error
+   static EGLDisplay _create_platform_device_display_fd(const unique_fd &fd, EGLDeviceEXT dev);
+
+   // Same as above for devices without drm nodes (EGL_MESA_device_software)
+   //
+   // may throw runtime_egl_error
+   static EGLDisplay _create_platform_device_display(EGLDeviceEXT dev);
+
+   static EGLDisplay _create_display_fd(const unique_fd &fd, DrmNodeFlag node, EGLDeviceEXT dev);
+
+private:
+   // Protects EGL extension function pointers
+   static inline std::once_flag _client_egl_procs_flag;
+
+   // Since we also assert on this variable in debug mode, some of our static functions
+   // wouldn't be thread-safe.
+   static inline std::atomic_bool _client_procs_ok = false;
+
+   // Devices marked by mark_device_unhealthy()
+   static inline std::mutex _unhealthy_lock;
+   static inline std::vector<EGLDeviceEXT> _unhealthy_devices;
+
+   // EXT_device_enumeration
+   static inline PFNEGLQUERYDEVICESEXTPROC _eglQueryDevicesEXT = nullptr;
+
+   // EXT_device_query
+   static inline PFNEGLQUERYDEVICEATTRIBEXTPROC _eglQueryDeviceAttribEXT = nullptr;
+   static inline PFNEGLQUERYDEVICESTRINGEXTPROC _eglQueryDeviceStringEXT = nullptr;
+   static inline PFNEGLQUERYDISPLAYATTRIBEXTPROC _eglQueryDisplayAttribEXT = nullptr;
+
+   // EGL_EXT_platform_base
+   static inline PFNEGLGETPLATFORMDISPLAYEXTPROC _eglGetPlatformDisplayEXT = nullptr;
+
+   // EGL_KHR_debug, optional
+   static inline PFNEGLDEBUGMESSAGECONTROLKHRPROC _eglDebugMessageControlKHR = nullptr;
+
+   // EGL_EXT_device_persistent_id, optional device extension
+   static inline PFNEGLQUERYDEVICEBINARYEXTPROC _eglQueryDeviceBinaryEXT = nullptr;
+
+   // Ids handed out by query_device_persistent_id(), never freed like EGL strings
+   static inline std::mutex _persistent_ids_lock;
+   static inline std::set<std::string, std::less<>> _persistent_ids;
+
+   // EGL client extensions that are mandatory for us.
+   inline static const list_sv EXT_CLIENT_REQUIRED = {
+      "EGL_EXT_platform_base",
+      "EGL_EXT_device_base",
+      "EGL_EXT_device_query",
+      "EGL_EXT_device_enumeration",
+      "EGL_EXT_platform_device",
+   };
+};
+
+} // namespace behead_egl::internal
@@ -0,0 +1,147 @@
+/*
+ * SPDX-FileCopyrightText: 2020 Piotr Rak <piotr.rak@gamil.com>
+ * SPDX-License-Identifier: MIT
+ */
+#include "bhd/bringup.hh"
+
+#include "behead_egl_impl.hh"
+#include "stats.hh"
+
+#include <cassert>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include <iostream>
+
+namespace bhdi = behead_egl::internal;
+namespace bhd = behead_egl;
+
+namespace {
+
+using std::chrono::steady_clock;
+
+struct Counters
+{
+   bhdi::StatCounter &device = bhdi::stat_counter("bringup.device");
+};
+
+Counters &counters()
+{
+   static Counters c;
+   return c;
+}
+
+// Runs on its own thread, touches only its result
+void bring_up(bhd::DisplayBringup &r, const bhd::BringupOpts &opts)
+{
+   using bhdi::BeheadEGL;
+
+   auto start = steady_clock::now();
+
+   r.dpy = BeheadEGL::create_device_display(r.device, opts.usage);
+
+   auto created = steady_clock::now();
+
+   r.create_time = created - start;
+
+   if (r.dpy != EGL_NO_DISPLAY && opts.initialize)
+   {
+      r.initialized = eglInitialize(r.dpy, &r.major, &r.minor) == EGL_TRUE;
+
+      if (!r.initialized)
+      {
+         r.egl_error = eglGetError();
+
+         // WARNING
+         std::cerr << "Failed to initialize display on " << (r.device.drm_path ? r.device.drm_path : "software device")
+                   << " (EGLError: " << r.egl_error << ")" << std::endl;
+      }
+
+      r.initialize_time = steady_clock::now() - created;
+   }
+
+   counters().device.record(r.create_time + r.initialize_time);
+}
+
+} // namespace anonymous
+
+namespace behead_egl {
+
+std::vector<DisplayBringup> create_headless_displays_all(const BringupOpts &opts)
+{
+   using bhdi::BeheadEGL;
+
+   std::vector<DisplayBringup> results;
+
+   try
+   {
+      if (!BeheadEGL::ensure_client_extensions())
+         return results;
+
+      bhdi::VecDevInfos infos;
+
+      try
+      {
+         infos = BeheadEGL::query_device_infos();
+      }
+      catch (const std::runtime_error &e)
+      {
+         // WARNING
+         std::cerr << "Couldn't query any device capabilities" << std::endl;
+         std::cerr << e.what() << std::endl;
+         return results;
+      }
+
+      for (const auto *info : BeheadEGL::rank_display_devices(infos))
+         results.push_back(DisplayBringup{*info});
+
+      // NB: Same selection as prewarm()
+      if (opts.include_software || results.empty())
+      {
+         for (const auto &info : infos)
+         {
+            if (info.has_MESA_device_software && !info.has_EXT_device_drm && !info.marked_unhealthy)
+               results.push_back(DisplayBringup{info});
+         }
+      }
+
+      if (results.empty())
+         return results;
+
+      std::vector<std::thread> threads;
+
+      threads.reserve(results.size() - 1);
+
+      // NB: Results don't move from now on, each thread writes only its own
+      for (std::size_t i = 1; i < results.size(); ++i)
+      {
+         try
+         {
+            threads.emplace_back([&r = results[i], &opts] {
+               bring_up(r, opts);
+               eglReleaseThread();
+            });
+         }
+         catch (const std::system_error &)
+         {
+            // Out of threads, this one is serial then
+            bring_up(results[i], opts);
+         }
+      }
+
+      // First one on calling thread, it is the one caller is most likely to use
+      bring_up(results.front(), opts);
+
+      for (auto &t : threads)
+         t.join();
+   }
+   catch (...)
+   {
+      assert(false && "Leaked exception");
+   }
+
+   return results;
+}
+
+} // namespace behead_egl
@@ -0,0 +1,239 @@
+/*
+ * SPDX-FileCopyrightText: 2020 Piotr Rak <piotr.rak@gamil.com>
+ * SPDX-License-Identifier: MIT
+ */
+#include "bhd/context.hh"
+
+#include "behead_egl_impl.hh"
+#include "debug_capture_impl.hh"
+#include "display_cache.hh"
+#include "stats.hh"
+
+#include <vector>
+
+#include <iostream>
+
+namespace bhdi = behead_egl::internal;
+namespace bhd = behead_egl;
+
+namespace {
+
+struct Counters
+{
+   bhdi::StatCounter &priority_downgrade = bhdi::stat_counter("context.priority_downgrade");
+};
+
+Counters &counters()
+{
+   static Counters c;
+   return c;
+}
+
+EGLint renderable_bit(const bhd::ContextOpts &opts) noexcept
+{
+   if (opts.api == bhd::ContextApi::OpenGL)
+      return EGL_OPENGL_BIT;
+
+   if (opts.major_version >= 3)
+      return EGL_OPENGL_ES3_BIT;
+
+   return EGL_OPENGL_ES2_BIT;
+}
+
+EGLenum egl_api(const bhd::ContextOpts &opts) noexcept
+{
+   return opts.api == bhd::ContextApi::OpenGL ? EGL_OPENGL_API : EGL_OPENGL_ES_API;
+}
+
+using bhdi::display_has_extension;
+using bhdi::DisplayExt;
+
+EGLint priority_level(bhd::ContextPriority priority) noexcept
+{
+   switch (priority)
+   {
+   case bhd::ContextPriority::Low:
+      return EGL_CONTEXT_PRIORITY_LOW_IMG;
+
+   case bhd::ContextPriority::Medium:
+      [[fallthrough]];
+
+   case bhd::ContextPriority::Default:
+      return EGL_CONTEXT_PRIORITY_MEDIUM_IMG;
+
+   case bhd::ContextPriority::High:
+      return EGL_CONTEXT_PRIORITY_HIGH_IMG;
+   }
+
+   return EGL_CONTEXT_PRIORITY_MEDIUM_IMG;
+}
+
+bhd::ContextPriority from_priority_level(EGLint level) noexcept
+{
+   switch (level)
+   {
+   case EGL_CONTEXT_PRIORITY_LOW_IMG:
+      return bhd::ContextPriority::Low;
+
+   case EGL_CONTEXT_PRIORITY_MEDIUM_IMG:
+      return bhd::ContextPriority::Medium;
+
+   case EGL_CONTEXT_PRIORITY_HIGH_IMG:
+      return bhd::ContextPriority::High;
+   }
+
+   return bhd::ContextPriority::Default;
+}
+
+const char *to_string(bhd::ContextPriority priority) noexcept
+{
+   switch (priority)
+   {
+   case bhd::ContextPriority::Default: return "default";
+   case bhd::ContextPriority::Low:     return "low";
+   case bhd::ContextPriority::Medium:  return "medium";
+   case bhd::ContextPriority::High:    return "high";
+   }
+
+   return "";
+}
+
+} // namespace anonymous
+
+namespace behead_egl
+{
+
+EGLConfig choose_headless_config(EGLDisplay dpy, const ContextOpts &opts)
+{
+   if (dpy == EGL_NO_DISPLAY)
+      return nullptr;
+
+   const EGLint attribs[] = {
+      EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+      EGL_RENDERABLE_TYPE, renderable_bit(opts),
+      EGL_RED_SIZE, 8,
+      EGL_GREEN_SIZE, 8,
+      EGL_BLUE_SIZE, 8,
+      EGL_ALPHA_SIZE, 8,
+      EGL_NONE
+   };
+
+   EGLConfig config = internal::cached_choose_config(dpy, attribs);
+
+   if (config == nullptr)
+   {
+      // ERROR
+      std::cerr << "Failed to choose EGLConfig (EGLError: " << eglGetError() << ")" << std::endl;
+      return nullptr;
+   }
+
+   return config;
+}
+
+EGLContext create_headless_context(EGLDisplay dpy, const ContextOpts &opts)
+{
+   EGLConfig config = choose_headless_config(dpy, opts);
+
+   if (config == nullptr)
+      return EGL_NO_CONTEXT;
+
+   if (eglBindAPI(egl_api(opts)) != EGL_TRUE)
+   {
+      // ERROR
+      std::cerr << "Failed to bind rendering API (EGLError: " << eglGetError() << ")" << std::endl;
+      return EGL_NO_CONTEXT;
+   }
+
+   std::vector<EGLint> attribs = {
+      EGL_CONTEXT_MAJOR_VERSION, opts.major_version,
+      EGL_CONTEXT_MINOR_VERSION, opts.minor_version,
+   };
+
+   if (opts.api == ContextApi::OpenGL)
+   {
+      attribs.push_back(EGL_CONTEXT_OPENGL_PROFILE_MASK);
+      attribs.push_back(EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT);
+   }
+
+   if (opts.robust)
+   {
+      if (display_has_extension(dpy, DisplayExt::EXT_create_context_robustness))
+      {
+         attribs.push_back(EGL_CONTEXT_OPENGL_ROBUST_ACCESS_EXT);
+         attribs.push_back(EGL_TRUE);
+         attribs.push_back(EGL_CONTEXT_OPENGL_RESET_NOTIFICATION_STRATEGY_EXT);
+         attribs.push_back(EGL_LOSE_CONTEXT_ON_RESET_EXT);
+      }
+      else
+      {
+         // WARNING
+         std::cerr << "Robust contexts aren't supported by display" << std::endl;
+      }
+   }
+
+   const bool priority = opts.priority != ContextPriority::Default &&
+                         display_has_extension(dpy, DisplayExt::IMG_context_priority);
+
+   if (priority)
+   {
+      attribs.push_back(EGL_CONTEXT_PRIORITY_LEVEL_IMG);
+      attribs.push_back(priority_level(opts.priority));
+   }
+
+   const bool debug = internal::debug_capture_enabled();
+
+   if (debug)
+   {
+      attribs.push_back(EGL_CONTEXT_OPENGL_DEBUG);
+      attribs.push_back(EGL_TRUE);
+   }
+
+   attribs.push_back(EGL_NONE);
+
+   EGLContext ctx = eglCreateContext(dpy, config, EGL_NO_CONTEXT, attribs.data());
+
+   if (ctx == EGL_NO_CONTEXT)
+   {
+      // ERROR
+      std::cerr << "Failed to create EGLContext (EGLError: " << eglGetError() << ")" << std::endl;
+      return ctx;
+   }
+
+   // NB: Drivers silently fall back to lower priority, ie. without CAP_SYS_NICE.
+   // Display without extension grants Default, that is downgrade as well
+   // (same as RenderScheduler::downgraded_workers() sees it).
+   if (opts.priority != ContextPriority::Default)
+   {
+      ContextPriority granted = priority ? query_context_priority(dpy, ctx) : ContextPriority::Default;
+
+      if (granted < opts.priority)
+      {
+         counters().priority_downgrade.add();
+
+         // WARNING
+         std::cerr << "EGLContext priority " << to_string(opts.priority)
+                   << " requested, got " << to_string(granted)
+                   << (priority ? "" : " (display lacks EGL_IMG_context_priority)") << std::endl;
+      }
+   }
+
+   if (debug)
+      internal::install_debug_output(dpy, ctx);
+
+   return ctx;
+}
+
+ContextPriority query_context_priority(EGLDisplay dpy, EGLContext ctx)
+{
+   if (ctx == EGL_NO_CONTEXT || !display_has_extension(dpy, DisplayExt::IMG_context_priority))
+      return ContextPriority::Default;
+
+   EGLint level = 0;
+
+   if (eglQueryContext(dpy, ctx, EGL_CONTEXT_PRIORITY_LEVEL_IMG, &level) != EGL_TRUE)
+      return ContextPriority::Default;
+
+   return from_priority_level(level);
+}
+
+} // namespace behead_egl
@@ -0,0 +1,404 @@
+/*
+ * SPDX-FileCopyrightText: 2020 Piotr Rak <piotr.rak@gamil.com>
+ * SPDX-License-Identifier: MIT
+ */
+#include "bhd/debug_capture.hh"
+
+#include "behead_egl_impl.hh"
+#include "debug_capture_impl.hh"
+#include "minigl.hh"
+#include "stats.hh"
+
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <iostream>
+
+namespace bhdi = behead_egl::internal;
+namespace bhd = behead_egl;
+
+namespace {
+
+using std::chrono::steady_clock;
+
+struct Counters
+{
+   bhdi::StatCounter &message    = bhdi::stat_counter("debug.message");
+   bhdi::StatCounter &suppressed = bhdi::stat_counter("debug.suppressed");
+   bhdi::StatCounter &dropped    = bhdi::stat_counter("debug.dropped");
+};
+
+Counters &counters()
+{
+   static Counters c;
+   return c;
+}
+
+struct Record
+{
+   bhd::DebugSource source;
+
+   std::uint32_t severity;
+   std::uint32_t type;
+   std::uint32_t id;
+
+   std::int32_t thread_id;
+
+   steady_clock::time_point timestamp;
+
+   char command[48];
+   char text[bhd::DebugMessageMaxLength + 1];
+};
+
+// Single producer (owning thread), single consumer (drain, serialized by lock)
+struct ThreadRing
+{
+   explicit ThreadRing(std::size_t size):
+      slots(size), mask(size - 1), thread_id(std::int32_t(::syscall(SYS_gettid))) {}
+
+   std::vector<Record> slots;
+   const std::size_t mask;
+
+   const std::int32_t thread_id;
+
+   alignas(64) std::atomic<std::uint64_t> head = 0;
+   alignas(64) std::atomic<std::uint64_t> tail = 0;
+
+   // {{{ Rate limit, owner only
+
+   steady_clock::time_point window_start;
+   unsigned in_window = 0;
+
+   // }}}
+};
+
+struct CaptureState
+{
+   // Drain and options
+   std::mutex lock;
+
+   // NB: Separate, so sink may trigger messages of its own.
+   std::mutex rings_lock;
+   std::vector<std::shared_ptr<ThreadRing>> rings;
+
+   bhd::debug_sink_t sink;
+
+   std::atomic<unsigned> ring_size = 256;
+   std::atomic<unsigned> max_per_second = 100;
+
+   bool egl_installed = false;
+};
+
+CaptureState &state()
+{
+   static CaptureState s;
+   return s;
+}
+
+thread_local std::shared_ptr<ThreadRing> t_ring;
+
+std::size_t round_up_pow2(unsigned v) noexcept
+{
+   std::size_t size = 1;
+
+   while (size < v)
+      size <<= 1;
+
+   return size;
+}
+
+ThreadRing &thread_ring()
+{
+   if (!t_ring)
+   {
+      auto &s = state();
+
+      t_ring = std::make_shared<ThreadRing>(round_up_pow2(std::max(s.ring_size.load(), 2u)));
+
+      std::lock_guard guard{s.rings_lock};
+      s.rings.push_back(t_ring);
+   }
+
+   return *t_ring;
+}
+
+void copy_text(char *dst, std::size_t cap, const char *src, std::size_t len) noexcept
+{
+   if (src == nullptr)
+      len = 0;
+
+   len = std::min(len, cap - 1);
+
+   if (len > 0)
+      std::memcpy(dst, src, len);
+
+   dst[len] = '\0';
+}
+
+// Called from debug callbacks, on whatever thread driver reports from
+void record(bhd::DebugSource source, std::uint32_t severity, std::uint32_t type, std::uint32_t id,
+            const char *command, const char *text, std::size_t text_len) noexcept
+{
+   if (!bhdi::debug_capture_enabled())
+      return;
+
+   ThreadRing *ring = nullptr;
+
+   try
+   {
+      ring = &thread_ring();
+   }
+   catch (...)
+   {
+      return;
+   }
+
+   auto now = steady_clock::now();
+
+   if (now - ring->window_start >= std::chrono::seconds(1))
+   {
+      ring->window_start = now;
+      ring->in_window = 0;
+   }
+
+   if (ring->in_window >= state().max_per_second.load(std::memory_order_relaxed))
+   {
+      counters().suppressed.add();
+      return;
+   }
+
+   ++ring->in_window;
+
+   std::uint64_t head = ring->head.load(std::memory_order_relaxed);
+
+   if (head - ring->tail.load(std::memory_order_acquire) > ring->mask)
+   {
+      counters().dropped.add();
+      return;
+   }
+
+   Record &r = ring->slots[head & ring->mask];
+
+   r.source = source;
+   r.severity = severity;
+   r.type = type;
+   r.id = id;
+   r.thread_id = ring->thread_id;
+   r.timestamp = now;
+
+   copy_text(r.command, sizeof(r.command), command, command != nullptr ? std::strlen(command) : 0);
+   copy_text(r.text, sizeof(r.text), text, text_len);
+
+   ring->head.store(head + 1, std::memory_order_release);
+
+   counters().message.add();
+}
+
+void EGLAPIENTRY egl_debug_cb(EGLenum error, const char *command, EGLint message_type,
+                              EGLLabelKHR, EGLLabelKHR, const char *message)
+{
+   record(bhd::DebugSource::EGL, std::uint32_t(message_type), 0, std::uint32_t(error),
+          command, message, message != nullptr ? std::strlen(message) : 0);
+}
+
+void GL_APIENTRY gl_debug_cb(GLenum, GLenum type, GLuint id, GLenum severity,
+                             GLsizei length, const GLchar *message, const void *)
+{
+   std::size_t len = 0;
+
+   if (message != nullptr)
+      len = length >= 0 ? std::size_t(length) : std::strlen(message);
+
+   record(bhd::DebugSource::GL, severity, type, id, nullptr, message, len);
+}
+
+void print_message(const bhd::DebugMessage &m)
+{
+   // WARNING
+   std::cerr << (m.source == bhd::DebugSource::EGL ? "EGL" : "GL")
+             << " debug [" << m.thread_id << "] ";
+
+   if (m.command != nullptr && *m.command != '\0')
+      std::cerr << m.command << ": ";
+
+   std::cerr << m.text << std::endl;
+}
+
+} // namespace anonymous
+
+namespace behead_egl::internal {
+
+std::atomic_bool debug_capture_on = false;
+
+void install_debug_output(EGLDisplay dpy, EGLContext ctx)
+{
+   EGLDisplay prev_dpy = eglGetCurrentDisplay();
+   EGLContext prev_ctx = eglGetCurrentContext();
+   EGLSurface prev_draw = eglGetCurrentSurface(EGL_DRAW);
+   EGLSurface prev_read = eglGetCurrentSurface(EGL_READ);
+
+   // NB: Needs EGL_KHR_surfaceless_context, as create_headless_context() contexts anyway.
+   if (eglMakeCurrent(dpy, EGL_NO_SURFACE, EGL_NO_SURFACE, ctx) != EGL_TRUE)
+   {
+      // WARNING
+      std::cerr << "Failed to make context current to install debug callback (EGLError: "
+                << eglGetError() << ")" << std::endl;
+      return;
+   }
+
+   capture_context_debug_output();
+
+   if (prev_ctx != EGL_NO_CONTEXT)
+      eglMakeCurrent(prev_dpy, prev_draw, prev_read, prev_ctx);
+   else
+      eglMakeCurrent(dpy, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+}
+
+} // namespace behead_egl::internal
+
+namespace behead_egl
+{
+
+bool enable_debug_capture(const DebugCaptureOpts &opts)
+{
+   auto &s = state();
+
+   std::lock_guard guard{s.lock};
+
+   s.sink = opts.sink;
+   s.ring_size.store(opts.ring_size, std::memory_order_relaxed);
+   s.max_per_second.store(opts.max_per_second, std::memory_order_relaxed);
+
+   internal::debug_capture_on.store(true, std::memory_order_release);
+
+   if (auto control = internal::BeheadEGL::debug_message_control(); control != nullptr)
+   {
+      const EGLAttrib attribs[] = {
+         EGL_DEBUG_MSG_CRITICAL_KHR, EGL_TRUE,
+         EGL_DEBUG_MSG_ERROR_KHR, EGL_TRUE,
+         EGL_DEBUG_MSG_WARN_KHR, EGL_TRUE,
+         EGL_DEBUG_MSG_INFO_KHR, EGL_TRUE,
+         EGL_NONE
+      };
+
+      s.egl_installed = control(egl_debug_cb, attribs) == EGL_SUCCESS;
+
+      if (!s.egl_installed)
+      {
+         // WARNING
+         std::cerr << "Failed to install EGL debug callback" << std::endl;
+      }
+   }
+
+   return s.egl_installed;
+}
+
+void disable_debug_capture()
+{
+   auto &s = state();
+
+   std::lock_guard guard{s.lock};
+
+   internal::debug_capture_on.store(false, std::memory_order_release);
+
+   if (s.egl_installed)
+   {
+      if (auto control = internal::BeheadEGL::debug_message_control(); control != nullptr)
+         control(nullptr, nullptr);
+
+      s.egl_installed = false;
+   }
+}
+
+bool capture_context_debug_output()
+{
+   if (!internal::debug_capture_enabled())
+      return false;
+
+   const auto &gl = internal::gl_procs();
+
+   if (!gl.ok || gl.glDebugMessageCallback == nullptr || gl.glDebugMessageControl == nullptr ||
+       !internal::gl_has_extension(gl, "GL_KHR_debug"))
+      return false;
+
+   // NB: By default low severity messages, where slow path warnings usually are, are off.
+   gl.glDebugMessageControl(GL_DONT_CARE, GL_DONT_CARE, GL_DONT_CARE, 0, nullptr, GL_TRUE);
+   gl.glDebugMessageCallback(gl_debug_cb, nullptr);
+   gl.glEnable(GL_DEBUG_OUTPUT);
+
+   return gl.glGetError() == GL_NO_ERROR;
+}
+
+std::size_t drain_debug_messages()
+{
+   auto &s = state();
+
+   std::lock_guard guard{s.lock};
+
+   std::vector<std::shared_ptr<ThreadRing>> rings;
+
+   {
+      std::lock_guard rings_guard{s.rings_lock};
+
+      // Forget rings of exited threads, those were drained last time
+      s.rings.erase(std::remove_if(s.rings.begin(), s.rings.end(), [] (const auto &ring) {
+         return ring.use_count() == 1 &&
+                ring->head.load(std::memory_order_acquire) == ring->tail.load(std::memory_order_relaxed);
+      }), s.rings.end());
+
+      rings = s.rings;
+   }
+
+   std::size_t delivered = 0;
+
+   for (auto &ring : rings)
+   {
+      std::uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+      std::uint64_t head = ring->head.load(std::memory_order_acquire);
+
+      for (; tail != head; ++tail)
+      {
+         const Record &r = ring->slots[tail & ring->mask];
+
+         DebugMessage m;
+
+         m.source = r.source;
+         m.severity = r.severity;
+         m.type = r.type;
+         m.id = r.id;
+         m.text = r.text;
+         m.command = r.command;
+         m.thread_id = r.thread_id;
+         m.timestamp = r.timestamp;
+
+         try
+         {
+            if (s.sink)
+               s.sink(m);
+            else
+               print_message(m);
+         }
+         catch (...)
+         {
+            // WARNING
+            std::cerr << "Debug sink has thrown" << std::endl;
+         }
+
+         ++delivered;
+      }
+
+      ring->tail.store(tail, std::memory_order_release);
+   }
+
+   return delivered;
+}
+
+} // namespace behead_egl
@@ -0,0 +1,27 @@
+/*
+ * SPDX-FileCopyrightText: 2020 Piotr Rak <piotr.rak@gamil.com>
+ * SPDX-License-Identifier: MIT
+ */
+#pragma once
+
+#include "bhd/behead_egl.hh"
+
+#include <atomic>
+
+namespace behead_egl::internal {
+
+// NB: Implemented in debug_capture.cc
+
+extern std::atomic_bool debug_capture_on;
+
+// Cheap check for context creation path
+inline bool debug_capture_enabled() noexcept
+{
+   return debug_capture_on.load(std::memory_order_relaxed);
+}
+
+// Installs GL debug callback on freshly created ctx, restores context
+// current on calling thread afterwards.
+void install_debug_output(EGLDisplay dpy, EGLContext ctx);
+
+} // namespace behead_egl::internal
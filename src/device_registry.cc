@@ -0,0 +1,459 @@
+/*
+ * SPDX-FileCopyrightText: 2020 Piotr Rak <piotr.rak@gamil.com>
+ * SPDX-License-Identifier: MIT
+ */
+#include "bhd/device_registry.hh"
+
+#include "behead_egl_impl.hh"
+#include "stats.hh"
+#include "ufd.hh"
+
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <dirent.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cerrno>
+#include <cstdint>
+#include <mutex>
+#include <string_view>
+#include <thread>
+#include <utility>
+
+#include <iostream>
+
+namespace bhdi = behead_egl::internal;
+namespace bhd = behead_egl;
+
+namespace {
+
+struct Counters
+{
+   bhdi::StatCounter &update = bhdi::stat_counter("registry.update");
+};
+
+Counters &counters()
+{
+   static Counters c;
+   return c;
+}
+
+constexpr std::uint32_t DIR_EVENTS = IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO |
+                                     IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR;
+
+constexpr std::uint32_t PARENT_EVENTS = IN_CREATE | IN_MOVED_TO | IN_ONLYDIR;
+
+bool is_drm_node(std::string_view name) noexcept
+{
+   return name.substr(0, 4) == "card" || name.substr(0, 7) == "renderD";
+}
+
+std::string_view base_name(std::string_view path) noexcept
+{
+   auto slash = path.rfind('/');
+
+   return slash == std::string_view::npos ? path : path.substr(slash + 1);
+}
+
+// Lists drm nodes in dir, sorted
+std::vector<std::string> scan_nodes(const std::string &dir)
+{
+   std::vector<std::string> names;
+
+   DIR *d = ::opendir(dir.c_str());
+
+   if (d == nullptr)
+      return names;
+
+   while (dirent *e = ::readdir(d))
+   {
+      if (is_drm_node(e->d_name))
+         names.emplace_back(e->d_name);
+   }
+
+   ::closedir(d);
+
+   std::sort(names.begin(), names.end());
+
+   return names;
+}
+
+// All EGL devices, empty if they can't be queried
+bhdi::VecDevInfos query_devices()
+{
+   using bhdi::BeheadEGL;
+
+   if (!BeheadEGL::ensure_client_extensions())
+      return {};
+
+   try
+   {
+      return BeheadEGL::query_device_infos();
+   }
+   catch (const std::runtime_error &e)
+   {
+      // WARNING
+      std::cerr << "Couldn't query any device capabilities" << std::endl;
+      std::cerr << e.what() << std::endl;
+   }
+
+   return {};
+}
+
+} // namespace anonymous
+
+namespace behead_egl::internal {
+
+struct DeviceRegistryImpl
+{
+   DeviceRegistryOpts opts;
+
+   std::string parent_dir;
+   std::string dir_name;
+
+   mutable std::mutex lock;
+
+   // {{{ Guarded by lock
+
+   std::vector<DeviceEXT_Info> devices;
+
+   // Sorted
+   std::vector<std::string> nodes;
+
+   // }}}
+
+   std::atomic<std::uint64_t> epoch = 0;
+
+   unique_fd inotify_fd;
+   unique_fd wake_fd;
+
+   int dir_wd = -1;
+   int parent_wd = -1;
+
+   std::atomic_bool stopping = false;
+
+   std::thread thread;
+
+   bool has_node(std::string_view name) const
+   {
+      return std::binary_search(nodes.begin(), nodes.end(), name);
+   }
+
+   // Device is listed while its primary node exists
+   bool listed(const DeviceEXT_Info &info) const
+   {
+      if (info.has_EXT_device_drm)
+         return info.drm_path != nullptr && has_node(base_name(info.drm_path));
+
+      return info.has_MESA_device_software;
+   }
+
+   void rescan();
+
+   void node_added(std::string_view name);
+   void node_removed(std::string_view name);
+
+   // Publishes change, called without lock held
+   void bump();
+
+   // (Re)adds watch on drm dir, falls back to watching its parent until dir exists
+   bool watch_dir();
+
+   void handle_events();
+
+   void watcher_main();
+};
+
+void DeviceRegistryImpl::rescan()
+{
+   auto names = scan_nodes(opts.drm_dir);
+   auto infos = query_devices();
+
+   {
+      std::lock_guard guard{lock};
+
+      nodes = std::move(names);
+      devices.clear();
+
+      for (const auto &info : infos)
+      {
+         if (listed(info))
+            devices.push_back(info);
+      }
+   }
+
+   bump();
+}
+
+void DeviceRegistryImpl::node_added(std::string_view name)
+{
+   // NB: Query before taking lock, EGL may take its time
+   auto infos = query_devices();
+
+   {
+      std::lock_guard guard{lock};
+
+      auto it = std::lower_bound(nodes.begin(), nodes.end(), name);
+
+      if (it != nodes.end() && *it == name)
+         return;
+
+      nodes.insert(it, std::string(name));
+
+      for (const auto &info : infos)
+      {
+         if (!info.has_EXT_device_drm || info.drm_path == nullptr || base_name(info.drm_path) != name)
+            continue;
+
+         auto present = std::find_if(devices.begin(), devices.end(), [&info] (const DeviceEXT_Info &d) {
+            return d.egl_device_ext == info.egl_device_ext;
+         });
+
+         if (present == devices.end())
+            devices.push_back(info);
+      }
+   }
+
+   bump();
+}
+
+void DeviceRegistryImpl::node_removed(std::string_view name)
+{
+   {
+      std::lock_guard guard{lock};
+
+      auto it = std::lower_bound(nodes.begin(), nodes.end(), name);
+
+      if (it == nodes.end() || *it != name)
+         return;
+
+      nodes.erase(it);
+
+      devices.erase(std::remove_if(devices.begin(), devices.end(), [name] (const DeviceEXT_Info &d) {
+         return d.has_EXT_device_drm && d.drm_path != nullptr && base_name(d.drm_path) == name;
+      }), devices.end());
+   }
+
+   bump();
+}
+
+void DeviceRegistryImpl::bump()
+{
+   std::uint64_t e = epoch.fetch_add(1, std::memory_order_acq_rel) + 1;
+
+   counters().update.add();
+
+   if (!opts.on_change)
+      return;
+
+   try
+   {
+      opts.on_change(e);
+   }
+   catch (...)
+   {
+      // WARNING
+      std::cerr << "Registry callback has thrown" << std::endl;
+   }
+}
+
+bool DeviceRegistryImpl::watch_dir()
+{
+   dir_wd = ::inotify_add_watch(inotify_fd.get(), opts.drm_dir.c_str(), DIR_EVENTS);
+
+   if (dir_wd >= 0)
+   {
+      if (parent_wd >= 0)
+      {
+         ::inotify_rm_watch(inotify_fd.get(), parent_wd);
+         parent_wd = -1;
+      }
+
+      return true;
+   }
+
+   // No drm device at all yet, wait for directory to appear
+   if (parent_wd < 0)
+      parent_wd = ::inotify_add_watch(inotify_fd.get(), parent_dir.c_str(), PARENT_EVENTS);
+
+   return parent_wd >= 0;
+}
+
+void DeviceRegistryImpl::handle_events()
+{
+   alignas(inotify_event) char buf[4096];
+
+   for (;;)
+   {
+      ssize_t len = ::read(inotify_fd.get(), buf, sizeof(buf));
+
+      if (len < 0 && errno == EINTR)
+         continue;
+
+      if (len <= 0)
+         return;
+
+      for (ssize_t off = 0; off < len; )
+      {
+         const auto *ev = reinterpret_cast<const inotify_event *>(buf + off);
+
+         off += ssize_t(sizeof(inotify_event) + ev->len);
+
+         std::string_view name = ev->len > 0 ? std::string_view(ev->name) : std::string_view{};
+
+         if (ev->mask & IN_Q_OVERFLOW)
+         {
+            rescan();
+            continue;
+         }
+
+         if (ev->wd == parent_wd)
+         {
+            if (name == dir_name && watch_dir())
+               rescan();
+
+            continue;
+         }
+
+         if (ev->wd != dir_wd)
+            continue;
+
+         if (ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF))
+         {
+            // WARNING
+            std::cerr << "Drm directory " << opts.drm_dir << " is gone" << std::endl;
+
+            ::inotify_rm_watch(inotify_fd.get(), dir_wd);
+            dir_wd = -1;
+
+            watch_dir();
+            rescan();
+            continue;
+         }
+
+         if (!is_drm_node(name))
+            continue;
+
+         if (ev->mask & (IN_CREATE | IN_MOVED_TO))
+            node_added(name);
+         else if (ev->mask & (IN_DELETE | IN_MOVED_FROM))
+            node_removed(name);
+      }
+   }
+}
+
+void DeviceRegistryImpl::watcher_main()
+{
+   pollfd fds[2] = {
+      { inotify_fd.get(), POLLIN, 0 },
+      { wake_fd.get(), POLLIN, 0 },
+   };
+
+   while (!stopping.load(std::memory_order_acquire))
+   {
+      int n = ::poll(fds, 2, -1);
+
+      if (n < 0 && errno != EINTR)
+      {
+         // ERROR
+         std::cerr << "Device registry poll failed" << std::endl;
+         break;
+      }
+
+      if (n > 0 && (fds[0].revents & POLLIN))
+         handle_events();
+   }
+}
+
+} // namespace behead_egl::internal
+
+namespace behead_egl
+{
+
+DeviceRegistry::DeviceRegistry(const DeviceRegistryOpts &opts):
+   _impl(std::make_unique<internal::DeviceRegistryImpl>())
+{
+   auto &impl = *_impl;
+
+   impl.opts = opts;
+
+   // Strip trailing slashes, so we can split off parent
+   while (impl.opts.drm_dir.size() > 1 && impl.opts.drm_dir.back() == '/')
+      impl.opts.drm_dir.pop_back();
+
+   auto slash = impl.opts.drm_dir.rfind('/');
+
+   impl.parent_dir = slash == std::string::npos ? "." :
+                     slash == 0 ? "/" : impl.opts.drm_dir.substr(0, slash);
+   impl.dir_name = slash == std::string::npos ? impl.opts.drm_dir :
+                   impl.opts.drm_dir.substr(slash + 1);
+
+   impl.inotify_fd.reset(::inotify_init1(IN_CLOEXEC | IN_NONBLOCK));
+   impl.wake_fd.reset(::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK));
+
+   // NB: Watch first, so we don't miss node appearing between scan and watch.
+   bool watching = impl.inotify_fd.ok() && impl.wake_fd.ok() && impl.watch_dir();
+
+   impl.rescan();
+
+   if (!watching)
+   {
+      // WARNING
+      std::cerr << "Failed to watch " << impl.opts.drm_dir << ", device list won't be updated" << std::endl;
+      return;
+   }
+
+   impl.thread = std::thread([&impl] { impl.watcher_main(); });
+}
+
+DeviceRegistry::~DeviceRegistry()
+{
+   if (!ok())
+      return;
+
+   _impl->stopping.store(true, std::memory_order_release);
+
+   std::uint64_t one = 1;
+   [[maybe_unused]] auto written = ::write(_impl->wake_fd.get(), &one, sizeof(one));
+
+   _impl->thread.join();
+}
+
+bool DeviceRegistry::ok() const noexcept
+{
+   return _impl->thread.joinable();
+}
+
+std::uint64_t DeviceRegistry::epoch() const noexcept
+{
+   return _impl->epoch.load(std::memory_order_acquire);
+}
+
+std::uint64_t DeviceRegistry::devices(std::vector<DeviceEXT_Info> &out) const
+{
+   std::lock_guard guard{_impl->lock};
+
+   out = _impl->devices;
+
+   return epoch();
+}
+
+std::uint64_t DeviceRegistry::nodes(std::vector<std::string> &out) const
+{
+   std::lock_guard guard{_impl->lock};
+
+   out = _impl->nodes;
+
+   return epoch();
+}
+
+void DeviceRegistry::refresh()
+{
+   _impl->rescan();
+}
+
+} // namespace behead_egl
@@ -0,0 +1,297 @@
+/*
+ * SPDX-FileCopyrightText: 2020 Piotr Rak <piotr.rak@gamil.com>
+ * SPDX-License-Identifier: MIT
+ */
+#include "bhd/device_table.hh"
+
+#include "behead_egl_impl.hh"
+#include "minidrm.hh"
+
+#include <cassert>
+#include <stdexcept>
+#include <vector>
+
+#include <iostream>
+
+namespace bhdi = behead_egl::internal;
+namespace bhd = behead_egl;
+
+namespace behead_egl::internal {
+
+struct DeviceTableImpl
+{
+   bool ok = false;
+
+   // {{{ Columns
+
+   std::vector<EGLDeviceEXT> devices;
+   std::vector<std::uint32_t> caps;
+   std::vector<std::int32_t> drm_minors;
+   std::vector<std::int32_t> cuda_ids;
+   std::vector<std::int32_t> numa_nodes;
+   std::vector<std::uint32_t> pci_ids;
+
+   // Cold, only for info()
+   std::vector<const char *> extensions;
+   std::vector<const char *> drm_paths;
+
+   // }}}
+
+   void clear();
+
+   void append(const DeviceEXT_Info &info);
+};
+
+void DeviceTableImpl::clear()
+{
+   devices.clear();
+   caps.clear();
+   drm_minors.clear();
+   cuda_ids.clear();
+   numa_nodes.clear();
+   pci_ids.clear();
+   extensions.clear();
+   drm_paths.clear();
+}
+
+void DeviceTableImpl::append(const DeviceEXT_Info &info)
+{
+   std::uint32_t cap = 0;
+
+   std::int32_t drm_minor = -1;
+   std::int32_t numa_node = -1;
+   std::uint32_t pci_id = 0;
+
+   if (info.has_NV_device_cuda)
+      cap |= DeviceCapNvCuda;
+
+   if (info.has_MESA_device_software)
+      cap |= DeviceCapMesaSoftware;
+
+   if (info.marked_unhealthy)
+      cap |= DeviceCapUnhealthy;
+
+   if (info.has_EXT_device_drm)
+   {
+      cap |= DeviceCapDrm;
+
+      unsigned minor;
+
+      if (query_drm_minor(info.drm_path, minor))
+         drm_minor = std::int32_t(minor);
+
+      DrmBusInfo bus;
+
+      if (query_drm_bus_info(info.drm_path, bus))
+      {
+         numa_node = bus.numa_node;
+
+         if (bus.pci_vendor != 0)
+         {
+            cap |= DeviceCapPci;
+            pci_id = (std::uint32_t(bus.pci_vendor) << 16) | bus.pci_device;
+         }
+      }
+   }
+
+   devices.push_back(info.egl_device_ext);
+   caps.push_back(cap);
+   drm_minors.push_back(drm_minor);
+   cuda_ids.push_back(info.cuda_dev_id.value_or(-1));
+   numa_nodes.push_back(numa_node);
+   pci_ids.push_back(pci_id);
+   extensions.push_back(info.device_extensions);
+   drm_paths.push_back(info.drm_path);
+}
+
+} // namespace behead_egl::internal
+
+namespace behead_egl {
+
+DeviceTable::DeviceTable():
+   _impl(std::make_unique<internal::DeviceTableImpl>())
+{
+   refresh();
+}
+
+DeviceTable::~DeviceTable() = default;
+
+bool DeviceTable::ok() const noexcept
+{
+   return _impl->ok;
+}
+
+bool DeviceTable::refresh()
+{
+   using bhdi::BeheadEGL;
+
+   auto &impl = *_impl;
+
+   impl.clear();
+   impl.ok = false;
+
+   if (!BeheadEGL::ensure_client_extensions())
+      return false;
+
+   try
+   {
+      const auto infos = BeheadEGL::query_device_infos();
+
+      for (const auto &info : infos)
+         impl.append(info);
+
+      impl.ok = true;
+   }
+   catch (const std::runtime_error &e)
+   {
+      // WARNING
+      std::cerr << "Couldn't query any device capabilities" << std::endl;
+      std::cerr << e.what() << std::endl;
+
+      impl.clear();
+   }
+
+   return impl.ok;
+}
+
+std::size_t DeviceTable::size() const noexcept
+{
+   return _impl->devices.size();
+}
+
+const EGLDeviceEXT *DeviceTable::devices() const noexcept
+{
+   return _impl->devices.data();
+}
+
+const std::uint32_t *DeviceTable::caps() const noexcept
+{
+   return _impl->caps.data();
+}
+
+const std::int32_t *DeviceTable::drm_minors() const noexcept
+{
+   return _impl->drm_minors.data();
+}
+
+const std::int32_t *DeviceTable::cuda_ids() const noexcept
+{
+   return _impl->cuda_ids.data();
+}
+
+const std::int32_t *DeviceTable::numa_nodes() const noexcept
+{
+   return _impl->numa_nodes.data();
+}
+
+const std::uint32_t *DeviceTable::pci_ids() const noexcept
+{
+   return _impl->pci_ids.data();
+}
+
+std::size_t DeviceTable::filter(const DeviceFilter &f, std::vector<std::uint32_t> &out) const
+{
+   const auto &impl = *_impl;
+
+   const std::size_t n = impl.caps.size();
+   const std::size_t first = out.size();
+
+   const std::uint32_t *caps = impl.caps.data();
+
+   // NB: Room for all, so caps scan below is branch-free; trimmed afterwards
+   out.resize(first + n);
+
+   std::uint32_t *dst = out.data() + first;
+   std::size_t matched = 0;
+
+   for (std::size_t i = 0; i < n; ++i)
+   {
+      bool match = ((caps[i] & f.require) == f.require) & ((caps[i] & f.exclude) == 0);
+
+      dst[matched] = std::uint32_t(i);
+      matched += match;
+   }
+
+   // Narrow down by other columns, only those asked for are touched
+   if (f.numa_node >= 0)
+   {
+      const std::int32_t *numa = impl.numa_nodes.data();
+      std::size_t kept = 0;
+
+      for (std::size_t j = 0; j < matched; ++j)
+      {
+         dst[kept] = dst[j];
+         kept += (numa[dst[j]] == f.numa_node);
+      }
+
+      matched = kept;
+   }
+
+   if (f.pci_vendor != 0)
+   {
+      const std::uint32_t *pci = impl.pci_ids.data();
+      std::size_t kept = 0;
+
+      for (std::size_t j = 0; j < matched; ++j)
+      {
+         dst[kept] = dst[j];
+         kept += ((pci[dst[j]] >> 16) == f.pci_vendor);
+      }
+
+      matched = kept;
+   }
+
+   out.resize(first + matched);
+
+   return matched;
+}
+
+std::size_t DeviceTable::pick() const noexcept
+{
+   const auto &caps = _impl->caps;
+
+   // NB: Same preference as pick_display_device_ext(): first healthy CUDA device,
+   // then first healthy drm device
+   constexpr std::uint32_t cuda = DeviceCapNvCuda | DeviceCapDrm;
+
+   for (std::size_t i = 0; i < caps.size(); ++i)
+   {
+      if ((caps[i] & (cuda | DeviceCapUnhealthy)) == cuda)
+         return i;
+   }
+
+   for (std::size_t i = 0; i < caps.size(); ++i)
+   {
+      if ((caps[i] & (DeviceCapDrm | DeviceCapUnhealthy)) == DeviceCapDrm)
+         return i;
+   }
+
+   return npos;
+}
+
+DeviceEXT_Info DeviceTable::info(std::size_t index) const
+{
+   const auto &impl = *_impl;
+
+   DeviceEXT_Info info;
+
+   if (index >= impl.devices.size())
+      return info;
+
+   const std::uint32_t cap = impl.caps[index];
+
+   info.egl_device_ext = impl.devices[index];
+   info.device_extensions = impl.extensions[index];
+   info.has_NV_device_cuda = (cap & DeviceCapNvCuda) != 0;
+   info.has_EXT_device_drm = (cap & DeviceCapDrm) != 0;
+   info.has_MESA_device_software = (cap & DeviceCapMesaSoftware) != 0;
+   info.drm_path = impl.drm_paths[index];
+   info.marked_unhealthy = (cap & DeviceCapUnhealthy) != 0;
+
+   if (impl.cuda_ids[index] >= 0)
+      info.cuda_dev_id = impl.cuda_ids[index];
+
+   return info;
+}
+
+} // namespace behead_egl
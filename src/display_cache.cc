@@ -0,0 +1,255 @@
+/*
+ * SPDX-FileCopyrightText: 2020 Piotr Rak <piotr.rak@gamil.com>
+ * SPDX-License-Identifier: MIT
+ */
+#include "bhd/display_cache.hh"
+#include "bhd/drm_telemetry.hh"
+
+#include "behead_egl_impl.hh"
+#include "display_cache.hh"
+#include "stats.hh"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <iterator>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace bhdi = behead_egl::internal;
+namespace bhd = behead_egl;
+
+namespace {
+
+using bhdi::DisplayExt;
+
+struct Counters
+{
+   bhdi::StatCounter &hit  = bhdi::stat_counter("display_cache.hit");
+   bhdi::StatCounter &miss = bhdi::stat_counter("display_cache.miss");
+};
+
+Counters &counters()
+{
+   static Counters c;
+   return c;
+}
+
+// NB: Same order as DisplayExt
+constexpr const char *DISPLAY_EXT_NAMES[] = {
+   "EGL_EXT_create_context_robustness",
+   "EGL_IMG_context_priority",
+   "EGL_KHR_fence_sync",
+   "EGL_ANDROID_native_fence_sync",
+   "EGL_KHR_surfaceless_context",
+};
+
+static_assert(std::size(DISPLAY_EXT_NAMES) == unsigned(DisplayExt::Count_));
+
+struct CachedConfig
+{
+   // Up to and including EGL_NONE
+   std::vector<EGLint> attribs;
+   EGLConfig config;
+};
+
+struct DisplayEntry
+{
+   bool ext_known = false;
+   std::uint32_t ext_bits = 0;
+
+   // Few per display, linear search is fine
+   std::vector<CachedConfig> configs;
+};
+
+struct DisplayCache
+{
+   std::shared_mutex lock;
+
+   std::unordered_map<EGLDisplay, DisplayEntry> displays;
+};
+
+DisplayCache &cache()
+{
+   static DisplayCache c;
+   return c;
+}
+
+std::size_t attrib_list_length(const EGLint *attribs) noexcept
+{
+   std::size_t len = 0;
+
+   while (attribs[len] != EGL_NONE)
+      len += 2;
+
+   return len + 1;
+}
+
+bool same_attribs(const std::vector<EGLint> &cached, const EGLint *attribs, std::size_t len) noexcept
+{
+   return cached.size() == len && std::equal(cached.begin(), cached.end(), attribs);
+}
+
+std::uint32_t parse_display_extensions(const char *extensions)
+{
+   std::uint32_t bits = 0;
+
+   for (unsigned i = 0; i < unsigned(DisplayExt::Count_); ++i)
+   {
+      if (bhdi::has_extension(extensions, DISPLAY_EXT_NAMES[i]))
+         bits |= 1u << i;
+   }
+
+   return bits;
+}
+
+} // namespace anonymous
+
+namespace behead_egl::internal {
+
+bool display_has_extension(EGLDisplay dpy, DisplayExt ext)
+{
+   const std::uint32_t bit = 1u << unsigned(ext);
+
+   auto &c = cache();
+
+   {
+      std::shared_lock guard{c.lock};
+
+      auto it = c.displays.find(dpy);
+
+      if (it != c.displays.end() && it->second.ext_known)
+      {
+         counters().hit.add();
+         return (it->second.ext_bits & bit) != 0;
+      }
+   }
+
+   counters().miss.add();
+
+   // NB: Outside of lock, racing threads parse the same string
+   const char *extensions = eglQueryString(dpy, EGL_EXTENSIONS);
+
+   // Not initialized (or terminated), nothing to remember
+   if (extensions == nullptr)
+      return false;
+
+   std::uint32_t bits = parse_display_extensions(extensions);
+
+   std::unique_lock guard{c.lock};
+
+   auto &entry = c.displays[dpy];
+
+   entry.ext_known = true;
+   entry.ext_bits = bits;
+
+   return (bits & bit) != 0;
+}
+
+EGLConfig cached_choose_config(EGLDisplay dpy, const EGLint *attribs)
+{
+   assert(attribs != nullptr);
+
+   const std::size_t len = attrib_list_length(attribs);
+
+   auto &c = cache();
+
+   EGLConfig hit = nullptr;
+
+   {
+      std::shared_lock guard{c.lock};
+
+      auto it = c.displays.find(dpy);
+
+      if (it != c.displays.end())
+      {
+         for (const auto &cached : it->second.configs)
+         {
+            if (same_attribs(cached.attribs, attribs, len))
+            {
+               hit = cached.config;
+               break;
+            }
+         }
+      }
+   }
+
+   if (hit != nullptr)
+   {
+      // NB: Display may have been terminated with plain eglTerminate() and initialized
+      // again, handle is the same then, but its configs are not. EGL looks stale
+      // config up in display's current ones, so this just fails.
+      EGLint config_id = 0;
+
+      if (eglGetConfigAttrib(dpy, hit, EGL_CONFIG_ID, &config_id) == EGL_TRUE)
+      {
+         counters().hit.add();
+         return hit;
+      }
+
+      std::unique_lock guard{c.lock};
+
+      c.displays.erase(dpy);
+   }
+
+   counters().miss.add();
+
+   EGLConfig config = nullptr;
+   EGLint num_configs = 0;
+
+   // NB: Caller reports eglGetError() of failure
+   if (eglChooseConfig(dpy, attribs, &config, 1, &num_configs) != EGL_TRUE || num_configs < 1)
+      return nullptr;
+
+   std::unique_lock guard{c.lock};
+
+   auto &configs = c.displays[dpy].configs;
+
+   auto it = std::find_if(configs.begin(), configs.end(), [&] (const CachedConfig &cached) {
+      return same_attribs(cached.attribs, attribs, len);
+   });
+
+   if (it == configs.end())
+      configs.push_back({ std::vector<EGLint>(attribs, attribs + len), config });
+
+   return config;
+}
+
+} // namespace behead_egl::internal
+
+namespace behead_egl {
+
+void forget_display(EGLDisplay dpy)
+{
+   try
+   {
+      auto &c = cache();
+
+      std::unique_lock guard{c.lock};
+
+      c.displays.erase(dpy);
+   }
+   catch (...)
+   {
+      assert(false && "Leaked exception");
+   }
+
+   untrack_display_usage(dpy);
+}
+
+EGLBoolean terminate_display(EGLDisplay dpy)
+{
+   EGLBoolean result = eglTerminate(dpy);
+
+   // NB: Forget after terminate. Other thread could refill cache from still live
+   // display in between otherwise, and that would outlive it. Lookups on
+   // terminated display find nothing to remember.
+   forget_display(dpy);
+
+   return result;
+}
+
+} // namespace behead_egl
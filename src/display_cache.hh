@@ -0,0 +1,32 @@
+/*
+ * SPDX-FileCopyrightText: 2020 Piotr Rak <piotr.rak@gamil.com>
+ * SPDX-License-Identifier: MIT
+ */
+#pragma once
+
+#include "bhd/behead_egl.hh"
+
+namespace behead_egl::internal {
+
+// NB: Implemented in display_cache.cc
+
+// Display extensions library checks for
+enum class DisplayExt : unsigned
+{
+   EXT_create_context_robustness,
+   IMG_context_priority,
+   KHR_fence_sync,
+   ANDROID_native_fence_sync,
+   KHR_surfaceless_context,
+
+   Count_
+};
+
+// Parses display extensions once per display; false if display isn't initialized.
+bool display_has_extension(EGLDisplay dpy, DisplayExt ext);
+
+// eglChooseConfig() for first matching config, memoized per display and attribute list.
+// Returns nullptr on failure, failures aren't cached.
+EGLConfig cached_choose_config(EGLDisplay dpy, const EGLint *attribs);
+
+} // namespace behead_egl::internal
@@ -0,0 +1,35 @@
+/*
+ * SPDX-FileCopyrightText: 2020 Piotr Rak <piotr.rak@gamil.com>
+ * SPDX-License-Identifier: MIT
+ */
+#pragma once
+
+#include "bhd/behead_egl.hh"
+
+#include "minidrm.hh"
+
+namespace behead_egl::internal {
+
+// Maps DrmNodeUsage onto nodes we need to open and order we try them in.
+//
+// NB: Implemented in behead_egl.cc
+struct DisplayCreationStrategy
+{
+   explicit DisplayCreationStrategy(DrmNodeUsage usage) noexcept:
+     _node_usage(usage) {}
+
+   DrmNodeFlag get_open_flag() const;
+
+   bool has_fallback() const;
+
+   DrmNodeFlag node_flag() const;
+   DrmNodeFlag fallback_node_flag() const;
+
+   unique_fd take_node_fd(DrmNodeFds& fds) const;
+   unique_fd take_fallback_node_fd(DrmNodeFds& fds) const;
+
+private:
+   const DrmNodeUsage _node_usage;
+};
+
+} // namespace behead_egl::internal
@@ -0,0 +1,662 @@
+/*
+ * SPDX-FileCopyrightText: 2020 Piotr Rak <piotr.rak@gamil.com>
+ * SPDX-License-Identifier: MIT
+ */
+#include "bhd/drm_telemetry.hh"
+
+#include "behead_egl_impl.hh"
+#include "minidrm.hh"
+#include "stats.hh"
+#include "tokenize_sv.hh"
+#include "ufd.hh"
+
+#include <algorithm>
+#include <cassert>
+#include <charconv>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <iostream>
+
+namespace bhdi = behead_egl::internal;
+namespace bhd = behead_egl;
+
+namespace {
+
+using std::chrono::steady_clock;
+using std::string_view;
+
+struct Counters
+{
+   bhdi::StatCounter &sample = bhdi::stat_counter("drm_telemetry.sample");
+};
+
+Counters &counters()
+{
+   static Counters c;
+   return c;
+}
+
+// Keys of drm-usage-stats we understand, see Documentation/gpu/drm-usage-stats.rst
+constexpr string_view KEY_DRIVER          = "drm-driver";
+constexpr string_view KEY_CLIENT_ID       = "drm-client-id";
+constexpr string_view KEY_ENGINE_CAPACITY = "drm-engine-capacity-";
+constexpr string_view KEY_ENGINE          = "drm-engine-";
+constexpr string_view KEY_TOTAL           = "drm-total-";
+constexpr string_view KEY_RESIDENT        = "drm-resident-";
+// Older kernels, same meaning as drm-resident-
+constexpr string_view KEY_MEMORY          = "drm-memory-";
+
+bool starts_with(string_view sv, string_view prefix) noexcept
+{
+   return sv.substr(0, prefix.size()) == prefix;
+}
+
+string_view trim(string_view sv) noexcept
+{
+   constexpr string_view blanks = " \t";
+
+   std::size_t first = sv.find_first_not_of(blanks);
+
+   if (first == string_view::npos)
+      return {};
+
+   return sv.substr(first, sv.find_last_not_of(blanks) - first + 1);
+}
+
+template <std::size_t Sz_>
+void copy_name(char (&dst)[Sz_], string_view src) noexcept
+{
+   src = src.substr(0, Sz_ - 1);
+
+   std::memcpy(dst, src.data(), src.size());
+   dst[src.size()] = '\0';
+}
+
+// Compares as stored, names longer than dst are truncated
+template <std::size_t Sz_>
+bool same_name(const char (&stored)[Sz_], string_view name) noexcept
+{
+   return string_view(stored) == name.substr(0, Sz_ - 1);
+}
+
+// "<uint> [ns]", unit isn't checked
+bool parse_u64(string_view value, std::uint64_t &out) noexcept
+{
+   auto [ptr, ec] = std::from_chars(value.data(), value.data() + value.size(), out);
+
+   return ec == std::errc() && ptr != value.data();
+}
+
+// "<uint> [KiB|MiB|GiB]" in bytes
+bool parse_bytes(string_view value, std::uint64_t &out) noexcept
+{
+   std::uint64_t n = 0;
+
+   auto [ptr, ec] = std::from_chars(value.data(), value.data() + value.size(), n);
+
+   if (ec != std::errc() || ptr == value.data())
+      return false;
+
+   string_view unit = trim(value.substr(std::size_t(ptr - value.data())));
+
+   if (unit == "KiB")
+      n <<= 10;
+   else if (unit == "MiB")
+      n <<= 20;
+   else if (unit == "GiB")
+      n <<= 30;
+   else if (!unit.empty())
+      return false;
+
+   out = n;
+
+   return true;
+}
+
+template <typename Ty_, std::size_t Sz_>
+Ty_ *find_or_add(Ty_ (&items)[Sz_], std::size_t &count, string_view name) noexcept
+{
+   for (std::size_t i = 0; i < count; ++i)
+   {
+      if (same_name(items[i].name, name))
+         return &items[i];
+   }
+
+   if (count == Sz_)
+      return nullptr;
+
+   Ty_ &item = items[count++];
+
+   item = Ty_{};
+   copy_name(item.name, name);
+
+   return &item;
+}
+
+// Returns false if text has no drm-driver key
+bool parse_fdinfo(string_view text, bhd::DrmUsageSample &out) noexcept
+{
+   bool has_driver = false;
+
+   out.engine_count = 0;
+   out.region_count = 0;
+   out.client_id = 0;
+   out.driver[0] = '\0';
+
+   auto engine = [&] (string_view name) {
+      return find_or_add(out.engines, out.engine_count, name);
+   };
+
+   auto region = [&] (string_view name) {
+      return find_or_add(out.regions, out.region_count, name);
+   };
+
+   bhdi::foreach_token_sv(text, '\n', [&] (string_view line) {
+      std::size_t colon = line.find(':');
+
+      if (colon == string_view::npos)
+         return;
+
+      string_view key = trim(line.substr(0, colon));
+      string_view value = trim(line.substr(colon + 1));
+
+      std::uint64_t n = 0;
+
+      if (key == KEY_DRIVER)
+      {
+         copy_name(out.driver, value);
+         has_driver = true;
+      }
+      else if (key == KEY_CLIENT_ID)
+      {
+         parse_u64(value, out.client_id);
+      }
+      // NB: Before drm-engine-, it is its prefix
+      else if (starts_with(key, KEY_ENGINE_CAPACITY))
+      {
+         if (parse_u64(value, n) && n > 0)
+         {
+            if (auto *e = engine(key.substr(KEY_ENGINE_CAPACITY.size())))
+               e->capacity = std::uint32_t(n);
+         }
+      }
+      else if (starts_with(key, KEY_ENGINE))
+      {
+         if (parse_u64(value, n))
+         {
+            if (auto *e = engine(key.substr(KEY_ENGINE.size())))
+               e->busy_ns = n;
+         }
+      }
+      else if (starts_with(key, KEY_TOTAL))
+      {
+         if (parse_bytes(value, n))
+         {
+            if (auto *r = region(key.substr(KEY_TOTAL.size())))
+               r->total = n;
+         }
+      }
+      else if (starts_with(key, KEY_RESIDENT) || starts_with(key, KEY_MEMORY))
+      {
+         string_view prefix = starts_with(key, KEY_RESIDENT) ? KEY_RESIDENT : KEY_MEMORY;
+
+         if (parse_bytes(value, n))
+         {
+            if (auto *r = region(key.substr(prefix.size())))
+               r->resident = n;
+         }
+      }
+   });
+
+   return has_driver;
+}
+
+} // namespace anonymous
+
+namespace behead_egl::internal {
+
+// Open drm file, shared by fds dup'ed from one another
+struct DrmClient
+{
+   dev_t node = 0;
+   std::uint64_t id = 0;
+
+   bool operator<(const DrmClient &other) const noexcept
+   {
+      return node != other.node ? node < other.node : id < other.id;
+   }
+
+   bool operator==(const DrmClient &other) const noexcept
+   {
+      return node == other.node && id == other.id;
+   }
+};
+
+struct DrmClientSnapshotImpl
+{
+   // Sorted
+   std::vector<DrmClient> clients;
+
+   bool ok = false;
+
+   bool contains(const DrmClient &client) const noexcept
+   {
+      return std::binary_search(clients.begin(), clients.end(), client);
+   }
+};
+
+struct FdinfoReaderImpl
+{
+   unique_fd fd;
+
+   // Few lines per engine and region, fits with plenty of room
+   char buf[4096];
+
+   bool open(const char *path) noexcept;
+
+   bool sample(DrmUsageSample &out) noexcept;
+};
+
+bool FdinfoReaderImpl::open(const char *path) noexcept
+{
+   fd.reset(::open(path, O_RDONLY | O_CLOEXEC));
+
+   return fd.ok();
+}
+
+bool FdinfoReaderImpl::sample(DrmUsageSample &out) noexcept
+{
+   if (!fd.ok())
+      return false;
+
+   out.taken = steady_clock::now();
+
+   // NB: procfs regenerates fdinfo on each read from offset 0
+   ssize_t len = ::pread(fd.get(), buf, sizeof(buf), 0);
+
+   if (len <= 0)
+      return false;
+
+   string_view text(buf, std::size_t(len));
+
+   // Didn't fit, drop line cut in half
+   if (std::size_t(len) == sizeof(buf))
+      text = text.substr(0, text.rfind('\n') + 1);
+
+   counters().sample.add();
+
+   return parse_fdinfo(text, out);
+}
+
+} // namespace behead_egl::internal
+
+namespace {
+
+// Summed into sample of first client read
+void merge_sample(bhd::DrmUsageSample &into, const bhd::DrmUsageSample &other) noexcept
+{
+   // NB: Several clients, none of ids applies
+   into.client_id = 0;
+   into.taken = other.taken;
+
+   for (std::size_t i = 0; i < other.engine_count; ++i)
+   {
+      const auto &e = other.engines[i];
+
+      if (auto *mine = find_or_add(into.engines, into.engine_count, e.name))
+      {
+         mine->busy_ns += e.busy_ns;
+         mine->capacity = std::max(mine->capacity, e.capacity);
+      }
+   }
+
+   for (std::size_t i = 0; i < other.region_count; ++i)
+   {
+      const auto &r = other.regions[i];
+
+      if (auto *mine = find_or_add(into.regions, into.region_count, r.name))
+      {
+         mine->total += r.total;
+         mine->resident += r.resident;
+      }
+   }
+}
+
+struct TrackedDisplay
+{
+   // fdinfo of one fd per drm client driver opened for display
+   std::vector<std::unique_ptr<bhdi::FdinfoReaderImpl>> readers;
+
+   // For samples merged into caller's one
+   bhd::DrmUsageSample scratch;
+
+   bool sample(bhd::DrmUsageSample &out) noexcept;
+};
+
+bool TrackedDisplay::sample(bhd::DrmUsageSample &out) noexcept
+{
+   bool any = false;
+
+   for (auto &reader : readers)
+   {
+      if (!reader->sample(any ? scratch : out))
+         continue;
+
+      if (any)
+         merge_sample(out, scratch);
+
+      any = true;
+   }
+
+   return any;
+}
+
+struct Registry
+{
+   std::mutex lock;
+
+   std::unordered_map<EGLDisplay, std::unique_ptr<TrackedDisplay>> displays;
+};
+
+Registry &registry()
+{
+   static Registry r;
+   return r;
+}
+
+// Open fds of process, read from /proc/self/fd
+std::vector<int> list_fds()
+{
+   std::vector<int> fds;
+
+   DIR *d = ::opendir("/proc/self/fd");
+
+   if (d == nullptr)
+      return fds;
+
+   const int self = ::dirfd(d);
+
+   while (dirent *e = ::readdir(d))
+   {
+      string_view name = e->d_name;
+      int fd = -1;
+
+      auto [ptr, ec] = std::from_chars(name.data(), name.data() + name.size(), fd);
+
+      if (ec == std::errc() && ptr == name.data() + name.size() && fd != self)
+         fds.push_back(fd);
+   }
+
+   ::closedir(d);
+
+   return fds;
+}
+
+// Calls fn(fd, client, reader) for each fd of process that is drm client
+// reporting usage stats, reader is left open on fdinfo of fd.
+template <typename Fn_>
+void foreach_drm_client(Fn_ &&fn)
+{
+   bhd::DrmUsageSample sample;
+
+   for (int fd : list_fds())
+   {
+      struct stat st;
+
+      if (::fstat(fd, &st) != 0 || !S_ISCHR(st.st_mode))
+         continue;
+
+      char path[48];
+      std::snprintf(path, sizeof(path), "/proc/self/fdinfo/%d", fd);
+
+      auto reader = std::make_unique<bhdi::FdinfoReaderImpl>();
+
+      // Kernels without drm-usage-stats for the driver have nothing to sample,
+      // nor do fds of other character devices
+      if (!reader->open(path) || !reader->sample(sample) || sample.client_id == 0)
+         continue;
+
+      fn(fd, bhdi::DrmClient{ st.st_rdev, sample.client_id }, std::move(reader));
+   }
+}
+
+} // namespace anonymous
+
+namespace behead_egl {
+
+double engine_utilization(const DrmUsageSample &prev, const DrmUsageSample &cur, const char *name) noexcept
+{
+   const DrmEngineUsage *p = nullptr;
+   const DrmEngineUsage *c = nullptr;
+
+   for (std::size_t i = 0; i < prev.engine_count; ++i)
+   {
+      if (same_name(prev.engines[i].name, name))
+         p = &prev.engines[i];
+   }
+
+   for (std::size_t i = 0; i < cur.engine_count; ++i)
+   {
+      if (same_name(cur.engines[i].name, name))
+         c = &cur.engines[i];
+   }
+
+   auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(cur.taken - prev.taken).count();
+
+   if (p == nullptr || c == nullptr || elapsed <= 0 || c->busy_ns < p->busy_ns)
+      return -1.0;
+
+   return double(c->busy_ns - p->busy_ns) / (double(elapsed) * c->capacity);
+}
+
+FdinfoReader::FdinfoReader(const char *path):
+   _impl(std::make_unique<internal::FdinfoReaderImpl>())
+{
+   if (!_impl->open(path))
+   {
+      // ERROR
+      std::cerr << "Failed to open fdinfo " << path << std::endl;
+   }
+}
+
+FdinfoReader::~FdinfoReader() = default;
+
+bool FdinfoReader::ok() const noexcept
+{
+   return _impl->fd.ok();
+}
+
+bool FdinfoReader::sample(DrmUsageSample &out) noexcept
+{
+   return _impl->sample(out);
+}
+
+DrmClientSnapshot::DrmClientSnapshot():
+   _impl(std::make_unique<internal::DrmClientSnapshotImpl>())
+{
+   auto &impl = *_impl;
+
+   try
+   {
+      foreach_drm_client([&] (int, const internal::DrmClient &client, auto &&) {
+         impl.clients.push_back(client);
+      });
+
+      std::sort(impl.clients.begin(), impl.clients.end());
+
+      impl.ok = true;
+   }
+   catch (const std::bad_alloc &)
+   {
+      // ERROR
+      std::cerr << "Out of memory taking drm client snapshot" << std::endl;
+      impl.clients.clear();
+   }
+}
+
+DrmClientSnapshot::~DrmClientSnapshot() = default;
+
+bool DrmClientSnapshot::ok() const noexcept
+{
+   return _impl->ok;
+}
+
+bool track_display_usage(EGLDisplay dpy, const DrmClientSnapshot &before)
+{
+   using bhdi::BeheadEGL;
+
+   try
+   {
+      if (!before.ok())
+         return false;
+
+      const DeviceEXT_Info info = BeheadEGL::get_display_device_info(dpy);
+
+      if (!info.has_EXT_device_drm || info.drm_path == nullptr)
+      {
+         // WARNING
+         std::cerr << "Display isn't on drm device, its usage can't be sampled" << std::endl;
+         return false;
+      }
+
+      auto tracked = std::make_unique<TrackedDisplay>();
+
+      std::vector<bhdi::DrmClient> seen;
+
+      // NB: Drivers open nodes of device themselves (ie. Mesa opens render node even
+      // when given fd), so we look for clients that appeared on display's device
+      // since snapshot; dup'ed fds share client, it is sampled once.
+      foreach_drm_client([&] (int fd, const bhdi::DrmClient &client, auto &&reader) {
+         if (before._impl->contains(client) ||
+             std::find(seen.begin(), seen.end(), client) != seen.end() ||
+             bhdi::match_drm_node(fd, info.drm_path) == bhdi::DrmNodeFlag::None)
+            return;
+
+         seen.push_back(client);
+         tracked->readers.push_back(std::move(reader));
+      });
+
+      if (tracked->readers.empty())
+      {
+         // WARNING
+         std::cerr << "No new drm client with usage stats found for display on " << info.drm_path
+                   << ", its usage can't be sampled" << std::endl;
+         return false;
+      }
+
+      auto &r = registry();
+
+      std::lock_guard guard{r.lock};
+
+      r.displays[dpy] = std::move(tracked);
+
+      return true;
+   }
+   catch (const std::bad_alloc &)
+   {
+      // ERROR
+      std::cerr << "Out of memory tracking display usage" << std::endl;
+   }
+   catch (...)
+   {
+      assert(false && "Leaked exception");
+   }
+
+   return false;
+}
+
+void untrack_display_usage(EGLDisplay dpy)
+{
+   std::unique_ptr<TrackedDisplay> tracked;
+
+   try
+   {
+      auto &r = registry();
+
+      std::lock_guard guard{r.lock};
+
+      auto it = r.displays.find(dpy);
+
+      if (it == r.displays.end())
+         return;
+
+      tracked = std::move(it->second);
+      r.displays.erase(it);
+   }
+   catch (...)
+   {
+      assert(false && "Leaked exception");
+   }
+
+   // NB: Readers are closed outside of lock
+}
+
+bool sample_display_usage(EGLDisplay dpy, DrmUsageSample &out)
+{
+   try
+   {
+      auto &r = registry();
+
+      std::lock_guard guard{r.lock};
+
+      auto it = r.displays.find(dpy);
+
+      if (it == r.displays.end())
+         return false;
+
+      return it->second->sample(out);
+   }
+   catch (...)
+   {
+      assert(false && "Leaked exception");
+   }
+
+   return false;
+}
+
+std::size_t foreach_display_usage(const display_usage_cb_t &cb)
+{
+   if (!cb)
+      return 0;
+
+   std::size_t sampled = 0;
+
+   try
+   {
+      auto &r = registry();
+
+      DrmUsageSample sample;
+
+      // NB: cb runs under lock, it must not track or untrack displays
+      std::lock_guard guard{r.lock};
+
+      for (auto &[dpy, tracked] : r.displays)
+      {
+         if (!tracked->sample(sample))
+            continue;
+
+         cb(dpy, sample);
+         ++sampled;
+      }
+   }
+   catch (...)
+   {
+      assert(false && "Leaked exception");
+   }
+
+   return sampled;
+}
+
+} // namespace behead_egl
@@ -0,0 +1,935 @@
+/*
+ * SPDX-FileCopyrightText: 2020 Piotr Rak <piotr.rak@gamil.com>
+ * SPDX-License-Identifier: MIT
+ */
+#include "bhd/egl_trace.hh"
+#include "bhd/display_cache.hh"
+
+#include "behead_egl_impl.hh"
+#include "egl_trace.hh"
+#include "stats.hh"
+#include "ufd.hh"
+
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <iostream>
+
+namespace bhdi = behead_egl::internal;
+namespace bhd = behead_egl;
+
+namespace {
+
+using std::chrono::steady_clock;
+using bhdi::unique_fd;
+
+struct Counters
+{
+   bhdi::StatCounter &call = bhdi::stat_counter("egl_trace.call");
+};
+
+Counters &counters()
+{
+   static Counters c;
+   return c;
+}
+
+constexpr std::uint32_t FILE_MAGIC = 0x62686474; // 'bhdt'
+constexpr std::uint32_t FILE_VERSION = 1;
+
+constexpr std::uint32_t NULL_STRING = 0xffffffff;
+
+// {{{ Log layout
+//
+// FileHeader, then records up to end of file. Record payload is sequence of
+// fields in order given by Call below; handles are stored as u64, strings as
+// u32 length (NULL_STRING for nullptr) followed by bytes.
+
+struct FileHeader
+{
+   std::uint32_t magic;
+   std::uint32_t version;
+};
+
+struct RecordHeader
+{
+   std::uint8_t  call;
+   std::uint8_t  reserved[3];
+   std::uint32_t size;
+   std::uint64_t duration_ns;
+};
+
+enum class Call : std::uint8_t
+{
+   // u64 dpy, i32 name, str result
+   QueryString = 1,
+   // i32 max_devices, u8 has_devices, i32 num_devices, u32 ret, u64 devices[num_devices]
+   QueryDevices,
+   // u64 dev, i32 name, str result
+   QueryDeviceString,
+   // u64 dev, i32 attribute, u32 ret, i64 value
+   QueryDeviceAttrib,
+   // u64 dpy, i32 attribute, u32 ret, i64 value
+   QueryDisplayAttrib,
+   // u32 platform, u64 native, u32 num_pairs, (i32 key, i32 value)[num_pairs],
+   // str drm_fd_path, u64 result
+   GetPlatformDisplay,
+};
+
+const char *call_name(Call call) noexcept
+{
+   switch (call)
+   {
+      case Call::QueryString:        return "eglQueryString";
+      case Call::QueryDevices:       return "eglQueryDevicesEXT";
+      case Call::QueryDeviceString:  return "eglQueryDeviceStringEXT";
+      case Call::QueryDeviceAttrib:  return "eglQueryDeviceAttribEXT";
+      case Call::QueryDisplayAttrib: return "eglQueryDisplayAttribEXT";
+      case Call::GetPlatformDisplay: return "eglGetPlatformDisplayEXT";
+   }
+
+   return nullptr;
+}
+
+template <typename Ty_>
+std::uint64_t handle(Ty_ *h) noexcept
+{
+   return std::uint64_t(reinterpret_cast<std::uintptr_t>(h));
+}
+
+// }}}
+
+// {{{ Recording
+
+struct Payload
+{
+   std::vector<char> buf;
+
+   template <typename Ty_>
+   void put(Ty_ value)
+   {
+      auto *p = reinterpret_cast<const char *>(&value);
+      buf.insert(buf.end(), p, p + sizeof(value));
+   }
+
+   void put_str(const char *s)
+   {
+      if (s == nullptr)
+      {
+         put(NULL_STRING);
+         return;
+      }
+
+      std::size_t len = std::strlen(s);
+
+      put(std::uint32_t(len));
+      buf.insert(buf.end(), s, s + len);
+   }
+};
+
+struct Trace
+{
+   std::mutex lock;
+
+   unique_fd fd;
+
+   // Procedures were looked up, too late to start recording
+   bool started = false;
+
+   // {{{ Originals, set once before thunks are installed
+
+   PFNEGLQUERYDEVICESEXTPROC query_devices = nullptr;
+   PFNEGLQUERYDEVICEATTRIBEXTPROC query_device_attrib = nullptr;
+   PFNEGLQUERYDEVICESTRINGEXTPROC query_device_string = nullptr;
+   PFNEGLQUERYDISPLAYATTRIBEXTPROC query_display_attrib = nullptr;
+   PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display = nullptr;
+
+   // }}}
+};
+
+Trace &trace()
+{
+   static Trace t;
+   return t;
+}
+
+std::atomic_bool tracing = false;
+
+bool write_all(int fd, const char *data, std::size_t len)
+{
+   std::size_t done = 0;
+
+   while (done < len)
+   {
+      ssize_t n = ::write(fd, data + done, len - done);
+
+      if (n < 0 && errno == EINTR)
+         continue;
+
+      if (n <= 0)
+         return false;
+
+      done += std::size_t(n);
+   }
+
+   return true;
+}
+
+unique_fd create_log(const char *path)
+{
+   unique_fd fd{::open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644)};
+
+   if (!fd.ok())
+      return fd;
+
+   FileHeader fh{FILE_MAGIC, FILE_VERSION};
+
+   if (!write_all(fd.get(), reinterpret_cast<const char *>(&fh), sizeof(fh)))
+      fd.reset();
+
+   return fd;
+}
+
+// NB: Called from thunks, never throws
+void emit(Call call, steady_clock::duration duration, const Payload &payload) noexcept
+{
+   RecordHeader rh{};
+
+   rh.call = std::uint8_t(call);
+   rh.size = std::uint32_t(payload.buf.size());
+   rh.duration_ns = std::uint64_t(std::chrono::nanoseconds(duration).count());
+
+   try
+   {
+      std::vector<char> record(sizeof(rh) + payload.buf.size());
+
+      std::memcpy(record.data(), &rh, sizeof(rh));
+      std::memcpy(record.data() + sizeof(rh), payload.buf.data(), payload.buf.size());
+
+      Trace &t = trace();
+      std::lock_guard guard{t.lock};
+
+      if (!t.fd.ok())
+         return;
+
+      // NB: Whole record at once, log stays readable if we are killed
+      if (!write_all(t.fd.get(), record.data(), record.size()))
+      {
+         // WARNING: we stop recording, partial record is reported by replay
+         std::cerr << "Failed to write EGL trace, recording stopped" << std::endl;
+         t.fd.reset();
+         return;
+      }
+
+      counters().call.add();
+   }
+   catch (...)
+   {
+   }
+}
+
+std::string fd_path(int fd)
+{
+   char link[64];
+   char path[PATH_MAX];
+
+   std::snprintf(link, sizeof(link), "/proc/self/fd/%d", fd);
+
+   ssize_t len = ::readlink(link, path, sizeof(path) - 1);
+
+   if (len <= 0)
+      return {};
+
+   return std::string(path, std::size_t(len));
+}
+
+// {{{ Thunks
+
+EGLBoolean EGLAPIENTRY thunk_query_devices(EGLint max_devices, EGLDeviceEXT *devices,
+                                           EGLint *num_devices)
+{
+   auto start = steady_clock::now();
+   EGLBoolean ret = trace().query_devices(max_devices, devices, num_devices);
+   auto duration = steady_clock::now() - start;
+
+   EGLint num = (ret == EGL_TRUE) ? *num_devices : 0;
+
+   try
+   {
+      Payload p;
+
+      p.put(std::int32_t(max_devices));
+      p.put(std::uint8_t(devices != nullptr));
+      p.put(std::int32_t(num));
+      p.put(std::uint32_t(ret));
+
+      if (devices != nullptr)
+      {
+         for (EGLint i = 0; i < num; ++i)
+            p.put(handle(devices[i]));
+      }
+
+      emit(Call::QueryDevices, duration, p);
+   }
+   catch (...)
+   {
+   }
+
+   return ret;
+}
+
+EGLBoolean EGLAPIENTRY thunk_query_device_attrib(EGLDeviceEXT dev, EGLint attribute,
+                                                 EGLAttrib *value)
+{
+   auto start = steady_clock::now();
+   EGLBoolean ret = trace().query_device_attrib(dev, attribute, value);
+   auto duration = steady_clock::now() - start;
+
+   try
+   {
+      Payload p;
+
+      p.put(handle(dev));
+      p.put(std::int32_t(attribute));
+      p.put(std::uint32_t(ret));
+      p.put(std::int64_t(ret == EGL_TRUE ? *value : 0));
+
+      emit(Call::QueryDeviceAttrib, duration, p);
+   }
+   catch (...)
+   {
+   }
+
+   return ret;
+}
+
+const char * EGLAPIENTRY thunk_query_device_string(EGLDeviceEXT dev, EGLint name)
+{
+   auto start = steady_clock::now();
+   const char *ret = trace().query_device_string(dev, name);
+   auto duration = steady_clock::now() - start;
+
+   try
+   {
+      Payload p;
+
+      p.put(handle(dev));
+      p.put(std::int32_t(name));
+      p.put_str(ret);
+
+      emit(Call::QueryDeviceString, duration, p);
+   }
+   catch (...)
+   {
+   }
+
+   return ret;
+}
+
+EGLBoolean EGLAPIENTRY thunk_query_display_attrib(EGLDisplay dpy, EGLint attribute,
+                                                  EGLAttrib *value)
+{
+   auto start = steady_clock::now();
+   EGLBoolean ret = trace().query_display_attrib(dpy, attribute, value);
+   auto duration = steady_clock::now() - start;
+
+   try
+   {
+      Payload p;
+
+      p.put(handle(dpy));
+      p.put(std::int32_t(attribute));
+      p.put(std::uint32_t(ret));
+      p.put(std::int64_t(ret == EGL_TRUE ? *value : 0));
+
+      emit(Call::QueryDisplayAttrib, duration, p);
+   }
+   catch (...)
+   {
+   }
+
+   return ret;
+}
+
+EGLDisplay EGLAPIENTRY thunk_get_platform_display(EGLenum platform, void *native_display,
+                                                  const EGLint *attrib_list)
+{
+   auto start = steady_clock::now();
+   EGLDisplay ret = trace().get_platform_display(platform, native_display, attrib_list);
+   auto duration = steady_clock::now() - start;
+
+   try
+   {
+      Payload p;
+      std::string drm_fd_path;
+      std::uint32_t num_pairs = 0;
+
+      for (const EGLint *a = attrib_list; a != nullptr && *a != EGL_NONE; a += 2)
+         ++num_pairs;
+
+      p.put(std::uint32_t(platform));
+      p.put(handle(native_display));
+      p.put(num_pairs);
+
+      for (std::uint32_t i = 0; i < num_pairs; ++i)
+      {
+         p.put(std::int32_t(attrib_list[2 * i]));
+         p.put(std::int32_t(attrib_list[2 * i + 1]));
+
+         // fd number means nothing to replay, node does
+         if (attrib_list[2 * i] == EGL_DRM_MASTER_FD_EXT)
+            drm_fd_path = fd_path(attrib_list[2 * i + 1]);
+      }
+
+      p.put_str(drm_fd_path.empty() ? nullptr : drm_fd_path.c_str());
+      p.put(handle(ret));
+
+      emit(Call::GetPlatformDisplay, duration, p);
+   }
+   catch (...)
+   {
+   }
+
+   return ret;
+}
+
+// }}}
+
+// }}}
+
+// {{{ Replay
+
+struct Cursor
+{
+   const char *pos;
+   const char *end;
+
+   bool ok = true;
+
+   template <typename Ty_>
+   Ty_ get() noexcept
+   {
+      Ty_ value{};
+
+      if (std::size_t(end - pos) < sizeof(value))
+      {
+         ok = false;
+         return value;
+      }
+
+      std::memcpy(&value, pos, sizeof(value));
+      pos += sizeof(value);
+
+      return value;
+   }
+
+   // Returns nullptr for null string, otherwise storage holding it
+   const std::string *get_str(std::string &storage) noexcept
+   {
+      auto len = get<std::uint32_t>();
+
+      if (!ok || len == NULL_STRING)
+         return nullptr;
+
+      if (std::size_t(end - pos) < len)
+      {
+         ok = false;
+         return nullptr;
+      }
+
+      storage.assign(pos, len);
+      pos += len;
+
+      return &storage;
+   }
+};
+
+bool read_file(const char *path, std::vector<char> &out)
+{
+   unique_fd fd{::open(path, O_RDONLY | O_CLOEXEC)};
+
+   if (!fd.ok())
+      return false;
+
+   struct stat st;
+
+   if (::fstat(fd.get(), &st) != 0)
+      return false;
+
+   out.resize(std::size_t(st.st_size));
+
+   std::size_t done = 0;
+
+   while (done < out.size())
+   {
+      ssize_t n = ::read(fd.get(), out.data() + done, out.size() - done);
+
+      if (n < 0 && errno == EINTR)
+         continue;
+
+      if (n <= 0)
+         return false;
+
+      done += std::size_t(n);
+   }
+
+   return true;
+}
+
+bool same_string(const std::string *recorded, const char *live) noexcept
+{
+   if (recorded == nullptr || live == nullptr)
+      return recorded == nullptr && live == nullptr;
+
+   return *recorded == live;
+}
+
+struct Replayer
+{
+   PFNEGLQUERYDEVICESEXTPROC query_devices = nullptr;
+   PFNEGLQUERYDEVICEATTRIBEXTPROC query_device_attrib = nullptr;
+   PFNEGLQUERYDEVICESTRINGEXTPROC query_device_string = nullptr;
+   PFNEGLQUERYDISPLAYATTRIBEXTPROC query_display_attrib = nullptr;
+   PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display = nullptr;
+
+   // Recorded handle -> live one, devices and displays alike
+   std::unordered_map<std::uint64_t, void *> handles;
+
+   // Created displays, initialized as caller of library had to
+   std::vector<EGLDisplay> displays;
+
+   std::string str_storage;
+
+   ~Replayer()
+   {
+      for (EGLDisplay dpy : displays)
+         bhd::terminate_display(dpy);
+   }
+
+   bool lookup(std::uint64_t recorded, void *&live) const
+   {
+      if (recorded == 0)
+      {
+         live = nullptr;
+         return true;
+      }
+
+      auto it = handles.find(recorded);
+
+      if (it == handles.end())
+         return false;
+
+      live = it->second;
+      return true;
+   }
+
+   void map(std::uint64_t recorded, void *live)
+   {
+      if (recorded != 0 && live != nullptr)
+         handles.emplace(recorded, live);
+   }
+
+   // Performs call, fills in replayed, skipped and matched
+   void replay(Call call, Cursor &c, bhd::ReplayedCall &out);
+};
+
+void Replayer::replay(Call call, Cursor &c, bhd::ReplayedCall &out)
+{
+   steady_clock::time_point start;
+   steady_clock::time_point stop;
+
+   switch (call)
+   {
+      case Call::QueryString:
+      {
+         auto dpy = c.get<std::uint64_t>();
+         auto name = c.get<std::int32_t>();
+         auto *result = c.get_str(str_storage);
+
+         void *live_dpy;
+
+         if (!c.ok || !lookup(dpy, live_dpy))
+            break;
+
+         start = steady_clock::now();
+         const char *live = eglQueryString(live_dpy, name);
+         stop = steady_clock::now();
+
+         out.matched = same_string(result, live);
+         out.skipped = false;
+         break;
+      }
+
+      case Call::QueryDevices:
+      {
+         auto max_devices = c.get<std::int32_t>();
+         auto has_devices = c.get<std::uint8_t>();
+         auto num = c.get<std::int32_t>();
+         auto ret = c.get<std::uint32_t>();
+
+         std::vector<std::uint64_t> recorded;
+
+         if (has_devices)
+         {
+            for (std::int32_t i = 0; c.ok && i < num; ++i)
+               recorded.push_back(c.get<std::uint64_t>());
+         }
+
+         if (!c.ok || query_devices == nullptr || max_devices < 0)
+            break;
+
+         std::vector<EGLDeviceEXT> devices(has_devices ? std::size_t(max_devices) : 0);
+         EGLint live_num = 0;
+
+         start = steady_clock::now();
+         EGLBoolean live_ret = query_devices(max_devices,
+                                             has_devices ? devices.data() : nullptr,
+                                             &live_num);
+         stop = steady_clock::now();
+
+         if (live_ret != EGL_TRUE)
+            live_num = 0;
+
+         // NB: Mapped by position, enumeration order is stable for given driver
+         for (std::size_t i = 0; i < recorded.size() && i < std::size_t(live_num); ++i)
+            map(recorded[i], devices[i]);
+
+         out.matched = (live_ret == ret) && (live_num == num);
+         out.skipped = false;
+         break;
+      }
+
+      case Call::QueryDeviceString:
+      {
+         auto dev = c.get<std::uint64_t>();
+         auto name = c.get<std::int32_t>();
+         auto *result = c.get_str(str_storage);
+
+         void *live_dev;
+
+         if (!c.ok || query_device_string == nullptr || !lookup(dev, live_dev))
+            break;
+
+         start = steady_clock::now();
+         const char *live = query_device_string(live_dev, name);
+         stop = steady_clock::now();
+
+         out.matched = same_string(result, live);
+         out.skipped = false;
+         break;
+      }
+
+      case Call::QueryDeviceAttrib:
+      {
+         auto dev = c.get<std::uint64_t>();
+         auto attribute = c.get<std::int32_t>();
+         auto ret = c.get<std::uint32_t>();
+         auto value = c.get<std::int64_t>();
+
+         void *live_dev;
+
+         if (!c.ok || query_device_attrib == nullptr || !lookup(dev, live_dev))
+            break;
+
+         EGLAttrib live_value = 0;
+
+         start = steady_clock::now();
+         EGLBoolean live_ret = query_device_attrib(live_dev, attribute, &live_value);
+         stop = steady_clock::now();
+
+         out.matched = (live_ret == ret) && (ret != EGL_TRUE || std::int64_t(live_value) == value);
+         out.skipped = false;
+         break;
+      }
+
+      case Call::QueryDisplayAttrib:
+      {
+         auto dpy = c.get<std::uint64_t>();
+         auto attribute = c.get<std::int32_t>();
+         auto ret = c.get<std::uint32_t>();
+         auto value = c.get<std::int64_t>();
+
+         void *live_dpy;
+
+         if (!c.ok || query_display_attrib == nullptr || !lookup(dpy, live_dpy))
+            break;
+
+         EGLAttrib live_value = 0;
+
+         start = steady_clock::now();
+         EGLBoolean live_ret = query_display_attrib(live_dpy, attribute, &live_value);
+         stop = steady_clock::now();
+
+         bool same_value = std::int64_t(live_value) == value;
+
+         if (live_ret == EGL_TRUE && attribute == EGL_DEVICE_EXT)
+         {
+            void *mapped;
+
+            // Device not enumerated in log is taken as it comes
+            if (lookup(std::uint64_t(value), mapped))
+            {
+               same_value = mapped == reinterpret_cast<void *>(live_value);
+            }
+            else
+            {
+               map(std::uint64_t(value), reinterpret_cast<void *>(live_value));
+               same_value = true;
+            }
+         }
+
+         out.matched = (live_ret == ret) && (ret != EGL_TRUE || same_value);
+         out.skipped = false;
+         break;
+      }
+
+      case Call::GetPlatformDisplay:
+      {
+         auto platform = c.get<std::uint32_t>();
+         auto native = c.get<std::uint64_t>();
+         auto num_pairs = c.get<std::uint32_t>();
+
+         std::vector<EGLint> attribs;
+
+         for (std::uint32_t i = 0; c.ok && i < num_pairs; ++i)
+         {
+            attribs.push_back(c.get<std::int32_t>());
+            attribs.push_back(c.get<std::int32_t>());
+         }
+
+         attribs.push_back(EGL_NONE);
+
+         auto *drm_fd_path = c.get_str(str_storage);
+         auto result = c.get<std::uint64_t>();
+
+         void *live_native;
+
+         // NB: Only device platform, native display of others can't be recreated
+         if (!c.ok || get_platform_display == nullptr
+             || platform != EGL_PLATFORM_DEVICE_EXT || !lookup(native, live_native))
+            break;
+
+         unique_fd drm_fd;
+
+         for (std::size_t i = 0; i + 1 < attribs.size(); i += 2)
+         {
+            if (attribs[i] != EGL_DRM_MASTER_FD_EXT)
+               continue;
+
+            if (drm_fd_path != nullptr)
+               drm_fd = unique_fd{::open(drm_fd_path->c_str(), O_RDWR | O_CLOEXEC)};
+
+            if (!drm_fd.ok())
+               return;
+
+            attribs[i + 1] = drm_fd.get();
+         }
+
+         start = steady_clock::now();
+         EGLDisplay live = get_platform_display(platform, live_native,
+                                                num_pairs != 0 ? attribs.data() : nullptr);
+         stop = steady_clock::now();
+
+         map(result, live);
+
+         // NB: Not timed, display queries in log were made on initialized ones
+         if (live != EGL_NO_DISPLAY
+             && std::find(displays.begin(), displays.end(), live) == displays.end()
+             && eglInitialize(live, nullptr, nullptr) == EGL_TRUE)
+            displays.push_back(live);
+
+         out.matched = (result == 0) == (live == EGL_NO_DISPLAY);
+         out.skipped = false;
+         break;
+      }
+   }
+
+   if (!out.skipped)
+      out.replayed = stop - start;
+}
+
+// }}}
+
+} // namespace anonymous
+
+namespace behead_egl::internal {
+
+bool egl_trace_start()
+{
+   Trace &t = trace();
+   std::lock_guard guard{t.lock};
+
+   t.started = true;
+
+   if (!t.fd.ok())
+   {
+      const char *env = std::getenv("BEHEAD_EGL_TRACE");
+
+      if (env != nullptr && *env != '\0')
+      {
+         t.fd = create_log(env);
+
+         // WARNING: asked for it, but we run without it
+         if (!t.fd.ok())
+            std::cerr << "Failed to create EGL trace: " << env << std::endl;
+      }
+   }
+
+   tracing.store(t.fd.ok(), std::memory_order_relaxed);
+
+   return t.fd.ok();
+}
+
+const char *traced_query_string(EGLDisplay dpy, EGLint name)
+{
+   if (!tracing.load(std::memory_order_relaxed))
+      return eglQueryString(dpy, name);
+
+   auto start = steady_clock::now();
+   const char *ret = eglQueryString(dpy, name);
+   auto duration = steady_clock::now() - start;
+
+   try
+   {
+      Payload p;
+
+      p.put(handle(dpy));
+      p.put(std::int32_t(name));
+      p.put_str(ret);
+
+      emit(Call::QueryString, duration, p);
+   }
+   catch (...)
+   {
+   }
+
+   return ret;
+}
+
+void egl_trace_hook(PFNEGLQUERYDEVICESEXTPROC &query_devices,
+                    PFNEGLQUERYDEVICEATTRIBEXTPROC &query_device_attrib,
+                    PFNEGLQUERYDEVICESTRINGEXTPROC &query_device_string,
+                    PFNEGLQUERYDISPLAYATTRIBEXTPROC &query_display_attrib,
+                    PFNEGLGETPLATFORMDISPLAYEXTPROC &get_platform_display)
+{
+   assert(tracing.load(std::memory_order_relaxed));
+
+   Trace &t = trace();
+
+   // NB: Written once under BeheadEGL once_flag, before any thunk can run
+   t.query_devices = std::exchange(query_devices, &thunk_query_devices);
+   t.query_device_attrib = std::exchange(query_device_attrib, &thunk_query_device_attrib);
+   t.query_device_string = std::exchange(query_device_string, &thunk_query_device_string);
+   t.query_display_attrib = std::exchange(query_display_attrib, &thunk_query_display_attrib);
+   t.get_platform_display = std::exchange(get_platform_display, &thunk_get_platform_display);
+}
+
+} // namespace behead_egl::internal
+
+namespace behead_egl {
+
+bool record_egl_calls(const char *path)
+{
+   try
+   {
+      Trace &t = trace();
+      std::lock_guard guard{t.lock};
+
+      if (t.started)
+         return false;
+
+      t.fd = create_log(path);
+
+      return t.fd.ok();
+   }
+   catch (...)
+   {
+      assert(false && "Leaked exception");
+   }
+
+   return false;
+}
+
+bool replay_egl_calls(const char *path, const replay_cb_t &cb)
+{
+   try
+   {
+      std::vector<char> log;
+
+      if (!read_file(path, log) || log.size() < sizeof(FileHeader))
+         return false;
+
+      FileHeader fh;
+      std::memcpy(&fh, log.data(), sizeof(fh));
+
+      if (fh.magic != FILE_MAGIC || fh.version != FILE_VERSION)
+         return false;
+
+      Replayer r;
+
+      // NB: Looked up on our own, BeheadEGL procedures could be recording thunks
+      bhdi::set_egl_proc(r.query_devices, "eglQueryDevicesEXT");
+      bhdi::set_egl_proc(r.query_device_attrib, "eglQueryDeviceAttribEXT");
+      bhdi::set_egl_proc(r.query_device_string, "eglQueryDeviceStringEXT");
+      bhdi::set_egl_proc(r.query_display_attrib, "eglQueryDisplayAttribEXT");
+      bhdi::set_egl_proc(r.get_platform_display, "eglGetPlatformDisplayEXT");
+
+      Cursor c{log.data() + sizeof(fh), log.data() + log.size()};
+      std::uint32_t index = 0;
+
+      while (c.pos != c.end)
+      {
+         auto rh = c.get<RecordHeader>();
+
+         if (!c.ok || std::size_t(c.end - c.pos) < rh.size)
+            return false;
+
+         ReplayedCall out;
+
+         out.name = call_name(Call(rh.call));
+         out.index = index++;
+         out.recorded = std::chrono::nanoseconds(rh.duration_ns);
+         out.skipped = true;
+
+         if (out.name == nullptr)
+            return false;
+
+         Cursor payload{c.pos, c.pos + rh.size};
+
+         r.replay(Call(rh.call), payload, out);
+
+         if (!payload.ok)
+            return false;
+
+         c.pos += rh.size;
+
+         if (cb)
+            cb(out);
+      }
+
+      return true;
+   }
+   catch (...)
+   {
+      assert(false && "Leaked exception");
+   }
+
+   return false;
+}
+
+} // namespace behead_egl
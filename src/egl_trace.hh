@@ -0,0 +1,27 @@
+/*
+ * SPDX-FileCopyrightText: 2020 Piotr Rak <piotr.rak@gamil.com>
+ * SPDX-License-Identifier: MIT
+ */
+#pragma once
+
+#include "bhd/behead_egl.hh"
+
+namespace behead_egl::internal {
+
+// NB: Implemented in egl_trace.cc, called only from BeheadEGL::_do_init_egl_client_procs
+
+// Opens log requested by record_egl_calls() or BEHEAD_EGL_TRACE,
+// later requests are refused. Returns true if calls are being recorded.
+bool egl_trace_start();
+
+// eglQueryString(), recorded when tracing
+const char *traced_query_string(EGLDisplay dpy, EGLint name);
+
+// Replaces procedures with recording thunks calling through to originals
+void egl_trace_hook(PFNEGLQUERYDEVICESEXTPROC &query_devices,
+                    PFNEGLQUERYDEVICEATTRIBEXTPROC &query_device_attrib,
+                    PFNEGLQUERYDEVICESTRINGEXTPROC &query_device_string,
+                    PFNEGLQUERYDISPLAYATTRIBEXTPROC &query_display_attrib,
+                    PFNEGLGETPLATFORMDISPLAYEXTPROC &get_platform_display);
+
+} // namespace behead_egl::internal
@@ -0,0 +1,519 @@
+/*
+ * SPDX-FileCopyrightText: 2020 Piotr Rak <piotr.rak@gamil.com>
+ * SPDX-License-Identifier: MIT
+ */
+#include "bhd/failover.hh"
+
+#include "behead_egl_impl.hh"
+#include "display_cache.hh"
+#include "minigl.hh"
+#include "stats.hh"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <condition_variable>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <iostream>
+
+namespace bhdi = behead_egl::internal;
+namespace bhd = behead_egl;
+
+namespace {
+
+using std::chrono::steady_clock;
+
+struct Counters
+{
+   bhdi::StatCounter &reset    = bhdi::stat_counter("failover.reset");
+   bhdi::StatCounter &recovery = bhdi::stat_counter("failover.recovery");
+};
+
+Counters &counters()
+{
+   static Counters c;
+   return c;
+}
+
+struct Watched
+{
+   EGLDisplay dpy = EGL_NO_DISPLAY;
+   EGLDeviceEXT dev = nullptr;
+
+   // Guard context, current only on watcher thread during checks
+   EGLContext guard = EGL_NO_CONTEXT;
+
+   // Guard context reports resets
+   bool robust = false;
+};
+
+enum class RequestKind
+{
+   Watch,
+   Unwatch,
+};
+
+struct Request
+{
+   RequestKind kind = RequestKind::Watch;
+   EGLDisplay dpy = EGL_NO_DISPLAY;
+
+   std::promise<bool> *done = nullptr;
+};
+
+enum class CheckResult
+{
+   Healthy,
+   Lost,
+   // Terminated by client or otherwise gone, stop watching quietly
+   Gone,
+};
+
+// Creates and initializes display on best healthy device
+EGLDisplay create_replacement(const bhd::FailoverOpts &opts, EGLDeviceEXT &dev)
+{
+   using bhdi::BeheadEGL;
+
+   if (!BeheadEGL::ensure_client_extensions())
+      return EGL_NO_DISPLAY;
+
+   bhdi::VecDevInfos infos = BeheadEGL::query_device_infos();
+
+   bhdi::VecDevInfoPtrs candidates = BeheadEGL::rank_display_devices(infos);
+
+   if (opts.allow_software)
+   {
+      for (const auto &info : infos)
+      {
+         if (info.has_MESA_device_software && !info.has_EXT_device_drm && !info.marked_unhealthy)
+            candidates.push_back(&info);
+      }
+   }
+
+   for (const auto *info : candidates)
+   {
+      EGLDisplay dpy = bhd::create_headless_display(*info, opts.usage);
+
+      if (dpy == EGL_NO_DISPLAY)
+         continue;
+
+      if (eglInitialize(dpy, nullptr, nullptr) != EGL_TRUE)
+      {
+         // WARNING
+         std::cerr << "Failed to initialize replacement display (EGLError: "
+                   << eglGetError() << ")" << std::endl;
+         continue;
+      }
+
+      dev = info->egl_device_ext;
+      return dpy;
+   }
+
+   return EGL_NO_DISPLAY;
+}
+
+} // namespace anonymous
+
+namespace behead_egl::internal {
+
+struct DisplayFailoverImpl
+{
+   failover_cb_t cb;
+   FailoverOpts opts;
+
+   mutable std::mutex lock;
+   std::condition_variable wake;
+
+   // {{{ Guarded by lock
+
+   std::vector<Request> requests;
+   std::vector<EGLDisplay> reported;
+
+   bool stopping = false;
+
+   // }}}
+
+   std::atomic<std::size_t> watched_count = 0;
+
+   // Watcher thread only
+   std::vector<Watched> watched;
+
+   std::thread thread;
+
+   void watcher_main();
+
+   bool add(EGLDisplay dpy);
+   void remove(EGLDisplay dpy);
+
+   CheckResult check(Watched &w, std::uint32_t &status);
+
+   void fail_over(Watched w, std::uint32_t status);
+
+   // Queues request for watcher thread and waits for it to be processed
+   bool request(RequestKind kind, EGLDisplay dpy);
+
+   bool on_watcher_thread() const
+   {
+      return std::this_thread::get_id() == thread.get_id();
+   }
+};
+
+bool DisplayFailoverImpl::add(EGLDisplay dpy)
+{
+   auto existing = std::find_if(watched.begin(), watched.end(),
+                                [dpy] (const Watched &w) { return w.dpy == dpy; });
+
+   if (existing != watched.end())
+      return true;
+
+   Watched w;
+
+   w.dpy = dpy;
+   w.dev = get_initialized_display_device_info(dpy).egl_device_ext;
+
+   ContextOpts ctx_opts = opts.context;
+   ctx_opts.robust = true;
+
+   w.robust = bhdi::display_has_extension(dpy, bhdi::DisplayExt::EXT_create_context_robustness);
+
+   w.guard = create_headless_context(dpy, ctx_opts);
+
+   if (w.guard == EGL_NO_CONTEXT)
+   {
+      // ERROR
+      std::cerr << "Failed to create guard context for watched display" << std::endl;
+      return false;
+   }
+
+   watched.push_back(w);
+   watched_count.store(watched.size(), std::memory_order_relaxed);
+
+   return true;
+}
+
+void DisplayFailoverImpl::remove(EGLDisplay dpy)
+{
+   auto it = std::find_if(watched.begin(), watched.end(),
+                          [dpy] (const Watched &w) { return w.dpy == dpy; });
+
+   if (it == watched.end())
+      return;
+
+   eglDestroyContext(it->dpy, it->guard);
+
+   watched.erase(it);
+   watched_count.store(watched.size(), std::memory_order_relaxed);
+}
+
+CheckResult DisplayFailoverImpl::check(Watched &w, std::uint32_t &status)
+{
+   status = 0;
+
+   if (eglMakeCurrent(w.dpy, EGL_NO_SURFACE, EGL_NO_SURFACE, w.guard) != EGL_TRUE)
+   {
+      EGLint err = eglGetError();
+
+      if (err == EGL_CONTEXT_LOST)
+         return CheckResult::Lost;
+
+      if (err != EGL_NOT_INITIALIZED && err != EGL_BAD_DISPLAY)
+      {
+         // WARNING
+         std::cerr << "Watched display became unusable (EGLError: " << err << ")" << std::endl;
+      }
+
+      return CheckResult::Gone;
+   }
+
+   const auto &gl = gl_procs();
+
+   if (w.robust && gl.glGetGraphicsResetStatus != nullptr)
+      status = gl.glGetGraphicsResetStatus();
+
+   eglMakeCurrent(w.dpy, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+
+   return status == GL_NO_ERROR ? CheckResult::Healthy : CheckResult::Lost;
+}
+
+void DisplayFailoverImpl::fail_over(Watched w, std::uint32_t status)
+{
+   auto start = steady_clock::now();
+
+   counters().reset.add();
+
+   // NB: Context lost on reset can only be destroyed.
+   eglDestroyContext(w.dpy, w.guard);
+
+   if (w.dev != nullptr)
+      mark_device_unhealthy(w.dev);
+
+   FailoverEvent ev;
+
+   ev.lost_display = w.dpy;
+   ev.lost_device = w.dev;
+   ev.reset_status = status;
+
+   try
+   {
+      ev.replacement = create_replacement(opts, ev.replacement_device);
+   }
+   catch (const std::runtime_error &e)
+   {
+      // ERROR
+      std::cerr << "Failed to create replacement display" << std::endl;
+      std::cerr << e.what() << std::endl;
+   }
+
+   if (ev.replacement != EGL_NO_DISPLAY && !add(ev.replacement))
+   {
+      // WARNING
+      std::cerr << "Replacement display isn't watched" << std::endl;
+   }
+
+   if (ev.replacement == EGL_NO_DISPLAY)
+   {
+      // ERROR
+      std::cerr << "No healthy device left to fail over to" << std::endl;
+   }
+
+   ev.recovery_time = steady_clock::now() - start;
+
+   counters().recovery.record(ev.recovery_time);
+
+   try
+   {
+      cb(ev);
+   }
+   catch (...)
+   {
+      // WARNING
+      std::cerr << "Failover callback has thrown" << std::endl;
+   }
+}
+
+bool DisplayFailoverImpl::request(RequestKind kind, EGLDisplay dpy)
+{
+   // Callback may (un)watch displays, serve it right away
+   if (on_watcher_thread())
+   {
+      if (kind == RequestKind::Watch)
+         return add(dpy);
+
+      remove(dpy);
+      return true;
+   }
+
+   std::promise<bool> done;
+   auto result = done.get_future();
+
+   {
+      std::lock_guard guard{lock};
+
+      if (stopping)
+         return false;
+
+      requests.push_back(Request{kind, dpy, &done});
+   }
+
+   wake.notify_one();
+
+   return result.get();
+}
+
+void DisplayFailoverImpl::watcher_main()
+{
+   std::unique_lock guard{lock};
+
+   while (!stopping)
+   {
+      auto pending_requests = std::move(requests);
+      auto pending_reported = std::move(reported);
+
+      requests.clear();
+      reported.clear();
+
+      guard.unlock();
+
+      for (auto &r : pending_requests)
+      {
+         bool ok = true;
+
+         if (r.kind == RequestKind::Watch)
+            ok = add(r.dpy);
+         else
+            remove(r.dpy);
+
+         r.done->set_value(ok);
+      }
+
+      for (EGLDisplay dpy : pending_reported)
+      {
+         auto it = std::find_if(watched.begin(), watched.end(),
+                                [dpy] (const Watched &w) { return w.dpy == dpy; });
+
+         if (it == watched.end())
+            continue;
+
+         Watched w = *it;
+
+         watched.erase(it);
+         watched_count.store(watched.size(), std::memory_order_relaxed);
+
+         fail_over(w, 0);
+      }
+
+      // NB: fail_over() appends replacements, those get checked next round.
+      for (std::size_t i = 0, n = watched.size(); i < n && i < watched.size(); )
+      {
+         std::uint32_t status = 0;
+
+         CheckResult result = check(watched[i], status);
+
+         if (result == CheckResult::Healthy)
+         {
+            ++i;
+            continue;
+         }
+
+         Watched w = watched[i];
+
+         watched.erase(watched.begin() + std::ptrdiff_t(i));
+         watched_count.store(watched.size(), std::memory_order_relaxed);
+         --n;
+
+         if (result == CheckResult::Lost)
+            fail_over(w, status);
+      }
+
+      guard.lock();
+
+      wake.wait_for(guard, opts.poll_interval, [this] {
+         return stopping || !requests.empty() || !reported.empty();
+      });
+   }
+
+   for (auto &r : requests)
+      r.done->set_value(false);
+
+   requests.clear();
+
+   guard.unlock();
+
+   for (auto &w : watched)
+      eglDestroyContext(w.dpy, w.guard);
+
+   watched.clear();
+   watched_count.store(0, std::memory_order_relaxed);
+
+   eglReleaseThread();
+}
+
+} // namespace behead_egl::internal
+
+namespace behead_egl
+{
+
+DisplayFailover::DisplayFailover(failover_cb_t cb, const FailoverOpts &opts):
+   _impl(std::make_unique<internal::DisplayFailoverImpl>())
+{
+   if (!cb)
+   {
+      // ERROR
+      std::cerr << "Invalid display failover setup" << std::endl;
+      return;
+   }
+
+   _impl->cb = std::move(cb);
+   _impl->opts = opts;
+
+   _impl->thread = std::thread([impl = _impl.get()] { impl->watcher_main(); });
+}
+
+DisplayFailover::~DisplayFailover()
+{
+   if (!ok())
+      return;
+
+   {
+      std::lock_guard guard{_impl->lock};
+      _impl->stopping = true;
+   }
+
+   _impl->wake.notify_one();
+   _impl->thread.join();
+}
+
+bool DisplayFailover::ok() const noexcept
+{
+   return _impl->thread.joinable();
+}
+
+EGLDisplay DisplayFailover::create_display()
+{
+   if (!ok())
+      return EGL_NO_DISPLAY;
+
+   EGLDeviceEXT dev = nullptr;
+   EGLDisplay dpy = EGL_NO_DISPLAY;
+
+   try
+   {
+      dpy = create_replacement(_impl->opts, dev);
+   }
+   catch (const std::runtime_error &e)
+   {
+      // ERROR
+      std::cerr << "Failed to create display" << std::endl;
+      std::cerr << e.what() << std::endl;
+      return EGL_NO_DISPLAY;
+   }
+
+   if (dpy != EGL_NO_DISPLAY && !watch(dpy))
+   {
+      // WARNING
+      std::cerr << "Created display isn't watched" << std::endl;
+   }
+
+   return dpy;
+}
+
+bool DisplayFailover::watch(EGLDisplay dpy)
+{
+   if (!ok() || dpy == EGL_NO_DISPLAY)
+      return false;
+
+   return _impl->request(RequestKind::Watch, dpy);
+}
+
+void DisplayFailover::unwatch(EGLDisplay dpy)
+{
+   if (!ok() || dpy == EGL_NO_DISPLAY)
+      return;
+
+   _impl->request(RequestKind::Unwatch, dpy);
+}
+
+void DisplayFailover::report_lost(EGLDisplay dpy)
+{
+   if (!ok() || dpy == EGL_NO_DISPLAY)
+      return;
+
+   {
+      std::lock_guard guard{_impl->lock};
+      _impl->reported.push_back(dpy);
+   }
+
+   _impl->wake.notify_one();
+}
+
+std::size_t DisplayFailover::watched() const
+{
+   return _impl->watched_count.load(std::memory_order_relaxed);
+}
+
+} // namespace behead_egl
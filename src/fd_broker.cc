@@ -0,0 +1,406 @@
+/*
+ * SPDX-FileCopyrightText: 2020 Piotr Rak <piotr.rak@gamil.com>
+ * SPDX-License-Identifier: MIT
+ */
+#include "bhd/fd_broker.hh"
+
+#include "display_strategy.hh"
+#include "minidrm.hh"
+#include "scm_rights.hh"
+
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstdint>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <iostream>
+
+namespace bhdi = behead_egl::internal;
+namespace bhd = behead_egl;
+
+namespace {
+
+// {{{ Wire protocol
+//
+// Client sends BrokerRequest, broker answers with BrokerReply;
+// on success node fd is attached to reply as SCM_RIGHTS.
+// Both sides run on same host, thus native byte order.
+
+constexpr std::uint32_t BROKER_MAGIC = 0x62686466; // 'bhdf'
+
+// How long serve() waits on single client to send rest of request or take reply,
+// before it drops it
+constexpr timeval CLIENT_IO_TIMEOUT = { 1, 0 };
+
+struct BrokerRequest
+{
+   std::uint32_t magic;
+   std::uint32_t device_index;
+   std::uint32_t node_usage;
+};
+
+struct BrokerReply
+{
+   std::uint32_t magic;
+   std::int32_t  status;       // 0 or errno value
+   std::uint32_t node;         // DrmNodeFlag of attached fd
+   std::uint32_t device_count;
+};
+
+// }}}
+
+bool is_valid_usage(std::uint32_t usage) noexcept
+{
+   using bhd::DrmNodeUsage;
+
+   switch (DrmNodeUsage(usage))
+   {
+   case DrmNodeUsage::UsePrimary:
+   case DrmNodeUsage::UseRender:
+   case DrmNodeUsage::UsePrimaryFallbackToRender:
+   case DrmNodeUsage::UseRenderFallbackToPrimary:
+      return true;
+   }
+
+   return false;
+}
+
+const bhdi::unique_fd &node_fd(const bhdi::DrmNodeFds &fds, bhdi::DrmNodeFlag node)
+{
+   assert(node == bhdi::DrmNodeFlag::Primary || node == bhdi::DrmNodeFlag::Render);
+
+   return node == bhdi::DrmNodeFlag::Primary ? fds.primary_fd : fds.render_fd;
+}
+
+} // namespace anonymous
+
+namespace behead_egl::internal {
+
+enum class ServeResult
+{
+   Served,
+   // Peer closed connection
+   Closed,
+   // I/O or protocol error
+   Failed,
+};
+
+struct DrmFdBrokerImpl
+{
+   std::vector<DrmNodeFds> devices;
+
+   ~DrmFdBrokerImpl();
+
+   BrokerReply handle(const BrokerRequest &req, int &fd_out) const;
+
+   // Receives and answers single request on conn_fd
+   ServeResult serve_request(int conn_fd) const;
+};
+
+DrmFdBrokerImpl::~DrmFdBrokerImpl()
+{
+   // NB: Nodes were opened back to back, so they mostly form runs closed
+   // by single close_range() each, rather than two close() per device.
+   unique_fd_set fds;
+
+   try
+   {
+      fds.reserve(devices.size() * 2);
+   }
+   catch (const std::bad_alloc &)
+   {
+      // Closed one by one with devices
+      return;
+   }
+
+   for (auto &d : devices)
+   {
+      fds.push_back(std::move(d.primary_fd));
+      fds.push_back(std::move(d.render_fd));
+   }
+}
+
+BrokerReply DrmFdBrokerImpl::handle(const BrokerRequest &req, int &fd_out) const
+{
+   BrokerReply reply = { BROKER_MAGIC, 0, unsigned(DrmNodeFlag::None), unsigned(devices.size()) };
+
+   fd_out = -1;
+
+   if (req.magic != BROKER_MAGIC || !is_valid_usage(req.node_usage))
+   {
+      reply.status = EPROTO;
+      return reply;
+   }
+
+   if (req.device_index >= devices.size())
+   {
+      reply.status = ENODEV;
+      return reply;
+   }
+
+   const auto &fds = devices[req.device_index];
+
+   DisplayCreationStrategy strategy(DrmNodeUsage(req.node_usage));
+
+   DrmNodeFlag node = strategy.node_flag();
+
+   if (!node_fd(fds, node).ok() && strategy.has_fallback())
+      node = strategy.fallback_node_flag();
+
+   if (!node_fd(fds, node).ok())
+   {
+      reply.status = ENOENT;
+      return reply;
+   }
+
+   // NB: No need for explicit dup(), kernel installs new fd in receiver
+   fd_out = node_fd(fds, node).get();
+   reply.node = unsigned(node);
+
+   return reply;
+}
+
+ServeResult DrmFdBrokerImpl::serve_request(int conn_fd) const
+{
+   BrokerRequest req;
+   unique_fd unexpected_fd;
+
+   if (!recv_with_fd(conn_fd, &req, sizeof(req), unexpected_fd))
+   {
+      // Peer is done with us
+      return errno == ECONNRESET ? ServeResult::Closed : ServeResult::Failed;
+   }
+
+   int fd = -1;
+   BrokerReply reply = handle(req, fd);
+
+   if (!send_with_fd(conn_fd, &reply, sizeof(reply), fd))
+      return ServeResult::Failed;
+
+   return ServeResult::Served;
+}
+
+} // namespace behead_egl::internal
+
+namespace behead_egl
+{
+
+DrmFdBroker::DrmFdBroker():
+   _impl(std::make_unique<internal::DrmFdBrokerImpl>())
+{}
+
+DrmFdBroker::~DrmFdBroker() = default;
+
+DrmFdBroker::DrmFdBroker(DrmFdBroker &&) noexcept = default;
+DrmFdBroker &DrmFdBroker::operator=(DrmFdBroker &&) noexcept = default;
+
+std::size_t DrmFdBroker::open_devices(DrmNodeUsage usage)
+{
+   struct Candidate
+   {
+      std::string drm_path;
+      bool has_cuda;
+   };
+
+   std::vector<Candidate> candidates;
+
+   bool ok = enumerate_display_devices([&] (const DeviceEXT_Info &info) {
+      candidates.push_back({ info.drm_path, info.has_NV_device_cuda });
+   }, EnumerateOpt::Usable);
+
+   if (!ok)
+      return 0;
+
+   // Same preference as create_headless_display(): CUDA devices first
+   std::stable_partition(candidates.begin(), candidates.end(),
+                         [] (const Candidate &c) { return c.has_cuda; });
+
+   internal::DisplayCreationStrategy strategy(usage);
+
+   std::size_t opened = 0;
+
+   for (const auto &c : candidates)
+   {
+      try
+      {
+         _impl->devices.push_back(internal::open_drm_nodes(c.drm_path.c_str(),
+                                                           strategy.get_open_flag()));
+         ++opened;
+      }
+      catch (const std::runtime_error &e)
+      {
+         // WARNING
+         std::cerr << "Broker failed to open drm nodes" << std::endl;
+         std::cerr << e.what() << std::endl;
+      }
+   }
+
+   return opened;
+}
+
+std::size_t DrmFdBroker::add_device(int primary_fd, int render_fd)
+{
+   internal::DrmNodeFds fds;
+
+   fds.primary_fd.reset(primary_fd);
+   fds.render_fd.reset(render_fd);
+
+   _impl->devices.push_back(std::move(fds));
+
+   return _impl->devices.size() - 1;
+}
+
+std::size_t DrmFdBroker::device_count() const noexcept
+{
+   return _impl->devices.size();
+}
+
+bool DrmFdBroker::serve_connection(int conn_fd) const
+{
+   using internal::ServeResult;
+
+   for (;;)
+   {
+      switch (_impl->serve_request(conn_fd))
+      {
+      case ServeResult::Served:
+         continue;
+      case ServeResult::Closed:
+         return true;
+      case ServeResult::Failed:
+         return false;
+      }
+   }
+}
+
+bool DrmFdBroker::serve(int listen_fd) const
+{
+   using internal::ServeResult;
+
+   // NB: Clients usually keep connection for their whole lifetime (ie. forked worker),
+   // so connections are served together, one long lived client can't hold others back.
+   // Entry 0 is listen_fd, entry i is conns[i - 1].
+   std::vector<pollfd> fds = { pollfd{ listen_fd, POLLIN, 0 } };
+   std::vector<internal::unique_fd> conns;
+
+   auto drop = [&] (std::size_t i) {
+      fds[i] = fds.back();
+      fds.pop_back();
+
+      conns[i - 1] = std::move(conns.back());
+      conns.pop_back();
+   };
+
+   for (;;)
+   {
+      if (::poll(fds.data(), fds.size(), -1) < 0)
+      {
+         if (errno == EINTR)
+            continue;
+
+         return false;
+      }
+
+      // NB: Dropped entry is replaced by last one, its revents are checked in turn
+      for (std::size_t i = 1; i < fds.size();)
+      {
+         if (fds[i].revents == 0)
+         {
+            ++i;
+            continue;
+         }
+
+         // POLLHUP with request still pending is served, EOF is seen next round
+         ServeResult r = (fds[i].revents & POLLIN) != 0 ? _impl->serve_request(fds[i].fd)
+                                                         : ServeResult::Closed;
+         fds[i].revents = 0;
+
+         if (r == ServeResult::Served)
+         {
+            ++i;
+            continue;
+         }
+
+         if (r == ServeResult::Failed)
+         {
+            // WARNING
+            std::cerr << "Broker dropped misbehaving client" << std::endl;
+         }
+
+         drop(i);
+      }
+
+      if (fds[0].revents == 0)
+         continue;
+
+      // NB: Blocking, so request arriving in pieces or reply not fitting socket buffer
+      // right away don't drop client. Timeouts bound how long client that stops
+      // talking mid-request or reading replies stalls others.
+      internal::unique_fd conn{::accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC)};
+
+      if (!conn.ok())
+      {
+         if (errno == EINTR || errno == ECONNABORTED || errno == EAGAIN)
+            continue;
+
+         return errno == EINVAL;
+      }
+
+      if (::setsockopt(conn.get(), SOL_SOCKET, SO_RCVTIMEO, &CLIENT_IO_TIMEOUT, sizeof(timeval)) != 0 ||
+          ::setsockopt(conn.get(), SOL_SOCKET, SO_SNDTIMEO, &CLIENT_IO_TIMEOUT, sizeof(timeval)) != 0)
+      {
+         // WARNING
+         std::cerr << "Broker failed to set client timeouts" << std::endl;
+         continue;
+      }
+
+      fds.push_back(pollfd{ conn.get(), POLLIN, 0 });
+      conns.push_back(std::move(conn));
+   }
+}
+
+int request_brokered_drm_fd(int sock_fd, DrmNodeUsage usage, unsigned device_index)
+{
+   BrokerRequest req = { BROKER_MAGIC, device_index, unsigned(usage) };
+
+   if (!internal::send_with_fd(sock_fd, &req, sizeof(req)))
+      return -1;
+
+   BrokerReply reply;
+   internal::unique_fd fd;
+
+   if (!internal::recv_with_fd(sock_fd, &reply, sizeof(reply), fd))
+      return -1;
+
+   if (reply.magic != BROKER_MAGIC)
+   {
+      errno = EPROTO;
+      return -1;
+   }
+
+   if (reply.status != 0)
+   {
+      errno = reply.status;
+      return -1;
+   }
+
+   if (!fd.ok())
+   {
+      errno = EPROTO;
+      return -1;
+   }
+
+   return fd.release();
+}
+
+} // namespace behead_egl
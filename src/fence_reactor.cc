@@ -0,0 +1,431 @@
+/*
+ * SPDX-FileCopyrightText: 2020 Piotr Rak <piotr.rak@gamil.com>
+ * SPDX-License-Identifier: MIT
+ */
+#include "bhd/fence_reactor.hh"
+
+#include "behead_egl_impl.hh"
+#include "display_cache.hh"
+#include "stats.hh"
+#include "ufd.hh"
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cassert>
+#include <cerrno>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <iostream>
+
+namespace bhdi = behead_egl::internal;
+namespace bhd = behead_egl;
+
+namespace {
+
+using std::chrono::steady_clock;
+
+struct Counters
+{
+   bhdi::StatCounter &wait    = bhdi::stat_counter("fence.wait");
+   bhdi::StatCounter &native  = bhdi::stat_counter("fence.native");
+   bhdi::StatCounter &polled  = bhdi::stat_counter("fence.polled");
+};
+
+Counters &counters()
+{
+   static Counters c;
+   return c;
+}
+
+// {{{ EGL_KHR_fence_sync and EGL_ANDROID_native_fence_sync entry points
+
+struct SyncProcs
+{
+   PFNEGLCREATESYNCKHRPROC eglCreateSyncKHR = nullptr;
+   PFNEGLDESTROYSYNCKHRPROC eglDestroySyncKHR = nullptr;
+   PFNEGLCLIENTWAITSYNCKHRPROC eglClientWaitSyncKHR = nullptr;
+   PFNEGLDUPNATIVEFENCEFDANDROIDPROC eglDupNativeFenceFDANDROID = nullptr;
+
+   bool ok = false;
+};
+
+const SyncProcs &sync_procs()
+{
+   static const SyncProcs procs = [] {
+      using bhdi::set_egl_proc;
+
+      SyncProcs p;
+
+      p.ok = bhdi::all(
+#define _egl_proc(name) set_egl_proc(p.name, #name)
+         _egl_proc(eglCreateSyncKHR),
+         _egl_proc(eglDestroySyncKHR),
+         _egl_proc(eglClientWaitSyncKHR)
+      );
+
+      // Optional
+      _egl_proc(eglDupNativeFenceFDANDROID);
+#undef _egl_proc
+
+      return p;
+   }();
+
+   return procs;
+}
+
+// }}}
+
+struct Fence
+{
+   EGLDisplay dpy = EGL_NO_DISPLAY;
+   EGLSyncKHR sync = EGL_NO_SYNC_KHR;
+
+   // Native fence fd, if display supports it
+   bhdi::unique_fd fd;
+
+   bhd::fence_cb_t cb;
+
+   steady_clock::time_point start;
+
+   // Position in FenceReactorImpl::watched
+   std::size_t slot = 0;
+};
+
+using FencePtr = std::unique_ptr<Fence>;
+
+} // namespace anonymous
+
+namespace behead_egl::internal {
+
+struct FenceReactorImpl
+{
+   FenceReactorOpts opts;
+
+   unique_fd epoll_fd;
+   unique_fd wake_fd;
+
+   std::thread thread;
+
+   std::mutex lock;
+   std::vector<FencePtr> incoming;
+   bool stopping = false;
+
+   std::atomic<std::size_t> pending = 0;
+
+   // Only touched by reactor thread
+   std::vector<FencePtr> polled;
+   std::vector<FencePtr> watched;
+
+   bool start();
+
+   void submit(FencePtr fence);
+
+   void wake() noexcept;
+
+   void complete(FencePtr fence, bool signaled) noexcept;
+
+   void run();
+};
+
+bool FenceReactorImpl::start()
+{
+   epoll_fd.reset(::epoll_create1(EPOLL_CLOEXEC));
+   wake_fd.reset(::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK));
+
+   if (!epoll_fd.ok() || !wake_fd.ok())
+      return false;
+
+   epoll_event ev = {};
+   ev.events = EPOLLIN;
+   ev.data.ptr = nullptr; // NB: Marks wake up
+
+   if (::epoll_ctl(epoll_fd.get(), EPOLL_CTL_ADD, wake_fd.get(), &ev) != 0)
+      return false;
+
+   thread = std::thread([this] { run(); });
+
+   return true;
+}
+
+void FenceReactorImpl::submit(FencePtr fence)
+{
+   fence->start = steady_clock::now();
+
+   pending.fetch_add(1, std::memory_order_relaxed);
+
+   {
+      std::lock_guard<std::mutex> guard(lock);
+      incoming.push_back(std::move(fence));
+   }
+
+   wake();
+}
+
+void FenceReactorImpl::wake() noexcept
+{
+   std::uint64_t one = 1;
+   ssize_t ret = ::write(wake_fd.get(), &one, sizeof(one));
+   (void) ret;
+}
+
+void FenceReactorImpl::complete(FencePtr fence, bool signaled) noexcept
+{
+   counters().wait.record(steady_clock::now() - fence->start);
+
+   sync_procs().eglDestroySyncKHR(fence->dpy, fence->sync);
+   fence->fd.reset();
+
+   try
+   {
+      fence->cb(signaled);
+   }
+   catch (...)
+   {
+      // WARNING
+      std::cerr << "Fence callback has thrown" << std::endl;
+   }
+
+   pending.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void FenceReactorImpl::run()
+{
+   const auto &procs = sync_procs();
+
+   constexpr int MAX_EVENTS = 64;
+   epoll_event events[MAX_EVENTS];
+
+   int poll_ms = int((opts.poll_interval.count() + 999) / 1000);
+
+   for (;;)
+   {
+      std::vector<FencePtr> fresh;
+      bool stop;
+
+      {
+         std::lock_guard<std::mutex> guard(lock);
+         fresh.swap(incoming);
+         stop = stopping;
+      }
+
+      for (auto &f : fresh)
+      {
+         if (f->fd.ok())
+         {
+            epoll_event ev = {};
+            ev.events = EPOLLIN;
+            ev.data.ptr = f.get();
+
+            if (::epoll_ctl(epoll_fd.get(), EPOLL_CTL_ADD, f->fd.get(), &ev) == 0)
+            {
+               counters().native.add();
+               f->slot = watched.size();
+               watched.push_back(std::move(f));
+               continue;
+            }
+
+            // Can't watch fd, poll it then
+            f->fd.reset();
+         }
+
+         counters().polled.add();
+         polled.push_back(std::move(f));
+      }
+
+      if (stop)
+         break;
+
+      int n = ::epoll_wait(epoll_fd.get(), events, MAX_EVENTS, polled.empty() ? -1 : poll_ms);
+
+      for (int i = 0; i < n; ++i)
+      {
+         if (events[i].data.ptr == nullptr)
+         {
+            std::uint64_t count;
+            ssize_t ret = ::read(wake_fd.get(), &count, sizeof(count));
+            (void) ret;
+            continue;
+         }
+
+         auto *raw = static_cast<Fence *>(events[i].data.ptr);
+
+         assert(watched[raw->slot].get() == raw);
+
+         std::size_t slot = raw->slot;
+         FencePtr f = std::move(watched[slot]);
+
+         if (slot + 1 != watched.size())
+         {
+            watched[slot] = std::move(watched.back());
+            watched[slot]->slot = slot;
+         }
+
+         watched.pop_back();
+
+         ::epoll_ctl(epoll_fd.get(), EPOLL_CTL_DEL, f->fd.get(), nullptr);
+
+         complete(std::move(f), (events[i].events & EPOLLERR) == 0);
+      }
+
+      // Poll fences without fd
+      for (std::size_t i = 0; i < polled.size();)
+      {
+         auto &f = polled[i];
+
+         EGLint status = procs.eglClientWaitSyncKHR(f->dpy, f->sync, 0, 0);
+
+         if (status == EGL_TIMEOUT_EXPIRED_KHR)
+         {
+            ++i;
+            continue;
+         }
+
+         FencePtr done = std::move(f);
+
+         polled[i] = std::move(polled.back());
+         polled.pop_back();
+
+         complete(std::move(done), status == EGL_CONDITION_SATISFIED_KHR);
+      }
+   }
+
+   // Shutting down, fail everything left
+   for (auto &f : polled)
+      complete(std::move(f), false);
+
+   for (auto &f : watched)
+      complete(std::move(f), false);
+
+   polled.clear();
+   watched.clear();
+}
+
+} // namespace behead_egl::internal
+
+namespace behead_egl
+{
+
+using internal::display_has_extension;
+using internal::DisplayExt;
+
+FenceReactor::FenceReactor(const FenceReactorOpts &opts):
+   _impl(std::make_unique<internal::FenceReactorImpl>())
+{
+   _impl->opts = opts;
+
+   if (!sync_procs().ok)
+   {
+      // ERROR
+      std::cerr << "EGL_KHR_fence_sync entry points are not available" << std::endl;
+      return;
+   }
+
+   if (!_impl->start())
+   {
+      // ERROR
+      std::cerr << "Failed to start fence reactor" << std::endl;
+   }
+}
+
+FenceReactor::~FenceReactor()
+{
+   auto &impl = *_impl;
+
+   if (!impl.thread.joinable())
+      return;
+
+   {
+      std::lock_guard<std::mutex> guard(impl.lock);
+      impl.stopping = true;
+   }
+
+   impl.wake();
+   impl.thread.join();
+}
+
+bool FenceReactor::ok() const noexcept
+{
+   return _impl->thread.joinable();
+}
+
+std::size_t FenceReactor::pending() const noexcept
+{
+   return _impl->pending.load(std::memory_order_relaxed);
+}
+
+bool FenceReactor::watch_fence(EGLDisplay dpy, fence_cb_t cb)
+{
+   if (!ok() || !cb)
+      return false;
+
+   const auto &procs = sync_procs();
+
+   bool native = procs.eglDupNativeFenceFDANDROID != nullptr &&
+                 display_has_extension(dpy, DisplayExt::ANDROID_native_fence_sync);
+
+   EGLSyncKHR sync = procs.eglCreateSyncKHR(dpy, native ? EGL_SYNC_NATIVE_FENCE_ANDROID
+                                                        : EGL_SYNC_FENCE_KHR, nullptr);
+
+   if (sync == EGL_NO_SYNC_KHR)
+   {
+      // ERROR
+      std::cerr << "Failed to create fence (EGLError: " << eglGetError() << ")" << std::endl;
+      return false;
+   }
+
+   // Flush, so fence is guaranteed to signal and native fd exists.
+   procs.eglClientWaitSyncKHR(dpy, sync, EGL_SYNC_FLUSH_COMMANDS_BIT_KHR, 0);
+
+   auto fence = std::make_unique<Fence>();
+
+   fence->dpy = dpy;
+   fence->sync = sync;
+   fence->cb = std::move(cb);
+
+   if (native)
+   {
+      // Sync keeps its own fd, we get duplicate
+      int fd = procs.eglDupNativeFenceFDANDROID(dpy, sync);
+
+      if (fd != EGL_NO_NATIVE_FENCE_FD_ANDROID)
+         fence->fd.reset(fd);
+   }
+
+   _impl->submit(std::move(fence));
+
+   return true;
+}
+
+bool FenceReactor::watch_sync(EGLDisplay dpy, EGLSyncKHR sync, fence_cb_t cb)
+{
+   if (sync == EGL_NO_SYNC_KHR)
+      return false;
+
+   if (!ok() || !cb)
+   {
+      if (sync_procs().ok)
+         sync_procs().eglDestroySyncKHR(dpy, sync);
+
+      return false;
+   }
+
+   auto fence = std::make_unique<Fence>();
+
+   fence->dpy = dpy;
+   fence->sync = sync;
+   fence->cb = std::move(cb);
+
+   _impl->submit(std::move(fence));
+
+   return true;
+}
+
+} // namespace behead_egl
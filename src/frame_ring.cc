@@ -0,0 +1,535 @@
+/*
+ * SPDX-FileCopyrightText: 2020 Piotr Rak <piotr.rak@gamil.com>
+ * SPDX-License-Identifier: MIT
+ */
+#include "bhd/frame_ring.hh"
+
+#include "minigl.hh"
+#include "scm_rights.hh"
+#include "shm_region.hh"
+#include "stats.hh"
+#include "ufd.hh"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <stdexcept>
+#include <utility>
+
+#include <iostream>
+
+namespace bhdi = behead_egl::internal;
+namespace bhd = behead_egl;
+
+namespace {
+
+using std::chrono::steady_clock;
+
+constexpr std::uint32_t RING_MAGIC = 0x62686672; // 'bhfr'
+constexpr std::uint32_t RING_VERSION = 1;
+
+constexpr std::size_t PAGE = 4096;
+
+constexpr std::size_t page_align(std::size_t sz) noexcept
+{
+   return (sz + PAGE - 1) / PAGE * PAGE;
+}
+
+// {{{ Shared memory layout
+//
+// Frame n (ids start at 1) goes to slot (n - 1) % slot_count.
+// Slot sequence is 2n - 1 while frame n is being written, 2n once published.
+
+struct alignas(64) RingSlot
+{
+   std::atomic<std::uint64_t> seq;
+
+   std::uint64_t frame_id;
+   std::uint64_t size;
+};
+
+struct RingHeader
+{
+   std::uint32_t magic;
+   std::uint32_t version;
+
+   std::uint32_t slot_count;
+   std::uint32_t width;
+   std::uint32_t height;
+   std::uint32_t format;
+   std::uint32_t type;
+   std::uint32_t reserved;
+
+   std::uint64_t stride;
+   std::uint64_t slot_size;
+
+   // Payload of slot i is at payload_offset + i * slot_pitch
+   std::uint64_t payload_offset;
+   std::uint64_t slot_pitch;
+
+   // Bumped on each publication, consumers futex_wait() on it
+   alignas(64) std::atomic<std::uint32_t> publish_seq;
+
+   std::atomic<std::uint64_t> last_frame;
+
+   RingSlot slots[bhd::MaxFrameRingSlots];
+};
+
+static_assert(std::atomic<std::uint64_t>::is_always_lock_free);
+
+// }}}
+
+// Layout as validated when ring was mapped. Header stays writable by producer,
+// so it isn't trusted past that.
+struct RingGeometry
+{
+   std::uint32_t slot_count = 0;
+   std::uint32_t width = 0;
+   std::uint32_t height = 0;
+   std::uint32_t format = 0;
+   std::uint32_t type = 0;
+
+   std::size_t stride = 0;
+   std::size_t slot_size = 0;
+   std::size_t payload_offset = 0;
+   std::size_t slot_pitch = 0;
+};
+
+RingGeometry geometry_of(const RingHeader &h) noexcept
+{
+   RingGeometry g;
+
+   g.slot_count = h.slot_count;
+   g.width = h.width;
+   g.height = h.height;
+   g.format = h.format;
+   g.type = h.type;
+   g.stride = std::size_t(h.stride);
+   g.slot_size = std::size_t(h.slot_size);
+   g.payload_offset = std::size_t(h.payload_offset);
+   g.slot_pitch = std::size_t(h.slot_pitch);
+
+   return g;
+}
+
+constexpr int REQUIRED_SEALS = F_SEAL_SHRINK | F_SEAL_GROW;
+
+struct Counters
+{
+   bhdi::StatCounter &frame    = bhdi::stat_counter("frame_ring.frame");
+   bhdi::StatCounter &dropped  = bhdi::stat_counter("frame_ring.dropped");
+};
+
+Counters &counters()
+{
+   static Counters c;
+   return c;
+}
+
+} // namespace anonymous
+
+namespace behead_egl::internal {
+
+struct FrameRingImpl
+{
+   unique_fd fd;
+   SharedRegion region;
+   RingGeometry geometry;
+
+   // Writer: last frame started, reader: last frame returned
+   std::uint64_t last_frame = 0;
+
+   std::uint64_t dropped = 0;
+
+   bool writing = false;
+
+   RingHeader &header() const
+   {
+      return *static_cast<RingHeader *>(region.data());
+   }
+
+   char *payload(std::uint64_t frame_id) const
+   {
+      std::size_t slot = std::size_t((frame_id - 1) % geometry.slot_count);
+
+      return static_cast<char *>(region.data()) + geometry.payload_offset + slot * geometry.slot_pitch;
+   }
+
+   RingSlot &slot(std::uint64_t frame_id) const
+   {
+      return header().slots[(frame_id - 1) % geometry.slot_count];
+   }
+};
+
+} // namespace behead_egl::internal
+
+namespace behead_egl
+{
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// FrameRingWriter implementation
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+FrameRingWriter::FrameRingWriter(unsigned width, unsigned height, const FrameRingOpts &opts):
+   _impl(std::make_unique<internal::FrameRingImpl>())
+{
+   unsigned bpp = internal::pixel_size(opts.format, opts.type);
+
+   if (width == 0 || height == 0 || bpp == 0)
+   {
+      // ERROR
+      std::cerr << "Invalid frame ring setup" << std::endl;
+      return;
+   }
+
+   // NB: Consumers don't know our pack alignment, keep rows tightly packed
+   // unless they must be padded (see capture()).
+   std::size_t stride = internal::pixel_row_stride(width, bpp, 4);
+   std::size_t slot_size = stride * height;
+
+   unsigned slots = std::clamp(opts.slots, 2u, MaxFrameRingSlots);
+
+   std::size_t payload_offset = page_align(sizeof(RingHeader));
+   std::size_t slot_pitch = page_align(slot_size);
+   std::size_t total = payload_offset + slots * slot_pitch;
+
+   try
+   {
+      internal::unique_fd fd{::memfd_create("behead-egl-frames", MFD_CLOEXEC | MFD_ALLOW_SEALING)};
+
+      if (!fd.ok())
+         throw std::runtime_error("Failed to create memfd");
+
+      if (::ftruncate(fd.get(), off_t(total)) != 0)
+         throw std::runtime_error("Failed to resize memfd");
+
+      // Consumers can rely on size not changing under them
+      if (::fcntl(fd.get(), F_ADD_SEALS, REQUIRED_SEALS | F_SEAL_SEAL) != 0)
+         throw std::runtime_error("Failed to seal memfd");
+
+      auto region = internal::SharedRegion::map_fd(fd.get(), total, true);
+
+      auto &h = *static_cast<RingHeader *>(region.data());
+
+      h.version = RING_VERSION;
+      h.slot_count = slots;
+      h.width = width;
+      h.height = height;
+      h.format = opts.format;
+      h.type = opts.type;
+      h.stride = stride;
+      h.slot_size = slot_size;
+      h.payload_offset = payload_offset;
+      h.slot_pitch = slot_pitch;
+
+      // Publish header last
+      std::atomic_thread_fence(std::memory_order_release);
+      h.magic = RING_MAGIC;
+
+      _impl->geometry = geometry_of(h);
+      _impl->fd = std::move(fd);
+      _impl->region = std::move(region);
+   }
+   catch (const std::runtime_error &e)
+   {
+      // ERROR
+      std::cerr << "Failed to set up frame ring" << std::endl;
+      std::cerr << e.what() << std::endl;
+   }
+}
+
+FrameRingWriter::~FrameRingWriter() = default;
+
+FrameRingWriter::FrameRingWriter(FrameRingWriter &&) noexcept = default;
+FrameRingWriter &FrameRingWriter::operator=(FrameRingWriter &&) noexcept = default;
+
+bool FrameRingWriter::ok() const noexcept
+{
+   return _impl != nullptr && _impl->region.ok();
+}
+
+int FrameRingWriter::fd() const noexcept
+{
+   return ok() ? _impl->fd.get() : -1;
+}
+
+bool FrameRingWriter::send_fd(int sock) const
+{
+   if (!ok())
+      return false;
+
+   const std::uint32_t magic = RING_MAGIC;
+
+   return internal::send_with_fd(sock, &magic, sizeof(magic), _impl->fd.get());
+}
+
+std::size_t FrameRingWriter::slot_size() const noexcept
+{
+   return ok() ? _impl->geometry.slot_size : 0;
+}
+
+std::size_t FrameRingWriter::stride() const noexcept
+{
+   return ok() ? _impl->geometry.stride : 0;
+}
+
+void *FrameRingWriter::begin_frame()
+{
+   if (!ok())
+      return nullptr;
+
+   auto &impl = *_impl;
+
+   if (!impl.writing)
+   {
+      std::uint64_t n = ++impl.last_frame;
+
+      impl.slot(n).seq.store(2 * n - 1, std::memory_order_relaxed);
+
+      // Readers must see odd sequence before any of frame data
+      std::atomic_thread_fence(std::memory_order_release);
+
+      impl.writing = true;
+   }
+
+   return impl.payload(impl.last_frame);
+}
+
+std::uint64_t FrameRingWriter::end_frame()
+{
+   if (!ok() || !_impl->writing)
+      return 0;
+
+   auto &impl = *_impl;
+   auto &h = impl.header();
+
+   std::uint64_t n = impl.last_frame;
+   RingSlot &s = impl.slot(n);
+
+   s.frame_id = n;
+   s.size = impl.geometry.slot_size;
+   s.seq.store(2 * n, std::memory_order_release);
+
+   h.last_frame.store(n, std::memory_order_release);
+   h.publish_seq.fetch_add(1, std::memory_order_release);
+
+   internal::futex_wake_all(h.publish_seq);
+
+   impl.writing = false;
+
+   counters().frame.add();
+
+   return n;
+}
+
+std::uint64_t FrameRingWriter::capture()
+{
+   if (!ok())
+      return 0;
+
+   const auto &gl = internal::gl_procs();
+
+   if (!gl.ok)
+      return 0;
+
+   const auto &g = _impl->geometry;
+
+   void *dst = begin_frame();
+
+   gl.glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+   // Rows in ring are aligned to 4 bytes, same as GL default
+   GLint alignment = 4;
+   gl.glGetIntegerv(GL_PACK_ALIGNMENT, &alignment);
+
+   if (alignment != 4)
+      gl.glPixelStorei(GL_PACK_ALIGNMENT, 4);
+
+   gl.glReadPixels(0, 0, GLsizei(g.width), GLsizei(g.height), g.format, g.type, dst);
+
+   if (alignment != 4)
+      gl.glPixelStorei(GL_PACK_ALIGNMENT, alignment);
+
+   if (GLenum err = gl.glGetError(); err != GL_NO_ERROR)
+   {
+      // ERROR
+      std::cerr << "Failed to read frame into ring (GLError: " << err << ")" << std::endl;
+
+      // NB: Slot stays odd, readers skip it.
+      _impl->writing = false;
+      return 0;
+   }
+
+   return end_frame();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// FrameRingReader implementation
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+FrameRingReader::FrameRingReader(int fd):
+   _impl(std::make_unique<internal::FrameRingImpl>())
+{
+   _impl->fd.reset(fd);
+
+   try
+   {
+      if (!_impl->fd.ok())
+         throw std::runtime_error("Invalid frame ring fd");
+
+      int seals = ::fcntl(fd, F_GET_SEALS);
+
+      if (seals < 0 || (seals & REQUIRED_SEALS) != REQUIRED_SEALS)
+         throw std::runtime_error("Frame ring memfd isn't sealed");
+
+      struct stat st;
+
+      if (::fstat(fd, &st) != 0 || std::size_t(st.st_size) < sizeof(RingHeader))
+         throw std::runtime_error("Frame ring memfd is too small");
+
+      auto region = internal::SharedRegion::map_fd(fd, std::size_t(st.st_size), false);
+
+      const auto &h = *static_cast<const RingHeader *>(region.data());
+
+      if (h.magic != RING_MAGIC || h.version != RING_VERSION)
+         throw std::runtime_error("Frame ring version mismatch");
+
+      std::atomic_thread_fence(std::memory_order_acquire);
+
+      // NB: Validated copy, producer could change header right after checks.
+      RingGeometry g = geometry_of(h);
+      const std::uint64_t size = std::uint64_t(st.st_size);
+
+      if (g.slot_count == 0 || g.slot_count > MaxFrameRingSlots ||
+          g.payload_offset > size || g.slot_pitch > size ||
+          g.payload_offset + g.slot_count * std::uint64_t(g.slot_pitch) > size ||
+          g.slot_size > g.slot_pitch || g.height == 0 || g.stride > g.slot_size / g.height)
+         throw std::runtime_error("Frame ring header is corrupted");
+
+      _impl->geometry = g;
+      _impl->region = std::move(region);
+      _impl->last_frame = h.last_frame.load(std::memory_order_acquire);
+   }
+   catch (const std::runtime_error &e)
+   {
+      // ERROR
+      std::cerr << "Failed to map frame ring" << std::endl;
+      std::cerr << e.what() << std::endl;
+   }
+}
+
+FrameRingReader::~FrameRingReader() = default;
+
+FrameRingReader::FrameRingReader(FrameRingReader &&) noexcept = default;
+FrameRingReader &FrameRingReader::operator=(FrameRingReader &&) noexcept = default;
+
+bool FrameRingReader::ok() const noexcept
+{
+   return _impl != nullptr && _impl->region.ok();
+}
+
+bool FrameRingReader::wait_frame(RingFrame &out, std::chrono::milliseconds timeout)
+{
+   if (!ok())
+      return false;
+
+   auto &impl = *_impl;
+   auto &h = impl.header();
+   const auto &g = impl.geometry;
+
+   const bool forever = timeout.count() < 0;
+   const auto deadline = steady_clock::now() + timeout;
+
+   for (;;)
+   {
+      std::uint32_t seq = h.publish_seq.load(std::memory_order_acquire);
+      std::uint64_t latest = h.last_frame.load(std::memory_order_acquire);
+
+      if (latest > impl.last_frame)
+      {
+         std::uint64_t next = impl.last_frame + 1;
+
+         // Fell behind, producer already reuses slot of next frame
+         if (latest - next >= g.slot_count - 1)
+         {
+            impl.dropped += latest - next;
+            counters().dropped.add(latest - next);
+            next = latest;
+         }
+
+         RingSlot &s = impl.slot(next);
+
+         if (s.seq.load(std::memory_order_acquire) != 2 * next)
+         {
+            // Overwritten meanwhile, try again with fresh state
+            impl.last_frame = next;
+            ++impl.dropped;
+            counters().dropped.add();
+            continue;
+         }
+
+         out.data = impl.payload(next);
+         out.size = g.slot_size;
+         out.stride = g.stride;
+         out.width = g.width;
+         out.height = g.height;
+         out.frame_id = next;
+
+         impl.last_frame = next;
+
+         return true;
+      }
+
+      std::int64_t timeout_ns = -1;
+
+      if (!forever)
+      {
+         auto left = deadline - steady_clock::now();
+
+         if (left <= std::chrono::nanoseconds(0))
+            return false;
+
+         timeout_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(left).count();
+      }
+
+      internal::futex_wait(h.publish_seq, seq, timeout_ns);
+   }
+}
+
+bool FrameRingReader::still_valid(const RingFrame &frame) const noexcept
+{
+   if (!ok() || frame.frame_id == 0)
+      return false;
+
+   // Order our reads of frame data before sequence check
+   std::atomic_thread_fence(std::memory_order_acquire);
+
+   return _impl->slot(frame.frame_id).seq.load(std::memory_order_relaxed) == 2 * frame.frame_id;
+}
+
+std::uint64_t FrameRingReader::dropped() const noexcept
+{
+   return ok() ? _impl->dropped : 0;
+}
+
+int receive_frame_ring_fd(int sock)
+{
+   std::uint32_t magic = 0;
+   internal::unique_fd fd;
+
+   if (!internal::recv_with_fd(sock, &magic, sizeof(magic), fd))
+      return -1;
+
+   if (magic != RING_MAGIC || !fd.ok())
+      return -1;
+
+   return fd.release();
+}
+
+} // namespace behead_egl
@@ -0,0 +1,320 @@
+/*
+ * SPDX-FileCopyrightText: 2020 Piotr Rak <piotr.rak@gamil.com>
+ * SPDX-License-Identifier: MIT
+ */
+#include "bhd/gpu_profiler.hh"
+
+#include "minigl.hh"
+#include "stats.hh"
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <deque>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <iostream>
+
+namespace bhdi = behead_egl::internal;
+namespace bhd = behead_egl;
+
+namespace {
+
+struct Counters
+{
+   bhdi::StatCounter &disjoint = bhdi::stat_counter("gpu_profiler.disjoint");
+};
+
+Counters &counters()
+{
+   static Counters c;
+   return c;
+}
+
+struct OpenScope
+{
+   bhdi::StatCounter *counter = nullptr;
+   GLuint begin = 0;
+};
+
+struct ClosedScope
+{
+   bhdi::StatCounter *counter = nullptr;
+   GLuint begin = 0;
+   GLuint end = 0;
+};
+
+// Scopes closed during single frame
+using Frame = std::vector<ClosedScope>;
+
+} // namespace anonymous
+
+namespace behead_egl::internal {
+
+struct GpuProfilerImpl
+{
+   const GlProcs *gl = nullptr;
+
+   PFNGLQUERYCOUNTEREXTPROC query_counter = nullptr;
+   PFNGLGETQUERYOBJECTUI64VEXTPROC get_query_ui64 = nullptr;
+
+   // GL_EXT_disjoint_timer_query reports disjoint timer
+   bool check_disjoint = false;
+
+   GpuProfilerOpts opts;
+
+   std::unordered_map<std::string, StatCounter *> counters_by_name;
+
+   std::vector<GLuint> free_queries;
+   std::vector<GLuint> all_queries;
+
+   std::vector<OpenScope> open;
+
+   Frame current;
+   std::deque<Frame> in_flight;
+
+   StatCounter *counter(std::string_view name);
+
+   GLuint timestamp();
+
+   // Reads frame results; when wait is false only if they are available.
+   // Returns false if frame isn't ready yet.
+   bool resolve(Frame &frame, bool wait);
+
+   void resolve_ready(std::size_t keep);
+};
+
+StatCounter *GpuProfilerImpl::counter(std::string_view name)
+{
+   // NB: Lookup of std::string by string_view needs C++20, name is short anyway
+   std::string key{name};
+
+   auto it = counters_by_name.find(key);
+
+   if (it != counters_by_name.end())
+      return it->second;
+
+   StatCounter *c = &stat_counter(opts.prefix + key);
+
+   counters_by_name.emplace(std::move(key), c);
+
+   return c;
+}
+
+GLuint GpuProfilerImpl::timestamp()
+{
+   GLuint q = 0;
+
+   if (free_queries.empty())
+   {
+      gl->glGenQueries(1, &q);
+      all_queries.push_back(q);
+   }
+   else
+   {
+      q = free_queries.back();
+      free_queries.pop_back();
+   }
+
+   query_counter(q, GL_TIMESTAMP_EXT);
+
+   return q;
+}
+
+bool GpuProfilerImpl::resolve(Frame &frame, bool wait)
+{
+   if (!wait && !frame.empty())
+   {
+      // Timestamps complete in order, last one being available implies all are
+      GLuint available = GL_FALSE;
+      gl->glGetQueryObjectuiv(frame.back().end, GL_QUERY_RESULT_AVAILABLE, &available);
+
+      if (available != GL_TRUE)
+         return false;
+   }
+
+   bool disjoint = false;
+
+   if (check_disjoint)
+   {
+      GLint d = 0;
+      gl->glGetIntegerv(GL_GPU_DISJOINT_EXT, &d);
+      disjoint = d != 0;
+   }
+
+   if (disjoint)
+      counters().disjoint.add();
+
+   for (const auto &s : frame)
+   {
+      if (!disjoint)
+      {
+         GLuint64 t0 = 0;
+         GLuint64 t1 = 0;
+
+         get_query_ui64(s.begin, GL_QUERY_RESULT, &t0);
+         get_query_ui64(s.end, GL_QUERY_RESULT, &t1);
+
+         s.counter->record(std::chrono::nanoseconds(t1 >= t0 ? t1 - t0 : 0));
+      }
+
+      free_queries.push_back(s.begin);
+      free_queries.push_back(s.end);
+   }
+
+   frame.clear();
+
+   return true;
+}
+
+void GpuProfilerImpl::resolve_ready(std::size_t keep)
+{
+   // Over latency, those have to be resolved even if GPU is behind
+   while (in_flight.size() > keep)
+   {
+      resolve(in_flight.front(), true);
+      in_flight.pop_front();
+   }
+
+   while (!in_flight.empty() && resolve(in_flight.front(), false))
+      in_flight.pop_front();
+}
+
+} // namespace behead_egl::internal
+
+namespace behead_egl
+{
+
+GpuProfiler::GpuProfiler(const GpuProfilerOpts &opts):
+   _impl(std::make_unique<internal::GpuProfilerImpl>())
+{
+   auto &impl = *_impl;
+
+   const auto &gl = internal::gl_procs();
+
+   if (!gl.ok)
+      return;
+
+   if (gl.glQueryCounterEXT != nullptr && gl.glGetQueryObjectui64vEXT != nullptr &&
+       gl.glGetQueryivEXT != nullptr &&
+       internal::gl_has_extension(gl, "GL_EXT_disjoint_timer_query"))
+   {
+      // NB: Implementations may support elapsed time queries only.
+      GLint bits = 0;
+      gl.glGetQueryivEXT(GL_TIMESTAMP_EXT, GL_QUERY_COUNTER_BITS_EXT, &bits);
+
+      if (bits > 0)
+      {
+         impl.query_counter = gl.glQueryCounterEXT;
+         impl.get_query_ui64 = gl.glGetQueryObjectui64vEXT;
+         impl.check_disjoint = true;
+      }
+   }
+   else if (gl.glQueryCounter != nullptr && gl.glGetQueryObjectui64v != nullptr &&
+            internal::gl_has_extension(gl, "GL_ARB_timer_query"))
+   {
+      impl.query_counter = gl.glQueryCounter;
+      impl.get_query_ui64 = gl.glGetQueryObjectui64v;
+   }
+
+   if (impl.query_counter == nullptr)
+   {
+      // ERROR
+      std::cerr << "Context doesn't support timestamp queries" << std::endl;
+      return;
+   }
+
+   impl.opts = opts;
+   impl.opts.latency = std::max(opts.latency, 1u);
+   impl.gl = &gl;
+}
+
+GpuProfiler::~GpuProfiler()
+{
+   if (!ok())
+      return;
+
+   auto &impl = *_impl;
+
+   // Scopes left open are never reported
+   for (auto &s : impl.open)
+      impl.free_queries.push_back(s.begin);
+
+   impl.open.clear();
+
+   flush();
+
+   impl.gl->glDeleteQueries(GLsizei(impl.all_queries.size()), impl.all_queries.data());
+}
+
+bool GpuProfiler::ok() const noexcept
+{
+   return _impl->gl != nullptr;
+}
+
+void GpuProfiler::begin(std::string_view name)
+{
+   if (!ok())
+      return;
+
+   auto &impl = *_impl;
+
+   OpenScope s;
+
+   s.counter = impl.counter(name);
+   s.begin = impl.timestamp();
+
+   impl.open.push_back(s);
+}
+
+void GpuProfiler::end()
+{
+   if (!ok())
+      return;
+
+   auto &impl = *_impl;
+
+   assert(!impl.open.empty() && "Unbalanced GpuProfiler::end()");
+
+   if (impl.open.empty())
+      return;
+
+   OpenScope s = impl.open.back();
+   impl.open.pop_back();
+
+   impl.current.push_back(ClosedScope{s.counter, s.begin, impl.timestamp()});
+}
+
+void GpuProfiler::end_frame()
+{
+   if (!ok())
+      return;
+
+   auto &impl = *_impl;
+
+   impl.in_flight.push_back(std::move(impl.current));
+   impl.current.clear();
+
+   impl.resolve_ready(impl.opts.latency);
+}
+
+void GpuProfiler::flush()
+{
+   if (!ok())
+      return;
+
+   auto &impl = *_impl;
+
+   if (!impl.current.empty())
+   {
+      impl.in_flight.push_back(std::move(impl.current));
+      impl.current.clear();
+   }
+
+   impl.resolve_ready(0);
+}
+
+} // namespace behead_egl
@@ -10,12 +10,15 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/sysmacros.h>
+#include <limits.h>
 
 #include <array>
 #include <cassert>
 #include <cstdarg>
 #include <cstddef>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <stdexcept>
 #include <utility>
 
@@ -29,6 +32,8 @@ namespace bhdi = behead_egl::internal;
 
 namespace {
 
+using bhdi::unique_fd;
+
 template <std::size_t Sz_>
 using buffer = std::array<char, Sz_>;
 
@@ -51,9 +56,6 @@ constexpr int DIR_OPEN_FLAGS = O_PATH | O_DIRECTORY | O_CLOEXEC;
 // Closed on exec, gpu driver will ioctl it, thus open read write
 constexpr int NODE_OPEN_FLAGS = O_RDWR | O_CLOEXEC;
 
-// Path to drm device directory
-constexpr const char *DRM_DIR = "/dev/dri/";
-
 struct DeviceId
 {
    unsigned _major;
@@ -70,6 +72,51 @@ buffer<64> make_sysfs_path(DeviceId id)
    return bprintf<64>("/sys/dev/char/%d:%d/device/drm/", id._major, id._minor);
 }
 
+buffer<64> make_sysfs_device_path(DeviceId id)
+{
+   return bprintf<64>("/sys/dev/char/%d:%d/device/", id._major, id._minor);
+}
+
+// Reads number from sysfs attribute, decimal or 0x prefixed hex
+bool read_sysfs_long(int dir_fd, const char *name, long &out) noexcept
+{
+   unique_fd fd{::openat(dir_fd, name, O_RDONLY | O_CLOEXEC)};
+
+   if (!fd.ok())
+      return false;
+
+   char buf[32];
+   ssize_t len = ::read(fd.get(), buf, sizeof(buf) - 1);
+
+   if (len <= 0)
+      return false;
+
+   buf[len] = '\0';
+
+   char *end = nullptr;
+   out = std::strtol(buf, &end, 0);
+
+   return end != buf;
+}
+
+// Last component of symlink target
+bool read_link_basename(const char *path, buffer<PATH_MAX> &out) noexcept
+{
+   ssize_t len = ::readlink(path, out.data(), out.size() - 1);
+
+   if (len <= 0)
+      return false;
+
+   out[std::size_t(len)] = '\0';
+
+   const char *base = std::strrchr(out.data(), '/');
+
+   if (base != nullptr)
+      std::memmove(out.data(), base + 1, std::strlen(base + 1) + 1);
+
+   return out[0] != '\0';
+}
+
 buffer<16> make_drm_path(bhdi::DrmNodeFlag f, unsigned _minor)
 {
    using bhdi::DrmNodeFlag;
@@ -111,7 +158,7 @@ const char* to_string(DrmNodeFlag f)
    return "";
 }
 
-DrmNodeFds open_drm_nodes(const char *dev, DrmNodeFlag nodes)
+DrmNodeFds open_drm_nodes(const char *dev, DrmNodeFlag nodes, const char *drm_dir)
 {
    using namespace std::literals::string_literals;
    using std::runtime_error;
@@ -147,7 +194,7 @@ DrmNodeFds open_drm_nodes(const char *dev, DrmNodeFlag nodes)
       throw runtime_error("Failed to open sysfs for "s + dev);
 
    // Easy access to /dev/dri directory.
-   unique_fd dev_drm_dir{::open(DRM_DIR, DIR_OPEN_FLAGS, 0)};
+   unique_fd dev_drm_dir{::open(drm_dir, DIR_OPEN_FLAGS, 0)};
 
    if (!dev_drm_dir.ok())
       throw runtime_error("Failed to open drm directory");
@@ -161,13 +208,15 @@ DrmNodeFds open_drm_nodes(const char *dev, DrmNodeFlag nodes)
       unique_fd node_fd{::openat(dev_drm_dir.get(), node_name, NODE_OPEN_FLAGS, 0)};
 
       if (!node_fd.ok())
-         throw runtime_error("Failed to open "s + DRM_DIR + node_name);
+         throw runtime_error("Failed to open "s + drm_dir + node_name);
 
       return node_fd;
    };
 
    DrmNodeFds result;
 
+   result.drm_minor = dev_id._minor;
+
    if (has<DrmNodeFlag::Primary>(nodes))
    {
       auto dev_card = make_drm_path(DrmNodeFlag::Primary, dev_id._minor);
@@ -192,4 +241,132 @@ DrmNodeFds open_drm_nodes(const char *dev, DrmNodeFlag nodes)
    return result;
 }
 
+bool query_drm_minor(const char *dev, unsigned &minor_out) noexcept
+{
+   struct stat st;
+
+   if (::stat(dev, &st) != 0 || !S_ISCHR(st.st_mode))
+      return false;
+
+   minor_out = DeviceId::from_stat(st)._minor;
+
+   return true;
+}
+
+unique_fd open_drm_dir(const char *drm_dir) noexcept
+{
+   return unique_fd{::open(drm_dir, DIR_OPEN_FLAGS, 0)};
+}
+
+bool drm_nodes_accessible(int drm_dir_fd, const char *dev, DrmNodeFlag nodes) noexcept
+{
+   struct stat st;
+
+   if (::stat(dev, &st) != 0 || !S_ISCHR(st.st_mode))
+      return false;
+
+   DeviceId dev_id = DeviceId::from_stat(st);
+
+   for (DrmNodeFlag node : { DrmNodeFlag::Primary, DrmNodeFlag::Render })
+   {
+      if (!has(nodes, node))
+         continue;
+
+      // NB: Same names open_drm_nodes() opens
+      auto name = make_drm_path(node, dev_id._minor);
+
+      if (::faccessat(drm_dir_fd, name.data(), R_OK | W_OK, AT_EACCESS) != 0)
+         return false;
+   }
+
+   return true;
+}
+
+DrmNodeFlag match_drm_node(int fd, const char *dev) noexcept
+{
+   struct stat fd_st;
+   struct stat dev_st;
+
+   if (::fstat(fd, &fd_st) != 0 || !S_ISCHR(fd_st.st_mode))
+      return DrmNodeFlag::None;
+
+   if (::stat(dev, &dev_st) != 0 || !S_ISCHR(dev_st.st_mode))
+      return DrmNodeFlag::None;
+
+   auto fd_id = DeviceId::from_stat(fd_st);
+   auto dev_id = DeviceId::from_stat(dev_st);
+
+   if (fd_id._major != dev_id._major)
+      return DrmNodeFlag::None;
+
+   // NB: Same numbering as in make_drm_path
+   if (fd_id._minor == dev_id._minor)
+      return DrmNodeFlag::Primary;
+
+   if (fd_id._minor == dev_id._minor + 128)
+      return DrmNodeFlag::Render;
+
+   return DrmNodeFlag::None;
+}
+
+bool query_drm_bus_info(const char *dev, DrmBusInfo &out) noexcept
+{
+   struct stat st;
+
+   if (::stat(dev, &st) != 0 || !S_ISCHR(st.st_mode))
+      return false;
+
+   auto sys_path = make_sysfs_device_path(DeviceId::from_stat(st));
+
+   unique_fd sys_dev_dir{::open(sys_path.data(), DIR_OPEN_FLAGS, 0)};
+
+   if (!sys_dev_dir.ok())
+      return false;
+
+   DrmBusInfo info;
+   long value;
+
+   if (read_sysfs_long(sys_dev_dir.get(), "numa_node", value) && value >= 0)
+      info.numa_node = int(value);
+
+   // NB: Only PCI devices have those, platform ones (ie. SoC) don't
+   if (read_sysfs_long(sys_dev_dir.get(), "vendor", value))
+      info.pci_vendor = std::uint16_t(value);
+
+   if (read_sysfs_long(sys_dev_dir.get(), "device", value))
+      info.pci_device = std::uint16_t(value);
+
+   out = info;
+
+   return true;
+}
+
+bool query_drm_bus_id(const char *dev, char *out, std::size_t size) noexcept
+{
+   struct stat st;
+
+   if (::stat(dev, &st) != 0 || !S_ISCHR(st.st_mode))
+      return false;
+
+   auto sys_path = make_sysfs_device_path(DeviceId::from_stat(st));
+
+   // /sys/dev/char/<maj>:<min>/device -> ../../../0000:01:00.0
+   buffer<PATH_MAX> address;
+   // /sys/dev/char/<maj>:<min>/device/subsystem -> ../../../bus/pci
+   buffer<PATH_MAX> bus;
+
+   auto subsystem_path = bprintf<80>("%ssubsystem", sys_path.data());
+
+   // NB: Drop trailing slash, we want link itself
+   sys_path[std::strlen(sys_path.data()) - 1] = '\0';
+
+   if (!read_link_basename(sys_path.data(), address)
+       || !read_link_basename(subsystem_path.data(), bus))
+      return false;
+
+   int len = std::snprintf(out, size, "%s:%s", bus.data(), address.data());
+
+   return len > 0 && std::size_t(len) < size;
+}
+
 } // namespace behead_egl::internal
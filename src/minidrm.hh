@@ -6,6 +6,9 @@
 
 #include "ufd.hh"
 
+#include <cstddef>
+#include <cstdint>
+
 namespace behead_egl::internal {
 
 enum class DrmNodeFlag : unsigned
@@ -43,15 +46,67 @@ inline constexpr DrmNodeFlag BothDrmNodes = DrmNodeFlag::Primary | DrmNodeFlag::
 
 const char *to_string(DrmNodeFlag);
 
+// Path to drm device directory
+constexpr const char *DRM_DIR = "/dev/dri/";
+
 struct DrmNodeFds
 {
    unique_fd render_fd;
    unique_fd primary_fd;
 
+   // Minor number of primary node, resolved while opening
+   unsigned drm_minor = 0;
+
    bool ok() const { return render_fd.ok() && primary_fd.ok(); }
 };
 
-// Open master and render node device file_descriptors
-DrmNodeFds open_drm_nodes(const char *dev, DrmNodeFlag nodes = BothDrmNodes);
+// Open master and render node device file_descriptors, looked up in drm_dir
+// (any other directory may stand in for it, ie. in benchmarks)
+DrmNodeFds open_drm_nodes(const char *dev, DrmNodeFlag nodes = BothDrmNodes,
+                          const char *drm_dir = DRM_DIR);
+
+// Resolves minor number of drm device dev without opening it
+//
+// Returns false if dev isn't character device.
+bool query_drm_minor(const char *dev, unsigned &minor_out) noexcept;
+
+// Opens drm_dir for node lookups of drm_nodes_accessible(),
+// any other directory may stand in for it (ie. in benchmarks).
+//
+// Returns invalid fd on failure.
+unique_fd open_drm_dir(const char *drm_dir = DRM_DIR) noexcept;
+
+// Checks, without opening anything, that given nodes of drm device dev exist
+// in directory drm_dir_fd (see open_drm_dir()) and this process may open them
+// for reading and writing, judged by its effective uid and gids (faccessat()
+// with AT_EACCESS).
+//
+// NB: Device cgroup and LSM denials are seen only by opening node.
+bool drm_nodes_accessible(int drm_dir_fd, const char *dev, DrmNodeFlag nodes) noexcept;
+
+// Checks whether fd refers to primary or render node of drm device dev
+//
+// Returns DrmNodeFlag::None if fd is not a node of dev.
+DrmNodeFlag match_drm_node(int fd, const char *dev) noexcept;
+
+// Bus identity of drm device, read from /sys/dev/char/<major>:<minor>/device
+struct DrmBusInfo
+{
+   // -1 when unknown, ie. single node system
+   int numa_node = -1;
+
+   // Both 0 when device isn't on PCI bus
+   std::uint16_t pci_vendor = 0;
+   std::uint16_t pci_device = 0;
+};
+
+// Returns false if dev isn't character device or it has no sysfs entry
+bool query_drm_bus_info(const char *dev, DrmBusInfo &out) noexcept;
+
+// Writes "<bus>:<address>" of drm device (ie. "pci:0000:01:00.0") to out,
+// it stays the same across reboots and driver reloads, unlike minor number.
+//
+// Returns false if dev has no sysfs entry or out is too small.
+bool query_drm_bus_id(const char *dev, char *out, std::size_t size) noexcept;
 
 } // namespace behead_egl::internal
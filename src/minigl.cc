@@ -0,0 +1,120 @@
+/*
+ * SPDX-FileCopyrightText: 2020 Piotr Rak <piotr.rak@gamil.com>
+ * SPDX-License-Identifier: MIT
+ */
+#include "minigl.hh"
+
+#include "behead_egl_impl.hh"
+
+namespace behead_egl::internal {
+
+const GlProcs &gl_procs()
+{
+   static const GlProcs procs = [] {
+      GlProcs gl;
+
+      gl.ok = all(
+#define _gl_proc(name) set_egl_proc(gl.name, #name)
+         _gl_proc(glGetError),
+         _gl_proc(glGetIntegerv),
+         _gl_proc(glGetString),
+         _gl_proc(glGetStringi),
+         _gl_proc(glEnable),
+         _gl_proc(glFlush),
+         _gl_proc(glFinish),
+
+         _gl_proc(glGenBuffers),
+         _gl_proc(glDeleteBuffers),
+         _gl_proc(glBindBuffer),
+         _gl_proc(glBufferData),
+         _gl_proc(glMapBufferRange),
+         _gl_proc(glUnmapBuffer),
+
+         _gl_proc(glGenTextures),
+         _gl_proc(glDeleteTextures),
+         _gl_proc(glBindTexture),
+         _gl_proc(glTexImage2D),
+         _gl_proc(glTexParameteri),
+
+         _gl_proc(glGenRenderbuffers),
+         _gl_proc(glDeleteRenderbuffers),
+         _gl_proc(glBindRenderbuffer),
+         _gl_proc(glRenderbufferStorage),
+
+         _gl_proc(glGenFramebuffers),
+         _gl_proc(glDeleteFramebuffers),
+         _gl_proc(glBindFramebuffer),
+         _gl_proc(glFramebufferTexture2D),
+         _gl_proc(glFramebufferRenderbuffer),
+         _gl_proc(glCheckFramebufferStatus),
+
+         _gl_proc(glPixelStorei),
+         _gl_proc(glReadPixels),
+
+         _gl_proc(glCreateShader),
+         _gl_proc(glShaderSource),
+         _gl_proc(glCompileShader),
+         _gl_proc(glDeleteShader),
+         _gl_proc(glCreateProgram),
+         _gl_proc(glAttachShader),
+         _gl_proc(glLinkProgram),
+         _gl_proc(glDeleteProgram),
+         _gl_proc(glGetProgramiv),
+
+         _gl_proc(glGenQueries),
+         _gl_proc(glDeleteQueries),
+         _gl_proc(glGetQueryObjectuiv),
+
+         _gl_proc(glFenceSync),
+         _gl_proc(glClientWaitSync),
+         _gl_proc(glDeleteSync)
+#undef _gl_proc
+      );
+
+      set_egl_proc(gl.glGetProgramBinary, "glGetProgramBinary");
+      set_egl_proc(gl.glProgramBinary, "glProgramBinary");
+
+      set_egl_proc(gl.glGetGraphicsResetStatus, "glGetGraphicsResetStatus") ||
+         set_egl_proc(gl.glGetGraphicsResetStatus, "glGetGraphicsResetStatusEXT") ||
+         set_egl_proc(gl.glGetGraphicsResetStatus, "glGetGraphicsResetStatusKHR");
+
+      set_egl_proc(gl.glDebugMessageCallback, "glDebugMessageCallback") ||
+         set_egl_proc(gl.glDebugMessageCallback, "glDebugMessageCallbackKHR");
+      set_egl_proc(gl.glDebugMessageControl, "glDebugMessageControl") ||
+         set_egl_proc(gl.glDebugMessageControl, "glDebugMessageControlKHR");
+
+      set_egl_proc(gl.glQueryCounter, "glQueryCounter");
+      set_egl_proc(gl.glGetQueryObjectui64v, "glGetQueryObjectui64v");
+      set_egl_proc(gl.glQueryCounterEXT, "glQueryCounterEXT");
+      set_egl_proc(gl.glGetQueryObjectui64vEXT, "glGetQueryObjectui64vEXT");
+      set_egl_proc(gl.glGetQueryivEXT, "glGetQueryivEXT");
+
+      set_egl_proc(gl.glBufferStorage, "glBufferStorage");
+      set_egl_proc(gl.glBufferStorageEXT, "glBufferStorageEXT");
+
+      return gl;
+   }();
+
+   return procs;
+}
+
+bool gl_has_extension(const GlProcs &gl, std::string_view ext)
+{
+   if (!gl.ok)
+      return false;
+
+   GLint count = 0;
+   gl.glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+
+   for (GLint i = 0; i < count; ++i)
+   {
+      const char *name = reinterpret_cast<const char *>(gl.glGetStringi(GL_EXTENSIONS, GLuint(i)));
+
+      if (name != nullptr && ext == name)
+         return true;
+   }
+
+   return false;
+}
+
+} // namespace behead_egl::internal
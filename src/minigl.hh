@@ -0,0 +1,154 @@
+/*
+ * SPDX-FileCopyrightText: 2020 Piotr Rak <piotr.rak@gamil.com>
+ * SPDX-License-Identifier: MIT
+ */
+#pragma once
+
+// We need only types and enums, entry points are looked up at runtime.
+#define GL_GLES_PROTOTYPES 0
+#include <GLES3/gl32.h>
+#include <GLES2/gl2ext.h>
+#undef GL_GLES_PROTOTYPES
+
+#include <cstddef>
+#include <string_view>
+
+namespace behead_egl::internal {
+
+// GL entry points used by the library, looked up through eglGetProcAddress()
+// (EGL 1.5 or EGL_KHR_get_all_proc_addresses), so we don't link any GL library.
+//
+// Those are subset common to OpenGL ES 3.0 and desktop OpenGL 3.3,
+// thus they work with contexts of both APIs.
+struct GlProcs
+{
+   // {{{ Core
+
+   PFNGLGETERRORPROC glGetError = nullptr;
+   PFNGLGETINTEGERVPROC glGetIntegerv = nullptr;
+   PFNGLGETSTRINGPROC glGetString = nullptr;
+   PFNGLGETSTRINGIPROC glGetStringi = nullptr;
+   PFNGLENABLEPROC glEnable = nullptr;
+   PFNGLFLUSHPROC glFlush = nullptr;
+   PFNGLFINISHPROC glFinish = nullptr;
+
+   PFNGLGENBUFFERSPROC glGenBuffers = nullptr;
+   PFNGLDELETEBUFFERSPROC glDeleteBuffers = nullptr;
+   PFNGLBINDBUFFERPROC glBindBuffer = nullptr;
+   PFNGLBUFFERDATAPROC glBufferData = nullptr;
+   PFNGLMAPBUFFERRANGEPROC glMapBufferRange = nullptr;
+   PFNGLUNMAPBUFFERPROC glUnmapBuffer = nullptr;
+
+   PFNGLGENTEXTURESPROC glGenTextures = nullptr;
+   PFNGLDELETETEXTURESPROC glDeleteTextures = nullptr;
+   PFNGLBINDTEXTUREPROC glBindTexture = nullptr;
+   PFNGLTEXIMAGE2DPROC glTexImage2D = nullptr;
+   PFNGLTEXPARAMETERIPROC glTexParameteri = nullptr;
+
+   PFNGLGENRENDERBUFFERSPROC glGenRenderbuffers = nullptr;
+   PFNGLDELETERENDERBUFFERSPROC glDeleteRenderbuffers = nullptr;
+   PFNGLBINDRENDERBUFFERPROC glBindRenderbuffer = nullptr;
+   PFNGLRENDERBUFFERSTORAGEPROC glRenderbufferStorage = nullptr;
+
+   PFNGLGENFRAMEBUFFERSPROC glGenFramebuffers = nullptr;
+   PFNGLDELETEFRAMEBUFFERSPROC glDeleteFramebuffers = nullptr;
+   PFNGLBINDFRAMEBUFFERPROC glBindFramebuffer = nullptr;
+   PFNGLFRAMEBUFFERTEXTURE2DPROC glFramebufferTexture2D = nullptr;
+   PFNGLFRAMEBUFFERRENDERBUFFERPROC glFramebufferRenderbuffer = nullptr;
+   PFNGLCHECKFRAMEBUFFERSTATUSPROC glCheckFramebufferStatus = nullptr;
+
+   PFNGLPIXELSTOREIPROC glPixelStorei = nullptr;
+   PFNGLREADPIXELSPROC glReadPixels = nullptr;
+
+   PFNGLCREATESHADERPROC glCreateShader = nullptr;
+   PFNGLSHADERSOURCEPROC glShaderSource = nullptr;
+   PFNGLCOMPILESHADERPROC glCompileShader = nullptr;
+   PFNGLDELETESHADERPROC glDeleteShader = nullptr;
+   PFNGLCREATEPROGRAMPROC glCreateProgram = nullptr;
+   PFNGLATTACHSHADERPROC glAttachShader = nullptr;
+   PFNGLLINKPROGRAMPROC glLinkProgram = nullptr;
+   PFNGLDELETEPROGRAMPROC glDeleteProgram = nullptr;
+   PFNGLGETPROGRAMIVPROC glGetProgramiv = nullptr;
+
+   PFNGLGENQUERIESPROC glGenQueries = nullptr;
+   PFNGLDELETEQUERIESPROC glDeleteQueries = nullptr;
+   PFNGLGETQUERYOBJECTUIVPROC glGetQueryObjectuiv = nullptr;
+
+   PFNGLFENCESYNCPROC glFenceSync = nullptr;
+   PFNGLCLIENTWAITSYNCPROC glClientWaitSync = nullptr;
+   PFNGLDELETESYNCPROC glDeleteSync = nullptr;
+
+   // }}}
+
+   // {{{ Optional, caller must check extension first
+
+   // OpenGL ES 3.0, GL_ARB_get_program_binary (desktop OpenGL 4.1)
+   PFNGLGETPROGRAMBINARYPROC glGetProgramBinary = nullptr;
+   PFNGLPROGRAMBINARYPROC glProgramBinary = nullptr;
+
+   // OpenGL ES 3.2, GL_EXT_robustness or GL_KHR_robustness, whichever was found first
+   PFNGLGETGRAPHICSRESETSTATUSPROC glGetGraphicsResetStatus = nullptr;
+
+   // OpenGL ES 3.2, GL_KHR_debug (desktop OpenGL 4.3), whichever was found first
+   PFNGLDEBUGMESSAGECALLBACKPROC glDebugMessageCallback = nullptr;
+   PFNGLDEBUGMESSAGECONTROLPROC glDebugMessageControl = nullptr;
+
+   // GL_ARB_timer_query (desktop OpenGL 3.3)
+   PFNGLQUERYCOUNTEREXTPROC glQueryCounter = nullptr;
+   PFNGLGETQUERYOBJECTUI64VEXTPROC glGetQueryObjectui64v = nullptr;
+   // GL_EXT_disjoint_timer_query
+   PFNGLQUERYCOUNTEREXTPROC glQueryCounterEXT = nullptr;
+   PFNGLGETQUERYOBJECTUI64VEXTPROC glGetQueryObjectui64vEXT = nullptr;
+   PFNGLGETQUERYIVEXTPROC glGetQueryivEXT = nullptr;
+
+   // GL_ARB_buffer_storage (desktop OpenGL 4.4)
+   PFNGLBUFFERSTORAGEEXTPROC glBufferStorage = nullptr;
+   // GL_EXT_buffer_storage
+   PFNGLBUFFERSTORAGEEXTPROC glBufferStorageEXT = nullptr;
+
+   // }}}
+
+   // All of core entry points were found
+   bool ok = false;
+};
+
+// Looks entry points up on first call, it is thread-safe.
+//
+// NB: Some implementations return nullptr without any context current,
+// call it with context current.
+const GlProcs &gl_procs();
+
+// Checks extension of context current on calling thread
+bool gl_has_extension(const GlProcs &gl, std::string_view ext);
+
+// Bytes per pixel for glReadPixels(), 0 if combination isn't supported by us.
+// We handle only 8 bits per channel formats.
+constexpr unsigned pixel_size(GLenum format, GLenum type) noexcept
+{
+   if (type != GL_UNSIGNED_BYTE && type != GL_BYTE)
+      return 0;
+
+   switch (format)
+   {
+   case GL_RED:
+      return 1;
+   case GL_RG:
+      return 2;
+   case GL_RGBA:
+      [[fallthrough]];
+   case GL_RGBA_INTEGER:
+      return 4;
+   }
+
+   return 0;
+}
+
+// Row size with GL_PACK_ALIGNMENT applied
+constexpr std::size_t pixel_row_stride(unsigned width, unsigned bpp, int alignment) noexcept
+{
+   std::size_t a = alignment > 0 ? std::size_t(alignment) : 1;
+
+   return (std::size_t(width) * bpp + a - 1) / a * a;
+}
+
+} // namespace behead_egl::internal
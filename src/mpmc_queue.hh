@@ -0,0 +1,135 @@
+/*
+ * SPDX-FileCopyrightText: 2020 Piotr Rak <piotr.rak@gamil.com>
+ * SPDX-License-Identifier: MIT
+ */
+#pragma once
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <memory>
+#include <utility>
+
+namespace behead_egl::internal {
+
+// Bounded lock-free multi-producer multi-consumer queue
+// (Dmitry Vyukov's sequenced ring).
+//
+// Each cell carries sequence number telling whether it is free for producer
+// of given lap, or holds value for consumer of that lap.
+template <typename Ty_>
+class bounded_mpmc_queue final
+{
+   static constexpr std::size_t CACHE_LINE = 64;
+
+public:
+   // Capacity is rounded up to power of two
+   explicit bounded_mpmc_queue(std::size_t capacity)
+   {
+      std::size_t cap = 2;
+
+      while (cap < capacity)
+         cap <<= 1;
+
+      _mask = cap - 1;
+      _cells = std::make_unique<cell[]>(cap);
+
+      for (std::size_t i = 0; i < cap; ++i)
+         _cells[i].seq.store(i, std::memory_order_relaxed);
+   }
+
+   bounded_mpmc_queue(const bounded_mpmc_queue &) = delete;
+   bounded_mpmc_queue &operator=(const bounded_mpmc_queue &) = delete;
+
+   std::size_t capacity() const noexcept { return _mask + 1; }
+
+   // Moves from v only on success
+   bool try_push(Ty_ &v)
+   {
+      std::size_t pos = _enqueue_pos.load(std::memory_order_relaxed);
+
+      for (;;)
+      {
+         cell &c = _cells[pos & _mask];
+
+         std::size_t seq = c.seq.load(std::memory_order_acquire);
+         auto diff = std::ptrdiff_t(seq) - std::ptrdiff_t(pos);
+
+         if (diff == 0)
+         {
+            if (_enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+            {
+               c.value = std::move(v);
+               c.seq.store(pos + 1, std::memory_order_release);
+               return true;
+            }
+         }
+         else if (diff < 0)
+         {
+            // Full
+            return false;
+         }
+         else
+         {
+            pos = _enqueue_pos.load(std::memory_order_relaxed);
+         }
+      }
+   }
+
+   bool try_pop(Ty_ &out)
+   {
+      std::size_t pos = _dequeue_pos.load(std::memory_order_relaxed);
+
+      for (;;)
+      {
+         cell &c = _cells[pos & _mask];
+
+         std::size_t seq = c.seq.load(std::memory_order_acquire);
+         auto diff = std::ptrdiff_t(seq) - std::ptrdiff_t(pos + 1);
+
+         if (diff == 0)
+         {
+            if (_dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+            {
+               out = std::move(c.value);
+               c.value = Ty_{};
+               c.seq.store(pos + _mask + 1, std::memory_order_release);
+               return true;
+            }
+         }
+         else if (diff < 0)
+         {
+            // Empty
+            return false;
+         }
+         else
+         {
+            pos = _dequeue_pos.load(std::memory_order_relaxed);
+         }
+      }
+   }
+
+   // Only approximate while producers or consumers are active
+   std::size_t size_approx() const noexcept
+   {
+      std::size_t tail = _enqueue_pos.load(std::memory_order_relaxed);
+      std::size_t head = _dequeue_pos.load(std::memory_order_relaxed);
+
+      return tail >= head ? tail - head : 0;
+   }
+
+private:
+   struct cell
+   {
+      std::atomic<std::size_t> seq;
+      Ty_ value;
+   };
+
+   std::unique_ptr<cell[]> _cells;
+   std::size_t _mask = 0;
+
+   alignas(CACHE_LINE) std::atomic<std::size_t> _enqueue_pos = 0;
+   alignas(CACHE_LINE) std::atomic<std::size_t> _dequeue_pos = 0;
+};
+
+} // namespace behead_egl::internal
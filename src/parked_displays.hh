@@ -0,0 +1,20 @@
+/*
+ * SPDX-FileCopyrightText: 2020 Piotr Rak <piotr.rak@gamil.com>
+ * SPDX-License-Identifier: MIT
+ */
+#pragma once
+
+#include "bhd/behead_egl.hh"
+
+namespace behead_egl::internal {
+
+// Hands out display parked by prewarm() for device and usage, waits if its
+// warm-up is in progress. Returns EGL_NO_DISPLAY if there is none.
+//
+// NB: Implemented in prewarm.cc
+EGLDisplay take_parked_display(EGLDeviceEXT dev, DrmNodeUsage usage);
+
+// Starts prewarm() if requested through BEHEAD_EGL_PREWARM, only on first call.
+void prewarm_from_env();
+
+} // namespace behead_egl::internal
@@ -0,0 +1,383 @@
+/*
+ * SPDX-FileCopyrightText: 2020 Piotr Rak <piotr.rak@gamil.com>
+ * SPDX-License-Identifier: MIT
+ */
+#include "bhd/prewarm.hh"
+
+#include "behead_egl_impl.hh"
+#include "minigl.hh"
+#include "parked_displays.hh"
+#include "stats.hh"
+
+#include <algorithm>
+#include <cassert>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <iostream>
+
+namespace bhdi = behead_egl::internal;
+namespace bhd = behead_egl;
+
+namespace {
+
+using std::chrono::steady_clock;
+
+struct Counters
+{
+   bhdi::StatCounter &device = bhdi::stat_counter("prewarm.device");
+   bhdi::StatCounter &hit    = bhdi::stat_counter("prewarm.hit");
+};
+
+Counters &counters()
+{
+   static Counters c;
+   return c;
+}
+
+struct Parked
+{
+   EGLDeviceEXT dev = nullptr;
+   bhd::DrmNodeUsage usage = bhd::DefaultDrmNodeUsage;
+
+   EGLDisplay dpy = EGL_NO_DISPLAY;
+
+   // Warm-up of device is done, dpy is valid if it succeeded
+   bool ready = false;
+};
+
+struct PrewarmState
+{
+   std::mutex lock;
+   std::condition_variable changed;
+
+   // {{{ Guarded by lock
+
+   std::vector<Parked> parked;
+
+   bool started = false;
+   bool done = false;
+
+   // }}}
+
+   std::thread thread;
+
+   ~PrewarmState()
+   {
+      if (thread.joinable())
+         thread.join();
+   }
+};
+
+PrewarmState &state()
+{
+   static PrewarmState s;
+   return s;
+}
+
+// Set on warm-up thread, so it doesn't wait for displays it creates itself
+thread_local bool t_warming_up = false;
+
+constexpr const char *ES_VERTEX_SRC =
+   "#version 300 es\n"
+   "void main() { gl_Position = vec4(0.0); }\n";
+
+constexpr const char *ES_FRAGMENT_SRC =
+   "#version 300 es\n"
+   "precision mediump float;\n"
+   "out vec4 color;\n"
+   "void main() { color = vec4(1.0); }\n";
+
+constexpr const char *GL_VERTEX_SRC =
+   "#version 330 core\n"
+   "void main() { gl_Position = vec4(0.0); }\n";
+
+constexpr const char *GL_FRAGMENT_SRC =
+   "#version 330 core\n"
+   "out vec4 color;\n"
+   "void main() { color = vec4(1.0); }\n";
+
+// Compiles and links trivial program, so driver loads its shader compiler
+bool compile_trivial_program(bhd::ContextApi api)
+{
+   const auto &gl = bhdi::gl_procs();
+
+   if (!gl.ok)
+      return false;
+
+   const bool es = api == bhd::ContextApi::OpenGLES;
+
+   const char *sources[] = {
+      es ? ES_VERTEX_SRC : GL_VERTEX_SRC,
+      es ? ES_FRAGMENT_SRC : GL_FRAGMENT_SRC,
+   };
+
+   const GLenum stages[] = { GL_VERTEX_SHADER, GL_FRAGMENT_SHADER };
+
+   GLuint program = gl.glCreateProgram();
+
+   for (int i = 0; i < 2; ++i)
+   {
+      GLuint shader = gl.glCreateShader(stages[i]);
+
+      gl.glShaderSource(shader, 1, &sources[i], nullptr);
+      gl.glCompileShader(shader);
+      gl.glAttachShader(program, shader);
+
+      // NB: Flagged for deletion, goes away with program
+      gl.glDeleteShader(shader);
+   }
+
+   gl.glLinkProgram(program);
+
+   GLint linked = GL_FALSE;
+   gl.glGetProgramiv(program, GL_LINK_STATUS, &linked);
+
+   gl.glDeleteProgram(program);
+   gl.glFinish();
+
+   return linked == GL_TRUE;
+}
+
+EGLDisplay warm_up(const bhd::DeviceEXT_Info &info, const bhd::PrewarmOpts &opts)
+{
+   EGLDisplay dpy = bhd::create_headless_display(info, opts.usage);
+
+   if (dpy == EGL_NO_DISPLAY)
+      return EGL_NO_DISPLAY;
+
+   if (eglInitialize(dpy, nullptr, nullptr) != EGL_TRUE)
+   {
+      // WARNING
+      std::cerr << "Failed to initialize display during warm-up (EGLError: "
+                << eglGetError() << ")" << std::endl;
+      return EGL_NO_DISPLAY;
+   }
+
+   EGLContext ctx = bhd::create_headless_context(dpy, opts.context);
+
+   if (ctx == EGL_NO_CONTEXT)
+      return dpy;
+
+   if (eglMakeCurrent(dpy, EGL_NO_SURFACE, EGL_NO_SURFACE, ctx) == EGL_TRUE)
+   {
+      if (!compile_trivial_program(opts.context.api))
+      {
+         // WARNING
+         std::cerr << "Failed to compile program during warm-up" << std::endl;
+      }
+
+      eglMakeCurrent(dpy, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+   }
+
+   eglDestroyContext(dpy, ctx);
+
+   return dpy;
+}
+
+void warm_up_main(bhdi::VecDevInfos infos, bhd::PrewarmOpts opts)
+{
+   auto &s = state();
+
+   t_warming_up = true;
+
+   for (const auto &info : infos)
+   {
+      auto start = steady_clock::now();
+
+      EGLDisplay dpy = warm_up(info, opts);
+
+      counters().device.record(steady_clock::now() - start);
+
+      std::lock_guard guard{s.lock};
+
+      for (auto &p : s.parked)
+      {
+         if (p.dev == info.egl_device_ext && !p.ready)
+         {
+            p.dpy = dpy;
+            p.ready = true;
+            break;
+         }
+      }
+
+      s.changed.notify_all();
+   }
+
+   eglReleaseThread();
+
+   std::lock_guard guard{s.lock};
+
+   s.done = true;
+   s.changed.notify_all();
+}
+
+bool start_prewarm(const bhd::PrewarmOpts &opts)
+{
+   using bhdi::BeheadEGL;
+
+   if (!BeheadEGL::ensure_client_extensions())
+      return false;
+
+   auto &s = state();
+
+   std::lock_guard guard{s.lock};
+
+   if (s.started)
+      return false;
+
+   bhdi::VecDevInfos infos;
+   bhdi::VecDevInfos selected;
+
+   try
+   {
+      infos = BeheadEGL::query_device_infos();
+   }
+   catch (const std::runtime_error &e)
+   {
+      // WARNING
+      std::cerr << "Couldn't query any device capabilities" << std::endl;
+      std::cerr << e.what() << std::endl;
+      return false;
+   }
+
+   auto ranked = BeheadEGL::rank_display_devices(infos);
+
+   for (const auto *info : ranked)
+   {
+      selected.push_back(*info);
+
+      if (!opts.all_devices)
+         break;
+   }
+
+   // Software devices are only used when asked for explicitly, or there is nothing else
+   if (opts.all_devices || selected.empty())
+   {
+      for (const auto &info : infos)
+      {
+         if (info.has_MESA_device_software && !info.has_EXT_device_drm)
+            selected.push_back(info);
+
+         if (!opts.all_devices && !selected.empty())
+            break;
+      }
+   }
+
+   if (selected.empty())
+      return false;
+
+   for (const auto &info : selected)
+      s.parked.push_back(Parked{info.egl_device_ext, opts.usage});
+
+   s.started = true;
+   s.thread = std::thread(warm_up_main, std::move(selected), opts);
+
+   return true;
+}
+
+} // namespace anonymous
+
+namespace behead_egl::internal {
+
+EGLDisplay take_parked_display(EGLDeviceEXT dev, DrmNodeUsage usage)
+{
+   if (t_warming_up)
+      return EGL_NO_DISPLAY;
+
+   auto &s = state();
+
+   std::unique_lock guard{s.lock};
+
+   auto find = [&] {
+      return std::find_if(s.parked.begin(), s.parked.end(), [&] (const Parked &p) {
+         return p.dev == dev && p.usage == usage;
+      });
+   };
+
+   auto it = find();
+
+   if (it == s.parked.end())
+      return EGL_NO_DISPLAY;
+
+   if (!it->ready)
+   {
+      s.changed.wait(guard, [&] {
+         it = find();
+         return it == s.parked.end() || it->ready;
+      });
+
+      // Someone else took it meanwhile
+      if (it == s.parked.end())
+         return EGL_NO_DISPLAY;
+   }
+
+   EGLDisplay dpy = it->dpy;
+
+   s.parked.erase(it);
+
+   if (dpy != EGL_NO_DISPLAY)
+      counters().hit.add();
+
+   return dpy;
+}
+
+void prewarm_from_env()
+{
+   static std::once_flag once;
+
+   std::call_once(once, [] {
+      const char *env = std::getenv("BEHEAD_EGL_PREWARM");
+
+      if (env == nullptr || *env == '\0' || std::strcmp(env, "0") == 0)
+         return;
+
+      PrewarmOpts opts;
+      opts.all_devices = std::strcmp(env, "all") == 0;
+
+      start_prewarm(opts);
+   });
+}
+
+} // namespace behead_egl::internal
+
+namespace behead_egl
+{
+
+bool prewarm(const PrewarmOpts &opts)
+{
+   try
+   {
+      return start_prewarm(opts);
+   }
+   catch (...)
+   {
+      assert(false && "Leaked exception");
+   }
+
+   return false;
+}
+
+bool wait_prewarm(std::chrono::milliseconds timeout)
+{
+   auto &s = state();
+
+   std::unique_lock guard{s.lock};
+
+   auto finished = [&s] { return !s.started || s.done; };
+
+   if (timeout.count() < 0)
+   {
+      s.changed.wait(guard, finished);
+      return true;
+   }
+
+   return s.changed.wait_for(guard, timeout, finished);
+}
+
+} // namespace behead_egl
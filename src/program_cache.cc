@@ -0,0 +1,634 @@
+/*
+ * SPDX-FileCopyrightText: 2020 Piotr Rak <piotr.rak@gamil.com>
+ * SPDX-License-Identifier: MIT
+ */
+#include "bhd/program_cache.hh"
+
+#include "minigl.hh"
+#include "shm_region.hh"
+#include "stats.hh"
+#include "ufd.hh"
+
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <stdexcept>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <iostream>
+
+namespace bhdi = behead_egl::internal;
+namespace bhd = behead_egl;
+
+using namespace std::literals;
+
+namespace {
+
+using std::runtime_error;
+
+constexpr std::uint32_t FILE_MAGIC = 0x62686470;   // 'bhdp'
+constexpr std::uint32_t RECORD_MAGIC = 0x62687072; // 'bhpr'
+constexpr std::uint32_t FILE_VERSION = 1;
+
+// {{{ File layout
+//
+// FileHeader, identity string, then records up to end of file.
+// Each variable sized part is padded to 8 bytes.
+
+struct FileHeader
+{
+   std::uint32_t magic;
+   std::uint32_t version;
+   std::uint32_t ident_len;
+   std::uint32_t reserved;
+};
+
+// Followed by key and binary
+struct RecordHeader
+{
+   std::uint32_t magic;
+   std::uint32_t key_len;
+   std::uint32_t format;
+   std::uint32_t size;
+   std::uint64_t checksum;
+};
+
+constexpr std::size_t pad8(std::size_t sz) noexcept
+{
+   return (sz + 7) & ~std::size_t(7);
+}
+
+// }}}
+
+// FNV-1a, we only need to catch torn writes and bit rot.
+struct Checksum
+{
+   std::uint64_t value = 0xcbf29ce484222325ull;
+
+   void update(const void *data, std::size_t len) noexcept
+   {
+      auto *p = static_cast<const unsigned char *>(data);
+
+      for (std::size_t i = 0; i < len; ++i)
+      {
+         value ^= p[i];
+         value *= 0x100000001b3ull;
+      }
+   }
+};
+
+std::uint64_t record_checksum(std::string_view key, std::uint32_t format,
+                              const void *binary, std::size_t size) noexcept
+{
+   Checksum c;
+
+   c.update(key.data(), key.size());
+   c.update(&format, sizeof(format));
+   c.update(binary, size);
+
+   return c.value;
+}
+
+void append_padded(std::vector<char> &out, const void *data, std::size_t len)
+{
+   auto *p = static_cast<const char *>(data);
+
+   out.insert(out.end(), p, p + len);
+   out.resize(pad8(out.size()), '\0');
+}
+
+void append_record(std::vector<char> &out, std::string_view key, std::uint32_t format,
+                   const void *binary, std::size_t size)
+{
+   RecordHeader rh{};
+
+   rh.magic = RECORD_MAGIC;
+   rh.key_len = std::uint32_t(key.size());
+   rh.format = format;
+   rh.size = std::uint32_t(size);
+   rh.checksum = record_checksum(key, format, binary, size);
+
+   append_padded(out, &rh, sizeof(rh));
+   append_padded(out, key.data(), key.size());
+   append_padded(out, binary, size);
+}
+
+void write_all(int fd, const std::vector<char> &buf)
+{
+   std::size_t done = 0;
+
+   while (done < buf.size())
+   {
+      ssize_t n = ::write(fd, buf.data() + done, buf.size() - done);
+
+      if (n < 0 && errno == EINTR)
+         continue;
+
+      if (n <= 0)
+         throw runtime_error("Failed to write program cache");
+
+      done += std::size_t(n);
+   }
+}
+
+bool same_file(int fd, const std::string &path) noexcept
+{
+   struct stat by_fd;
+   struct stat by_path;
+
+   return ::fstat(fd, &by_fd) == 0 && ::stat(path.c_str(), &by_path) == 0 &&
+          by_fd.st_dev == by_path.st_dev && by_fd.st_ino == by_path.st_ino;
+}
+
+// Opens file at path and flock()s it with op. Retries if file got replaced while
+// we waited for lock, so lock is held on the one path refers to.
+//
+// Appenders hold LOCK_SH, so their records don't land in file being replaced;
+// LOCK_EX is held while file is rewritten. Returns invalid fd if file is missing.
+bhdi::unique_fd open_locked(const std::string &path, int flags, int op)
+{
+   for (;;)
+   {
+      bhdi::unique_fd fd{::open(path.c_str(), flags | O_CLOEXEC)};
+
+      if (!fd.ok())
+      {
+         if (errno == ENOENT)
+            return fd;
+
+         throw runtime_error("Failed to open " + path);
+      }
+
+      int r;
+
+      do
+         r = ::flock(fd.get(), op);
+      while (r != 0 && errno == EINTR);
+
+      if (r != 0)
+         throw runtime_error("Failed to lock " + path);
+
+      if (same_file(fd.get(), path))
+         return fd;
+   }
+}
+
+// Driver and device identity cache file is bound to
+std::string identity(const bhdi::GlProcs &gl, const bhd::DeviceEXT_Info &device)
+{
+   auto gl_string = [&gl] (GLenum name) {
+      auto *s = reinterpret_cast<const char *>(gl.glGetString(name));
+      return std::string(s != nullptr ? s : "");
+   };
+
+   std::string ident;
+
+   ident += gl_string(GL_VENDOR) + "\n";
+   ident += gl_string(GL_RENDERER) + "\n";
+   ident += gl_string(GL_VERSION) + "\n";
+
+   if (device.drm_path != nullptr)
+      ident += "drm:"s + device.drm_path;
+   else if (device.cuda_dev_id)
+      ident += "cuda:" + std::to_string(*device.cuda_dev_id);
+   else if (device.has_MESA_device_software)
+      ident += "software";
+
+   return ident;
+}
+
+struct Counters
+{
+   bhdi::StatCounter &hit   = bhdi::stat_counter("program_cache.hit");
+   bhdi::StatCounter &miss  = bhdi::stat_counter("program_cache.miss");
+   bhdi::StatCounter &store = bhdi::stat_counter("program_cache.store");
+};
+
+Counters &counters()
+{
+   static Counters c;
+   return c;
+}
+
+struct Entry
+{
+   // Within mapping, or record appended by us
+   const char *binary = nullptr;
+   std::uint32_t size = 0;
+   std::uint32_t format = 0;
+};
+
+enum class ScanEnd
+{
+   // Every record is valid
+   Complete,
+
+   // Last record is cut short, ie. other process is appending it right now
+   Truncated,
+
+   // Complete record fails its checks
+   Damaged
+};
+
+} // namespace anonymous
+
+namespace behead_egl::internal {
+
+struct ProgramBinaryCacheImpl
+{
+   const GlProcs *gl = nullptr;
+
+   std::string path;
+   std::string ident;
+
+   std::mutex lock;
+
+   // {{{ Guarded by lock
+
+   SharedRegion region;
+
+   // Records we appended since file was mapped
+   std::deque<std::vector<char>> appended;
+
+   // Points into region or appended, later records win
+   std::unordered_map<std::string_view, Entry> index;
+
+   // File is missing or belongs to other driver or device
+   bool stale = true;
+
+   // }}}
+
+   // Maps and scans file, replaces it if damaged.
+   void reload();
+
+   // Maps file fd refers to and indexes its records. Valid ones are copied
+   // to valid, unless it is null.
+   ScanEnd map_and_scan(int fd, std::vector<char> *valid);
+
+   // Rewrites damaged file keeping its valid records, under LOCK_EX
+   void repair();
+
+   // Atomically replaces file with header and given records.
+   // Caller holds LOCK_EX on file being replaced, if there is one.
+   void replace(const std::vector<char> &records);
+
+   // Indexes record laid out as in file, it is kept in appended
+   void index_appended(std::vector<char> &&record);
+};
+
+ScanEnd ProgramBinaryCacheImpl::map_and_scan(int fd, std::vector<char> *valid)
+{
+   index.clear();
+   appended.clear();
+   region = SharedRegion{};
+   stale = true;
+
+   struct stat st;
+
+   if (::fstat(fd, &st) != 0 || std::size_t(st.st_size) < sizeof(FileHeader))
+      return ScanEnd::Complete;
+
+   region = SharedRegion::map_fd(fd, std::size_t(st.st_size), false);
+
+   const char *base = static_cast<const char *>(region.data());
+   const std::size_t size = region.size();
+
+   FileHeader fh;
+   std::memcpy(&fh, base, sizeof(fh));
+
+   std::size_t pos = pad8(sizeof(fh));
+
+   if (fh.magic != FILE_MAGIC || fh.version != FILE_VERSION ||
+       fh.ident_len > size - pos || ident != std::string_view(base + pos, fh.ident_len))
+      return ScanEnd::Complete;
+
+   stale = false;
+
+   pos += pad8(fh.ident_len);
+
+   while (pos < size)
+   {
+      RecordHeader rh;
+
+      if (pos + sizeof(rh) > size)
+         return ScanEnd::Truncated;
+
+      std::memcpy(&rh, base + pos, sizeof(rh));
+
+      if (rh.magic != RECORD_MAGIC)
+         return ScanEnd::Damaged;
+
+      std::uint64_t key_at = pos + pad8(sizeof(rh));
+      std::uint64_t bin_at = key_at + pad8(rh.key_len);
+      std::uint64_t end = bin_at + pad8(rh.size);
+
+      if (end > size)
+         return ScanEnd::Truncated;
+
+      std::string_view key{base + key_at, rh.key_len};
+
+      if (rh.checksum != record_checksum(key, rh.format, base + bin_at, rh.size))
+         return ScanEnd::Damaged;
+
+      index[key] = Entry{base + bin_at, rh.size, rh.format};
+
+      if (valid != nullptr)
+         valid->insert(valid->end(), base + pos, base + end);
+
+      pos = std::size_t(end);
+   }
+
+   return ScanEnd::Complete;
+}
+
+void ProgramBinaryCacheImpl::reload()
+{
+   unique_fd fd{::open(path.c_str(), O_RDONLY | O_CLOEXEC)};
+
+   if (!fd.ok())
+   {
+      index.clear();
+      appended.clear();
+      region = SharedRegion{};
+      stale = true;
+      return;
+   }
+
+   // NB: Record cut short is most likely being appended by other process right
+   // now, it is picked up next time; rewriting file would lose it.
+   if (map_and_scan(fd.get(), nullptr) == ScanEnd::Damaged)
+      repair();
+}
+
+void ProgramBinaryCacheImpl::repair()
+{
+   // NB: Appenders are done and out once we hold it
+   unique_fd fd = open_locked(path, O_RDONLY, LOCK_EX);
+
+   if (!fd.ok())
+      return;
+
+   std::vector<char> valid;
+
+   // Record still cut short under lock was left behind by writer that died
+   if (map_and_scan(fd.get(), &valid) == ScanEnd::Complete || stale)
+      return;
+
+   // WARNING
+   std::cerr << "Program cache " << path << " is damaged, rewriting it" << std::endl;
+
+   replace(valid);
+
+   // Lock is released with old file
+   fd.reset();
+
+   reload();
+}
+
+void ProgramBinaryCacheImpl::index_appended(std::vector<char> &&record)
+{
+   const char *base = appended.emplace_back(std::move(record)).data();
+
+   RecordHeader rh;
+   std::memcpy(&rh, base, sizeof(rh));
+
+   const char *key_at = base + pad8(sizeof(rh));
+   const char *bin_at = key_at + pad8(rh.key_len);
+
+   index[std::string_view{key_at, rh.key_len}] = Entry{bin_at, rh.size, rh.format};
+}
+
+void ProgramBinaryCacheImpl::replace(const std::vector<char> &records)
+{
+   std::vector<char> buf;
+
+   FileHeader fh{};
+
+   fh.magic = FILE_MAGIC;
+   fh.version = FILE_VERSION;
+   fh.ident_len = std::uint32_t(ident.size());
+
+   append_padded(buf, &fh, sizeof(fh));
+   append_padded(buf, ident.data(), ident.size());
+
+   buf.insert(buf.end(), records.begin(), records.end());
+
+   std::string tmp = path + ".tmp." + std::to_string(::getpid());
+
+   unique_fd fd{::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)};
+
+   if (!fd.ok())
+      throw runtime_error("Failed to create " + tmp);
+
+   try
+   {
+      write_all(fd.get(), buf);
+
+      if (::fsync(fd.get()) != 0)
+         throw runtime_error("Failed to sync " + tmp);
+
+      if (::rename(tmp.c_str(), path.c_str()) != 0)
+         throw runtime_error("Failed to replace " + path);
+   }
+   catch (const runtime_error &)
+   {
+      ::unlink(tmp.c_str());
+      throw;
+   }
+}
+
+} // namespace behead_egl::internal
+
+namespace behead_egl
+{
+
+ProgramBinaryCache::ProgramBinaryCache(std::string path, const DeviceEXT_Info &device):
+   _impl(std::make_unique<internal::ProgramBinaryCacheImpl>())
+{
+   auto &impl = *_impl;
+
+   impl.path = std::move(path);
+
+   const auto &gl = internal::gl_procs();
+
+   if (!gl.ok || gl.glGetProgramBinary == nullptr || gl.glProgramBinary == nullptr)
+   {
+      // ERROR
+      std::cerr << "Program binaries aren't supported" << std::endl;
+      return;
+   }
+
+   GLint formats = 0;
+   gl.glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+
+   // NB: Desktop contexts without GL_ARB_get_program_binary fail query with GL_INVALID_ENUM
+   gl.glGetError();
+
+   if (formats <= 0)
+   {
+      // ERROR
+      std::cerr << "Driver doesn't support any program binary format" << std::endl;
+      return;
+   }
+
+   impl.ident = identity(gl, device);
+
+   try
+   {
+      impl.reload();
+   }
+   catch (const std::runtime_error &e)
+   {
+      // WARNING
+      std::cerr << "Failed to load program cache " << impl.path << std::endl;
+      std::cerr << e.what() << std::endl;
+   }
+
+   impl.gl = &gl;
+}
+
+ProgramBinaryCache::~ProgramBinaryCache() = default;
+
+bool ProgramBinaryCache::ok() const noexcept
+{
+   return _impl->gl != nullptr;
+}
+
+bool ProgramBinaryCache::load(std::uint32_t program, std::string_view key)
+{
+   if (!ok())
+      return false;
+
+   auto &impl = *_impl;
+   const auto &gl = *impl.gl;
+
+   std::lock_guard guard{impl.lock};
+
+   auto it = impl.index.find(key);
+
+   if (it == impl.index.end())
+   {
+      counters().miss.add();
+      return false;
+   }
+
+   const Entry &e = it->second;
+
+   gl.glProgramBinary(program, e.format, e.binary, GLsizei(e.size));
+
+   GLint linked = GL_FALSE;
+   gl.glGetProgramiv(program, GL_LINK_STATUS, &linked);
+
+   // Rejected binaries leave error behind on some drivers
+   gl.glGetError();
+
+   if (linked != GL_TRUE)
+   {
+      counters().miss.add();
+      return false;
+   }
+
+   counters().hit.add();
+
+   return true;
+}
+
+bool ProgramBinaryCache::store(std::uint32_t program, std::string_view key)
+{
+   if (!ok())
+      return false;
+
+   auto &impl = *_impl;
+   const auto &gl = *impl.gl;
+
+   GLint length = 0;
+   gl.glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+
+   if (length <= 0)
+      return false;
+
+   std::vector<char> binary(std::size_t(length), '\0');
+
+   GLsizei written = 0;
+   GLenum format = 0;
+
+   gl.glGetProgramBinary(program, length, &written, &format, binary.data());
+
+   if (GLenum err = gl.glGetError(); err != GL_NO_ERROR || written <= 0)
+   {
+      // WARNING
+      std::cerr << "Failed to retrieve program binary (GLError: " << err << ")" << std::endl;
+      return false;
+   }
+
+   std::vector<char> record;
+   append_record(record, key, format, binary.data(), std::size_t(written));
+
+   std::lock_guard guard{impl.lock};
+
+   try
+   {
+      if (impl.stale)
+      {
+         // Replaced file may have appenders of its own
+         internal::unique_fd old = open_locked(impl.path, O_RDONLY, LOCK_EX);
+
+         std::vector<char> records;
+
+         // Other process could have replaced it for our driver meanwhile, keep its records then
+         if (old.ok())
+            impl.map_and_scan(old.get(), &records);
+
+         records.insert(records.end(), record.begin(), record.end());
+
+         impl.replace(records);
+         impl.stale = false;
+      }
+      else
+      {
+         // NB: Single write() with O_APPEND, concurrent writers don't interleave records.
+         internal::unique_fd fd = open_locked(impl.path, O_WRONLY | O_APPEND, LOCK_SH);
+
+         if (!fd.ok())
+            throw runtime_error("Failed to open " + impl.path);
+
+         write_all(fd.get(), record);
+      }
+
+      // NB: File isn't scanned again, records stored by others meanwhile
+      // are picked up once it is reopened.
+      impl.index_appended(std::move(record));
+   }
+   catch (const std::runtime_error &e)
+   {
+      // WARNING
+      std::cerr << "Failed to store program binary" << std::endl;
+      std::cerr << e.what() << std::endl;
+      return false;
+   }
+
+   counters().store.add();
+
+   return true;
+}
+
+std::size_t ProgramBinaryCache::size() const noexcept
+{
+   std::lock_guard guard{_impl->lock};
+   return _impl->index.size();
+}
+
+const std::string &ProgramBinaryCache::path() const noexcept
+{
+   return _impl->path;
+}
+
+} // namespace behead_egl
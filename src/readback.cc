@@ -0,0 +1,289 @@
+/*
+ * SPDX-FileCopyrightText: 2020 Piotr Rak <piotr.rak@gamil.com>
+ * SPDX-License-Identifier: MIT
+ */
+#include "bhd/readback.hh"
+
+#include "minigl.hh"
+#include "stats.hh"
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <utility>
+#include <vector>
+
+#include <iostream>
+
+namespace bhdi = behead_egl::internal;
+namespace bhd = behead_egl;
+
+namespace {
+
+using std::chrono::steady_clock;
+
+struct Counters
+{
+   bhdi::StatCounter &frame = bhdi::stat_counter("readback.frame");
+   bhdi::StatCounter &stall = bhdi::stat_counter("readback.stall");
+};
+
+Counters &counters()
+{
+   static Counters c;
+   return c;
+}
+
+struct Slot
+{
+   GLuint pbo = 0;
+   GLsync fence = nullptr;
+
+   std::uint64_t frame_id = 0;
+};
+
+} // namespace anonymous
+
+namespace behead_egl::internal {
+
+struct ReadbackPipelineImpl
+{
+   const GlProcs *gl = nullptr;
+
+   readback_cb_t cb;
+   ReadbackOpts opts;
+
+   unsigned width = 0;
+   unsigned height = 0;
+
+   std::size_t stride = 0;
+   std::size_t size = 0;
+
+   std::vector<Slot> ring;
+
+   // Oldest in flight and number of those
+   unsigned head = 0;
+   unsigned count = 0;
+
+   std::uint64_t last_frame_id = 0;
+
+   // Waits for oldest frame at most timeout_ns, returns false if it's not ready.
+   bool retire_oldest(GLuint64 timeout_ns);
+};
+
+bool ReadbackPipelineImpl::retire_oldest(GLuint64 timeout_ns)
+{
+   assert(count > 0);
+
+   Slot &s = ring[head];
+
+   GLbitfield flags = timeout_ns > 0 ? GL_SYNC_FLUSH_COMMANDS_BIT : 0;
+   GLenum status = gl->glClientWaitSync(s.fence, flags, timeout_ns);
+
+   if (status == GL_TIMEOUT_EXPIRED)
+      return false;
+
+   gl->glDeleteSync(s.fence);
+   s.fence = nullptr;
+
+   if (status != GL_WAIT_FAILED)
+   {
+      gl->glBindBuffer(GL_PIXEL_PACK_BUFFER, s.pbo);
+
+      const void *data = gl->glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, GLsizeiptr(size), GL_MAP_READ_BIT);
+
+      if (data != nullptr)
+      {
+         ReadbackFrame frame;
+
+         frame.data = data;
+         frame.size = size;
+         frame.stride = stride;
+         frame.width = width;
+         frame.height = height;
+         frame.frame_id = s.frame_id;
+
+         counters().frame.add();
+
+         try
+         {
+            cb(frame);
+         }
+         catch (...)
+         {
+            // WARNING
+            std::cerr << "Readback callback has thrown" << std::endl;
+         }
+
+         gl->glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+      }
+      else
+      {
+         // WARNING
+         std::cerr << "Failed to map pixel buffer (GLError: " << gl->glGetError() << ")" << std::endl;
+      }
+
+      gl->glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+   }
+
+   head = (head + 1) % ring.size();
+   --count;
+
+   return true;
+}
+
+} // namespace behead_egl::internal
+
+namespace behead_egl
+{
+
+ReadbackPipeline::ReadbackPipeline(unsigned width, unsigned height, readback_cb_t cb,
+                                   const ReadbackOpts &opts):
+   _impl(std::make_unique<internal::ReadbackPipelineImpl>())
+{
+   auto &impl = *_impl;
+
+   const auto &gl = internal::gl_procs();
+
+   unsigned bpp = internal::pixel_size(opts.format, opts.type);
+
+   if (!gl.ok || !cb || width == 0 || height == 0 || bpp == 0)
+   {
+      // ERROR
+      std::cerr << "Invalid readback pipeline setup" << std::endl;
+      return;
+   }
+
+   GLint alignment = 4;
+   gl.glGetIntegerv(GL_PACK_ALIGNMENT, &alignment);
+
+   impl.cb = std::move(cb);
+   impl.opts = opts;
+   impl.opts.depth = std::max(opts.depth, 1u);
+   impl.width = width;
+   impl.height = height;
+   impl.stride = internal::pixel_row_stride(width, bpp, alignment);
+   impl.size = impl.stride * height;
+
+   impl.ring.resize(impl.opts.depth);
+
+   for (auto &s : impl.ring)
+   {
+      gl.glGenBuffers(1, &s.pbo);
+      gl.glBindBuffer(GL_PIXEL_PACK_BUFFER, s.pbo);
+      gl.glBufferData(GL_PIXEL_PACK_BUFFER, GLsizeiptr(impl.size), nullptr, GL_STREAM_READ);
+   }
+
+   gl.glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+   if (GLenum err = gl.glGetError(); err != GL_NO_ERROR)
+   {
+      // ERROR
+      std::cerr << "Failed to allocate pixel buffers (GLError: " << err << ")" << std::endl;
+
+      for (auto &s : impl.ring)
+         gl.glDeleteBuffers(1, &s.pbo);
+
+      impl.ring.clear();
+      return;
+   }
+
+   impl.gl = &gl;
+}
+
+ReadbackPipeline::~ReadbackPipeline()
+{
+   if (!ok())
+      return;
+
+   flush();
+
+   for (auto &s : _impl->ring)
+      _impl->gl->glDeleteBuffers(1, &s.pbo);
+}
+
+bool ReadbackPipeline::ok() const noexcept
+{
+   return _impl->gl != nullptr;
+}
+
+std::uint64_t ReadbackPipeline::capture()
+{
+   if (!ok())
+      return 0;
+
+   auto &impl = *_impl;
+   const auto &gl = *impl.gl;
+
+   // Make room, deliver what is ready first
+   poll();
+
+   if (impl.count == impl.ring.size())
+   {
+      auto start = steady_clock::now();
+
+      impl.retire_oldest(GL_TIMEOUT_IGNORED);
+
+      counters().stall.record(steady_clock::now() - start);
+   }
+
+   Slot &s = impl.ring[(impl.head + impl.count) % impl.ring.size()];
+
+   gl.glBindBuffer(GL_PIXEL_PACK_BUFFER, s.pbo);
+
+   // NB: With pack buffer bound, it only schedules copy.
+   gl.glReadPixels(0, 0, GLsizei(impl.width), GLsizei(impl.height), impl.opts.format, impl.opts.type, nullptr);
+
+   gl.glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+   s.fence = gl.glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+   if (s.fence == nullptr)
+   {
+      // ERROR
+      std::cerr << "Failed to create readback fence (GLError: " << gl.glGetError() << ")" << std::endl;
+      return 0;
+   }
+
+   // Make sure fence gets to GPU, so polling sees it eventually signal
+   gl.glFlush();
+
+   s.frame_id = ++impl.last_frame_id;
+   ++impl.count;
+
+   return s.frame_id;
+}
+
+std::size_t ReadbackPipeline::poll()
+{
+   if (!ok())
+      return 0;
+
+   std::size_t delivered = 0;
+
+   while (_impl->count > 0 && _impl->retire_oldest(0))
+      ++delivered;
+
+   return delivered;
+}
+
+void ReadbackPipeline::flush()
+{
+   if (!ok())
+      return;
+
+   while (_impl->count > 0)
+      _impl->retire_oldest(GL_TIMEOUT_IGNORED);
+}
+
+unsigned ReadbackPipeline::depth() const noexcept
+{
+   return unsigned(_impl->ring.size());
+}
+
+unsigned ReadbackPipeline::in_flight() const noexcept
+{
+   return _impl->count;
+}
+
+} // namespace behead_egl
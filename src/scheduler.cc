@@ -0,0 +1,473 @@
+/*
+ * SPDX-FileCopyrightText: 2020 Piotr Rak <piotr.rak@gamil.com>
+ * SPDX-License-Identifier: MIT
+ */
+#include "bhd/scheduler.hh"
+#include "bhd/display_cache.hh"
+
+#include "mpmc_queue.hh"
+#include "shm_region.hh"
+#include "stats.hh"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <future>
+#include <mutex>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <iostream>
+
+namespace bhdi = behead_egl::internal;
+namespace bhd = behead_egl;
+
+namespace {
+
+using std::chrono::steady_clock;
+
+struct Counters
+{
+   bhdi::StatCounter &job       = bhdi::stat_counter("scheduler.job");
+   bhdi::StatCounter &steal     = bhdi::stat_counter("scheduler.steal");
+   bhdi::StatCounter &failed    = bhdi::stat_counter("scheduler.job_failed");
+};
+
+Counters &counters()
+{
+   static Counters c;
+   return c;
+}
+
+struct SchedDevice
+{
+   bhd::DeviceEXT_Info info;
+
+   EGLDisplay display = EGL_NO_DISPLAY;
+
+   // Workers of devices in same group may steal from each other
+   unsigned steal_group = 0;
+};
+
+struct Worker
+{
+   explicit Worker(std::size_t queue_capacity): queue(queue_capacity) {}
+
+   bhd::RenderWorker self;
+
+   bhdi::bounded_mpmc_queue<bhd::render_job_t> queue;
+
+   // Other workers, we may steal from
+   std::vector<Worker *> victims;
+
+   std::thread thread;
+
+   // Priority asked for worker context
+   bhd::ContextPriority requested_priority = bhd::ContextPriority::Default;
+
+   std::atomic_bool running = false;
+};
+
+// Devices scheduler runs on: drm ones, or software ones if there are none.
+std::vector<bhd::DeviceEXT_Info> collect_devices(unsigned max_devices)
+{
+   std::vector<bhd::DeviceEXT_Info> drm;
+   std::vector<bhd::DeviceEXT_Info> software;
+
+   bhd::enumerate_display_devices([&] (const bhd::DeviceEXT_Info &info) {
+      if (info.has_EXT_device_drm)
+         drm.push_back(info);
+      else if (info.has_MESA_device_software)
+         software.push_back(info);
+   }, bhd::EnumerateOpt::All);
+
+   auto devices = drm.empty() ? std::move(software) : std::move(drm);
+
+   if (max_devices != 0 && devices.size() > max_devices)
+      devices.resize(max_devices);
+
+   return devices;
+}
+
+} // namespace anonymous
+
+namespace behead_egl::internal {
+
+struct RenderSchedulerImpl
+{
+   SchedulerOpts opts;
+
+   std::vector<SchedDevice> devices;
+   std::vector<std::unique_ptr<Worker>> workers;
+
+   // Bumped on each submission, idle workers futex_wait() on it
+   std::atomic<std::uint32_t> work_seq = 0;
+   std::atomic<unsigned> sleepers = 0;
+
+   std::atomic_bool stopping = false;
+
+   // Round-robin positions, per JobClass
+   std::atomic<std::size_t> next_worker[2] = {0, 0};
+
+   // Workers of each JobClass
+   std::vector<Worker *> class_workers[2];
+
+   // Submitted and not finished jobs
+   std::atomic<std::size_t> pending = 0;
+
+   std::mutex idle_lock;
+   std::condition_variable idle_cv;
+
+   bool push(Worker &w, render_job_t &job);
+
+   // Round-robin over workers of given class
+   bool push_class(JobClass job_class, render_job_t &job);
+
+   bool take(Worker &w, render_job_t &job);
+
+   void run(Worker &w, render_job_t &job);
+
+   void worker_main(Worker &w, std::promise<bool> *started);
+};
+
+bool RenderSchedulerImpl::push(Worker &w, render_job_t &job)
+{
+   if (!w.running.load(std::memory_order_acquire))
+      return false;
+
+   pending.fetch_add(1, std::memory_order_relaxed);
+
+   if (!w.queue.try_push(job))
+   {
+      pending.fetch_sub(1, std::memory_order_relaxed);
+      return false;
+   }
+
+   work_seq.fetch_add(1, std::memory_order_release);
+
+   if (sleepers.load(std::memory_order_seq_cst) != 0)
+      futex_wake_all(work_seq);
+
+   return true;
+}
+
+bool RenderSchedulerImpl::push_class(JobClass job_class, render_job_t &job)
+{
+   const auto &workers = class_workers[unsigned(job_class)];
+   const std::size_t n = workers.size();
+
+   if (n == 0)
+      return false;
+
+   std::size_t first = next_worker[unsigned(job_class)].fetch_add(1, std::memory_order_relaxed);
+
+   for (std::size_t i = 0; i < n; ++i)
+   {
+      if (push(*workers[(first + i) % n], job))
+         return true;
+   }
+
+   return false;
+}
+
+bool RenderSchedulerImpl::take(Worker &w, render_job_t &job)
+{
+   if (w.queue.try_pop(job))
+      return true;
+
+   if (!opts.work_stealing)
+      return false;
+
+   // Start with most loaded victim
+   Worker *victim = nullptr;
+   std::size_t victim_load = 0;
+
+   for (Worker *v : w.victims)
+   {
+      std::size_t load = v->queue.size_approx();
+
+      if (load > victim_load)
+      {
+         victim = v;
+         victim_load = load;
+      }
+   }
+
+   if (victim != nullptr && victim->queue.try_pop(job))
+   {
+      counters().steal.add();
+      return true;
+   }
+
+   return false;
+}
+
+void RenderSchedulerImpl::run(Worker &w, render_job_t &job)
+{
+   auto start = steady_clock::now();
+
+   try
+   {
+      job(w.self);
+   }
+   catch (...)
+   {
+      counters().failed.add();
+   }
+
+   counters().job.record(steady_clock::now() - start);
+
+   job = nullptr;
+
+   if (pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+   {
+      std::lock_guard<std::mutex> guard(idle_lock);
+      idle_cv.notify_all();
+   }
+}
+
+void RenderSchedulerImpl::worker_main(Worker &w, std::promise<bool> *started)
+{
+   EGLDisplay dpy = w.self.display;
+
+   ContextOpts ctx_opts = opts.context;
+   ctx_opts.priority = w.requested_priority;
+
+   EGLContext ctx = create_headless_context(dpy, ctx_opts);
+
+   if (ctx == EGL_NO_CONTEXT || eglMakeCurrent(dpy, EGL_NO_SURFACE, EGL_NO_SURFACE, ctx) != EGL_TRUE)
+   {
+      // ERROR
+      std::cerr << "Render worker " << w.self.index << " failed to set up context" << std::endl;
+
+      if (ctx != EGL_NO_CONTEXT)
+         eglDestroyContext(dpy, ctx);
+
+      eglReleaseThread();
+      started->set_value(false);
+      return;
+   }
+
+   w.self.context = ctx;
+   w.self.priority = query_context_priority(dpy, ctx);
+   w.running.store(true, std::memory_order_release);
+   started->set_value(true);
+
+   render_job_t job;
+
+   for (;;)
+   {
+      if (take(w, job))
+      {
+         run(w, job);
+         continue;
+      }
+
+      // Read sequence before last check, so we don't sleep through submission
+      std::uint32_t seq = work_seq.load(std::memory_order_acquire);
+
+      sleepers.fetch_add(1, std::memory_order_seq_cst);
+
+      if (take(w, job))
+      {
+         sleepers.fetch_sub(1, std::memory_order_relaxed);
+         run(w, job);
+         continue;
+      }
+
+      if (stopping.load(std::memory_order_acquire))
+      {
+         sleepers.fetch_sub(1, std::memory_order_relaxed);
+         break;
+      }
+
+      futex_wait(work_seq, seq, -1);
+
+      sleepers.fetch_sub(1, std::memory_order_relaxed);
+   }
+
+   eglMakeCurrent(dpy, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+   eglDestroyContext(dpy, ctx);
+   eglReleaseThread();
+}
+
+} // namespace behead_egl::internal
+
+namespace behead_egl
+{
+
+RenderScheduler::RenderScheduler(const SchedulerOpts &opts):
+   _impl(std::make_unique<internal::RenderSchedulerImpl>())
+{
+   auto &impl = *_impl;
+
+   impl.opts = opts;
+   impl.opts.workers_per_device = std::max(opts.workers_per_device, 1u);
+
+   // One display per device, shared by its workers
+   for (const auto &info : collect_devices(opts.max_devices))
+   {
+      EGLDisplay dpy = create_headless_display(info, opts.node_usage);
+
+      if (dpy == EGL_NO_DISPLAY)
+         continue;
+
+      if (eglInitialize(dpy, nullptr, nullptr) != EGL_TRUE)
+      {
+         // WARNING
+         std::cerr << "Failed to initialize EGLDisplay (EGLError: " << eglGetError() << ")" << std::endl;
+         continue;
+      }
+
+      unsigned group = unsigned(impl.devices.size());
+
+      for (const auto &d : impl.devices)
+      {
+         if (std::string_view(d.info.device_extensions) == info.device_extensions)
+         {
+            group = d.steal_group;
+            break;
+         }
+      }
+
+      impl.devices.push_back({ info, dpy, group });
+   }
+
+   auto add_worker = [&impl] (unsigned d, JobClass job_class, ContextPriority priority) {
+      auto w = std::make_unique<Worker>(impl.opts.queue_capacity);
+
+      w->self.index = unsigned(impl.workers.size());
+      w->self.device_index = d;
+      w->self.display = impl.devices[d].display;
+      w->self.device = &impl.devices[d].info;
+      w->self.job_class = job_class;
+      w->requested_priority = priority;
+
+      impl.class_workers[unsigned(job_class)].push_back(w.get());
+      impl.workers.push_back(std::move(w));
+   };
+
+   for (unsigned d = 0; d < impl.devices.size(); ++d)
+   {
+      for (unsigned i = 0; i < impl.opts.workers_per_device; ++i)
+         add_worker(d, JobClass::Batch, impl.opts.context.priority);
+
+      for (unsigned i = 0; i < impl.opts.interactive_workers_per_device; ++i)
+         add_worker(d, JobClass::Interactive, impl.opts.interactive_priority);
+   }
+
+   for (auto &w : impl.workers)
+   {
+      for (auto &v : impl.workers)
+      {
+         if (v != w && v->self.job_class == w->self.job_class &&
+                       impl.devices[v->self.device_index].steal_group ==
+                       impl.devices[w->self.device_index].steal_group)
+            w->victims.push_back(v.get());
+      }
+   }
+
+   // Start workers and wait until their contexts are set up
+   std::vector<std::promise<bool>> started(impl.workers.size());
+
+   for (std::size_t i = 0; i < impl.workers.size(); ++i)
+   {
+      Worker *worker = impl.workers[i].get();
+      std::promise<bool> *p = &started[i];
+
+      worker->thread = std::thread([&impl, worker, p] { impl.worker_main(*worker, p); });
+   }
+
+   for (auto &p : started)
+      p.get_future().wait();
+}
+
+RenderScheduler::~RenderScheduler()
+{
+   auto &impl = *_impl;
+
+   wait_idle();
+
+   impl.stopping.store(true, std::memory_order_release);
+   impl.work_seq.fetch_add(1, std::memory_order_release);
+   internal::futex_wake_all(impl.work_seq);
+
+   for (auto &w : impl.workers)
+   {
+      if (w->thread.joinable())
+         w->thread.join();
+   }
+
+   for (auto &d : impl.devices)
+      terminate_display(d.display);
+}
+
+bool RenderScheduler::ok() const noexcept
+{
+   return std::any_of(_impl->workers.begin(), _impl->workers.end(), [] (const auto &w) {
+      return w->running.load(std::memory_order_acquire);
+   });
+}
+
+std::size_t RenderScheduler::worker_count() const noexcept
+{
+   return _impl->workers.size();
+}
+
+std::size_t RenderScheduler::device_count() const noexcept
+{
+   return _impl->devices.size();
+}
+
+bool RenderScheduler::submit(render_job_t job)
+{
+   return submit(std::move(job), JobClass::Batch);
+}
+
+bool RenderScheduler::submit(render_job_t job, JobClass job_class)
+{
+   auto &impl = *_impl;
+
+   if (impl.push_class(job_class, job))
+      return true;
+
+   // None of class took it: not running, full or there are none
+   return job_class != JobClass::Batch && impl.push_class(JobClass::Batch, job);
+}
+
+bool RenderScheduler::submit_to(std::size_t worker, render_job_t job)
+{
+   auto &impl = *_impl;
+
+   if (worker >= impl.workers.size())
+      return false;
+
+   return impl.push(*impl.workers[worker], job);
+}
+
+std::size_t RenderScheduler::downgraded_workers() const noexcept
+{
+   return std::count_if(_impl->workers.begin(), _impl->workers.end(), [] (const auto &w) {
+      return w->running.load(std::memory_order_acquire) &&
+             w->requested_priority != ContextPriority::Default &&
+             w->self.priority < w->requested_priority;
+   });
+}
+
+void RenderScheduler::wait_idle()
+{
+   auto &impl = *_impl;
+
+   std::unique_lock<std::mutex> guard(impl.idle_lock);
+
+   impl.idle_cv.wait(guard, [&impl] {
+      return impl.pending.load(std::memory_order_acquire) == 0;
+   });
+}
+
+} // namespace behead_egl
@@ -0,0 +1,104 @@
+/*
+ * SPDX-FileCopyrightText: 2020 Piotr Rak <piotr.rak@gamil.com>
+ * SPDX-License-Identifier: MIT
+ */
+#include "scm_rights.hh"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include <cerrno>
+#include <cstring>
+
+namespace behead_egl::internal {
+
+bool send_with_fd(int sock, const void *buf, std::size_t len, int fd) noexcept
+{
+   // NB: Protocol messages are tiny; we don't handle partial sends of ancillary data.
+   iovec iov = { const_cast<void *>(buf), len };
+
+   alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))] = {};
+
+   msghdr msg = {};
+   msg.msg_iov = &iov;
+   msg.msg_iovlen = 1;
+
+   if (fd >= 0)
+   {
+      msg.msg_control = control;
+      msg.msg_controllen = sizeof(control);
+
+      cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+      cmsg->cmsg_level = SOL_SOCKET;
+      cmsg->cmsg_type = SCM_RIGHTS;
+      cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+      std::memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+   }
+
+   ssize_t ret;
+
+   do {
+      ret = ::sendmsg(sock, &msg, MSG_NOSIGNAL);
+   } while (ret < 0 && errno == EINTR);
+
+   if (ret < 0)
+      return false;
+
+   if (std::size_t(ret) != len)
+   {
+      errno = EMSGSIZE;
+      return false;
+   }
+
+   return true;
+}
+
+bool recv_with_fd(int sock, void *buf, std::size_t len, unique_fd &fd_out) noexcept
+{
+   iovec iov = { buf, len };
+
+   alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))] = {};
+
+   msghdr msg = {};
+   msg.msg_iov = &iov;
+   msg.msg_iovlen = 1;
+   msg.msg_control = control;
+   msg.msg_controllen = sizeof(control);
+
+   ssize_t ret;
+
+   do {
+      // Stream peer may send message in pieces
+      ret = ::recvmsg(sock, &msg, MSG_CMSG_CLOEXEC | MSG_WAITALL);
+   } while (ret < 0 && errno == EINTR);
+
+   if (ret < 0)
+      return false;
+
+   // Take ownership of received fd first, so it won't leak on errors below
+   for (cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr; cmsg = CMSG_NXTHDR(&msg, cmsg))
+   {
+      if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+      {
+         int fd = -1;
+         std::memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+         fd_out.reset(fd);
+      }
+   }
+
+   if (ret == 0)
+   {
+      errno = ECONNRESET;
+      return false;
+   }
+
+   if (std::size_t(ret) != len || (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) != 0)
+   {
+      errno = EBADMSG;
+      return false;
+   }
+
+   return true;
+}
+
+} // namespace behead_egl::internal
@@ -0,0 +1,25 @@
+/*
+ * SPDX-FileCopyrightText: 2020 Piotr Rak <piotr.rak@gamil.com>
+ * SPDX-License-Identifier: MIT
+ */
+#pragma once
+
+#include "ufd.hh"
+
+#include <cstddef>
+
+namespace behead_egl::internal {
+
+// Sends exactly len bytes of buf over unix domain socket sock;
+// if fd is valid it is attached as SCM_RIGHTS ancillary data.
+//
+// Returns false on failure, errno is set.
+bool send_with_fd(int sock, const void *buf, std::size_t len, int fd = -1) noexcept;
+
+// Receives exactly len bytes into buf from unix domain socket sock;
+// fd passed with SCM_RIGHTS (if any) is stored in fd_out with O_CLOEXEC set.
+//
+// Returns false on failure or premature end of stream, errno is set.
+bool recv_with_fd(int sock, void *buf, std::size_t len, unique_fd &fd_out) noexcept;
+
+} // namespace behead_egl::internal
@@ -0,0 +1,148 @@
+/*
+ * SPDX-FileCopyrightText: 2020 Piotr Rak <piotr.rak@gamil.com>
+ * SPDX-License-Identifier: MIT
+ */
+#include "shm_region.hh"
+
+#include "ufd.hh"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <climits>
+#include <ctime>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+#ifndef __linux__
+#error "Not implemented for other platforms"
+#endif
+
+namespace behead_egl::internal {
+
+static_assert(sizeof(std::atomic<std::uint32_t>) == sizeof(std::uint32_t));
+static_assert(std::atomic<std::uint32_t>::is_always_lock_free);
+
+SharedRegion::~SharedRegion()
+{
+   reset();
+}
+
+SharedRegion::SharedRegion(SharedRegion &&other) noexcept:
+   _addr(std::exchange(other._addr, nullptr)),
+   _size(std::exchange(other._size, 0))
+{}
+
+SharedRegion &SharedRegion::operator=(SharedRegion &&other) noexcept
+{
+   reset();
+
+   _addr = std::exchange(other._addr, nullptr);
+   _size = std::exchange(other._size, 0);
+
+   return *this;
+}
+
+void SharedRegion::reset() noexcept
+{
+   if (_addr != nullptr)
+      ::munmap(_addr, _size);
+
+   _addr = nullptr;
+   _size = 0;
+}
+
+SharedRegion SharedRegion::open(const char *name, std::size_t size, unsigned mode)
+{
+   using namespace std::literals::string_literals;
+   using std::runtime_error;
+
+   // NB: Anyone able to write it can starve or corrupt others' slots,
+   // so sharing it beyond owner is caller's choice.
+   unique_fd fd{::shm_open(name, O_RDWR | O_CREAT | O_CLOEXEC, mode_t(mode))};
+
+   if (!fd.ok())
+      throw runtime_error("Failed to open shared memory "s + name);
+
+   struct stat st;
+
+   if (::fstat(fd.get(), &st) != 0)
+      throw runtime_error("Failed to stat shared memory "s + name);
+
+   // Racing creators all grow it to same size; extension is zero-filled.
+   if (std::size_t(st.st_size) < size && ::ftruncate(fd.get(), off_t(size)) != 0)
+      throw runtime_error("Failed to resize shared memory "s + name);
+
+   try
+   {
+      return map_fd(fd.get(), size, true);
+   }
+   catch (const runtime_error &)
+   {
+      throw runtime_error("Failed to map shared memory "s + name);
+   }
+}
+
+SharedRegion SharedRegion::map_fd(int fd, std::size_t size, bool writable)
+{
+   int prot = writable ? PROT_READ | PROT_WRITE : PROT_READ;
+
+   void *addr = ::mmap(nullptr, size, prot, MAP_SHARED, fd, 0);
+
+   if (addr == MAP_FAILED)
+      throw std::runtime_error("Failed to map shared memory");
+
+   SharedRegion region;
+   region._addr = addr;
+   region._size = size;
+
+   return region;
+}
+
+void futex_wait(std::atomic<std::uint32_t> &word, std::uint32_t expected,
+                std::int64_t timeout_ns) noexcept
+{
+   timespec ts;
+   timespec *pts = nullptr;
+
+   if (timeout_ns >= 0)
+   {
+      ts.tv_sec = time_t(timeout_ns / 1000000000);
+      ts.tv_nsec = long(timeout_ns % 1000000000);
+      pts = &ts;
+   }
+
+   // NB: Not FUTEX_PRIVATE_FLAG, word lives in memory shared between processes.
+   ::syscall(SYS_futex, reinterpret_cast<std::uint32_t *>(&word),
+             FUTEX_WAIT, expected, pts, nullptr, 0);
+}
+
+void futex_wake_all(std::atomic<std::uint32_t> &word) noexcept
+{
+   ::syscall(SYS_futex, reinterpret_cast<std::uint32_t *>(&word),
+             FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+}
+
+bool is_pid_alive(std::int32_t pid) noexcept
+{
+   if (pid <= 0)
+      return false;
+
+   int previous_errno = errno;
+
+   // EPERM means it exists, but belongs to someone else
+   bool alive = ::kill(pid, 0) == 0 || errno != ESRCH;
+
+   errno = previous_errno;
+
+   return alive;
+}
+
+} // namespace behead_egl::internal
@@ -0,0 +1,92 @@
+/*
+ * SPDX-FileCopyrightText: 2020 Piotr Rak <piotr.rak@gamil.com>
+ * SPDX-License-Identifier: MIT
+ */
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace behead_egl::internal {
+
+// Named POSIX shared memory mapping (/dev/shm/<name>) shared by all processes
+// on the host that open it with the same name and size.
+//
+// Memory of new region is zero-filled, thus structures placed there must treat
+// all-zero bytes as valid initial state.
+class SharedRegion final
+{
+public:
+   SharedRegion() noexcept = default;
+   ~SharedRegion();
+
+   SharedRegion(SharedRegion &&other) noexcept;
+   SharedRegion &operator=(SharedRegion &&other) noexcept;
+
+   SharedRegion(const SharedRegion &) = delete;
+   SharedRegion &operator=(const SharedRegion &) = delete;
+
+   // Opens or creates region name of at least size bytes.
+   // Region is created with permissions mode (less umask), existing one keeps its own.
+   //
+   // may throw std::runtime_error
+   static SharedRegion open(const char *name, std::size_t size, unsigned mode = 0600);
+
+   // Maps size bytes of fd (ie. memfd) shared, read-only unless writable.
+   //
+   // may throw std::runtime_error
+   static SharedRegion map_fd(int fd, std::size_t size, bool writable);
+
+   void *data() const noexcept { return _addr; }
+   std::size_t size() const noexcept { return _size; }
+
+   bool ok() const noexcept { return _addr != nullptr; }
+
+private:
+   void reset() noexcept;
+
+   void *_addr = nullptr;
+   std::size_t _size = 0;
+};
+
+// Claims header word of region for layout identified by magic.
+// Returns false if region is already in use with different layout.
+inline bool claim_region_magic(std::atomic<std::uint32_t> &word, std::uint32_t magic) noexcept
+{
+   std::uint32_t expected = 0;
+
+   if (word.compare_exchange_strong(expected, magic, std::memory_order_acq_rel))
+      return true;
+
+   return expected == magic;
+}
+
+// {{{ Process shared futex helpers
+
+// Blocks while word == expected, for at most timeout_ns (< 0 means forever).
+void futex_wait(std::atomic<std::uint32_t> &word, std::uint32_t expected,
+                std::int64_t timeout_ns) noexcept;
+
+// Wakes all waiters blocked on word
+void futex_wake_all(std::atomic<std::uint32_t> &word) noexcept;
+
+// NB: Above work on process private memory as well, just bit slower.
+
+// }}}
+
+// {{{ Liveness
+
+// Checks whether process pid still exists.
+//
+// NB: Pids get reused, so it may report long dead owner alive. Consumers
+// only use it to eventually reclaim slots, never to grant access.
+//
+// NB: Pids are meaningful only within pid namespace. Processes sharing region
+// from different namespaces (ie. containers) see each other's pids as dead or
+// as unrelated process, and may reclaim slots that are still held.
+bool is_pid_alive(std::int32_t pid) noexcept;
+
+// }}}
+
+} // namespace behead_egl::internal
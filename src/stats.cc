@@ -0,0 +1,99 @@
+/*
+ * SPDX-FileCopyrightText: 2020 Piotr Rak <piotr.rak@gamil.com>
+ * SPDX-License-Identifier: MIT
+ */
+#include "bhd/stats.hh"
+
+#include "stats.hh"
+
+#include <cassert>
+#include <deque>
+#include <mutex>
+
+namespace {
+
+using bhdi_counter = behead_egl::internal::StatCounter;
+
+struct Registry
+{
+   std::mutex lock;
+
+   // NB: deque never moves its elements
+   std::deque<bhdi_counter> counters;
+};
+
+Registry &registry()
+{
+   static Registry r;
+   return r;
+}
+
+} // namespace anonymous
+
+namespace behead_egl::internal {
+
+StatCounter &stat_counter(std::string_view name)
+{
+   auto &r = registry();
+
+   std::lock_guard<std::mutex> guard(r.lock);
+
+   for (auto &c : r.counters)
+   {
+      if (c.name == name)
+         return c;
+   }
+
+   return r.counters.emplace_back(name);
+}
+
+} // namespace behead_egl::internal
+
+namespace behead_egl
+{
+
+void foreach_stat(const stats_cb_t &cb)
+{
+   if (!cb)
+      return;
+
+   auto &r = registry();
+
+   std::unique_lock<std::mutex> guard(r.lock);
+
+   // Counters are never removed, so we can call cb without lock for those seen.
+   std::size_t n = r.counters.size();
+
+   guard.unlock();
+
+   for (std::size_t i = 0; i < n; ++i)
+   {
+      guard.lock();
+      const auto &c = r.counters[i];
+      guard.unlock();
+
+      StatSample s;
+      s.name = c.name.c_str();
+      s.count = c.count.load(std::memory_order_relaxed);
+      s.total_ns = c.total_ns.load(std::memory_order_relaxed);
+      s.max_ns = c.max_ns.load(std::memory_order_relaxed);
+
+      cb(s);
+   }
+}
+
+void reset_stats()
+{
+   auto &r = registry();
+
+   std::lock_guard<std::mutex> guard(r.lock);
+
+   for (auto &c : r.counters)
+   {
+      c.count.store(0, std::memory_order_relaxed);
+      c.total_ns.store(0, std::memory_order_relaxed);
+      c.max_ns.store(0, std::memory_order_relaxed);
+   }
+}
+
+} // namespace behead_egl
@@ -0,0 +1,51 @@
+/*
+ * SPDX-FileCopyrightText: 2020 Piotr Rak <piotr.rak@gamil.com>
+ * SPDX-License-Identifier: MIT
+ */
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace behead_egl::internal {
+
+// Process-wide named counter, reported through behead_egl::foreach_stat()
+//
+// Recording is lock-free, only registration takes lock.
+struct StatCounter
+{
+   explicit StatCounter(std::string_view n): name(n) {}
+
+   void add(std::uint64_t n = 1) noexcept
+   {
+      count.fetch_add(n, std::memory_order_relaxed);
+   }
+
+   void record(std::chrono::nanoseconds d) noexcept
+   {
+      std::uint64_t ns = d.count() > 0 ? std::uint64_t(d.count()) : 0;
+
+      count.fetch_add(1, std::memory_order_relaxed);
+      total_ns.fetch_add(ns, std::memory_order_relaxed);
+
+      std::uint64_t prev = max_ns.load(std::memory_order_relaxed);
+
+      while (prev < ns && !max_ns.compare_exchange_weak(prev, ns, std::memory_order_relaxed))
+         ;
+   }
+
+   const std::string name;
+
+   std::atomic<std::uint64_t> count    = 0;
+   std::atomic<std::uint64_t> total_ns = 0;
+   std::atomic<std::uint64_t> max_ns   = 0;
+};
+
+// Returns counter registered under name, registers it on first use.
+// Reference stays valid for lifetime of process, callers are expected to cache it.
+StatCounter &stat_counter(std::string_view name);
+
+} // namespace behead_egl::internal
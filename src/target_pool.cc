@@ -0,0 +1,477 @@
+/*
+ * SPDX-FileCopyrightText: 2020 Piotr Rak <piotr.rak@gamil.com>
+ * SPDX-License-Identifier: MIT
+ */
+#include "bhd/target_pool.hh"
+
+#include "minigl.hh"
+#include "stats.hh"
+
+#include <cassert>
+#include <deque>
+#include <unordered_map>
+#include <utility>
+
+#include <iostream>
+
+namespace bhdi = behead_egl::internal;
+namespace bhd = behead_egl;
+
+namespace {
+
+using bhd::ColorFormat;
+using bhd::DepthFormat;
+
+struct Counters
+{
+   bhdi::StatCounter &hit   = bhdi::stat_counter("target_pool.hit");
+   bhdi::StatCounter &miss  = bhdi::stat_counter("target_pool.miss");
+   bhdi::StatCounter &evict = bhdi::stat_counter("target_pool.evict");
+};
+
+Counters &counters()
+{
+   static Counters c;
+   return c;
+}
+
+struct ColorFormatInfo
+{
+   GLint internal_format;
+   GLenum format;
+   GLenum type;
+   unsigned bpp;
+};
+
+// NB: Same order as ColorFormat
+constexpr ColorFormatInfo COLOR_FORMATS[] = {
+   { GL_RGBA8,   GL_RGBA, GL_UNSIGNED_BYTE, 4 },
+   { GL_RGBA16F, GL_RGBA, GL_HALF_FLOAT,    8 },
+   { GL_R8,      GL_RED,  GL_UNSIGNED_BYTE, 1 },
+};
+
+struct DepthFormatInfo
+{
+   GLenum internal_format;
+   GLenum attachment;
+   unsigned bpp;
+};
+
+// NB: Same order as DepthFormat
+constexpr DepthFormatInfo DEPTH_FORMATS[] = {
+   { GL_NONE,               GL_NONE,                     0 },
+   { GL_DEPTH24_STENCIL8,   GL_DEPTH_STENCIL_ATTACHMENT, 4 },
+   { GL_DEPTH_COMPONENT32F, GL_DEPTH_ATTACHMENT,         4 },
+};
+
+// Pbuffer configs we pick are 8 bits per channel RGBA
+constexpr unsigned PBUFFER_BPP = 4;
+
+// Rounds up to multiple of quarter of highest power of 2 not above n,
+// so class is at most 25% larger than n.
+constexpr std::uint32_t size_class(std::uint32_t n) noexcept
+{
+   if (n <= 16)
+      return 16;
+
+   std::uint32_t p = 1;
+
+   while (p <= n / 2)
+      p <<= 1;
+
+   const std::uint32_t step = p / 4;
+
+   return (n + step - 1) / step * step;
+}
+
+static_assert(size_class(17) == 20);
+static_assert(size_class(1024) == 1024);
+static_assert(size_class(1080) == 1280);
+
+struct Target
+{
+   GLuint framebuffer = 0;
+   GLuint color_texture = 0;
+   GLuint depth_renderbuffer = 0;
+   EGLSurface pbuffer = EGL_NO_SURFACE;
+
+   std::uint32_t width = 0;
+   std::uint32_t height = 0;
+
+   std::uint64_t key = 0;
+   std::size_t bytes = 0;
+
+   // Set while idle
+   GLsync fence = nullptr;
+   std::uint64_t released = 0;
+};
+
+std::size_t target_bytes(std::uint32_t width, std::uint32_t height, const bhd::RenderTargetDesc &desc) noexcept
+{
+   unsigned bpp = COLOR_FORMATS[unsigned(desc.color)].bpp + DEPTH_FORMATS[unsigned(desc.depth)].bpp;
+
+   if (desc.pbuffer)
+      bpp += PBUFFER_BPP;
+
+   return std::size_t(width) * height * bpp;
+}
+
+// Size class and formats packed together; GL limits sizes well below 2^24
+std::uint64_t make_key(std::uint32_t width, std::uint32_t height, const bhd::RenderTargetDesc &desc) noexcept
+{
+   return std::uint64_t(width) |
+      (std::uint64_t(height) << 24) |
+      (std::uint64_t(desc.color) << 48) |
+      (std::uint64_t(desc.depth) << 52) |
+      (std::uint64_t(desc.pbuffer) << 56);
+}
+
+} // namespace anonymous
+
+namespace behead_egl::internal {
+
+struct TargetPoolImpl
+{
+   const GlProcs *gl = nullptr;
+
+   EGLDisplay dpy = EGL_NO_DISPLAY;
+   RenderTargetPoolOpts opts;
+
+   // Chosen on first pbuffer request
+   EGLConfig pbuffer_config = nullptr;
+
+   std::size_t memory = 0;
+
+   std::uint64_t last_id = 0;
+   std::uint64_t last_released = 0;
+
+   // Per size class, in release order
+   std::unordered_map<std::uint64_t, std::deque<Target>> idle;
+   std::size_t idle_count = 0;
+
+   std::unordered_map<std::uint64_t, Target> busy;
+
+   bool allocate(Target &t, const RenderTargetDesc &desc);
+
+   void destroy(Target &t);
+
+   // Frees least recently released idle target, false if there is none
+   bool evict_oldest();
+};
+
+bool TargetPoolImpl::allocate(Target &t, const RenderTargetDesc &desc)
+{
+   const auto &color = COLOR_FORMATS[unsigned(desc.color)];
+   const auto &depth = DEPTH_FORMATS[unsigned(desc.depth)];
+
+   // NB: Restore bindings, so we don't disturb ones application may care about.
+   GLint prev_framebuffer = 0;
+   GLint prev_texture = 0;
+   GLint prev_renderbuffer = 0;
+
+   gl->glGetIntegerv(GL_FRAMEBUFFER_BINDING, &prev_framebuffer);
+   gl->glGetIntegerv(GL_TEXTURE_BINDING_2D, &prev_texture);
+   gl->glGetIntegerv(GL_RENDERBUFFER_BINDING, &prev_renderbuffer);
+
+   gl->glGenTextures(1, &t.color_texture);
+   gl->glBindTexture(GL_TEXTURE_2D, t.color_texture);
+   gl->glTexImage2D(GL_TEXTURE_2D, 0, color.internal_format, GLsizei(t.width), GLsizei(t.height), 0,
+                    color.format, color.type, nullptr);
+   // No mipmaps, texture has to be complete for sampling
+   gl->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+   gl->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+   gl->glGenFramebuffers(1, &t.framebuffer);
+   gl->glBindFramebuffer(GL_FRAMEBUFFER, t.framebuffer);
+   gl->glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, t.color_texture, 0);
+
+   if (desc.depth != DepthFormat::None)
+   {
+      gl->glGenRenderbuffers(1, &t.depth_renderbuffer);
+      gl->glBindRenderbuffer(GL_RENDERBUFFER, t.depth_renderbuffer);
+      gl->glRenderbufferStorage(GL_RENDERBUFFER, depth.internal_format, GLsizei(t.width), GLsizei(t.height));
+      gl->glFramebufferRenderbuffer(GL_FRAMEBUFFER, depth.attachment, GL_RENDERBUFFER, t.depth_renderbuffer);
+   }
+
+   GLenum status = gl->glCheckFramebufferStatus(GL_FRAMEBUFFER);
+
+   gl->glBindFramebuffer(GL_FRAMEBUFFER, GLuint(prev_framebuffer));
+   gl->glBindTexture(GL_TEXTURE_2D, GLuint(prev_texture));
+   gl->glBindRenderbuffer(GL_RENDERBUFFER, GLuint(prev_renderbuffer));
+
+   if (status != GL_FRAMEBUFFER_COMPLETE)
+   {
+      // ERROR
+      std::cerr << "Render target " << t.width << "x" << t.height
+                << " incomplete (status: " << status << ", GLError: " << gl->glGetError() << ")" << std::endl;
+      return false;
+   }
+
+   if (!desc.pbuffer)
+      return true;
+
+   if (pbuffer_config == nullptr)
+      pbuffer_config = bhd::choose_headless_config(dpy, opts.context);
+
+   if (pbuffer_config == nullptr)
+      return false;
+
+   const EGLint attribs[] = {
+      EGL_WIDTH, EGLint(t.width),
+      EGL_HEIGHT, EGLint(t.height),
+      EGL_NONE
+   };
+
+   t.pbuffer = eglCreatePbufferSurface(dpy, pbuffer_config, attribs);
+
+   if (t.pbuffer == EGL_NO_SURFACE)
+   {
+      // ERROR
+      std::cerr << "Failed to create pbuffer " << t.width << "x" << t.height
+                << " (EGLError: " << eglGetError() << ")" << std::endl;
+      return false;
+   }
+
+   return true;
+}
+
+void TargetPoolImpl::destroy(Target &t)
+{
+   if (t.fence != nullptr)
+      gl->glDeleteSync(t.fence);
+
+   if (t.pbuffer != EGL_NO_SURFACE)
+      eglDestroySurface(dpy, t.pbuffer);
+
+   if (t.framebuffer != 0)
+      gl->glDeleteFramebuffers(1, &t.framebuffer);
+
+   if (t.depth_renderbuffer != 0)
+      gl->glDeleteRenderbuffers(1, &t.depth_renderbuffer);
+
+   if (t.color_texture != 0)
+      gl->glDeleteTextures(1, &t.color_texture);
+
+   t = Target{};
+}
+
+bool TargetPoolImpl::evict_oldest()
+{
+   // NB: Few size classes in practice, linear scan over them is fine
+   auto oldest = idle.end();
+
+   for (auto it = idle.begin(); it != idle.end(); ++it)
+   {
+      if (!it->second.empty() &&
+          (oldest == idle.end() || it->second.front().released < oldest->second.front().released))
+         oldest = it;
+   }
+
+   if (oldest == idle.end())
+      return false;
+
+   auto &t = oldest->second.front();
+
+   memory -= t.bytes;
+   --idle_count;
+
+   // NB: GL defers freeing objects still in use by pending commands.
+   destroy(t);
+
+   oldest->second.pop_front();
+
+   counters().evict.add();
+
+   return true;
+}
+
+} // namespace behead_egl::internal
+
+namespace behead_egl {
+
+RenderTargetPool::RenderTargetPool(EGLDisplay dpy, const RenderTargetPoolOpts &opts):
+   _impl(std::make_unique<internal::TargetPoolImpl>())
+{
+   auto &impl = *_impl;
+
+   const auto &gl = internal::gl_procs();
+
+   if (!gl.ok || dpy == EGL_NO_DISPLAY)
+   {
+      // ERROR
+      std::cerr << "Invalid render target pool setup" << std::endl;
+      return;
+   }
+
+   impl.dpy = dpy;
+   impl.opts = opts;
+   impl.gl = &gl;
+}
+
+RenderTargetPool::~RenderTargetPool()
+{
+   if (!ok())
+      return;
+
+   auto &impl = *_impl;
+
+   for (auto &[key, targets] : impl.idle)
+   {
+      for (auto &t : targets)
+         impl.destroy(t);
+   }
+
+   for (auto &[id, t] : impl.busy)
+      impl.destroy(t);
+}
+
+bool RenderTargetPool::ok() const noexcept
+{
+   return _impl->gl != nullptr;
+}
+
+RenderTarget RenderTargetPool::acquire(const RenderTargetDesc &desc)
+{
+   try
+   {
+      if (!ok() || desc.width == 0 || desc.height == 0)
+         return {};
+
+      auto &impl = *_impl;
+      const auto &gl = *impl.gl;
+
+      const std::uint32_t width = size_class(desc.width);
+      const std::uint32_t height = size_class(desc.height);
+      const std::uint64_t key = make_key(width, height, desc);
+
+      Target t;
+
+      auto it = impl.idle.find(key);
+
+      // NB: Fences of one context signal in order, if oldest didn't, neither did the rest.
+      if (it != impl.idle.end() && !it->second.empty() &&
+          gl.glClientWaitSync(it->second.front().fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0) != GL_TIMEOUT_EXPIRED)
+      {
+         t = std::move(it->second.front());
+         it->second.pop_front();
+         --impl.idle_count;
+
+         gl.glDeleteSync(t.fence);
+         t.fence = nullptr;
+
+         counters().hit.add();
+      }
+      else
+      {
+         counters().miss.add();
+
+         t.width = width;
+         t.height = height;
+         t.key = key;
+         t.bytes = target_bytes(width, height, desc);
+
+         while (impl.memory + t.bytes > impl.opts.memory_cap && impl.evict_oldest())
+            ;
+
+         if (impl.memory + t.bytes > impl.opts.memory_cap)
+         {
+            // WARNING
+            std::cerr << "Render target pool over memory cap, " << impl.memory
+                      << " bytes held by targets in use" << std::endl;
+            return {};
+         }
+
+         if (!impl.allocate(t, desc))
+         {
+            impl.destroy(t);
+            return {};
+         }
+
+         impl.memory += t.bytes;
+      }
+
+      RenderTarget target;
+
+      target.framebuffer = t.framebuffer;
+      target.color_texture = t.color_texture;
+      target.depth_renderbuffer = t.depth_renderbuffer;
+      target.pbuffer = t.pbuffer;
+      target.width = t.width;
+      target.height = t.height;
+      target.id = ++impl.last_id;
+
+      impl.busy.emplace(target.id, std::move(t));
+
+      return target;
+   }
+   catch (...)
+   {
+      assert(false && "Leaked exception");
+   }
+
+   return {};
+}
+
+void RenderTargetPool::release(RenderTarget &target)
+{
+   try
+   {
+      if (!ok() || !target)
+         return;
+
+      auto &impl = *_impl;
+
+      auto it = impl.busy.find(target.id);
+
+      if (it == impl.busy.end())
+      {
+         assert(false && "Target not acquired from this pool");
+         return;
+      }
+
+      Target t = std::move(it->second);
+      impl.busy.erase(it);
+
+      t.fence = impl.gl->glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+      t.released = ++impl.last_released;
+
+      if (t.fence == nullptr)
+      {
+         // NB: Can't tell when it is free, don't hand it out again.
+         impl.memory -= t.bytes;
+         impl.destroy(t);
+      }
+      else
+      {
+         impl.idle[t.key].push_back(std::move(t));
+         ++impl.idle_count;
+      }
+
+      target = RenderTarget{};
+   }
+   catch (...)
+   {
+      assert(false && "Leaked exception");
+   }
+}
+
+void RenderTargetPool::trim()
+{
+   if (!ok())
+      return;
+
+   while (_impl->evict_oldest())
+      ;
+}
+
+std::size_t RenderTargetPool::memory() const noexcept
+{
+   return _impl->memory;
+}
+
+std::size_t RenderTargetPool::size() const noexcept
+{
+   return _impl->idle_count + _impl->busy.size();
+}
+
+} // namespace behead_egl
@@ -9,4 +9,6 @@ namespace behead_egl::internal {
 // Instantiate with posix_closer
 template class basic_unique_fd<posix_closer>;
 
+template class basic_unique_fd_set<posix_closer>;
+
 } // behead_egl::internal
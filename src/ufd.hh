@@ -5,9 +5,14 @@
 
 #pragma once
 
+#include <algorithm>
+#include <cstddef>
+#include <memory>
 #include <utility>
 
 #include <errno.h>
+#include <fcntl.h>
+#include <sys/syscall.h>
 #include <unistd.h>
 
 namespace behead_egl::internal {
@@ -115,6 +120,279 @@ private:
 
 };
 
+// close_range(2) (Linux 5.9, CLOSE_RANGE_CLOEXEC since 5.11) through syscall(),
+// so we don't depend on libc wrapper. Fails with ENOSYS where unavailable.
+inline int sys_close_range(unsigned first, unsigned last, unsigned flags) noexcept
+{
+#if defined(SYS_close_range)
+   return int(::syscall(SYS_close_range, first, last, flags));
+#else
+   (void)first; (void)last; (void)flags;
+   errno = ENOSYS;
+   return -1;
+#endif
+}
+
+// From linux/close_range.h, not every libc exposes it
+constexpr unsigned SYS_CLOSE_RANGE_CLOEXEC = 1u << 2;
+
+// Owns set of fds released together, first N_ are kept inline.
+//
+// Closer may provide close_range(first, last) closing whole inclusive range,
+// runs of consecutive fds are then released by single call each; otherwise,
+// or if it fails, fds are passed to closer one by one.
+template <typename CloserTy_, std::size_t N_ = 8>
+class basic_unique_fd_set final
+{
+   constexpr static bool if_closer_noexcept = noexcept(std::declval<CloserTy_>()(int()));
+
+public:
+   using unique_fd_type = basic_unique_fd<CloserTy_>;
+
+   basic_unique_fd_set() noexcept = default;
+
+   ~basic_unique_fd_set()
+   {
+      this->reset();
+   }
+
+   basic_unique_fd_set(basic_unique_fd_set&& other) noexcept
+   {
+      this->steal(other);
+   }
+
+   basic_unique_fd_set(const basic_unique_fd_set&) = delete;
+
+   void operator=(const basic_unique_fd_set&) = delete;
+
+   ///{{{ Observers
+
+   std::size_t size() const noexcept
+   { return _size; }
+
+   bool empty() const noexcept
+   { return _size == 0; }
+
+   int operator[](std::size_t i) const noexcept
+   { return data()[i]; }
+
+   const int *begin() const noexcept
+   { return data(); }
+
+   const int *end() const noexcept
+   { return data() + _size; }
+
+   /// }}}
+
+   /// {{{ Mutators
+
+   basic_unique_fd_set& operator=(basic_unique_fd_set&& other) noexcept(if_closer_noexcept)
+   {
+      if (this != &other)
+      {
+         this->reset();
+         this->steal(other);
+      }
+
+      return *this;
+   }
+
+   // Takes ownership of fd, invalid one is ignored.
+   // May throw std::bad_alloc, fd stays owned by caller then.
+   void push_back(unique_fd_type&& fd)
+   {
+      if (!fd.ok())
+         return;
+
+      this->reserve(_size + 1);
+
+      data()[_size++] = fd.release();
+   }
+
+   // Gives up ownership of fd at i, last one takes its place
+   [[nodiscard]] unique_fd_type take(std::size_t i) noexcept
+   {
+      int *fds = data();
+
+      int fd = fds[i];
+      fds[i] = fds[--_size];
+
+      return unique_fd_type{fd};
+   }
+
+   void reserve(std::size_t capacity)
+   {
+      if (capacity <= _capacity)
+         return;
+
+      capacity = std::max(capacity, _capacity * 2);
+
+      auto heap = std::make_unique<int[]>(capacity);
+
+      std::copy(begin(), end(), heap.get());
+
+      _heap = std::move(heap);
+      _capacity = capacity;
+   }
+
+   // Duplicates every fd into out (F_DUPFD_CLOEXEC unless cloexec is false),
+   // all or nothing. New fds are asked for in ascending order, so they form
+   // runs as long as fd table has no holes past them.
+   //
+   // May throw std::bad_alloc.
+   bool dup_into(basic_unique_fd_set& out, bool cloexec = true) const
+   {
+      const int cmd = cloexec ? F_DUPFD_CLOEXEC : F_DUPFD;
+      const std::size_t first = out._size;
+
+      out.reserve(out._size + _size);
+
+      int min_fd = 0;
+
+      for (int fd : *this)
+      {
+         int dup_fd = ::fcntl(fd, cmd, min_fd);
+
+         // Past RLIMIT_NOFILE, take any
+         if (dup_fd < 0 && errno == EINVAL)
+            dup_fd = ::fcntl(fd, cmd, 0);
+
+         if (dup_fd < 0)
+         {
+            int previous_errno = errno;
+
+            while (out._size > first)
+               close_one(out.data()[--out._size]);
+
+            errno = previous_errno;
+            return false;
+         }
+
+         out.data()[out._size++] = dup_fd;
+         min_fd = dup_fd + 1;
+      }
+
+      return true;
+   }
+
+   // Sets or clears FD_CLOEXEC of every fd. Setting it uses single
+   // close_range(CLOSE_RANGE_CLOEXEC) per run of consecutive fds, where available.
+   bool set_cloexec(bool on) noexcept
+   {
+      const int *fds = data();
+      bool ok = true;
+
+      for (std::size_t i = 0; i < _size;)
+      {
+         std::size_t j = i + 1;
+
+         while (on && j < _size && fds[j] == fds[j - 1] + 1)
+            ++j;
+
+         if (j - i > 1 && sys_close_range(unsigned(fds[i]), unsigned(fds[j - 1]), SYS_CLOSE_RANGE_CLOEXEC) == 0)
+         {
+            i = j;
+            continue;
+         }
+
+         for (; i < j; ++i)
+         {
+            int flags = ::fcntl(fds[i], F_GETFD);
+
+            if (flags < 0)
+            {
+               ok = false;
+               continue;
+            }
+
+            flags = on ? (flags | FD_CLOEXEC) : (flags & ~FD_CLOEXEC);
+
+            ok &= ::fcntl(fds[i], F_SETFD, flags) == 0;
+         }
+      }
+
+      return ok;
+   }
+
+   // Closes every fd, runs of consecutive fds with single close_range() each
+   void reset() noexcept(if_closer_noexcept)
+   {
+      int *fds = data();
+
+      std::sort(fds, fds + _size);
+
+      for (std::size_t i = 0; i < _size;)
+      {
+         std::size_t j = i + 1;
+
+         while (j < _size && fds[j] == fds[j - 1] + 1)
+            ++j;
+
+         close_run(fds[i], fds[j - 1], 0);
+
+         i = j;
+      }
+
+      _size = 0;
+   }
+
+   /// }}}
+
+private:
+   int _inline[N_];
+   std::unique_ptr<int[]> _heap;
+
+   std::size_t _size = 0;
+   std::size_t _capacity = N_;
+
+   int *data() noexcept
+   { return _heap ? _heap.get() : _inline; }
+
+   const int *data() const noexcept
+   { return _heap ? _heap.get() : _inline; }
+
+   void steal(basic_unique_fd_set& other) noexcept
+   {
+      if (other._heap)
+         _heap = std::move(other._heap);
+      else
+      {
+         // Our spilled storage would otherwise shadow inline copy
+         _heap.reset();
+         std::copy(other._inline, other._inline + other._size, _inline);
+      }
+
+      _size = std::exchange(other._size, 0);
+      _capacity = std::exchange(other._capacity, N_);
+   }
+
+   static void close_one(int fd) noexcept(if_closer_noexcept)
+   {
+      CloserTy_ c;
+      c(fd);
+   }
+
+   template <typename Ty_ = CloserTy_>
+   static auto close_run(int first, int last, int) noexcept(if_closer_noexcept) ->
+      decltype(std::declval<Ty_&>().close_range(0u, 0u), void())
+   {
+      Ty_ c;
+
+      if (first != last && c.close_range(unsigned(first), unsigned(last)) == 0)
+         return;
+
+      for (int fd = first; fd <= last; ++fd)
+         c(fd);
+   }
+
+   template <typename Ty_ = CloserTy_>
+   static void close_run(int first, int last, long) noexcept(if_closer_noexcept)
+   {
+      for (int fd = first; fd <= last; ++fd)
+         close_one(fd);
+   }
+};
+
 struct posix_closer final
 {
    int operator() (int fd) noexcept
@@ -124,11 +402,23 @@ struct posix_closer final
       errno = previous_errno;
       return ret;
    }
+
+   int close_range(unsigned first, unsigned last) noexcept
+   {
+      int previous_errno = errno;
+      int ret = sys_close_range(first, last, 0);
+      errno = previous_errno;
+      return ret;
+   }
 };
 
 using unique_fd = basic_unique_fd<posix_closer>;
 
+using unique_fd_set = basic_unique_fd_set<posix_closer>;
+
 extern template class basic_unique_fd<posix_closer>;
 
+extern template class basic_unique_fd_set<posix_closer>;
+
 } // namespace behead_egl::internal
 
@@ -0,0 +1,441 @@
+/*
+ * SPDX-FileCopyrightText: 2020 Piotr Rak <piotr.rak@gamil.com>
+ * SPDX-License-Identifier: MIT
+ */
+#include "bhd/upload_ring.hh"
+
+#include "minigl.hh"
+#include "stats.hh"
+
+#include <cassert>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include <iostream>
+
+namespace bhdi = behead_egl::internal;
+namespace bhd = behead_egl;
+
+namespace {
+
+using std::chrono::steady_clock;
+
+struct Counters
+{
+   bhdi::StatCounter &bytes = bhdi::stat_counter("upload.bytes");
+   bhdi::StatCounter &block = bhdi::stat_counter("upload.block");
+   bhdi::StatCounter &stall = bhdi::stat_counter("upload.stall");
+};
+
+Counters &counters()
+{
+   static Counters c;
+   return c;
+}
+
+enum class SliceState
+{
+   Reserved,
+   Submitted,
+   Canceled
+};
+
+struct Pending
+{
+   std::uint64_t id = 0;
+
+   std::size_t offset = 0;
+   std::size_t size = 0;
+
+   // Ring position past this slice, including padding in front of it
+   std::uint64_t end = 0;
+
+   SliceState state = SliceState::Reserved;
+   std::uint64_t tag = 0;
+};
+
+struct Fence
+{
+   GLsync sync = nullptr;
+
+   // Ring position released once sync signals
+   std::uint64_t end = 0;
+};
+
+constexpr bool is_pow2(std::size_t v) noexcept
+{
+   return v != 0 && (v & (v - 1)) == 0;
+}
+
+} // namespace anonymous
+
+namespace behead_egl::internal {
+
+struct UploadRingImpl
+{
+   const GlProcs *gl = nullptr;
+
+   GLuint buffer = 0;
+   char *mapping = nullptr;
+   std::size_t capacity = 0;
+
+   // {{{ Guarded by lock
+
+   std::mutex lock;
+   std::condition_variable space_freed;
+
+   // Monotonic positions, both taken modulo capacity; head - tail bytes are in use
+   std::uint64_t head = 0;
+   std::uint64_t tail = 0;
+
+   std::uint64_t last_id = 0;
+
+   // Reserved and not consumed yet, in reservation order
+   std::deque<Pending> pending;
+
+   // }}}
+
+   // Render thread only
+   std::deque<Fence> fences;
+
+   Pending *find(std::uint64_t id);
+
+   // Releases space of signaled fences, never blocks
+   void retire();
+};
+
+Pending *UploadRingImpl::find(std::uint64_t id)
+{
+   if (pending.empty() || id < pending.front().id)
+      return nullptr;
+
+   std::uint64_t idx = id - pending.front().id;
+
+   return idx < pending.size() ? &pending[std::size_t(idx)] : nullptr;
+}
+
+void UploadRingImpl::retire()
+{
+   std::uint64_t released = 0;
+
+   while (!fences.empty())
+   {
+      GLenum status = gl->glClientWaitSync(fences.front().sync, 0, 0);
+
+      if (status == GL_TIMEOUT_EXPIRED)
+         break;
+
+      // NB: GL_WAIT_FAILED means we can't tell anymore, don't hold space forever.
+      gl->glDeleteSync(fences.front().sync);
+      released = fences.front().end;
+      fences.pop_front();
+   }
+
+   if (released == 0)
+      return;
+
+   {
+      std::lock_guard guard{lock};
+      tail = released;
+   }
+
+   space_freed.notify_all();
+}
+
+} // namespace behead_egl::internal
+
+namespace behead_egl
+{
+
+UploadRing::UploadRing(const UploadRingOpts &opts):
+   _impl(std::make_unique<internal::UploadRingImpl>())
+{
+   auto &impl = *_impl;
+
+   const auto &gl = internal::gl_procs();
+
+   if (!gl.ok || opts.capacity == 0)
+   {
+      // ERROR
+      std::cerr << "Invalid upload ring setup" << std::endl;
+      return;
+   }
+
+   PFNGLBUFFERSTORAGEEXTPROC buffer_storage = nullptr;
+
+   if (gl.glBufferStorageEXT != nullptr && internal::gl_has_extension(gl, "GL_EXT_buffer_storage"))
+      buffer_storage = gl.glBufferStorageEXT;
+   else if (gl.glBufferStorage != nullptr && internal::gl_has_extension(gl, "GL_ARB_buffer_storage"))
+      buffer_storage = gl.glBufferStorage;
+
+   if (buffer_storage == nullptr)
+   {
+      // ERROR
+      std::cerr << "Context doesn't support buffer storage" << std::endl;
+      return;
+   }
+
+   const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT_EXT | GL_MAP_COHERENT_BIT_EXT;
+
+   // NB: Use copy write target, so we don't disturb bindings application may care about.
+   gl.glGenBuffers(1, &impl.buffer);
+   gl.glBindBuffer(GL_COPY_WRITE_BUFFER, impl.buffer);
+
+   buffer_storage(GL_COPY_WRITE_BUFFER, GLsizeiptr(opts.capacity), nullptr, flags);
+
+   void *mapping = gl.glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, GLsizeiptr(opts.capacity), flags);
+
+   gl.glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+   if (mapping == nullptr)
+   {
+      // ERROR
+      std::cerr << "Failed to map upload buffer (GLError: " << gl.glGetError() << ")" << std::endl;
+
+      gl.glDeleteBuffers(1, &impl.buffer);
+      impl.buffer = 0;
+      return;
+   }
+
+   impl.mapping = static_cast<char *>(mapping);
+   impl.capacity = opts.capacity;
+   impl.gl = &gl;
+}
+
+UploadRing::~UploadRing()
+{
+   if (!ok())
+      return;
+
+   auto &impl = *_impl;
+
+   for (auto &f : impl.fences)
+      impl.gl->glDeleteSync(f.sync);
+
+   // NB: GL keeps storage alive until commands sourcing it are done,
+   // deleting mapped buffer unmaps it.
+   impl.gl->glDeleteBuffers(1, &impl.buffer);
+}
+
+bool UploadRing::ok() const noexcept
+{
+   return _impl->gl != nullptr;
+}
+
+UploadSlice UploadRing::reserve(std::size_t size, std::size_t alignment,
+                                std::chrono::milliseconds timeout)
+{
+   if (!ok() || size == 0 || size > _impl->capacity || !is_pow2(alignment))
+      return UploadSlice{};
+
+   auto &impl = *_impl;
+
+   std::unique_lock guard{impl.lock};
+
+   std::size_t offset = 0;
+   std::uint64_t needed = 0;
+
+   auto fits = [&] {
+      // Nothing in use, start over from beginning of buffer, so slice
+      // can take all of it whatever came before.
+      if (impl.head == impl.tail)
+      {
+         impl.head = (impl.head + impl.capacity - 1) / impl.capacity * impl.capacity;
+         impl.tail = impl.head;
+      }
+
+      std::size_t pos = std::size_t(impl.head % impl.capacity);
+      std::size_t aligned = (pos + alignment - 1) & ~(alignment - 1);
+
+      if (aligned + size > impl.capacity)
+      {
+         // Wrap around, skipping tail end of buffer. Slice goes in front of
+         // tail offset, unless tail is still behind us in previous lap.
+         offset = 0;
+         needed = impl.capacity - pos + size;
+
+         std::size_t tail_pos = std::size_t(impl.tail % impl.capacity);
+
+         return tail_pos <= pos && tail_pos >= size &&
+                impl.capacity - (impl.head - impl.tail) >= needed;
+      }
+
+      offset = aligned;
+      needed = aligned - pos + size;
+
+      return impl.capacity - (impl.head - impl.tail) >= needed;
+   };
+
+   if (!fits())
+   {
+      auto start = steady_clock::now();
+
+      if (timeout.count() < 0)
+         impl.space_freed.wait(guard, fits);
+      else if (!impl.space_freed.wait_for(guard, timeout, fits))
+         return UploadSlice{};
+
+      counters().stall.record(steady_clock::now() - start);
+   }
+
+   impl.head += needed;
+
+   Pending p;
+
+   p.id = ++impl.last_id;
+   p.offset = offset;
+   p.size = size;
+   p.end = impl.head;
+
+   impl.pending.push_back(p);
+
+   UploadSlice slice;
+
+   slice.data = impl.mapping + offset;
+   slice.size = size;
+   slice.offset = offset;
+   slice.id = p.id;
+
+   return slice;
+}
+
+bool UploadRing::submit(const UploadSlice &slice, std::uint64_t tag)
+{
+   if (!ok() || !slice)
+      return false;
+
+   auto &impl = *_impl;
+
+   std::lock_guard guard{impl.lock};
+
+   Pending *p = impl.find(slice.id);
+
+   if (p == nullptr || p->state != SliceState::Reserved)
+      return false;
+
+   p->state = SliceState::Submitted;
+   p->tag = tag;
+
+   counters().bytes.add(p->size);
+
+   return true;
+}
+
+bool UploadRing::cancel(const UploadSlice &slice)
+{
+   if (!ok() || !slice)
+      return false;
+
+   auto &impl = *_impl;
+
+   std::lock_guard guard{impl.lock};
+
+   Pending *p = impl.find(slice.id);
+
+   if (p == nullptr || p->state != SliceState::Reserved)
+      return false;
+
+   p->state = SliceState::Canceled;
+
+   return true;
+}
+
+std::size_t UploadRing::consume(const upload_cb_t &cb)
+{
+   if (!ok())
+      return 0;
+
+   auto &impl = *_impl;
+   const auto &gl = *impl.gl;
+
+   impl.retire();
+
+   std::vector<Pending> batch;
+
+   {
+      std::lock_guard guard{impl.lock};
+
+      while (!impl.pending.empty() && impl.pending.front().state != SliceState::Reserved)
+      {
+         batch.push_back(impl.pending.front());
+         impl.pending.pop_front();
+      }
+   }
+
+   if (batch.empty())
+      return 0;
+
+   std::size_t delivered = 0;
+
+   for (const auto &p : batch)
+   {
+      if (p.state != SliceState::Submitted)
+         continue;
+
+      UploadBlock block;
+
+      block.buffer = impl.buffer;
+      block.offset = p.offset;
+      block.size = p.size;
+      block.id = p.id;
+      block.tag = p.tag;
+
+      try
+      {
+         if (cb)
+            cb(block);
+      }
+      catch (...)
+      {
+         // WARNING
+         std::cerr << "Upload callback has thrown" << std::endl;
+      }
+
+      ++delivered;
+   }
+
+   counters().block.add(delivered);
+
+   // NB: Fence even if everything was canceled, space is released in ring order.
+   GLsync sync = gl.glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+   if (sync == nullptr)
+   {
+      // WARNING
+      std::cerr << "Failed to create upload fence (GLError: " << gl.glGetError() << ")" << std::endl;
+
+      // Fall back to waiting for GPU, otherwise space would never be released
+      gl.glFinish();
+      impl.retire();
+
+      {
+         std::lock_guard guard{impl.lock};
+         impl.tail = batch.back().end;
+      }
+
+      impl.space_freed.notify_all();
+
+      return delivered;
+   }
+
+   gl.glFlush();
+
+   impl.fences.push_back(Fence{sync, batch.back().end});
+
+   return delivered;
+}
+
+std::uint32_t UploadRing::buffer() const noexcept
+{
+   return _impl->buffer;
+}
+
+std::size_t UploadRing::capacity() const noexcept
+{
+   return _impl->capacity;
+}
+
+} // namespace behead_egl
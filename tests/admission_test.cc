@@ -0,0 +1,87 @@
+/*
+ * SPDX-FileCopyrightText: 2020 Piotr Rak <piotr.rak@gamil.com>
+ * SPDX-License-Identifier: MIT
+ */
+#include "check.hh"
+
+#include <bhd/admission.hh>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <string>
+#include <thread>
+
+namespace bhd = behead_egl;
+
+namespace {
+
+using std::chrono::milliseconds;
+
+// Polls cond for a while, thread being queued isn't observable otherwise
+template <typename Fn_>
+bool eventually(Fn_ &&cond)
+{
+   for (int i = 0; i < 500; ++i)
+   {
+      if (cond())
+         return true;
+
+      std::this_thread::sleep_for(milliseconds(10));
+   }
+
+   return false;
+}
+
+} // namespace anonymous
+
+int main()
+{
+   const std::string name = "/bhd-admission-test-" + std::to_string(::getpid());
+
+   bhd::AdmissionOpts opts;
+
+   opts.max_per_device = 1;
+   opts.max_wait = milliseconds(5000);
+   opts.shm_name = name.c_str();
+
+   {
+      bhd::DeviceLimiter limiter(opts);
+
+      if (!BHD_CHECK(limiter.ok()))
+      {
+         ::shm_unlink(name.c_str());
+         return bhd::test::result();
+      }
+
+      constexpr unsigned MINOR = 0;
+
+      bhd::AdmissionTicket held = limiter.try_acquire(MINOR);
+
+      BHD_CHECK(held.ok());
+      BHD_CHECK(limiter.in_use(MINOR) == 1);
+      BHD_CHECK(limiter.waiting(MINOR) == 0);
+      BHD_CHECK(!limiter.try_acquire(MINOR).ok());
+
+      bool admitted = false;
+
+      std::thread waiter([&] { admitted = limiter.acquire(MINOR).ok(); });
+
+      BHD_CHECK(eventually([&] { return limiter.waiting(MINOR) == 1; }));
+
+      // Other devices have no queue
+      BHD_CHECK(limiter.waiting(MINOR + 1) == 0);
+
+      held.release();
+      waiter.join();
+
+      BHD_CHECK(admitted);
+      BHD_CHECK(limiter.waiting(MINOR) == 0);
+      BHD_CHECK(limiter.in_use(MINOR) == 0);
+   }
+
+   ::shm_unlink(name.c_str());
+
+   return bhd::test::result();
+}
@@ -0,0 +1,120 @@
+/*
+ * SPDX-FileCopyrightText: 2020 Piotr Rak <piotr.rak@gamil.com>
+ * SPDX-License-Identifier: MIT
+ */
+#include "check.hh"
+
+#include <bhd/behead_egl.hh>
+
+#include <atomic>
+#include <cstdlib>
+#include <memory_resource>
+#include <new>
+
+namespace bhd = behead_egl;
+
+// {{{ Global heap counting
+
+namespace {
+
+std::atomic<long> global_allocs{0};
+
+void *counted_alloc(std::size_t size, std::size_t alignment)
+{
+   ++global_allocs;
+
+   size = size != 0 ? (size + alignment - 1) / alignment * alignment : alignment;
+
+   void *p = alignment > alignof(std::max_align_t) ? std::aligned_alloc(alignment, size)
+                                                   : std::malloc(size);
+   if (p == nullptr)
+      throw std::bad_alloc();
+
+   return p;
+}
+
+} // namespace anonymous
+
+void *operator new(std::size_t size) { return counted_alloc(size, alignof(std::max_align_t)); }
+void *operator new[](std::size_t size) { return counted_alloc(size, alignof(std::max_align_t)); }
+void *operator new(std::size_t size, std::align_val_t al) { return counted_alloc(size, std::size_t(al)); }
+void *operator new[](std::size_t size, std::align_val_t al) { return counted_alloc(size, std::size_t(al)); }
+
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete[](void *p) noexcept { std::free(p); }
+void operator delete(void *p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void *p, std::size_t) noexcept { std::free(p); }
+void operator delete(void *p, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void *p, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void *p, std::size_t, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void *p, std::size_t, std::align_val_t) noexcept { std::free(p); }
+
+// }}}
+
+namespace {
+
+// Global allocations made by fn
+template <typename Fn_>
+long count_allocs(Fn_ &&fn)
+{
+   long before = global_allocs.load();
+   fn();
+   return global_allocs.load() - before;
+}
+
+} // namespace anonymous
+
+int main()
+{
+   bool has_drm = false;
+   bhd::DeviceEXT_Info software;
+
+   bhd::device_enumeration_cb_t cb = [&] (const bhd::DeviceEXT_Info &info) {
+      has_drm |= info.has_EXT_device_drm;
+
+      if (info.has_MESA_device_software)
+         software = info;
+   };
+
+   // Warm up, EGL and our one-time setup allocate
+   if (!bhd::enumerate_display_devices(cb))
+      return bhd::test::SKIP;
+
+   // Counter sees allocations of default resource
+   BHD_CHECK(count_allocs([&] { bhd::enumerate_display_devices(cb); }) > 0);
+
+   // Arena with no upstream: every allocation must fit it, none reaches global heap
+   alignas(std::max_align_t) char buf[16384];
+
+   std::pmr::monotonic_buffer_resource arena{ buf, sizeof(buf), std::pmr::null_memory_resource() };
+
+   bool listed = false;
+
+   BHD_CHECK(count_allocs([&] {
+      listed = bhd::enumerate_display_devices(cb, bhd::DefaultEnumerateOpt, &arena);
+   }) == 0);
+   BHD_CHECK(listed);
+
+   // Device selection and display creation
+   if (has_drm)
+   {
+      arena.release();
+
+      EGLDisplay dpy = EGL_NO_DISPLAY;
+
+      BHD_CHECK(count_allocs([&] {
+         dpy = bhd::create_headless_display(bhd::DefaultDrmNodeUsage, &arena);
+      }) == 0);
+      BHD_CHECK(dpy != EGL_NO_DISPLAY);
+   }
+
+   if (software.has_MESA_device_software)
+   {
+      EGLDisplay dpy = EGL_NO_DISPLAY;
+
+      BHD_CHECK(count_allocs([&] { dpy = bhd::create_headless_display(software); }) == 0);
+      BHD_CHECK(dpy != EGL_NO_DISPLAY);
+   }
+
+   return bhd::test::result();
+}
@@ -0,0 +1,40 @@
+/*
+ * SPDX-FileCopyrightText: 2020 Piotr Rak <piotr.rak@gamil.com>
+ * SPDX-License-Identifier: MIT
+ */
+#pragma once
+
+#include <cstdio>
+
+namespace behead_egl::test {
+
+inline int &failures()
+{
+   static int n = 0;
+   return n;
+}
+
+inline bool check(bool cond, const char *expr, const char *file, int line)
+{
+   if (!cond)
+   {
+      std::fprintf(stderr, "%s:%d: check failed: %s\n", file, line, expr);
+      ++failures();
+   }
+
+   return cond;
+}
+
+// Exit status for main()
+inline int result()
+{
+   return failures() == 0 ? 0 : 1;
+}
+
+// Exit status meson treats as skipped, ie. no EGL device to run on
+constexpr int SKIP = 77;
+
+} // namespace behead_egl::test
+
+// Keeps going on failure, so single run reports every broken check
+#define BHD_CHECK(cond) ::behead_egl::test::check(!!(cond), #cond, __FILE__, __LINE__)
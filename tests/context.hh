@@ -0,0 +1,66 @@
+/*
+ * SPDX-FileCopyrightText: 2020 Piotr Rak <piotr.rak@gamil.com>
+ * SPDX-License-Identifier: MIT
+ */
+#pragma once
+
+#include <bhd/context.hh>
+#include <bhd/display_cache.hh>
+
+#include "minigl.hh"
+
+namespace behead_egl::test {
+
+// Display and context current on calling thread, for tests driving GL themselves.
+// Drm device is preferred, llvmpipe is fine too.
+struct CurrentContext
+{
+   EGLDisplay dpy = EGL_NO_DISPLAY;
+   EGLContext ctx = EGL_NO_CONTEXT;
+
+   CurrentContext()
+   {
+      for (bool software : { false, true })
+      {
+         enumerate_display_devices([&] (const DeviceEXT_Info &info) {
+            bool usable = software ? info.has_MESA_device_software : info.has_EXT_device_drm;
+
+            if (dpy == EGL_NO_DISPLAY && usable)
+               dpy = create_headless_display(info);
+         });
+      }
+
+      if (dpy == EGL_NO_DISPLAY || !eglInitialize(dpy, nullptr, nullptr))
+         return;
+
+      ctx = create_headless_context(dpy);
+
+      if (ctx != EGL_NO_CONTEXT && !eglMakeCurrent(dpy, EGL_NO_SURFACE, EGL_NO_SURFACE, ctx))
+      {
+         eglDestroyContext(dpy, ctx);
+         ctx = EGL_NO_CONTEXT;
+      }
+   }
+
+   ~CurrentContext()
+   {
+      if (ctx != EGL_NO_CONTEXT)
+      {
+         eglMakeCurrent(dpy, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+         eglDestroyContext(dpy, ctx);
+      }
+
+      if (dpy != EGL_NO_DISPLAY)
+         terminate_display(dpy);
+   }
+
+   CurrentContext(const CurrentContext &) = delete;
+   CurrentContext &operator=(const CurrentContext &) = delete;
+
+   bool ok() const
+   {
+      return ctx != EGL_NO_CONTEXT && internal::gl_procs().ok;
+   }
+};
+
+} // namespace behead_egl::test
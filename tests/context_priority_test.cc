@@ -0,0 +1,238 @@
+/*
+ * SPDX-FileCopyrightText: 2020 Piotr Rak <piotr.rak@gamil.com>
+ * SPDX-License-Identifier: MIT
+ */
+#include "check.hh"
+
+#include <bhd/context.hh>
+#include <bhd/display_cache.hh>
+#include <bhd/scheduler.hh>
+#include <bhd/stats.hh>
+
+#include <EGL/eglext.h>
+#include <dlfcn.h>
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace bhd = behead_egl;
+
+using bhd::ContextPriority;
+
+// {{{ Stub EGL
+//
+// Executable's definitions interpose libEGL's ones for the library linked into it.
+// When stub_priority is set, displays advertise EGL_IMG_context_priority and grant
+// at most Medium, like driver of process without CAP_SYS_NICE. When stub_refuse_high
+// is set too, contexts requesting High fail to create.
+
+namespace {
+
+std::atomic<bool> stub_priority{false};
+std::atomic<bool> stub_refuse_high{false};
+
+template <typename Fn_>
+Fn_ *real(const char *name)
+{
+   return reinterpret_cast<Fn_ *>(::dlsym(RTLD_NEXT, name));
+}
+
+} // namespace anonymous
+
+extern "C" const char *eglQueryString(EGLDisplay dpy, EGLint name)
+{
+   static auto *next = real<const char *(EGLDisplay, EGLint)>("eglQueryString");
+   thread_local std::string extended;
+
+   const char *result = next(dpy, name);
+
+   if (!stub_priority || dpy == EGL_NO_DISPLAY || name != EGL_EXTENSIONS || result == nullptr)
+      return result;
+
+   extended = result;
+   extended += " EGL_IMG_context_priority";
+
+   return extended.c_str();
+}
+
+extern "C" EGLContext eglCreateContext(EGLDisplay dpy, EGLConfig config, EGLContext share,
+                                       const EGLint *attribs)
+{
+   static auto *next = real<EGLContext (EGLDisplay, EGLConfig, EGLContext, const EGLint *)>("eglCreateContext");
+
+   // Driver underneath knows nothing about priorities
+   std::vector<EGLint> stripped;
+
+   for (; attribs != nullptr && *attribs != EGL_NONE; attribs += 2)
+   {
+      if (attribs[0] == EGL_CONTEXT_PRIORITY_LEVEL_IMG)
+      {
+         if (stub_refuse_high && attribs[1] == EGL_CONTEXT_PRIORITY_HIGH_IMG)
+            return EGL_NO_CONTEXT;
+
+         continue;
+      }
+
+      stripped.push_back(attribs[0]);
+      stripped.push_back(attribs[1]);
+   }
+
+   stripped.push_back(EGL_NONE);
+
+   return next(dpy, config, share, stripped.data());
+}
+
+extern "C" EGLBoolean eglQueryContext(EGLDisplay dpy, EGLContext ctx, EGLint attribute, EGLint *value)
+{
+   static auto *next = real<EGLBoolean (EGLDisplay, EGLContext, EGLint, EGLint *)>("eglQueryContext");
+
+   if (stub_priority && attribute == EGL_CONTEXT_PRIORITY_LEVEL_IMG)
+   {
+      *value = EGL_CONTEXT_PRIORITY_MEDIUM_IMG;
+      return EGL_TRUE;
+   }
+
+   return next(dpy, ctx, attribute, value);
+}
+
+// }}}
+
+namespace {
+
+std::uint64_t downgrades()
+{
+   std::uint64_t count = 0;
+
+   bhd::foreach_stat([&] (const bhd::StatSample &s) {
+      if (std::strcmp(s.name, "context.priority_downgrade") == 0)
+         count = s.count;
+   });
+
+   return count;
+}
+
+EGLDisplay software_display()
+{
+   EGLDisplay dpy = EGL_NO_DISPLAY;
+
+   bhd::enumerate_display_devices([&] (const bhd::DeviceEXT_Info &info) {
+      if (dpy == EGL_NO_DISPLAY && info.has_MESA_device_software)
+         dpy = bhd::create_headless_display(info);
+   });
+
+   if (dpy != EGL_NO_DISPLAY && !eglInitialize(dpy, nullptr, nullptr))
+      dpy = EGL_NO_DISPLAY;
+
+   return dpy;
+}
+
+// Returns priority granted, checks downgrade was counted iff expected
+ContextPriority create_with(EGLDisplay dpy, ContextPriority priority, bool downgrade)
+{
+   bhd::ContextOpts opts;
+   opts.priority = priority;
+
+   std::uint64_t before = downgrades();
+
+   EGLContext ctx = bhd::create_headless_context(dpy, opts);
+
+   if (!BHD_CHECK(ctx != EGL_NO_CONTEXT))
+      return ContextPriority::Default;
+
+   BHD_CHECK(downgrades() - before == (downgrade ? 1u : 0u));
+
+   ContextPriority granted = bhd::query_context_priority(dpy, ctx);
+
+   eglDestroyContext(dpy, ctx);
+
+   return granted;
+}
+
+// Scheduler counts same workers downgraded as contexts counted
+void check_scheduler()
+{
+   bhd::SchedulerOpts opts;
+   opts.context.priority = ContextPriority::High;
+
+   std::uint64_t before = downgrades();
+
+   bhd::RenderScheduler scheduler(opts);
+
+   if (!BHD_CHECK(scheduler.ok()))
+      return;
+
+   BHD_CHECK(scheduler.downgraded_workers() == scheduler.worker_count());
+   BHD_CHECK(downgrades() - before == scheduler.worker_count());
+}
+
+// Interactive jobs go to batch workers, when interactive ones failed to start
+void check_interactive_fallback()
+{
+   bhd::SchedulerOpts opts;
+   opts.interactive_workers_per_device = 1;
+   opts.interactive_priority = ContextPriority::High;
+
+   stub_refuse_high = true;
+
+   bhd::RenderScheduler scheduler(opts);
+
+   stub_refuse_high = false;
+
+   if (!BHD_CHECK(scheduler.ok()))
+      return;
+
+   std::atomic<int> ran{0};
+   std::atomic<int> misplaced{0};
+
+   for (int i = 0; i < 4; ++i)
+   {
+      BHD_CHECK(scheduler.submit([&] (const bhd::RenderWorker &w) {
+         ++ran;
+         misplaced += w.job_class != bhd::JobClass::Batch;
+      }, bhd::JobClass::Interactive));
+   }
+
+   scheduler.wait_idle();
+
+   BHD_CHECK(ran == 4);
+   BHD_CHECK(misplaced == 0);
+}
+
+} // namespace anonymous
+
+int main()
+{
+   // Display without extension grants Default
+   EGLDisplay dpy = software_display();
+
+   if (dpy == EGL_NO_DISPLAY)
+      return bhd::test::SKIP;
+
+   BHD_CHECK(create_with(dpy, ContextPriority::Default, false) == ContextPriority::Default);
+   BHD_CHECK(create_with(dpy, ContextPriority::High, true) == ContextPriority::Default);
+
+   bhd::terminate_display(dpy);
+
+   check_scheduler();
+
+   // Driver grants less than requested
+   stub_priority = true;
+
+   dpy = software_display();
+
+   if (BHD_CHECK(dpy != EGL_NO_DISPLAY))
+   {
+      BHD_CHECK(create_with(dpy, ContextPriority::High, true) == ContextPriority::Medium);
+      BHD_CHECK(create_with(dpy, ContextPriority::Medium, false) == ContextPriority::Medium);
+
+      bhd::terminate_display(dpy);
+   }
+
+   check_scheduler();
+   check_interactive_fallback();
+
+   return bhd::test::result();
+}
@@ -0,0 +1,118 @@
+/*
+ * SPDX-FileCopyrightText: 2020 Piotr Rak <piotr.rak@gamil.com>
+ * SPDX-License-Identifier: MIT
+ */
+#include "check.hh"
+
+#include <bhd/device_registry.hh>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace bhd = behead_egl;
+
+namespace {
+
+void touch(const std::string &path)
+{
+   int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0600);
+
+   if (fd >= 0)
+      ::close(fd);
+}
+
+// Node names registry lists, sorted
+std::vector<std::string> nodes(const bhd::DeviceRegistry &registry)
+{
+   std::vector<std::string> out;
+
+   registry.nodes(out);
+   std::sort(out.begin(), out.end());
+
+   return out;
+}
+
+// Watcher applies changes asynchronously
+bool wait_nodes(const bhd::DeviceRegistry &registry, const std::vector<std::string> &expected)
+{
+   auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+
+   while (nodes(registry) != expected)
+   {
+      if (std::chrono::steady_clock::now() > deadline)
+         return false;
+
+      std::this_thread::sleep_for(std::chrono::milliseconds(5));
+   }
+
+   return true;
+}
+
+} // namespace anonymous
+
+int main()
+{
+   char tmp[] = "/tmp/bhd-registry-XXXXXX";
+
+   if (::mkdtemp(tmp) == nullptr)
+      return EXIT_FAILURE;
+
+   // Plain files stand in for nodes, registry goes by names
+   const std::string dir = std::string(tmp) + "/dri";
+   ::mkdir(dir.c_str(), 0700);
+   touch(dir + "/card0");
+
+   std::atomic<unsigned> changes{0};
+
+   bhd::DeviceRegistryOpts opts;
+   opts.drm_dir = dir;
+   opts.on_change = [&] (std::uint64_t) { ++changes; };
+
+   {
+      bhd::DeviceRegistry registry(opts);
+
+      BHD_CHECK(registry.ok());
+      BHD_CHECK(nodes(registry) == std::vector<std::string>{ "card0" });
+
+      std::uint64_t epoch = registry.epoch();
+
+      // Only drm node names are listed
+      touch(dir + "/renderD128");
+      touch(dir + "/by-path");
+      BHD_CHECK(wait_nodes(registry, { "card0", "renderD128" }));
+      BHD_CHECK(registry.epoch() > epoch);
+      BHD_CHECK(changes > 0);
+
+      ::unlink((dir + "/card0").c_str());
+      BHD_CHECK(wait_nodes(registry, { "renderD128" }));
+
+      // Directory itself goes away (ie. last device unbound) and comes back
+      ::unlink((dir + "/renderD128").c_str());
+      ::unlink((dir + "/by-path").c_str());
+      ::rmdir(dir.c_str());
+      BHD_CHECK(wait_nodes(registry, {}));
+
+      ::mkdir(dir.c_str(), 0700);
+      touch(dir + "/card1");
+      BHD_CHECK(wait_nodes(registry, { "card1" }));
+
+      touch(dir + "/card2");
+      BHD_CHECK(wait_nodes(registry, { "card1", "card2" }));
+   }
+
+   ::unlink((dir + "/card1").c_str());
+   ::unlink((dir + "/card2").c_str());
+   ::rmdir(dir.c_str());
+   ::rmdir(tmp);
+
+   return bhd::test::result();
+}
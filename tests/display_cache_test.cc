@@ -0,0 +1,68 @@
+/*
+ * SPDX-FileCopyrightText: 2020 Piotr Rak <piotr.rak@gamil.com>
+ * SPDX-License-Identifier: MIT
+ */
+#include "check.hh"
+
+#include <bhd/context.hh>
+#include <bhd/display_cache.hh>
+
+namespace bhd = behead_egl;
+
+namespace {
+
+EGLDisplay create_display()
+{
+   EGLDisplay dpy = EGL_NO_DISPLAY;
+
+   // Drm device is preferred, llvmpipe is fine too
+   for (bool software : { false, true })
+   {
+      bhd::enumerate_display_devices([&] (const bhd::DeviceEXT_Info &info) {
+         bool usable = software ? info.has_MESA_device_software : info.has_EXT_device_drm;
+
+         if (dpy == EGL_NO_DISPLAY && usable)
+            dpy = bhd::create_headless_display(info);
+      });
+   }
+
+   return dpy;
+}
+
+bool valid_config(EGLDisplay dpy, EGLConfig config)
+{
+   EGLint id = 0;
+   return config != nullptr && eglGetConfigAttrib(dpy, config, EGL_CONFIG_ID, &id) == EGL_TRUE;
+}
+
+} // namespace anonymous
+
+int main()
+{
+   EGLDisplay dpy = create_display();
+
+   if (dpy == EGL_NO_DISPLAY || !eglInitialize(dpy, nullptr, nullptr))
+      return bhd::test::SKIP;
+
+   EGLConfig config = bhd::choose_headless_config(dpy);
+
+   if (!BHD_CHECK(valid_config(dpy, config)))
+      return bhd::test::result();
+
+   // Cached
+   BHD_CHECK(bhd::choose_headless_config(dpy) == config);
+
+   // Terminated behind library's back, then initialized again with the same handle
+   eglTerminate(dpy);
+
+   BHD_CHECK(bhd::choose_headless_config(dpy) == nullptr);
+
+   if (!BHD_CHECK(eglInitialize(dpy, nullptr, nullptr)))
+      return bhd::test::result();
+
+   BHD_CHECK(valid_config(dpy, bhd::choose_headless_config(dpy)));
+
+   bhd::terminate_display(dpy);
+
+   return bhd::test::result();
+}
@@ -0,0 +1,177 @@
+/*
+ * SPDX-FileCopyrightText: 2020 Piotr Rak <piotr.rak@gamil.com>
+ * SPDX-License-Identifier: MIT
+ */
+#include "check.hh"
+
+#include <bhd/drm_telemetry.hh>
+
+#include <unistd.h>
+
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+
+namespace bhd = behead_egl;
+
+namespace {
+
+// As amdgpu reports it, plus legacy drm-memory- key of older kernels
+constexpr const char *FDINFO_V1 =
+   "pos:\t0\n"
+   "flags:\t02100002\n"
+   "mnt_id:\t24\n"
+   "ino:\t1034\n"
+   "drm-driver:\tamdgpu\n"
+   "drm-client-id:\t42\n"
+   "drm-engine-gfx:\t1000000000 ns\n"
+   "drm-engine-compute:\t5000 ns\n"
+   "drm-engine-capacity-compute:\t4\n"
+   "drm-total-vram:\t256 MiB\n"
+   "drm-resident-vram:\t128 MiB\n"
+   "drm-memory-gtt:\t2048 KiB\n";
+
+constexpr const char *FDINFO_V2 =
+   "drm-driver:\tamdgpu\n"
+   "drm-client-id:\t42\n"
+   "drm-engine-gfx:\t1500000000 ns\n"
+   "drm-engine-compute:\t5000 ns\n"
+   "drm-engine-capacity-compute:\t4\n";
+
+// Rewritten in place: reader keeps file open, as it does /proc/self/fdinfo/<fd>
+void write_file(const std::string &path, const char *text)
+{
+   std::ofstream out(path, std::ios::trunc);
+   out << text;
+}
+
+const bhd::DrmEngineUsage *engine(const bhd::DrmUsageSample &s, const char *name)
+{
+   for (std::size_t i = 0; i < s.engine_count; ++i)
+   {
+      if (std::strcmp(s.engines[i].name, name) == 0)
+         return &s.engines[i];
+   }
+
+   return nullptr;
+}
+
+const bhd::DrmRegionUsage *region(const bhd::DrmUsageSample &s, const char *name)
+{
+   for (std::size_t i = 0; i < s.region_count; ++i)
+   {
+      if (std::strcmp(s.regions[i].name, name) == 0)
+         return &s.regions[i];
+   }
+
+   return nullptr;
+}
+
+void test_parse(const std::string &path)
+{
+   write_file(path, FDINFO_V1);
+
+   bhd::FdinfoReader reader(path.c_str());
+
+   if (!BHD_CHECK(reader.ok()))
+      return;
+
+   bhd::DrmUsageSample s;
+
+   if (!BHD_CHECK(reader.sample(s)))
+      return;
+
+   BHD_CHECK(std::strcmp(s.driver, "amdgpu") == 0);
+   BHD_CHECK(s.client_id == 42);
+   BHD_CHECK(s.engine_count == 2);
+   BHD_CHECK(s.region_count == 2);
+
+   const auto *gfx = engine(s, "gfx");
+   const auto *compute = engine(s, "compute");
+
+   BHD_CHECK(gfx != nullptr && gfx->busy_ns == 1000000000 && gfx->capacity == 1);
+   BHD_CHECK(compute != nullptr && compute->busy_ns == 5000 && compute->capacity == 4);
+
+   const auto *vram = region(s, "vram");
+   const auto *gtt = region(s, "gtt");
+
+   BHD_CHECK(vram != nullptr && vram->total == (256u << 20) && vram->resident == (128u << 20));
+   BHD_CHECK(gtt != nullptr && gtt->total == 0 && gtt->resident == (2048u << 10));
+
+   // Next sample rereads same file, previous regions don't linger
+   write_file(path, FDINFO_V2);
+
+   bhd::DrmUsageSample next;
+
+   if (!BHD_CHECK(reader.sample(next)))
+      return;
+
+   BHD_CHECK(next.region_count == 0);
+
+   // Known interval instead of wall clock between samples
+   next.taken = s.taken + std::chrono::seconds(1);
+
+   BHD_CHECK(std::fabs(bhd::engine_utilization(s, next, "gfx") - 0.5) < 1e-9);
+   BHD_CHECK(bhd::engine_utilization(s, next, "compute") == 0.0);
+   BHD_CHECK(bhd::engine_utilization(s, next, "video") < 0);
+
+   // Busy time going backwards means different client
+   BHD_CHECK(bhd::engine_utilization(next, s, "gfx") < 0);
+}
+
+void test_not_drm(const std::string &path)
+{
+   write_file(path, "pos:\t0\nflags:\t02\nmnt_id:\t24\n");
+
+   bhd::FdinfoReader reader(path.c_str());
+   bhd::DrmUsageSample s;
+
+   BHD_CHECK(reader.ok());
+   BHD_CHECK(!reader.sample(s));
+
+   bhd::FdinfoReader missing((path + ".missing").c_str());
+
+   BHD_CHECK(!missing.ok());
+   BHD_CHECK(!missing.sample(s));
+}
+
+void test_tracking()
+{
+   bhd::DrmUsageSample s;
+
+   bhd::DrmClientSnapshot before;
+
+   BHD_CHECK(before.ok());
+
+   // Nothing is tracked unless asked
+   BHD_CHECK(!bhd::sample_display_usage(EGL_NO_DISPLAY, s));
+   BHD_CHECK(!bhd::track_display_usage(EGL_NO_DISPLAY, before));
+   BHD_CHECK(bhd::foreach_display_usage([] (EGLDisplay, const bhd::DrmUsageSample &) {}) == 0);
+   BHD_CHECK(bhd::foreach_display_usage(nullptr) == 0);
+
+   bhd::untrack_display_usage(EGL_NO_DISPLAY);
+}
+
+} // namespace anonymous
+
+int main()
+{
+   char path[] = "/tmp/bhd-fdinfo-XXXXXX";
+   int fd = ::mkstemp(path);
+
+   if (fd < 0)
+      return EXIT_FAILURE;
+
+   ::close(fd);
+
+   test_parse(path);
+   test_not_drm(path);
+   test_tracking();
+
+   ::unlink(path);
+
+   return bhd::test::result();
+}
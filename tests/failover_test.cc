@@ -0,0 +1,173 @@
+/*
+ * SPDX-FileCopyrightText: 2020 Piotr Rak <piotr.rak@gamil.com>
+ * SPDX-License-Identifier: MIT
+ */
+#include "check.hh"
+
+#include <bhd/display_cache.hh>
+#include <bhd/failover.hh>
+
+#include "minigl.hh"
+
+#include <dlfcn.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string_view>
+#include <vector>
+
+namespace bhd = behead_egl;
+
+namespace {
+
+// Reset status stub reports, GL_NO_ERROR while device is fine
+std::atomic<GLenum> injected_status{GL_NO_ERROR};
+
+GLenum GL_APIENTRY stub_reset_status()
+{
+   return injected_status.load();
+}
+
+} // namespace anonymous
+
+// Stub EGL: executable's definition interposes libEGL's one for the library linked
+// into it, so every reset status query ends up in stub_reset_status().
+extern "C" __eglMustCastToProperFunctionPointerType eglGetProcAddress(const char *name)
+{
+   using proc_t = __eglMustCastToProperFunctionPointerType;
+
+   static auto real = reinterpret_cast<proc_t (*)(const char *)>(::dlsym(RTLD_NEXT, "eglGetProcAddress"));
+
+   // glGetGraphicsResetStatus, ...EXT and ...KHR
+   if (std::string_view(name).substr(0, 24) == "glGetGraphicsResetStatus")
+      return reinterpret_cast<proc_t>(stub_reset_status);
+
+   return real != nullptr ? real(name) : nullptr;
+}
+
+namespace {
+
+struct Events
+{
+   std::mutex lock;
+   std::condition_variable cond;
+
+   std::vector<bhd::FailoverEvent> seen;
+
+   void push(const bhd::FailoverEvent &e)
+   {
+      std::lock_guard guard{lock};
+      seen.push_back(e);
+      cond.notify_all();
+   }
+
+   bool wait_for(std::size_t count)
+   {
+      std::unique_lock guard{lock};
+      return cond.wait_for(guard, std::chrono::seconds(5), [&] { return seen.size() >= count; });
+   }
+
+   bhd::FailoverEvent last()
+   {
+      std::lock_guard guard{lock};
+      return seen.back();
+   }
+};
+
+bool is_unhealthy(EGLDeviceEXT dev)
+{
+   bool unhealthy = false;
+
+   bhd::enumerate_display_devices([&] (const bhd::DeviceEXT_Info &info) {
+      if (info.egl_device_ext == dev)
+         unhealthy = info.marked_unhealthy;
+   });
+
+   return unhealthy;
+}
+
+void reset_health()
+{
+   injected_status = GL_NO_ERROR;
+
+   bhd::enumerate_display_devices([] (const bhd::DeviceEXT_Info &info) {
+      bhd::mark_device_unhealthy(info.egl_device_ext, false);
+   });
+}
+
+} // namespace anonymous
+
+int main()
+{
+   Events events;
+
+   bhd::FailoverOpts opts;
+   opts.poll_interval = std::chrono::milliseconds(5);
+
+   bhd::DisplayFailover failover([&] (const bhd::FailoverEvent &e) { events.push(e); }, opts);
+
+   EGLDisplay dpy = failover.create_display();
+
+   if (dpy == EGL_NO_DISPLAY)
+      return bhd::test::SKIP;
+
+   BHD_CHECK(failover.ok());
+   BHD_CHECK(failover.watched() == 1);
+
+   // Reset is seen by watcher
+   injected_status = GL_GUILTY_CONTEXT_RESET;
+
+   if (BHD_CHECK(events.wait_for(1)))
+   {
+      auto e = events.last();
+
+      BHD_CHECK(e.lost_display == dpy);
+      BHD_CHECK(e.reset_status == GL_GUILTY_CONTEXT_RESET);
+      BHD_CHECK(is_unhealthy(e.lost_device));
+
+      // Replacement, if some other device was healthy, is watched instead
+      BHD_CHECK(failover.watched() == (e.replacement != EGL_NO_DISPLAY ? 1u : 0u));
+
+      if (e.replacement != EGL_NO_DISPLAY)
+      {
+         failover.unwatch(e.replacement);
+         bhd::terminate_display(e.replacement);
+      }
+   }
+
+   failover.unwatch(dpy);
+   bhd::terminate_display(dpy);
+   reset_health();
+
+   // Loss reported by client
+   dpy = failover.create_display();
+
+   if (BHD_CHECK(dpy != EGL_NO_DISPLAY))
+   {
+      failover.report_lost(dpy);
+
+      if (BHD_CHECK(events.wait_for(2)))
+      {
+         auto e = events.last();
+
+         BHD_CHECK(e.lost_display == dpy);
+         BHD_CHECK(e.reset_status == 0);
+         BHD_CHECK(is_unhealthy(e.lost_device));
+
+         if (e.replacement != EGL_NO_DISPLAY)
+         {
+            failover.unwatch(e.replacement);
+            bhd::terminate_display(e.replacement);
+         }
+      }
+
+      failover.unwatch(dpy);
+      bhd::terminate_display(dpy);
+   }
+
+   reset_health();
+
+   return bhd::test::result();
+}
@@ -0,0 +1,218 @@
+/*
+ * SPDX-FileCopyrightText: 2020 Piotr Rak <piotr.rak@gamil.com>
+ * SPDX-License-Identifier: MIT
+ */
+#include "check.hh"
+
+#include "scm_rights.hh"
+
+#include <bhd/fd_broker.hh>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+
+namespace bhd = behead_egl;
+namespace bhdi = behead_egl::internal;
+
+namespace {
+
+using bhd::DrmNodeUsage;
+
+// Plain files stand in for device nodes, content tells which one we got
+struct FakeNodes
+{
+   char dir[32] = "/tmp/bhd-broker-XXXXXX";
+
+   std::string primary;
+   std::string render;
+
+   FakeNodes()
+   {
+      if (::mkdtemp(dir) == nullptr)
+         std::abort();
+
+      primary = std::string(dir) + "/card0";
+      render = std::string(dir) + "/renderD128";
+
+      write(primary, "primary");
+      write(render, "render");
+   }
+
+   ~FakeNodes()
+   {
+      ::unlink(primary.c_str());
+      ::unlink(render.c_str());
+      ::rmdir(dir);
+   }
+
+   static void write(const std::string &path, const char *content)
+   {
+      int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+
+      if (fd < 0 || ::write(fd, content, std::strlen(content)) < 0)
+         std::abort();
+
+      ::close(fd);
+   }
+
+   int open_primary() const { return ::open(primary.c_str(), O_RDONLY | O_CLOEXEC); }
+   int open_render() const { return ::open(render.c_str(), O_RDONLY | O_CLOEXEC); }
+};
+
+// Content of file fd refers to, fd is closed
+std::string content(int fd)
+{
+   if (fd < 0)
+      return {};
+
+   char buf[16] = {};
+   ssize_t len = ::pread(fd, buf, sizeof(buf) - 1, 0);
+
+   ::close(fd);
+
+   return len > 0 ? std::string(buf, std::size_t(len)) : std::string{};
+}
+
+void test_serve_connection(const FakeNodes &nodes)
+{
+   bhd::DrmFdBroker broker;
+
+   BHD_CHECK(broker.add_device(nodes.open_primary(), nodes.open_render()) == 0);
+   BHD_CHECK(broker.add_device(nodes.open_primary(), -1) == 1);
+   BHD_CHECK(broker.device_count() == 2);
+
+   int sv[2];
+
+   if (!BHD_CHECK(::socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) == 0))
+      return;
+
+   bool served = false;
+   std::thread server([&] { served = broker.serve_connection(sv[0]); });
+
+   BHD_CHECK(content(bhd::request_brokered_drm_fd(sv[1])) == "render");
+   BHD_CHECK(content(bhd::request_brokered_drm_fd(sv[1], DrmNodeUsage::UsePrimary)) == "primary");
+
+   // No render node, falls back to primary
+   BHD_CHECK(content(bhd::request_brokered_drm_fd(sv[1], DrmNodeUsage::UseRenderFallbackToPrimary, 1))
+             == "primary");
+
+   BHD_CHECK(bhd::request_brokered_drm_fd(sv[1], DrmNodeUsage::UseRender, 1) == -1);
+   BHD_CHECK(errno == ENOENT);
+
+   BHD_CHECK(bhd::request_brokered_drm_fd(sv[1], DrmNodeUsage::UseRender, 7) == -1);
+   BHD_CHECK(errno == ENODEV);
+
+   ::close(sv[1]);
+   server.join();
+
+   BHD_CHECK(served);
+
+   ::close(sv[0]);
+}
+
+int connect_to(const sockaddr_un &addr, socklen_t len)
+{
+   int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+   if (fd >= 0 && ::connect(fd, reinterpret_cast<const sockaddr *>(&addr), len) != 0)
+   {
+      ::close(fd);
+      return -1;
+   }
+
+   return fd;
+}
+
+// Client keeping its connection open must not block others
+void test_serve_concurrent(const FakeNodes &nodes)
+{
+   bhd::DrmFdBroker broker;
+
+   broker.add_device(nodes.open_primary(), nodes.open_render());
+
+   int listen_fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+   // Abstract address, nothing to clean up
+   sockaddr_un addr = {};
+   addr.sun_family = AF_UNIX;
+
+   int n = std::snprintf(addr.sun_path + 1, sizeof(addr.sun_path) - 1, "bhd-broker-test-%d", int(::getpid()));
+   socklen_t len = socklen_t(offsetof(sockaddr_un, sun_path) + 1 + std::size_t(n));
+
+   if (!BHD_CHECK(::bind(listen_fd, reinterpret_cast<sockaddr *>(&addr), len) == 0) ||
+       !BHD_CHECK(::listen(listen_fd, 8) == 0))
+   {
+      ::close(listen_fd);
+      return;
+   }
+
+   bool served = false;
+   std::thread server([&] { served = broker.serve(listen_fd); });
+
+   int worker = connect_to(addr, len);
+   BHD_CHECK(content(bhd::request_brokered_drm_fd(worker)) == "render");
+
+   // worker stays connected
+   int other = connect_to(addr, len);
+   BHD_CHECK(content(bhd::request_brokered_drm_fd(other, DrmNodeUsage::UsePrimary)) == "primary");
+   ::close(other);
+
+   // Garbage gets client dropped, others are still served
+   int bad = connect_to(addr, len);
+   BHD_CHECK(::write(bad, "x", 1) == 1);
+
+   BHD_CHECK(content(bhd::request_brokered_drm_fd(worker)) == "render");
+
+   // Request arriving in pieces is served, not dropped
+   int split = connect_to(addr, len);
+   const std::uint32_t request[] = { 0x62686466, 0, std::uint32_t(DrmNodeUsage::UseRender) };
+   const char *bytes = reinterpret_cast<const char *>(request);
+
+   BHD_CHECK(::write(split, bytes, 5) == 5);
+   std::this_thread::sleep_for(std::chrono::milliseconds(50));
+   BHD_CHECK(::write(split, bytes + 5, sizeof(request) - 5) == ssize_t(sizeof(request) - 5));
+
+   std::uint32_t reply[4] = {};
+   bhdi::unique_fd fd;
+
+   BHD_CHECK(bhdi::recv_with_fd(split, reply, sizeof(reply), fd));
+   BHD_CHECK(reply[1] == 0);
+   BHD_CHECK(content(fd.release()) == "render");
+
+   // and can carry on
+   BHD_CHECK(content(bhd::request_brokered_drm_fd(split, DrmNodeUsage::UsePrimary)) == "primary");
+   ::close(split);
+
+   ::close(bad);
+   ::close(worker);
+
+   ::shutdown(listen_fd, SHUT_RDWR);
+   server.join();
+
+   BHD_CHECK(served);
+
+   ::close(listen_fd);
+}
+
+} // namespace anonymous
+
+int main()
+{
+   FakeNodes nodes;
+
+   test_serve_connection(nodes);
+   test_serve_concurrent(nodes);
+
+   return bhd::test::result();
+}
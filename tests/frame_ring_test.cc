@@ -0,0 +1,246 @@
+/*
+ * SPDX-FileCopyrightText: 2020 Piotr Rak <piotr.rak@gamil.com>
+ * SPDX-License-Identifier: MIT
+ */
+#include "check.hh"
+#include "context.hh"
+
+#include <bhd/frame_ring.hh>
+
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+namespace bhd = behead_egl;
+namespace bhdi = behead_egl::internal;
+
+namespace {
+
+using std::chrono::milliseconds;
+
+constexpr unsigned WIDTH = 64;
+constexpr unsigned HEIGHT = 32;
+constexpr unsigned SLOTS = 4;
+
+// Frames published between consumer's waits, more than ring holds
+constexpr std::uint64_t BURST = 6;
+
+// Steps of producer and consumer are kept in lockstep with single bytes over socket
+bool send_step(int sock)
+{
+   char c = 'x';
+   return ::write(sock, &c, 1) == 1;
+}
+
+bool wait_step(int sock)
+{
+   char c = 0;
+   return ::read(sock, &c, 1) == 1;
+}
+
+bool filled_with(const void *data, std::size_t size, unsigned char value)
+{
+   const auto *bytes = static_cast<const unsigned char *>(data);
+
+   for (std::size_t i = 0; i < size; ++i)
+   {
+      if (bytes[i] != value)
+         return false;
+   }
+
+   return true;
+}
+
+// Pixels glClear() filled frame with, RGBA8
+bool cleared_to(const bhd::RingFrame &frame, const unsigned char (&rgba)[4])
+{
+   const auto *rows = static_cast<const unsigned char *>(frame.data);
+
+   for (unsigned y = 0; y < frame.height; ++y)
+   {
+      for (unsigned x = 0; x < frame.width; ++x)
+      {
+         if (std::memcmp(rows + y * frame.stride + x * 4, rgba, 4) != 0)
+            return false;
+      }
+   }
+
+   return true;
+}
+
+constexpr unsigned char CLEAR_RGBA[4] = { 255, 0, 255, 255 };
+
+// Runs in forked child, no EGL there
+int consumer(int sock)
+{
+   int fd = bhd::receive_frame_ring_fd(sock);
+
+   // Producer couldn't set up context
+   if (fd < 0)
+      return bhd::test::SKIP;
+
+   bhd::FrameRingReader reader(fd);
+
+   if (!BHD_CHECK(reader.ok()))
+      return bhd::test::result();
+
+   bhd::RingFrame first;
+
+   BHD_CHECK(send_step(sock));
+
+   if (BHD_CHECK(reader.wait_frame(first, milliseconds(5000))))
+   {
+      BHD_CHECK(first.frame_id == 1);
+      BHD_CHECK(first.width == WIDTH && first.height == HEIGHT);
+      BHD_CHECK(first.stride == WIDTH * 4);
+      BHD_CHECK(first.size >= first.stride * HEIGHT);
+      BHD_CHECK(filled_with(first.data, first.size, 1));
+      BHD_CHECK(reader.still_valid(first));
+      BHD_CHECK(reader.dropped() == 0);
+   }
+
+   // Nothing new yet
+   bhd::RingFrame none;
+   BHD_CHECK(!reader.wait_frame(none, milliseconds(10)));
+
+   // Producer runs ahead by more than ring holds
+   BHD_CHECK(send_step(sock));
+   BHD_CHECK(wait_step(sock));
+
+   bhd::RingFrame latest;
+
+   if (BHD_CHECK(reader.wait_frame(latest, milliseconds(5000))))
+   {
+      BHD_CHECK(latest.frame_id == 1 + BURST);
+      BHD_CHECK(filled_with(latest.data, latest.size, (unsigned char)(1 + BURST)));
+      BHD_CHECK(reader.still_valid(latest));
+      BHD_CHECK(reader.dropped() == BURST - 1);
+   }
+
+   // Slot of first frame was reused meanwhile
+   BHD_CHECK(!reader.still_valid(first));
+
+   // Frame read back from GL
+   BHD_CHECK(send_step(sock));
+
+   bhd::RingFrame captured;
+
+   if (BHD_CHECK(reader.wait_frame(captured, milliseconds(5000))))
+   {
+      BHD_CHECK(captured.frame_id == 2 + BURST);
+      BHD_CHECK(cleared_to(captured, CLEAR_RGBA));
+      BHD_CHECK(reader.still_valid(captured));
+   }
+
+   return bhd::test::result();
+}
+
+std::uint64_t publish(bhd::FrameRingWriter &writer, unsigned char fill)
+{
+   void *data = writer.begin_frame();
+
+   if (data == nullptr)
+      return 0;
+
+   std::memset(data, fill, writer.slot_size());
+
+   return writer.end_frame();
+}
+
+void producer(int sock)
+{
+   bhd::test::CurrentContext context;
+
+   if (!context.ok())
+      return;
+
+   const auto &gl = bhdi::gl_procs();
+
+   auto clear_color = reinterpret_cast<PFNGLCLEARCOLORPROC>(eglGetProcAddress("glClearColor"));
+   auto clear = reinterpret_cast<PFNGLCLEARPROC>(eglGetProcAddress("glClear"));
+
+   if (!BHD_CHECK(clear_color != nullptr && clear != nullptr))
+      return;
+
+   bhd::FrameRingWriter writer(WIDTH, HEIGHT, bhd::FrameRingOpts{ SLOTS });
+
+   if (!BHD_CHECK(writer.ok()) || !BHD_CHECK(writer.send_fd(sock)))
+      return;
+
+   BHD_CHECK(wait_step(sock));
+   BHD_CHECK(publish(writer, 1) == 1);
+
+   BHD_CHECK(wait_step(sock));
+
+   for (std::uint64_t i = 2; i <= 1 + BURST; ++i)
+      BHD_CHECK(publish(writer, (unsigned char)i) == i);
+
+   BHD_CHECK(send_step(sock));
+   BHD_CHECK(wait_step(sock));
+
+   GLuint rb = 0;
+   GLuint fbo = 0;
+
+   gl.glGenRenderbuffers(1, &rb);
+   gl.glBindRenderbuffer(GL_RENDERBUFFER, rb);
+   gl.glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, GLsizei(WIDTH), GLsizei(HEIGHT));
+
+   gl.glGenFramebuffers(1, &fbo);
+   gl.glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+   gl.glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, rb);
+
+   clear_color(CLEAR_RGBA[0] / 255.0f, CLEAR_RGBA[1] / 255.0f, CLEAR_RGBA[2] / 255.0f, CLEAR_RGBA[3] / 255.0f);
+   clear(GL_COLOR_BUFFER_BIT);
+
+   BHD_CHECK(writer.capture() == 2 + BURST);
+
+   gl.glBindFramebuffer(GL_FRAMEBUFFER, 0);
+   gl.glDeleteFramebuffers(1, &fbo);
+   gl.glDeleteRenderbuffers(1, &rb);
+}
+
+} // namespace anonymous
+
+int main()
+{
+   int sv[2];
+
+   if (::socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) != 0)
+      return EXIT_FAILURE;
+
+   // NB: Fork before EGL is touched, consumer is plain process mapping ring.
+   pid_t pid = ::fork();
+
+   if (pid < 0)
+      return EXIT_FAILURE;
+
+   if (pid == 0)
+   {
+      ::close(sv[0]);
+      ::_exit(consumer(sv[1]));
+   }
+
+   ::close(sv[1]);
+
+   producer(sv[0]);
+
+   // Unblocks consumer if producer gave up early
+   ::close(sv[0]);
+
+   int status = 0;
+
+   if (!BHD_CHECK(::waitpid(pid, &status, 0) == pid) || !BHD_CHECK(WIFEXITED(status)))
+      return bhd::test::result();
+
+   if (WEXITSTATUS(status) == bhd::test::SKIP && bhd::test::result() == 0)
+      return bhd::test::SKIP;
+
+   BHD_CHECK(WEXITSTATUS(status) == 0);
+
+   return bhd::test::result();
+}
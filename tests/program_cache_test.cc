@@ -0,0 +1,225 @@
+/*
+ * SPDX-FileCopyrightText: 2020 Piotr Rak <piotr.rak@gamil.com>
+ * SPDX-License-Identifier: MIT
+ */
+#include "check.hh"
+#include "context.hh"
+
+#include <bhd/program_cache.hh>
+
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+
+namespace bhd = behead_egl;
+namespace bhdi = behead_egl::internal;
+
+namespace {
+
+constexpr const char *VERTEX_SHADER =
+   "#version 300 es\n"
+   "void main() { gl_Position = vec4(0.0); }\n";
+
+// Constant makes each program different
+std::string fragment_shader(int n)
+{
+   return "#version 300 es\n"
+          "precision mediump float;\n"
+          "out vec4 color;\n"
+          "void main() { color = vec4(" + std::to_string(n) + ".0 / 255.0); }\n";
+}
+
+GLuint compile(GLenum type, const char *source)
+{
+   const auto &gl = bhdi::gl_procs();
+
+   GLuint shader = gl.glCreateShader(type);
+
+   gl.glShaderSource(shader, 1, &source, nullptr);
+   gl.glCompileShader(shader);
+
+   return shader;
+}
+
+// Linked program, 0 on failure
+GLuint link_program(int n)
+{
+   const auto &gl = bhdi::gl_procs();
+
+   GLuint vs = compile(GL_VERTEX_SHADER, VERTEX_SHADER);
+   GLuint fs = compile(GL_FRAGMENT_SHADER, fragment_shader(n).c_str());
+
+   GLuint program = gl.glCreateProgram();
+
+   gl.glAttachShader(program, vs);
+   gl.glAttachShader(program, fs);
+   gl.glLinkProgram(program);
+
+   gl.glDeleteShader(vs);
+   gl.glDeleteShader(fs);
+
+   GLint linked = GL_FALSE;
+   gl.glGetProgramiv(program, GL_LINK_STATUS, &linked);
+
+   if (linked != GL_TRUE)
+   {
+      gl.glDeleteProgram(program);
+      return 0;
+   }
+
+   return program;
+}
+
+bool loads(bhd::ProgramBinaryCache &cache, const char *key)
+{
+   const auto &gl = bhdi::gl_procs();
+
+   GLuint program = gl.glCreateProgram();
+   bool loaded = cache.load(program, key);
+
+   gl.glDeleteProgram(program);
+
+   return loaded;
+}
+
+struct stat file_stat(const std::string &path)
+{
+   struct stat st = {};
+   ::stat(path.c_str(), &st);
+   return st;
+}
+
+void append(const std::string &path, const void *data, std::size_t len)
+{
+   int fd = ::open(path.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+
+   if (fd < 0 || ::write(fd, data, len) != ssize_t(len))
+      std::abort();
+
+   ::close(fd);
+}
+
+// Flips byte at offset from the end
+void corrupt(const std::string &path, off_t from_end)
+{
+   int fd = ::open(path.c_str(), O_RDWR | O_CLOEXEC);
+
+   if (fd < 0)
+      std::abort();
+
+   off_t at = ::lseek(fd, 0, SEEK_END) - from_end;
+   unsigned char b = 0;
+
+   if (::pread(fd, &b, 1, at) != 1)
+      std::abort();
+
+   b ^= 0xff;
+
+   if (::pwrite(fd, &b, 1, at) != 1)
+      std::abort();
+
+   ::close(fd);
+}
+
+} // namespace anonymous
+
+int main()
+{
+   bhd::test::CurrentContext context;
+
+   if (!context.ok())
+      return bhd::test::SKIP;
+
+   bhd::DeviceEXT_Info device;
+   device.has_MESA_device_software = true;
+
+   char dir[] = "/tmp/bhd-program-cache-XXXXXX";
+
+   if (::mkdtemp(dir) == nullptr)
+      return EXIT_FAILURE;
+
+   const std::string path = std::string(dir) + "/programs";
+
+   const auto &gl = bhdi::gl_procs();
+
+   {
+      bhd::ProgramBinaryCache cache(path, device);
+
+      // Driver without binary formats
+      if (!cache.ok())
+      {
+         ::rmdir(dir);
+         return bhd::test::SKIP;
+      }
+
+      const char *keys[] = { "a", "b", "c" };
+
+      for (int i = 0; i < 3; ++i)
+      {
+         GLuint program = link_program(i);
+
+         if (BHD_CHECK(program != 0))
+         {
+            BHD_CHECK(cache.store(program, keys[i]));
+            gl.glDeleteProgram(program);
+         }
+
+         // Stored record is indexed right away
+         BHD_CHECK(cache.size() == std::size_t(i + 1));
+         BHD_CHECK(loads(cache, keys[i]));
+      }
+   }
+
+   // Record of other process still being appended
+   {
+      // Header of record with 4 KiB binary, as laid out in file ('bhpr', key_len, format,
+      // size, checksum), nothing of key and binary made it yet
+      const std::uint32_t partial[] = { 0x62687072, 8, 0, 4096, 0, 0 };
+
+      auto before = file_stat(path);
+
+      append(path, partial, sizeof(partial));
+
+      bhd::ProgramBinaryCache cache(path, device);
+
+      BHD_CHECK(cache.size() == 3);
+      BHD_CHECK(loads(cache, "a") && loads(cache, "c"));
+
+      // Left alone, not rewritten
+      auto after = file_stat(path);
+
+      BHD_CHECK(after.st_ino == before.st_ino);
+      BHD_CHECK(after.st_size == before.st_size + off_t(sizeof(partial)));
+
+      // Appends land after it, can't be told apart from damage then
+      ::truncate(path.c_str(), before.st_size);
+   }
+
+   // Complete record that fails its checksum is dropped, file rewritten
+   {
+      auto before = file_stat(path);
+
+      // Within binary of last record
+      corrupt(path, 16);
+
+      bhd::ProgramBinaryCache cache(path, device);
+
+      BHD_CHECK(cache.size() == 2);
+      BHD_CHECK(loads(cache, "a") && loads(cache, "b"));
+      BHD_CHECK(!loads(cache, "c"));
+
+      auto after = file_stat(path);
+
+      BHD_CHECK(after.st_ino != before.st_ino);
+      BHD_CHECK(after.st_size < before.st_size);
+   }
+
+   ::unlink(path.c_str());
+   ::rmdir(dir);
+
+   return bhd::test::result();
+}
@@ -0,0 +1,181 @@
+/*
+ * SPDX-FileCopyrightText: 2020 Piotr Rak <piotr.rak@gamil.com>
+ * SPDX-License-Identifier: MIT
+ */
+#include "check.hh"
+
+#include "ufd.hh"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <vector>
+
+namespace bhd = behead_egl;
+namespace bhdi = behead_egl::internal;
+
+namespace {
+
+bool is_open(int fd)
+{
+   return ::fcntl(fd, F_GETFD) != -1 || errno != EBADF;
+}
+
+bool is_closed(int fd)
+{
+   return ::fcntl(fd, F_GETFD) == -1 && errno == EBADF;
+}
+
+// Block of consecutive fds
+std::vector<int> open_fds(std::size_t count)
+{
+   std::vector<int> fds;
+
+   for (std::size_t i = 0; i < count; ++i)
+   {
+      int fd = ::open("/dev/null", O_RDONLY | O_CLOEXEC);
+
+      if (fd < 0)
+         std::abort();
+
+      fds.push_back(fd);
+   }
+
+   return fds;
+}
+
+// Set that spilled to heap takes inline-only one, it must own moved fds only
+void test_move_assign_after_spill()
+{
+   std::vector<int> spilled = open_fds(12);
+
+   bhdi::unique_fd_set big;
+
+   for (int fd : spilled)
+      big.push_back(bhdi::unique_fd{fd});
+
+   // Opened before spilled ones are closed, so they can't share numbers
+   std::vector<int> moved = open_fds(2);
+
+   big.reset();
+
+   bhdi::unique_fd_set small;
+
+   for (int fd : moved)
+      small.push_back(bhdi::unique_fd{fd});
+
+   big = std::move(small);
+
+   BHD_CHECK(small.empty());
+   BHD_CHECK(big.size() == moved.size());
+
+   for (std::size_t i = 0; i < moved.size() && i < big.size(); ++i)
+      BHD_CHECK(big[i] == moved[i]);
+
+   // Spilled fds may be reused by now, keep them from being closed by set
+   std::vector<int> bystanders = open_fds(12);
+
+   big.reset();
+
+   for (int fd : moved)
+      BHD_CHECK(is_closed(fd));
+
+   for (int fd : bystanders)
+   {
+      BHD_CHECK(is_open(fd));
+      ::close(fd);
+   }
+}
+
+} // namespace anonymous
+
+int main()
+{
+   // Set takes runs of several lengths, bystanders in between stay with us.
+   // More of them than set keeps inline, so it spills to heap as well.
+   std::vector<int> fds = open_fds(24);
+   std::vector<int> owned;
+   std::vector<int> bystanders;
+
+   for (std::size_t i = 0; i < fds.size(); ++i)
+   {
+      // Runs of 1, 2, 3, ... separated by single bystander
+      bool bystander = i == 1 || i == 4 || i == 8 || i == 13 || i == 19;
+
+      (bystander ? bystanders : owned).push_back(fds[i]);
+   }
+
+   {
+      bhdi::unique_fd_set set;
+
+      // Out of order, reset() sorts them into runs
+      std::vector<int> shuffled = owned;
+      std::reverse(shuffled.begin(), shuffled.end());
+      std::rotate(shuffled.begin(), shuffled.begin() + 5, shuffled.end());
+
+      for (int fd : shuffled)
+         set.push_back(bhdi::unique_fd{fd});
+
+      BHD_CHECK(set.size() == owned.size());
+
+      // Taken one is left open
+      int taken = -1;
+
+      for (std::size_t i = 0; i < set.size(); ++i)
+      {
+         if (set[i] == owned[6])
+         {
+            taken = set.take(i).release();
+            break;
+         }
+      }
+
+      BHD_CHECK(taken == owned[6]);
+      BHD_CHECK(set.set_cloexec(false));
+
+      for (int fd : set)
+         BHD_CHECK((::fcntl(fd, F_GETFD) & FD_CLOEXEC) == 0);
+
+      BHD_CHECK(set.set_cloexec(true));
+
+      for (int fd : set)
+         BHD_CHECK((::fcntl(fd, F_GETFD) & FD_CLOEXEC) != 0);
+
+      set.reset();
+
+      BHD_CHECK(set.empty());
+
+      for (int fd : owned)
+      {
+         if (fd != taken)
+            BHD_CHECK(is_closed(fd));
+      }
+
+      BHD_CHECK(is_open(taken));
+      ::close(taken);
+
+      // Runs end exactly at last fd of set
+      for (int fd : bystanders)
+         BHD_CHECK(is_open(fd));
+
+      // Again through destructor
+      set.push_back(bhdi::unique_fd{bystanders[0]});
+      set.push_back(bhdi::unique_fd{bystanders[1]});
+   }
+
+   BHD_CHECK(is_closed(bystanders[0]));
+   BHD_CHECK(is_closed(bystanders[1]));
+
+   for (std::size_t i = 2; i < bystanders.size(); ++i)
+   {
+      BHD_CHECK(is_open(bystanders[i]));
+      ::close(bystanders[i]);
+   }
+
+   test_move_assign_after_spill();
+
+   return bhd::test::result();
+}
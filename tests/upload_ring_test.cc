@@ -0,0 +1,101 @@
+/*
+ * SPDX-FileCopyrightText: 2020 Piotr Rak <piotr.rak@gamil.com>
+ * SPDX-License-Identifier: MIT
+ */
+#include "check.hh"
+#include "context.hh"
+
+#include <bhd/upload_ring.hh>
+
+#include <chrono>
+#include <cstring>
+
+namespace bhd = behead_egl;
+namespace bhdi = behead_egl::internal;
+
+namespace {
+
+using std::chrono::milliseconds;
+
+constexpr std::size_t MiB = std::size_t(1) << 20;
+constexpr std::size_t CAPACITY = 4 * MiB;
+
+// Hands over everything submitted and waits for GPU, so all space is released
+void drain(bhd::UploadRing &ring)
+{
+   ring.consume(nullptr);
+   bhdi::gl_procs().glFinish();
+   ring.consume(nullptr);
+}
+
+bool upload(bhd::UploadRing &ring, std::size_t size)
+{
+   auto slice = ring.reserve(size, 256, milliseconds(1000));
+
+   if (!slice)
+      return false;
+
+   std::memset(slice.data, 0x5a, slice.size);
+
+   bool submitted = ring.submit(slice);
+
+   drain(ring);
+
+   return submitted;
+}
+
+// Small slice followed by one that takes most of ring, on empty ring each fits
+void test_mixed_sizes(bhd::UploadRing &ring)
+{
+   const std::size_t sizes[] = {
+      1 * MiB, 3 * MiB + MiB / 2, MiB / 2, 3 * MiB, 4 * MiB, 1000, 4 * MiB - 256, 2 * MiB + 1
+   };
+
+   for (std::size_t size : sizes)
+      BHD_CHECK(upload(ring, size));
+}
+
+// Slice not fitting next to held one waits, and gets space once it is released
+void test_wait_for_space(bhd::UploadRing &ring)
+{
+   auto held = ring.reserve(1 * MiB);
+
+   if (!BHD_CHECK(held))
+      return;
+
+   BHD_CHECK(!ring.reserve(3 * MiB + MiB / 2, 256, milliseconds(50)));
+
+   BHD_CHECK(ring.submit(held));
+   drain(ring);
+
+   auto big = ring.reserve(3 * MiB + MiB / 2, 256, milliseconds(1000));
+
+   if (BHD_CHECK(big))
+   {
+      BHD_CHECK(big.offset + big.size <= ring.capacity());
+      BHD_CHECK(ring.cancel(big));
+   }
+
+   drain(ring);
+}
+
+} // namespace anonymous
+
+int main()
+{
+   bhd::test::CurrentContext context;
+
+   if (!context.ok())
+      return bhd::test::SKIP;
+
+   bhd::UploadRing ring(bhd::UploadRingOpts{ CAPACITY });
+
+   // Context without buffer storage
+   if (!ring.ok())
+      return bhd::test::SKIP;
+
+   test_mixed_sizes(ring);
+   test_wait_for_space(ring);
+
+   return bhd::test::result();
+}
@@ -0,0 +1,123 @@
+/*
+ * SPDX-FileCopyrightText: 2020 Piotr Rak <piotr.rak@gamil.com>
+ * SPDX-License-Identifier: MIT
+ */
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <string>
+
+#include <bhd/egl_trace.hh>
+
+namespace bhd = behead_egl;
+
+namespace {
+
+struct Totals
+{
+   unsigned calls = 0;
+   unsigned skipped = 0;
+   unsigned mismatched = 0;
+
+   std::chrono::nanoseconds recorded{0};
+   std::chrono::nanoseconds replayed{0};
+};
+
+double to_us(std::chrono::nanoseconds ns)
+{
+   return double(ns.count()) / 1000.0;
+}
+
+void usage(const char *argv0)
+{
+   std::cerr << "Usage: " << argv0 << " [-q] <trace>" << std::endl
+             << std::endl
+             << "Replays EGL calls recorded with BEHEAD_EGL_TRACE=<trace> against" << std::endl
+             << "EGL implementation loaded (use LD_PRELOAD for stub), prints latency" << std::endl
+             << "of each call and totals per procedure." << std::endl
+             << std::endl
+             << "\t-q\tprint totals only" << std::endl;
+}
+
+} // namespace anonymous
+
+int main(int argc, char *argv[])
+{
+   bool quiet = false;
+   const char *path = nullptr;
+
+   for (int i = 1; i < argc; ++i)
+   {
+      if (std::strcmp(argv[i], "-q") == 0)
+         quiet = true;
+      else if (path == nullptr)
+         path = argv[i];
+      else
+      {
+         usage(argv[0]);
+         return 2;
+      }
+   }
+
+   if (path == nullptr)
+   {
+      usage(argv[0]);
+      return 2;
+   }
+
+   std::map<std::string, Totals> totals;
+
+   if (!quiet)
+      std::printf("%6s %-26s %12s %12s %12s\n", "#", "call", "recorded_us", "replayed_us", "delta_us");
+
+   bool ok = bhd::replay_egl_calls(path, [&] (const bhd::ReplayedCall &call) {
+
+      Totals &t = totals[call.name];
+
+      ++t.calls;
+
+      if (call.skipped)
+      {
+         ++t.skipped;
+
+         if (!quiet)
+            std::printf("%6u %-26s %12.1f %12s %12s\n",
+                        call.index, call.name, to_us(call.recorded), "skipped", "-");
+         return;
+      }
+
+      if (!call.matched)
+         ++t.mismatched;
+
+      t.recorded += call.recorded;
+      t.replayed += call.replayed;
+
+      if (!quiet)
+         std::printf("%6u %-26s %12.1f %12.1f %+12.1f%s\n",
+                     call.index, call.name, to_us(call.recorded), to_us(call.replayed),
+                     to_us(call.replayed - call.recorded), call.matched ? "" : "  (result differs)");
+   });
+
+   if (!quiet)
+      std::printf("\n");
+
+   std::printf("%-26s %6s %8s %10s %12s %12s %12s\n",
+               "call", "count", "skipped", "differs", "recorded_us", "replayed_us", "delta_us");
+
+   for (const auto &[name, t] : totals)
+   {
+      std::printf("%-26s %6u %8u %10u %12.1f %12.1f %+12.1f\n",
+                  name.c_str(), t.calls, t.skipped, t.mismatched,
+                  to_us(t.recorded), to_us(t.replayed), to_us(t.replayed - t.recorded));
+   }
+
+   if (!ok)
+   {
+      std::cerr << "Failed to read trace: " << path << " (missing or damaged)" << std::endl;
+      return 1;
+   }
+
+   return 0;
+}